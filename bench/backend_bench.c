@@ -0,0 +1,387 @@
+// Benchmark so sánh 2 backend I/O của server (epoll / io_uring) trên cùng 1 tải:
+// P cặp client (sender -> receiver) gửi private message, mỗi cặp có tối đa W tin đang bay.
+// Mỗi backend chạy 1 server mới (DB tạm copy từ server/chat.db); đo thông lượng, độ trễ
+// và CPU/context switch của tiến trình server trong lúc chạy tải (đọc /proc/<pid>).
+//
+// Build & chạy: make bench-backend
+//   ./bench/backend_bench [-s server_binary] [-p pairs] [-m messages_per_pair] [-w window]
+//                         [-t reactor_threads] [-1 (frame v1)]
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "../shared/frame.h"
+
+#define BENCH_PORT 8888
+#define BENCH_DB "server/chat.db"
+
+typedef struct {
+    int fd;
+    unsigned char buf[4 * FRAME_MAX_SIZE];
+    size_t len;
+} Conn;
+
+typedef struct {
+    Conn sender;
+    Conn receiver;
+    char target[MAX_USERNAME];
+    int sent;
+    int received;
+} Pair;
+
+typedef struct {
+    double elapsed_s;
+    int delivered;
+    double p50_us, p99_us, max_us;
+    double cpu_user_ms, cpu_sys_ms;
+    long ctx_vol, ctx_invol;
+} Result;
+
+static int proto_version = FRAME_PROTO_V2;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void* data, size_t len) {
+    const unsigned char* p = data;
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+static int send_packet(Conn* c, MessageType type, const char* source, const char* target, const char* body, int version) {
+    ChatPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.type = type;
+    snprintf(packet.source_user, MAX_USERNAME, "%s", source);
+    snprintf(packet.target_user, MAX_USERNAME, "%s", target);
+    snprintf(packet.body, MAX_BODY, "%s", body);
+    unsigned char scratch[FRAME_MAX_SIZE];
+    size_t len;
+    const void* data = frame_encode(&packet, version, scratch, &len);
+    return write_all(c->fd, data, len);
+}
+
+// Lấy 1 frame đầy đủ từ buffer của kết nối. 1 nếu có, 0 nếu cần đọc thêm, -1 nếu lỗi.
+static int take_frame(Conn* c, ChatPacket* out) {
+    long n = frame_length(c->buf, c->len);
+    if (n < 0) return -1;
+    if (n == 0 || (size_t)n > c->len) return 0;
+    frame_decode(c->buf, (size_t)n, out);
+    c->len -= (size_t)n;
+    memmove(c->buf, c->buf + n, c->len);
+    return 1;
+}
+
+// Đọc (blocking) cho tới khi nhận được packet loại `type`; bỏ qua các packet khác
+static int wait_for(Conn* c, MessageType type, ChatPacket* out) {
+    while (1) {
+        int rc = take_frame(c, out);
+        if (rc < 0) return -1;
+        if (rc > 0) {
+            if (out->type == type) return 0;
+            continue;
+        }
+        ssize_t r = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+        if (r <= 0) return -1;
+        c->len += (size_t)r;
+    }
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// HELLO (nếu dùng v2), đăng ký và đăng nhập 1 user
+static int login(Conn* c, const char* username) {
+    ChatPacket reply;
+    c->fd = connect_server();
+    c->len = 0;
+    if (c->fd < 0) return -1;
+    if (proto_version >= FRAME_PROTO_V2) {
+        if (send_packet(c, MSG_TYPE_HELLO, "", "", "2", FRAME_PROTO_V1) != 0) return -1;
+        if (wait_for(c, MSG_TYPE_HELLO, &reply) != 0) return -1;
+    }
+    if (send_packet(c, MSG_TYPE_REGISTER_REQUEST, username, "", "pw", proto_version) != 0) return -1;
+    if (send_packet(c, MSG_TYPE_LOGIN_REQUEST, username, "", "pw", proto_version) != 0) return -1;
+    return wait_for(c, MSG_TYPE_LOGIN_SUCCESS, &reply);
+}
+
+static int copy_file(const char* from, const char* to) {
+    int in = open(from, O_RDONLY);
+    if (in < 0) return -1;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) { close(in); return -1; }
+    char buf[65536];
+    ssize_t r;
+    int rc = 0;
+    while ((r = read(in, buf, sizeof(buf))) > 0) {
+        if (write_all(out, buf, (size_t)r) != 0) { rc = -1; break; }
+    }
+    if (r < 0) rc = -1;
+    close(in);
+    close(out);
+    return rc;
+}
+
+// CPU (ms) và context switch của tiến trình server
+static void read_proc_stats(pid_t pid, double* user_ms, double* sys_ms, long* vol, long* invol) {
+    char path[320], line[256];
+    double tick_ms = 1000.0 / sysconf(_SC_CLK_TCK);
+    *user_ms = *sys_ms = 0;
+    *vol = *invol = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE* f = fopen(path, "r");
+    if (f) {
+        char buf[1024];
+        if (fgets(buf, sizeof(buf), f)) {
+            // Bỏ qua "pid (comm)" rồi đếm tới trường utime (14) và stime (15)
+            char* p = strrchr(buf, ')');
+            unsigned long utime = 0, stime = 0;
+            if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+                *user_ms = utime * tick_ms;
+                *sys_ms = stime * tick_ms;
+            }
+        }
+        fclose(f);
+    }
+    // Context switch tính riêng theo thread: cộng mọi thread của server
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    DIR* dir = opendir(path);
+    struct dirent* ent;
+    while (dir && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "/proc/%d/task/%s/status", (int)pid, ent->d_name);
+        f = fopen(path, "r");
+        if (!f) continue;
+        long v;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "voluntary_ctxt_switches: %ld", &v) == 1) *vol += v;
+            if (sscanf(line, "nonvoluntary_ctxt_switches: %ld", &v) == 1) *invol += v;
+        }
+        fclose(f);
+    }
+    if (dir) closedir(dir);
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static pid_t start_server(const char* server, const char* dir, const char* backend, int threads) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    char threads_arg[16];
+    snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+    if (chdir(dir) != 0) _exit(127);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    execl(server, server, "-t", threads_arg, "-b", backend, (char*)NULL);
+    _exit(127);
+}
+
+static int run_backend(const char* server, const char* backend, int pairs, int messages, int window,
+                       int threads, Result* res) {
+    char dir[] = "/tmp/backend_bench_XXXXXX";
+    char path[PATH_MAX];
+    if (!mkdtemp(dir)) { perror("mkdtemp"); return -1; }
+    snprintf(path, sizeof(path), "%s/server", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s", dir, BENCH_DB);
+    if (copy_file(BENCH_DB, path) != 0) { perror("copy " BENCH_DB); return -1; }
+
+    pid_t pid = start_server(server, dir, backend, threads);
+    if (pid < 0) { perror("fork"); return -1; }
+
+    // Chờ server listen
+    int fd = -1;
+    for (int i = 0; i < 100 && fd < 0; i++) {
+        usleep(50 * 1000);
+        fd = connect_server();
+    }
+    if (fd >= 0) close(fd);
+
+    Pair* p = calloc((size_t)pairs, sizeof(Pair));
+    double* lat = malloc(sizeof(double) * (size_t)pairs * messages);
+    int rc = (fd < 0 || !p || !lat) ? -1 : 0;
+    for (int i = 0; i < pairs && rc == 0; i++) {
+        char sender[MAX_USERNAME];
+        snprintf(sender, sizeof(sender), "bs%d_%d", (int)getpid(), i);
+        snprintf(p[i].target, sizeof(p[i].target), "br%d_%d", (int)getpid(), i);
+        if (login(&p[i].sender, sender) != 0 || login(&p[i].receiver, p[i].target) != 0) {
+            fprintf(stderr, "%s: login failed for pair %d\n", backend, i);
+            rc = -1;
+        }
+    }
+
+    int ep = epoll_create1(0);
+    for (int i = 0; i < pairs && rc == 0; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+        fcntl(p[i].receiver.fd, F_SETFL, fcntl(p[i].receiver.fd, F_GETFL, 0) | O_NONBLOCK);
+        epoll_ctl(ep, EPOLL_CTL_ADD, p[i].receiver.fd, &ev);
+    }
+
+    memset(res, 0, sizeof(*res));
+    double cpu_user0 = 0, cpu_sys0 = 0;
+    long vol0 = 0, invol0 = 0;
+    read_proc_stats(pid, &cpu_user0, &cpu_sys0, &vol0, &invol0);
+    double start = now_ns();
+    char body[32];
+
+    // Mỗi cặp gửi trước `window` tin, sau đó gửi 1 tin mới mỗi khi receiver nhận 1 tin
+    for (int i = 0; i < pairs && rc == 0; i++) {
+        for (; p[i].sent < window && p[i].sent < messages; p[i].sent++) {
+            snprintf(body, sizeof(body), "%.0f", now_ns());
+            send_packet(&p[i].sender, MSG_TYPE_PRIVATE_MESSAGE, "", p[i].target, body, proto_version);
+        }
+    }
+    int total = pairs * messages;
+    double last_progress = now_ns();
+    while (rc == 0 && res->delivered < total) {
+        struct epoll_event events[64];
+        int n = epoll_wait(ep, events, 64, 1000);
+        if (n == 0 && now_ns() - last_progress > 10e9) {
+            fprintf(stderr, "%s: stalled at %d/%d messages\n", backend, res->delivered, total);
+            rc = -1;
+            break;
+        }
+        for (int e = 0; e < n; e++) {
+            Pair* pr = &p[events[e].data.u32];
+            Conn* c = &pr->receiver;
+            ssize_t r;
+            while ((r = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len)) > 0) {
+                c->len += (size_t)r;
+                ChatPacket packet;
+                while (take_frame(c, &packet) > 0) {
+                    if (packet.type != MSG_TYPE_RECEIVE_PRIVATE) continue;
+                    double t = now_ns();
+                    lat[res->delivered++] = (t - atof(packet.body)) / 1000.0;
+                    pr->received++;
+                    last_progress = t;
+                    if (pr->sent < messages) {
+                        snprintf(body, sizeof(body), "%.0f", now_ns());
+                        send_packet(&pr->sender, MSG_TYPE_PRIVATE_MESSAGE, "", pr->target, body, proto_version);
+                        pr->sent++;
+                    }
+                }
+            }
+        }
+    }
+    res->elapsed_s = (now_ns() - start) / 1e9;
+
+    double cpu_user1, cpu_sys1;
+    long vol1, invol1;
+    read_proc_stats(pid, &cpu_user1, &cpu_sys1, &vol1, &invol1);
+    res->cpu_user_ms = cpu_user1 - cpu_user0;
+    res->cpu_sys_ms = cpu_sys1 - cpu_sys0;
+    res->ctx_vol = vol1 - vol0;
+    res->ctx_invol = invol1 - invol0;
+
+    if (res->delivered > 0) {
+        qsort(lat, (size_t)res->delivered, sizeof(double), cmp_double);
+        res->p50_us = lat[res->delivered / 2];
+        res->p99_us = lat[(size_t)(res->delivered * 0.99)];
+        res->max_us = lat[res->delivered - 1];
+    }
+
+    for (int i = 0; p && i < pairs; i++) {
+        if (p[i].sender.fd > 0) close(p[i].sender.fd);
+        if (p[i].receiver.fd > 0) close(p[i].receiver.fd);
+    }
+    if (ep >= 0) close(ep);
+    free(p);
+    free(lat);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s-journal", dir, BENCH_DB);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/server", dir);
+    rmdir(path);
+    rmdir(dir);
+    return rc;
+}
+
+int main(int argc, char* argv[]) {
+    const char* server = "server/server";
+    int pairs = 50, messages = 2000, window = 16, threads = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:m:w:t:1")) != -1) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'p': pairs = atoi(optarg); break;
+            case 'm': messages = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case '1': proto_version = FRAME_PROTO_V1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s server] [-p pairs] [-m messages] [-w window] [-t threads] [-1]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (pairs <= 0 || messages <= 0 || window <= 0) return 1;
+    char server_path[PATH_MAX];
+    if (!realpath(server, server_path)) { perror(server); return 1; }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d pairs x %d messages, window %d, %d reactor thread(s), frame v%d\n",
+           pairs, messages, window, threads, proto_version);
+    printf("%-8s %9s %10s %9s %9s %9s %13s %11s %15s\n", "backend", "msgs", "msgs/s", "p50 us", "p99 us",
+           "max us", "cpu usr/sys", "cpu us/msg", "ctxsw vol/inv");
+    const char* backends[] = { "epoll", "uring" };
+    for (int b = 0; b < 2; b++) {
+        Result res;
+        if (run_backend(server_path, backends[b], pairs, messages, window, threads, &res) != 0) {
+            printf("%-8s failed\n", backends[b]);
+            continue;
+        }
+        char cpu[32], ctx[32];
+        snprintf(cpu, sizeof(cpu), "%.0f/%.0f ms", res.cpu_user_ms, res.cpu_sys_ms);
+        snprintf(ctx, sizeof(ctx), "%ld/%ld", res.ctx_vol, res.ctx_invol);
+        printf("%-8s %9d %10.0f %9.0f %9.0f %9.0f %13s %11.2f %15s\n", backends[b], res.delivered,
+               res.delivered / res.elapsed_s, res.p50_us, res.p99_us, res.max_us, cpu,
+               (res.cpu_user_ms + res.cpu_sys_ms) * 1000.0 / res.delivered, ctx);
+    }
+    return 0;
+}
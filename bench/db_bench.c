@@ -0,0 +1,271 @@
+// Benchmark độ trễ truy vấn của db_handler: prepare/finalize mỗi lần gọi (cách cũ)
+// so với statement cache (db_* hiện tại), và thông lượng ghi tin nhắn offline (có fsync):
+// rollback journal / WAL, mỗi câu lệnh 1 transaction / gom lô như writer của db_pool.
+//
+// Build & chạy: make bench-db
+//   ./bench/db_bench [số vòng lặp] [số dòng ghi]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../server/db_handler.h"
+#include "../server/db_pool.h"
+
+#define BENCH_USERS 1000
+#define BENCH_GROUPS 100
+#define BENCH_GROUP_SIZE 20
+#define BENCH_FRIENDS 20
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void user_name(char* out, int i) { snprintf(out, MAX_USERNAME, "user%d", i); }
+// DB mới tạo: user thứ i được đăng ký thứ i nên users.id = i + 1
+static UserId user_id(int i) { return (UserId)(i + 1); }
+static void group_name(char* out, int i) { snprintf(out, MAX_USERNAME, "group%d", i); }
+
+static void register_users(sqlite3* db) {
+    char u[MAX_USERNAME];
+    sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    for (int i = 0; i < BENCH_USERS; i++) {
+        user_name(u, i);
+        db_register_user(db, u, "pw");
+    }
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+}
+
+static void populate(sqlite3* db) {
+    char g[MAX_USERNAME];
+    register_users(db);
+    sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+    for (int i = 0; i < BENCH_USERS; i++) {
+        for (int k = 1; k <= BENCH_FRIENDS / 2; k++) {
+            UserId v = user_id((i + k) % BENCH_USERS);
+            db_friend_request(db, user_id(i), v);
+            db_friend_accept(db, v, user_id(i));
+        }
+    }
+    for (int i = 0; i < BENCH_GROUPS; i++) {
+        group_name(g, i);
+        db_create_group(db, g, user_id(i));
+        for (int k = 0; k < BENCH_GROUP_SIZE; k++) {
+            db_add_group_member(db, g, user_id((i + k) % BENCH_USERS));
+        }
+    }
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+}
+
+// ----- Cách cũ: prepare + finalize cho mỗi lần gọi -----
+
+static int uncached_exists(sqlite3* db, const char* sql, const char* a, UserId b) {
+    sqlite3_stmt* stmt = NULL;
+    int found = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 0; }
+    sqlite3_bind_text(stmt, 1, a, -1, SQLITE_STATIC);
+    if (b) sqlite3_bind_int64(stmt, 2, b);
+    if (sqlite3_step(stmt) == SQLITE_ROW) found = 1;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// name != NULL: bind tên vào ?1; ngược lại bind id vào ?1 và ?2
+static int uncached_rows(sqlite3* db, const char* sql, const char* name, UserId id) {
+    sqlite3_stmt* stmt = NULL;
+    int rows = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 0; }
+    if (name) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_int64(stmt, 1, id);
+        sqlite3_bind_int64(stmt, 2, id);
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (sqlite3_column_text(stmt, 1)) rows++;
+    }
+    sqlite3_finalize(stmt);
+    return rows;
+}
+
+static int uncached_store(sqlite3* db, const char* from, const char* to, const char* msg) {
+    sqlite3_stmt* stmt = NULL;
+    const char* sql = "INSERT INTO offline_messages (from_user_id, to_user_id, message) "
+                      "SELECT f.id, t.id, ? FROM users f, users t WHERE f.username = ? AND t.username = ?;";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 1; }
+    sqlite3_bind_text(stmt, 1, msg, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, from, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, to, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE ? 0 : 1;
+}
+
+#define SQL_IS_GROUP_MEMBER "SELECT 1 FROM group_members gm JOIN groups g ON g.group_id = gm.group_id " \
+                            "WHERE g.group_name = ? AND gm.user_id = ? LIMIT 1;"
+#define SQL_GROUP_EXISTS    "SELECT 1 FROM groups WHERE group_name = ? LIMIT 1;"
+#define SQL_USER_EXISTS     "SELECT id FROM users WHERE username = ?;"
+#define SQL_GROUP_MEMBERS   "SELECT u.id, u.username FROM groups g JOIN group_members gm ON gm.group_id = g.group_id " \
+                            "JOIN users u ON u.id = gm.user_id WHERE g.group_name = ?;"
+#define SQL_FRIEND_LIST     "SELECT u.id, u.username FROM friends f JOIN users u ON u.id = f.user_b_id " \
+                            "WHERE f.user_a_id = ? AND f.status = 1 UNION " \
+                            "SELECT u.id, u.username FROM friends f JOIN users u ON u.id = f.user_a_id " \
+                            "WHERE f.user_b_id = ? AND f.status = 1;"
+
+// ----- Cách mới: db_* (statement cache) -----
+
+static void count_user(void* arg, UserId id, const char* name) { (void)id; (void)name; (*(int*)arg)++; }
+
+typedef enum {
+    Q_IS_GROUP_MEMBER, Q_GROUP_EXISTS, Q_USER_EXISTS, Q_GROUP_MEMBERS, Q_FRIEND_LIST, Q_STORE_OFFLINE, Q_COUNT
+} QueryKind;
+
+static const char* query_names[Q_COUNT] = {
+    "db_is_group_member", "db_group_exists", "db_user_exists",
+    "db_get_group_members", "db_get_friend_list", "db_store_offline_message"
+};
+
+static void run_query(sqlite3* db, QueryKind q, int cached, int i) {
+    char u[MAX_USERNAME], g[MAX_USERNAME];
+    int n = 0;
+    user_name(u, i % BENCH_USERS);
+    group_name(g, i % BENCH_GROUPS);
+    switch (q) {
+    case Q_IS_GROUP_MEMBER:
+        if (cached) db_is_group_member(db, g, user_id(i % BENCH_USERS));
+        else uncached_exists(db, SQL_IS_GROUP_MEMBER, g, user_id(i % BENCH_USERS));
+        break;
+    case Q_GROUP_EXISTS:
+        if (cached) db_group_exists(db, g); else uncached_exists(db, SQL_GROUP_EXISTS, g, 0);
+        break;
+    case Q_USER_EXISTS:
+        if (cached) db_user_exists(db, u); else uncached_exists(db, SQL_USER_EXISTS, u, 0);
+        break;
+    case Q_GROUP_MEMBERS:
+        if (cached) db_get_group_members(db, g, count_user, &n); else uncached_rows(db, SQL_GROUP_MEMBERS, g, 0);
+        break;
+    case Q_FRIEND_LIST:
+        if (cached) db_get_friend_list(db, user_id(i % BENCH_USERS), count_user, &n);
+        else uncached_rows(db, SQL_FRIEND_LIST, NULL, user_id(i % BENCH_USERS));
+        break;
+    case Q_STORE_OFFLINE:
+        if (cached) db_store_offline_message(db, u, "user0", "hello"); else uncached_store(db, u, "user0", "hello");
+        break;
+    default:
+        break;
+    }
+}
+
+// ----- Thông lượng ghi (synchronous = FULL như server) -----
+
+typedef struct {
+    const char* name;
+    const char* journal_mode;
+    int batch;                  // số dòng mỗi transaction (1 = autocommit)
+} WriteMode;
+
+static const WriteMode write_modes[] = {
+    { "rollback journal, autocommit", "DELETE", 1 },
+    { "WAL, autocommit",              "WAL",    1 },
+    { "WAL, batch 16",                "WAL",    16 },
+    { "WAL, batch 256 (db writer)",   "WAL",    DB_WRITE_BATCH_MAX },
+};
+
+static void remove_db_files(const char* path) {
+    char side[64];
+    unlink(path);
+    snprintf(side, sizeof(side), "%s-wal", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-journal", path);
+    unlink(side);
+}
+
+// Số dòng/giây; < 0 nếu lỗi
+static double bench_write_mode(const WriteMode* m, int rows) {
+    char path[] = "/tmp/db_bench_write_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    if (tmp_fd < 0) { perror("mkstemp"); return -1; }
+    close(tmp_fd);
+
+    sqlite3* db;
+    if (db_open(path, &db) != 0) { remove_db_files(path); return -1; }
+    char pragma[64];
+    snprintf(pragma, sizeof(pragma), "PRAGMA journal_mode = %s;", m->journal_mode);
+    sqlite3_exec(db, pragma, NULL, NULL, NULL);
+    register_users(db); // tin offline chỉ được lưu cho người gửi/nhận có trong users
+
+    char from[MAX_USERNAME], to[MAX_USERNAME];
+    double start = now_ns();
+    for (int i = 0; i < rows; i += m->batch) {
+        if (m->batch > 1) sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+        for (int k = i; k < i + m->batch && k < rows; k++) {
+            user_name(from, k % BENCH_USERS);
+            user_name(to, (k * 7) % BENCH_USERS);
+            db_store_offline_message(db, from, to, "offline message body");
+        }
+        if (m->batch > 1) sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    db_close(db);
+    remove_db_files(path);
+    return rows / secs;
+}
+
+static void bench_writes(int rows) {
+    fprintf(stderr, "\n%d offline-message INSERTs, synchronous = FULL (file in /tmp)\n", rows);
+    fprintf(stderr, "%-30s %12s %8s\n", "mode", "rows/s", "speedup");
+    double base = 0;
+    for (size_t i = 0; i < sizeof(write_modes) / sizeof(write_modes[0]); i++) {
+        double rate = bench_write_mode(&write_modes[i], rows);
+        if (rate < 0) continue;
+        if (i == 0) base = rate;
+        fprintf(stderr, "%-30s %12.0f %7.1fx\n", write_modes[i].name, rate, base > 0 ? rate / base : 0);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    if (iterations <= 0) iterations = 20000;
+    int write_rows = argc > 2 ? atoi(argv[2]) : 2000;
+    if (write_rows <= 0) write_rows = 2000;
+
+    char path[] = "/tmp/db_bench_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    if (tmp_fd < 0) { perror("mkstemp"); return 1; }
+    close(tmp_fd);
+
+    // db_* in log cho từng thao tác; tắt stdout khi populate/đo, chỉ in kết quả ra stderr
+    FILE* devnull = freopen("/dev/null", "w", stdout);
+    (void)devnull;
+
+    sqlite3* db;
+    if (db_open(path, &db) != 0) { remove_db_files(path); return 1; }
+    populate(db);
+    // Đo chi phí CPU của truy vấn, không đo fsync
+    sqlite3_exec(db, "PRAGMA synchronous = OFF;", NULL, NULL, NULL);
+
+    fprintf(stderr, "%d iterations, %d users, %d groups x %d members, %d friends/user\n",
+            iterations, BENCH_USERS, BENCH_GROUPS, BENCH_GROUP_SIZE, BENCH_FRIENDS);
+    fprintf(stderr, "%-26s %14s %14s %8s\n", "query", "prepare/call", "cached", "speedup");
+    for (int q = 0; q < Q_COUNT; q++) {
+        double ns[2];
+        for (int cached = 0; cached <= 1; cached++) {
+            for (int i = 0; i < iterations / 10; i++) run_query(db, q, cached, i); // warm-up
+            double start = now_ns();
+            for (int i = 0; i < iterations; i++) run_query(db, q, cached, i);
+            ns[cached] = (now_ns() - start) / iterations;
+        }
+        fprintf(stderr, "%-26s %11.0f ns %11.0f ns %7.2fx\n", query_names[q], ns[0], ns[1], ns[0] / ns[1]);
+    }
+
+    db_close(db);
+    remove_db_files(path);
+
+    bench_writes(write_rows);
+    return 0;
+}
@@ -0,0 +1,770 @@
+// Bộ sinh tải headless: nhiều nghìn kết nối client trong 1 vòng epoll, không cần ncurses.
+// Các kịch bản chạy lần lượt trên cùng 1 tập kết nối:
+//   login      N kết nối cùng lúc: HELLO + REGISTER + LOGIN (đo từ connect tới LOGIN_SUCCESS)
+//   ping       N/2 cặp gửi private message qua lại (đo độ trễ 1 chiều của từng tin)
+//   group      N/G group G thành viên: tạo + join (group-setup), rồi owner gửi tin và đo
+//              độ trễ tới từng thành viên (fan-out)
+//   friend     N/2 cặp lặp request -> accept -> unfriend (đo từ lệnh tới trả lời của server)
+//   reconnect  ngắt hết rồi kết nối + login lại đồng loạt, R vòng
+// Mỗi kịch bản in thông lượng và độ trễ p50/p99/p999/max (micro giây).
+// Mặc định chạy server mới (DB tạm copy từ server/chat.db); -H để đo server đang chạy.
+//
+// Build & chạy: make bench-load
+//   ./bench/load_bench [-s server_binary | -H host] [-P port] [-n connections] [-m messages]
+//                      [-w window] [-g group_size] [-f friend_cycles] [-r reconnect_rounds]
+//                      [-x login,ping,group,friend,reconnect] [-t reactor_threads] [-1 (frame v1)]
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "../shared/frame.h"
+
+#define BENCH_DB "server/chat.db"
+#define STALL_NS 10e9               // không có tiến triển trong 10s -> dừng kịch bản
+#define LOGIN_RETRY_NS 5e6          // LOGIN_FAIL khi reconnect (phiên cũ chưa gỡ xong): thử lại sau 5ms
+
+typedef struct {
+    int fd;                         // -1 = chưa kết nối
+    int connecting;                 // connect() chưa xong
+    unsigned char in[4 * FRAME_MAX_SIZE];
+    size_t in_len;
+    unsigned char* out;             // dữ liệu chờ gửi (socket đầy)
+    size_t out_len;
+    size_t out_cap;
+    int want_out;                   // đang đăng ký EPOLLOUT
+    char user[MAX_USERNAME];
+    int logged_in;
+    double t0;                      // lúc gửi thao tác đang chờ trả lời
+    double retry_at;                // > 0: gửi lại LOGIN lúc này
+    int count;                      // bộ đếm riêng của kịch bản
+} Conn;
+
+typedef struct {
+    char name[MAX_USERNAME];
+    int joined;                     // số thành viên (trừ owner) đã join
+    int sent;
+    int delivered;
+} Group;
+
+typedef struct {
+    const char* name;
+    long (*start)(void);            // gửi các request đầu tiên; trả về số thao tác cần hoàn thành
+    void (*on_frame)(int idx, const ChatPacket* p);
+    void (*tick)(double now);       // có thể NULL
+} Scenario;
+
+typedef struct {
+    double* lat_us;
+    size_t count;
+    size_t cap;
+    long ops;
+    long errors;
+    double last_progress;
+} Stats;
+
+static Conn* conns = NULL;
+static int num_conns = 1000;
+static int ep = -1;
+static int proto_version = FRAME_PROTO_V2;
+static struct sockaddr_in server_addr;
+
+static int messages = 200;          // tin mỗi cặp (ping) / mỗi group (fan-out)
+static int window = 1;              // tin đang bay mỗi cặp ping
+static int group_size = 20;
+static int friend_cycles = 20;
+static int reconnect_rounds = 3;
+
+static Group* groups = NULL;
+static int num_groups = 0;
+
+static const Scenario* current = NULL;
+static Stats stats;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// ----- Thống kê -----
+
+static void record_sample(double t0) {
+    double t = now_ns();
+    if (stats.count == stats.cap) {
+        size_t cap = stats.cap ? stats.cap * 2 : 4096;
+        double* grown = realloc(stats.lat_us, sizeof(double) * cap);
+        if (!grown) return;
+        stats.lat_us = grown;
+        stats.cap = cap;
+    }
+    stats.lat_us[stats.count++] = (t - t0) / 1000.0;
+    stats.ops++;
+    stats.last_progress = t;
+}
+
+// Thao tác kết thúc nhưng thất bại: vẫn tính là xong để kịch bản không chờ mãi
+static void record_failure(long ops) {
+    stats.ops += ops;
+    stats.errors += ops;
+    stats.last_progress = now_ns();
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double q) {
+    if (stats.count == 0) return 0;
+    size_t i = (size_t)(stats.count * q);
+    return stats.lat_us[i < stats.count ? i : stats.count - 1];
+}
+
+// ----- Kết nối -----
+
+static void conn_close(Conn* c) {
+    if (c->fd >= 0) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->connecting = 0;
+    c->in_len = 0;
+    c->out_len = 0;
+    c->want_out = 0;
+    c->logged_in = 0;
+    c->retry_at = 0;
+}
+
+static void conn_fail(Conn* c) {
+    conn_close(c);
+    stats.errors++;
+}
+
+static void set_want_out(Conn* c, int want) {
+    if (c->want_out == want) return;
+    struct epoll_event ev = { .events = EPOLLIN | (want ? EPOLLOUT : 0), .data.u32 = (uint32_t)(c - conns) };
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want;
+}
+
+static void conn_flush(Conn* c) {
+    size_t off = 0;
+    while (off < c->out_len) {
+        ssize_t w = send(c->fd, c->out + off, c->out_len - off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_fail(c);
+            return;
+        }
+        off += (size_t)w;
+    }
+    c->out_len -= off;
+    memmove(c->out, c->out + off, c->out_len);
+    set_want_out(c, c->out_len > 0);
+}
+
+static int conn_open(Conn* c) {
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    // Chờ EPOLLOUT = connect xong; dữ liệu gửi trước đó nằm trong c->out
+    c->connecting = 1;
+    c->want_out = 1;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.u32 = (uint32_t)(c - conns) };
+    epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ev);
+    return 0;
+}
+
+static void conn_send_version(Conn* c, MessageType type, const char* target, const char* body, int version) {
+    if (c->fd < 0) return;
+    ChatPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.type = type;
+    snprintf(packet.source_user, MAX_USERNAME, "%s", c->user);
+    if (target) snprintf(packet.target_user, MAX_USERNAME, "%s", target);
+    if (body) snprintf(packet.body, MAX_BODY, "%s", body);
+    unsigned char scratch[FRAME_MAX_SIZE];
+    size_t len;
+    const void* data = frame_encode(&packet, version, scratch, &len);
+
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + len) cap *= 2;
+        unsigned char* grown = realloc(c->out, cap);
+        if (!grown) { conn_fail(c); return; }
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    if (!c->connecting) conn_flush(c);
+}
+
+static void conn_send(Conn* c, MessageType type, const char* target, const char* body) {
+    conn_send_version(c, type, target, body, proto_version);
+}
+
+// Kết nối + (HELLO) + [REGISTER] + LOGIN gửi liền 1 lượt; server nhận diện v1/v2 theo từng frame
+static int conn_login(Conn* c, int do_register) {
+    c->t0 = now_ns();
+    if (conn_open(c) != 0) return -1;
+    if (proto_version >= FRAME_PROTO_V2) conn_send_version(c, MSG_TYPE_HELLO, NULL, "2", FRAME_PROTO_V1);
+    if (do_register) conn_send(c, MSG_TYPE_REGISTER_REQUEST, NULL, "pw");
+    conn_send(c, MSG_TYPE_LOGIN_REQUEST, NULL, "pw");
+    return c->fd >= 0 ? 0 : -1;
+}
+
+static void send_timestamp(Conn* c, MessageType type, const char* target) {
+    char body[32];
+    snprintf(body, sizeof(body), "ts %.0f", now_ns());
+    conn_send(c, type, target, body);
+}
+
+static int parse_timestamp(const ChatPacket* p, double* t0) {
+    if (strncmp(p->body, "ts ", 3) != 0) return 0;
+    *t0 = atof(p->body + 3);
+    return 1;
+}
+
+static int starts_with(const char* s, const char* prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+// Lấy 1 frame đầy đủ từ buffer của kết nối. 1 nếu có, 0 nếu cần đọc thêm, -1 nếu lỗi.
+static int take_frame(Conn* c, ChatPacket* out) {
+    long n = frame_length(c->in, c->in_len);
+    if (n < 0) return -1;
+    if (n == 0 || (size_t)n > c->in_len) return 0;
+    frame_decode(c->in, (size_t)n, out);
+    c->in_len -= (size_t)n;
+    memmove(c->in, c->in + n, c->in_len);
+    return 1;
+}
+
+static void handle_readable(int idx) {
+    Conn* c = &conns[idx];
+    int fd = c->fd;
+    while (c->fd == fd) {
+        ssize_t r = recv(fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_fail(c);
+            return;
+        }
+        if (r == 0) { conn_fail(c); return; }
+        c->in_len += (size_t)r;
+        ChatPacket packet;
+        int rc;
+        // Kịch bản có thể đóng kết nối trong on_frame: dừng khi fd đổi
+        while (c->fd == fd && (rc = take_frame(c, &packet)) > 0) {
+            current->on_frame(idx, &packet);
+        }
+        if (c->fd == fd && rc < 0) { conn_fail(c); return; }
+    }
+}
+
+static void handle_writable(Conn* c) {
+    if (c->connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            conn_fail(c);
+            return;
+        }
+        c->connecting = 0;
+    }
+    conn_flush(c);
+}
+
+static void pump(int timeout_ms) {
+    struct epoll_event events[256];
+    int n = epoll_wait(ep, events, 256, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        int idx = (int)events[i].data.u32;
+        Conn* c = &conns[idx];
+        if (c->fd < 0) continue;
+        if (events[i].events & EPOLLOUT) handle_writable(c);
+        if (c->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) handle_readable(idx);
+    }
+}
+
+// ----- Kịch bản: login storm -----
+
+static long login_start(void) {
+    for (int i = 0; i < num_conns; i++) {
+        Conn* c = &conns[i];
+        snprintf(c->user, MAX_USERNAME, "l%d_%d", (int)getpid(), i);
+        if (conn_login(c, 1) != 0) record_failure(1);
+    }
+    return num_conns;
+}
+
+static void login_frame(int idx, const ChatPacket* p) {
+    Conn* c = &conns[idx];
+    if (c->logged_in) return;
+    if (p->type == MSG_TYPE_LOGIN_SUCCESS) {
+        c->logged_in = 1;
+        record_sample(c->t0);
+    } else if (p->type == MSG_TYPE_LOGIN_FAIL) {
+        record_failure(1);
+        conn_close(c);
+    }
+}
+
+// ----- Kịch bản: private message ping-pong -----
+// Cặp (2k, 2k+1); conns[2k].count = số tin cặp đã gửi
+
+static long ping_start(void) {
+    long target = 0;
+    for (int k = 0; k + 1 < num_conns; k += 2) {
+        Conn* a = &conns[k];
+        Conn* b = &conns[k + 1];
+        a->count = 0;
+        if (!a->logged_in || !b->logged_in) continue;
+        for (; a->count < window && a->count < messages; a->count++) {
+            send_timestamp(a, MSG_TYPE_PRIVATE_MESSAGE, b->user);
+        }
+        target += messages;
+    }
+    return target;
+}
+
+static void ping_frame(int idx, const ChatPacket* p) {
+    double t0;
+    if (p->type != MSG_TYPE_RECEIVE_PRIVATE || !parse_timestamp(p, &t0)) return;
+    record_sample(t0);
+    Conn* owner = &conns[idx & ~1];
+    if (owner->count < messages) {
+        send_timestamp(&conns[idx], MSG_TYPE_PRIVATE_MESSAGE, conns[idx ^ 1].user);
+        owner->count++;
+    }
+}
+
+// ----- Kịch bản: group (tạo + join, rồi fan-out) -----
+// Group g gồm conns[g*G .. g*G+G-1], conns[g*G] là owner
+
+static Group* group_of(int idx, int* is_owner) {
+    if (group_size < 2 || idx >= num_groups * group_size) return NULL;
+    *is_owner = idx % group_size == 0;
+    return &groups[idx / group_size];
+}
+
+static long group_setup_start(void) {
+    long target = 0;
+    num_groups = group_size >= 2 ? num_conns / group_size : 0;
+    free(groups);
+    groups = calloc((size_t)(num_groups > 0 ? num_groups : 1), sizeof(Group));
+    if (!groups) { num_groups = 0; return 0; }
+    for (int g = 0; g < num_groups; g++) {
+        Conn* owner = &conns[g * group_size];
+        snprintf(groups[g].name, MAX_USERNAME, "lg%d_%d", (int)getpid(), g);
+        target += group_size;   // create + (G-1) join
+        if (!owner->logged_in) { record_failure(group_size); continue; }
+        owner->t0 = now_ns();
+        conn_send(owner, MSG_TYPE_CREATE_GROUP_REQUEST, groups[g].name, NULL);
+    }
+    return target;
+}
+
+static void group_setup_frame(int idx, const ChatPacket* p) {
+    int is_owner;
+    Group* g = group_of(idx, &is_owner);
+    if (!g || p->type != MSG_TYPE_GROUP_RESPONSE) return;
+    if (is_owner) {
+        if (!starts_with(p->body, "Group created")) { record_failure(group_size); return; }
+        record_sample(conns[idx].t0);
+        for (int m = idx + 1; m < idx + group_size; m++) {
+            if (!conns[m].logged_in) { record_failure(1); continue; }
+            conns[m].t0 = now_ns();
+            conn_send(&conns[m], MSG_TYPE_JOIN_GROUP_REQUEST, g->name, NULL);
+        }
+    } else if (starts_with(p->body, "Joined group")) {
+        g->joined++;
+        record_sample(conns[idx].t0);
+    } else {
+        record_failure(1);
+    }
+}
+
+static long group_fanout_start(void) {
+    long target = 0;
+    for (int g = 0; g < num_groups; g++) {
+        Conn* owner = &conns[g * group_size];
+        groups[g].sent = groups[g].delivered = 0;
+        if (!owner->logged_in || groups[g].joined == 0) continue;
+        send_timestamp(owner, MSG_TYPE_GROUP_MESSAGE, groups[g].name);
+        groups[g].sent = 1;
+        target += (long)messages * groups[g].joined;
+    }
+    return target;
+}
+
+static void group_fanout_frame(int idx, const ChatPacket* p) {
+    int is_owner;
+    double t0;
+    Group* g = group_of(idx, &is_owner);
+    if (!g || is_owner || p->type != MSG_TYPE_RECEIVE_GROUP_MESSAGE || !parse_timestamp(p, &t0)) return;
+    record_sample(t0);
+    // Tin tiếp theo khi mọi thành viên đã nhận tin trước (1 tin đang bay mỗi group)
+    if (++g->delivered == g->sent * g->joined && g->sent < messages) {
+        send_timestamp(&conns[(g - groups) * group_size], MSG_TYPE_GROUP_MESSAGE, g->name);
+        g->sent++;
+    }
+}
+
+// ----- Kịch bản: friend churn -----
+// Cặp (A = 2k, B = 2k+1): A request -> B accept -> A unfriend, lặp lại.
+// conns[2k].count = số thao tác cặp đã hoàn thành (3 mỗi vòng)
+
+static long friend_start(void) {
+    long target = 0;
+    for (int k = 0; k + 1 < num_conns; k += 2) {
+        Conn* a = &conns[k];
+        a->count = 0;
+        if (!a->logged_in || !conns[k + 1].logged_in) continue;
+        a->t0 = now_ns();
+        conn_send(a, MSG_TYPE_FRIEND_REQUEST, conns[k + 1].user, NULL);
+        target += 3L * friend_cycles;
+    }
+    return target;
+}
+
+static void friend_frame(int idx, const ChatPacket* p) {
+    if (idx + 1 >= num_conns && !(idx & 1)) return; // conn lẻ cuối không có cặp
+    Conn* a = &conns[idx & ~1];
+    Conn* b = &conns[idx | 1];
+    Conn* c = &conns[idx];
+
+    if (p->type == MSG_TYPE_FRIEND_REQUEST_INCOMING && c == b && strcmp(p->source_user, a->user) == 0) {
+        b->t0 = now_ns();
+        conn_send(b, MSG_TYPE_FRIEND_ACCEPT, a->user, NULL);
+        return;
+    }
+    if (p->type != MSG_TYPE_FRIEND_UPDATE || strcmp(p->source_user, "Server") != 0) return;
+
+    if (starts_with(p->body, "Failed") || starts_with(p->body, "User not found") || starts_with(p->body, "Server busy")) {
+        // Cặp dừng lại: phần còn lại tính là lỗi
+        record_failure(3L * friend_cycles - a->count);
+        a->count = 3 * friend_cycles;
+    } else if (c == a && starts_with(p->body, "Friend request sent")) {
+        record_sample(a->t0);
+        a->count++;
+    } else if (c == b && starts_with(p->body, "You are now friends")) {
+        record_sample(b->t0);
+        a->count++;
+        a->t0 = now_ns();
+        conn_send(a, MSG_TYPE_FRIEND_UNFRIEND, b->user, NULL);
+    } else if (c == a && starts_with(p->body, "You are no longer friends")) {
+        record_sample(a->t0);
+        a->count++;
+        if (a->count < 3 * friend_cycles) {
+            a->t0 = now_ns();
+            conn_send(a, MSG_TYPE_FRIEND_REQUEST, b->user, NULL);
+        }
+    }
+}
+
+// ----- Kịch bản: reconnect storm -----
+// conns[i].count = 1 nếu tham gia (đã login trước kịch bản)
+
+static int reconnect_round = 0;
+static int reconnect_active = 0;
+static int reconnect_done = 0;
+static int reconnect_restart = 0;   // vòng vừa xong: tick() mở vòng mới (ngoài lúc duyệt event)
+static int retries_pending = 0;
+
+static void reconnect_storm(void) {
+    reconnect_done = 0;
+    for (int i = 0; i < num_conns; i++) {
+        if (conns[i].count) conn_close(&conns[i]);
+    }
+    for (int i = 0; i < num_conns; i++) {
+        if (conns[i].count && conn_login(&conns[i], 0) != 0) {
+            record_failure(1);
+            reconnect_done++;
+        }
+    }
+}
+
+static long reconnect_start(void) {
+    reconnect_round = 0;
+    reconnect_active = 0;
+    reconnect_restart = 0;
+    retries_pending = 0;
+    for (int i = 0; i < num_conns; i++) {
+        conns[i].count = conns[i].logged_in;
+        reconnect_active += conns[i].count;
+    }
+    if (reconnect_active == 0) return 0;
+    reconnect_storm();
+    return (long)reconnect_active * reconnect_rounds;
+}
+
+static void reconnect_frame(int idx, const ChatPacket* p) {
+    Conn* c = &conns[idx];
+    if (!c->count || c->logged_in) return;
+    if (p->type == MSG_TYPE_LOGIN_SUCCESS) {
+        c->logged_in = 1;
+        record_sample(c->t0);
+        if (++reconnect_done == reconnect_active && reconnect_round + 1 < reconnect_rounds) reconnect_restart = 1;
+    } else if (p->type == MSG_TYPE_LOGIN_FAIL && c->retry_at == 0) {
+        // Phiên trước của user chưa được server gỡ xong
+        c->retry_at = now_ns() + LOGIN_RETRY_NS;
+        retries_pending++;
+    }
+}
+
+static void reconnect_tick(double now) {
+    if (reconnect_restart) {
+        reconnect_restart = 0;
+        reconnect_round++;
+        retries_pending = 0;
+        reconnect_storm();
+        return;
+    }
+    for (int i = 0; retries_pending > 0 && i < num_conns; i++) {
+        Conn* c = &conns[i];
+        if (c->retry_at == 0 || c->retry_at > now) continue;
+        c->retry_at = 0;
+        retries_pending--;
+        conn_send(c, MSG_TYPE_LOGIN_REQUEST, NULL, "pw");
+    }
+}
+
+// ----- Chạy kịch bản -----
+
+static const Scenario scenarios[] = {
+    { "login",        login_start,        login_frame,        NULL },
+    { "ping",         ping_start,         ping_frame,         NULL },
+    { "group-setup",  group_setup_start,  group_setup_frame,  NULL },
+    { "group-fanout", group_fanout_start, group_fanout_frame, NULL },
+    { "friend",       friend_start,       friend_frame,       NULL },
+    { "reconnect",    reconnect_start,    reconnect_frame,    reconnect_tick },
+};
+#define NUM_SCENARIOS ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+static int run_scenario(const Scenario* s) {
+    current = s;
+    stats.count = 0;
+    stats.ops = 0;
+    stats.errors = 0;
+    double start = now_ns();
+    stats.last_progress = start;
+    long target = s->start();
+    int stalled = 0;
+
+    while (stats.ops < target) {
+        pump(retries_pending > 0 || reconnect_restart ? 1 : 100);
+        double now = now_ns();
+        if (s->tick) s->tick(now);
+        if (now - stats.last_progress > STALL_NS) {
+            stalled = 1;
+            break;
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    qsort(stats.lat_us, stats.count, sizeof(double), cmp_double);
+    printf("%-13s %9ld %10.0f %9.0f %9.0f %9.0f %9.0f %7ld%s\n", s->name, (long)stats.count,
+           elapsed > 0 ? stats.count / elapsed : 0, percentile(0.50), percentile(0.99), percentile(0.999),
+           stats.count ? stats.lat_us[stats.count - 1] : 0, stats.errors, stalled ? "  (stalled)" : "");
+    fflush(stdout);
+    return stalled ? -1 : 0;
+}
+
+// ----- Server -----
+
+static int copy_file(const char* from, const char* to) {
+    int in = open(from, O_RDONLY);
+    if (in < 0) return -1;
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) { close(in); return -1; }
+    char buf[65536];
+    ssize_t r;
+    int rc = 0;
+    while ((r = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, (size_t)r) != r) { rc = -1; break; }
+    }
+    if (r < 0) rc = -1;
+    close(in);
+    close(out);
+    return rc;
+}
+
+static pid_t start_server(const char* server, const char* dir, int threads) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    char threads_arg[16];
+    snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+    if (chdir(dir) != 0) _exit(127);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    if (threads > 0) execl(server, server, "-t", threads_arg, (char*)NULL);
+    else execl(server, server, (char*)NULL);
+    _exit(127);
+}
+
+static int wait_for_server(void) {
+    for (int i = 0; i < 100; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        int ok = connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == 0;
+        close(fd);
+        if (ok) return 0;
+        usleep(50 * 1000);
+    }
+    return -1;
+}
+
+static void remove_server_dir(const char* dir) {
+    const char* files[] = { BENCH_DB, BENCH_DB "-wal", BENCH_DB "-shm", BENCH_DB "-journal" };
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/server", dir);
+    rmdir(path);
+    rmdir(dir);
+}
+
+// Nâng soft limit số fd lên hard limit: mỗi kết nối cần 1 fd
+static void raise_fd_limit(int wanted) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur != RLIM_INFINITY && (rlim_t)wanted + 16 > rl.rlim_cur) {
+        fprintf(stderr, "warning: fd limit %ld is below %d connections\n", (long)rl.rlim_cur, wanted);
+    }
+}
+
+static int resolve_host(const char* host, int port) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0 || !res) return -1;
+    memcpy(&server_addr, res->ai_addr, sizeof(server_addr));
+    server_addr.sin_port = htons((uint16_t)port);
+    freeaddrinfo(res);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* server = "server/server";
+    const char* host = NULL;
+    const char* only = "login,ping,group,friend,reconnect";
+    int port = 8888, threads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:H:P:n:m:w:g:f:r:x:t:1")) != -1) {
+        switch (opt) {
+            case 's': server = optarg; break;
+            case 'H': host = optarg; break;
+            case 'P': port = atoi(optarg); break;
+            case 'n': num_conns = atoi(optarg); break;
+            case 'm': messages = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'g': group_size = atoi(optarg); break;
+            case 'f': friend_cycles = atoi(optarg); break;
+            case 'r': reconnect_rounds = atoi(optarg); break;
+            case 'x': only = optarg; break;
+            case 't': threads = atoi(optarg); break;
+            case '1': proto_version = FRAME_PROTO_V1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s server | -H host] [-P port] [-n connections] [-m messages] [-w window]\n"
+                                "       [-g group_size] [-f friend_cycles] [-r reconnect_rounds]\n"
+                                "       [-x login,ping,group,friend,reconnect] [-t threads] [-1]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (num_conns < 2 || messages <= 0 || window <= 0 || friend_cycles <= 0 || reconnect_rounds <= 0) return 1;
+    if (resolve_host(host ? host : "127.0.0.1", port) != 0) { fprintf(stderr, "cannot resolve %s\n", host); return 1; }
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit(num_conns);
+
+    // Server riêng trên bản sao DB, trừ khi đo server có sẵn (-H)
+    pid_t pid = -1;
+    char dir[] = "/tmp/load_bench_XXXXXX";
+    if (!host) {
+        char server_path[PATH_MAX], path[PATH_MAX];
+        if (!realpath(server, server_path)) { perror(server); return 1; }
+        if (!mkdtemp(dir)) { perror("mkdtemp"); return 1; }
+        snprintf(path, sizeof(path), "%s/server", dir);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/%s", dir, BENCH_DB);
+        if (copy_file(BENCH_DB, path) != 0) { perror("copy " BENCH_DB); remove_server_dir(dir); return 1; }
+        pid = start_server(server_path, dir, threads);
+        if (pid < 0) { perror("fork"); remove_server_dir(dir); return 1; }
+    }
+
+    int rc = 0;
+    conns = calloc((size_t)num_conns, sizeof(Conn));
+    ep = epoll_create1(0);
+    if (!conns || ep < 0 || wait_for_server() != 0) {
+        fprintf(stderr, "server not reachable on port %d\n", port);
+        rc = 1;
+    }
+    for (int i = 0; conns && i < num_conns; i++) conns[i].fd = -1;
+
+    if (rc == 0) {
+        printf("%d connections, %d msgs per pair/group, window %d, group size %d, %d friend cycles, "
+               "%d reconnect rounds, frame v%d\n", num_conns, messages, window, group_size, friend_cycles,
+               reconnect_rounds, proto_version);
+        printf("%-13s %9s %10s %9s %9s %9s %9s %7s\n", "scenario", "ops", "ops/s", "p50 us", "p99 us",
+               "p999 us", "max us", "errors");
+        // Login luôn chạy trước: các kịch bản khác dùng các session này
+        if (run_scenario(&scenarios[0]) != 0) rc = 1;
+        const char* names[] = { "ping", "group", "friend", "reconnect" };
+        const int first[] = { 1, 2, 4, 5 };
+        const int count[] = { 1, 2, 1, 1 };
+        for (int k = 0; k < 4; k++) {
+            if (!strstr(only, names[k])) continue;
+            for (int s = first[k]; s < first[k] + count[k]; s++) {
+                if (run_scenario(&scenarios[s]) != 0) rc = 1;
+            }
+        }
+    }
+
+    for (int i = 0; conns && i < num_conns; i++) {
+        conn_close(&conns[i]);
+        free(conns[i].out);
+    }
+    free(conns);
+    free(groups);
+    free(stats.lat_us);
+    if (ep >= 0) close(ep);
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        remove_server_dir(dir);
+    }
+    return rc;
+}
@@ -7,6 +7,7 @@
 #include <sys/select.h>
 #include <signal.h>
 #include "../shared/protocol.h"
+#include "../shared/frame.h"
 #include "ui.h" // UI mới (đã có ClientState)
 #include <ctype.h> // <-- ADDED: isspace()
 
@@ -21,13 +22,28 @@
 
 // Provide a global server socket FD used by send_packet
 int server_sock_fd = -1;
+// Định dạng frame gửi lên server: v1 cho tới khi server trả lời HELLO
+int proto_version = FRAME_PROTO_V1;
 
 // Remove extern declaration and add a real implementation for send_packet
 int send_packet(ChatPacket* packet) {
     if (!packet) return -1;
     if (server_sock_fd <= 0) return -1;
-    ssize_t w = write(server_sock_fd, packet, sizeof(ChatPacket));
-    return (w == sizeof(ChatPacket)) ? 0 : -1;
+    unsigned char wire[FRAME_MAX_SIZE];
+    size_t len;
+    const void* data = frame_encode(packet, proto_version, wire, &len);
+    ssize_t w = write(server_sock_fd, data, len);
+    return (w == (ssize_t)len) ? 0 : -1;
+}
+
+// Đề nghị server dùng frame v2 và xác nhận từng trang tin offline;
+// server cũ bỏ qua packet lạ nên vẫn dùng v1
+static void send_hello(void) {
+    ChatPacket packet;
+    memset(&packet, 0, sizeof(ChatPacket));
+    packet.type = MSG_TYPE_HELLO;
+    snprintf(packet.body, MAX_BODY, "%d ack", FRAME_PROTO_V2);
+    send_packet(&packet);
 }
 
 // --- Biến Trạng thái Toàn cục ---
@@ -52,6 +68,54 @@ typedef enum {
 ChatContextType current_chat_type = CHAT_TYPE_NONE;
 char current_chat_target[MAX_USERNAME]; // Sẽ lưu tên user hoặc tên group
 
+// (THÊM MỚI) Tập user online phía client: snapshot lúc login + các delta sau đó
+char (*online_users)[MAX_USERNAME] = NULL;
+int online_count = 0;
+int online_cap = 0;
+
+void online_set_clear(void) {
+    online_count = 0;
+}
+
+int online_set_find(const char* user) {
+    for (int i = 0; i < online_count; i++) {
+        if (strncmp(online_users[i], user, MAX_USERNAME) == 0) return i;
+    }
+    return -1;
+}
+
+void online_set_add(const char* user) {
+    if (!user || user[0] == '\0' || online_set_find(user) >= 0) return;
+    if (online_count == online_cap) {
+        int new_cap = online_cap ? online_cap * 2 : 64;
+        void* grown = realloc(online_users, sizeof(*online_users) * new_cap);
+        if (!grown) return;
+        online_users = grown;
+        online_cap = new_cap;
+    }
+    memset(online_users[online_count], 0, MAX_USERNAME);
+    strncpy(online_users[online_count], user, MAX_USERNAME - 1);
+    online_count++;
+}
+
+void online_set_remove(const char* user) {
+    int i = online_set_find(user);
+    if (i < 0) return;
+    // Thứ tự không quan trọng: đưa phần tử cuối vào chỗ trống
+    online_count--;
+    if (i != online_count) memcpy(online_users[i], online_users[online_count], MAX_USERNAME);
+}
+
+// In tập online ra LOG (cắt bớt nếu quá dài để vừa 1 dòng log)
+void online_set_log(void) {
+    char line[MAX_BODY];
+    int offset = snprintf(line, sizeof(line), "Online (%d): ", online_count);
+    for (int i = 0; i < online_count && offset < (int)sizeof(line) - 1; i++) {
+        offset += snprintf(line + offset, sizeof(line) - offset, "%s%s", i ? ", " : "", online_users[i]);
+    }
+    ui_add_log(line);
+}
+
 // Khai báo hàm
 int connect_to_server();
 void handle_server_message(int sock_fd);
@@ -89,6 +153,7 @@ int main() {
 
     // Set global socket for send_packet
     server_sock_fd = sock_fd;
+    send_hello();
 
     ui_init();
     
@@ -155,7 +220,7 @@ void do_login_flow(int sock_fd) {
     current_chat_type = CHAT_TYPE_NONE;
     memset(current_chat_target, 0, MAX_USERNAME);
 
-    write(sock_fd, &packet, sizeof(ChatPacket));
+    send_packet(&packet);
     ui_add_log("Login request sent. Waiting for server...");
 }
 
@@ -177,7 +242,7 @@ void do_register_flow(int sock_fd) {
     current_chat_type = CHAT_TYPE_NONE;
     memset(current_chat_target, 0, MAX_USERNAME);
     
-    write(sock_fd, &packet, sizeof(ChatPacket));
+    send_packet(&packet);
     ui_add_log("Register request sent. Waiting for server...");
 }
 
@@ -489,7 +554,7 @@ void handle_keyboard_input(int sock_fd) {
 
             } else if (strcmp(buffer, "/exit") == 0) {
                 packet.type = MSG_TYPE_LOGOUT_REQUEST;
-                write(sock_fd, &packet, sizeof(ChatPacket));
+                send_packet(&packet);
                 ui_add_log("Logging out...");
                 // clear auth state locally
                 is_authenticated = 0;
@@ -563,6 +628,8 @@ void handle_keyboard_input(int sock_fd) {
                 else ui_add_log("Failed to send unfriend.");
             } else if (strcmp(buffer, "/unfriend") == 0) {
                 do_unfriend_flow(sock_fd);
+            } else if (strcmp(buffer, "/online") == 0) {
+                online_set_log();
             } else if (strcmp(buffer, "/friends") == 0 || strcmp(buffer, "/2") == 0) {
                  ChatPacket pkt;
                  memset(&pkt, 0, sizeof(pkt));
@@ -653,7 +720,7 @@ void handle_keyboard_input(int sock_fd) {
             }
 
             // 3. Gửi packet
-            write(sock_fd, &packet, sizeof(ChatPacket));
+            send_packet(&packet);
 
             // 4. In tin nhắn của MÌNH lên cửa sổ chat
             ui_add_message(my_msg);
@@ -662,33 +729,24 @@ void handle_keyboard_input(int sock_fd) {
 }
 
 // (SỬA LẠI) Bộ não xử lý phản hồi
-void handle_server_message(int sock_fd) {
-    ChatPacket packet;
-    ssize_t bytes_read = read(sock_fd, &packet, sizeof(ChatPacket));
-
-    if (bytes_read <= 0) {
-        ui_destroy();
-        printf("Server disconnected. Exiting.\n");
-        exit(0);
-    }
-
-    char buffer[MAX_BODY + MAX_USERNAME + 20];
+static void handle_server_packet(ChatPacket* packet) {
+    char buffer[MAX_BODY + 2 * MAX_USERNAME + 20]; // đủ cho "[#group from user]: body"
 
     // --- Xử lý phản hồi và THAY ĐỔI TRẠNG THÁI ---
-    switch (packet.type) {
+    switch (packet->type) {
         // --- Các case thay đổi trạng thái ---
         case MSG_TYPE_LOGIN_SUCCESS: {
-            ui_add_log(packet.body); // "Login successful!"
+            ui_add_log(packet->body); // "Login successful!"
 
             // Chỉ chấp nhận nếu đang có yêu cầu login và tên user khớp
-            if (!pending_login_active || strncmp(pending_login, packet.source_user, MAX_USERNAME) != 0) {
+            if (!pending_login_active || strncmp(pending_login, packet->source_user, MAX_USERNAME) != 0) {
                 ui_add_log("Received unexpected login success. Ignoring.");
                 break;
             }
 
             // Accept login: set current_user from server and mark authenticated
             memset(current_user, 0, sizeof(current_user));
-            strncpy(current_user, packet.source_user, MAX_USERNAME - 1);
+            strncpy(current_user, packet->source_user, MAX_USERNAME - 1);
             current_user[MAX_USERNAME - 1] = '\0';
 
             is_authenticated = 1;
@@ -704,7 +762,7 @@ void handle_server_message(int sock_fd) {
         } break;
             
         case MSG_TYPE_LOGIN_FAIL:
-            ui_add_log(packet.body); // In lỗi ra LOG
+            ui_add_log(packet->body); // In lỗi ra LOG
             // Ensure we are not authenticated
             is_authenticated = 0;
             pending_login_active = 0; // Xóa cờ chờ
@@ -713,11 +771,11 @@ void handle_server_message(int sock_fd) {
             break;
 
         case MSG_TYPE_REGISTER_FAIL:
-            ui_add_log(packet.body); // In lỗi ra LOG
+            ui_add_log(packet->body); // In lỗi ra LOG
             break;
 
         case MSG_TYPE_REGISTER_SUCCESS:
-            ui_add_log(packet.body); // "Register successful!"
+            ui_add_log(packet->body); // "Register successful!"
             ui_add_log("Please login using /1.");
             // Trạng thái vẫn là PRE_LOGIN
             break;
@@ -725,41 +783,69 @@ void handle_server_message(int sock_fd) {
         // --- Các case xử lý tin nhắn ---
         case MSG_TYPE_RECEIVE_PRIVATE:
             snprintf(buffer, sizeof(buffer), "[From %.*s]: %.*s",
-                     (int)MAX_USERNAME, packet.source_user,
-                     (int)MAX_BODY, packet.body);
+                     (int)MAX_USERNAME, packet->source_user,
+                     (int)MAX_BODY, packet->body);
             ui_add_message(buffer);
             break;
 
         case MSG_TYPE_RECEIVE_GROUP_MESSAGE: // (THÊM MỚI)
             snprintf(buffer, sizeof(buffer), "[#%.*s from %.*s]: %.*s",
-                     (int)MAX_USERNAME, packet.target_user,
-                     (int)MAX_USERNAME, packet.source_user,
-                     (int)MAX_BODY, packet.body);
+                     (int)MAX_USERNAME, packet->target_user,
+                     (int)MAX_USERNAME, packet->source_user,
+                     (int)MAX_BODY, packet->body);
             ui_add_message(buffer);
             break;
 
         case MSG_TYPE_SEND_OFFLINE_MSG:
             snprintf(buffer, sizeof(buffer), "[Offline Msg from %.*s]: %.*s",
-                     (int)MAX_USERNAME, packet.source_user,
-                     (int)MAX_BODY, packet.body);
+                     (int)MAX_USERNAME, packet->source_user,
+                     (int)MAX_BODY, packet->body);
             ui_add_message(buffer);
             break;
 
         // --- Các case thông báo (Như cũ) ---
-        case MSG_TYPE_ONLINE_LIST_UPDATE:
-            // Always show online list in log when received
-            snprintf(buffer, sizeof(buffer), "Online: %.*s",
-                     (int)MAX_BODY, packet.body);
-            ui_add_log(buffer);
-            break;
+        case MSG_TYPE_ONLINE_LIST_UPDATE: {
+            // Snapshot: chunk đầu thay thế tập hiện có, chunk "+" cộng dồn
+            if (packet->target_user[0] != '+') online_set_clear();
+            packet->body[MAX_BODY - 1] = '\0';
+            char* save = NULL;
+            for (char* name = strtok_r(packet->body, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+                online_set_add(name);
+            }
+            online_set_log();
+        } break;
+
+        case MSG_TYPE_PRESENCE_DELTA: {
+            // Danh sách "+user," (online) / "-user," (offline) đã được server gộp theo lô
+            packet->body[MAX_BODY - 1] = '\0';
+            char joined[MAX_BODY] = "", left[MAX_BODY] = "";
+            char* save = NULL;
+            for (char* tok = strtok_r(packet->body, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                if (tok[0] != '+' && tok[0] != '-') continue;
+                char* list = tok[0] == '+' ? joined : left;
+                if (tok[0] == '+') online_set_add(tok + 1);
+                else online_set_remove(tok + 1);
+                size_t used = strlen(list);
+                snprintf(list + used, MAX_BODY - used, "%s%s", used ? ", " : "", tok + 1);
+            }
+            // Đủ chỗ cho cả 2 danh sách (buffer chung chỉ chứa được 1 body)
+            char line[2 * MAX_BODY + 48];
+            if (joined[0] && left[0]) {
+                snprintf(line, sizeof(line), "Online: %s | Offline: %s (%d online)", joined, left, online_count);
+            } else {
+                snprintf(line, sizeof(line), "%s %s (%d online)", joined[0] ? joined : left,
+                         joined[0] ? "is online" : "is offline", online_count);
+            }
+            ui_add_log(line);
+        } break;
 
         case MSG_TYPE_FRIEND_LIST_RESPONSE:
-            ui_add_log(packet.body);
+            ui_add_log(packet->body);
             break;
 
         case MSG_TYPE_FRIEND_REQUEST_INCOMING: {
             char buf[MAX_BODY];
-            snprintf(buf, sizeof(buf), "Friend request from %s. Type: /accept %s or /decline %s", packet.source_user, packet.source_user, packet.source_user);
+            snprintf(buf, sizeof(buf), "Friend request from %s. Type: /accept %s or /decline %s", packet->source_user, packet->source_user, packet->source_user);
             ui_add_log(buf);
         } break;
 
@@ -767,30 +853,71 @@ void handle_server_message(int sock_fd) {
             // Show "username <status>" when server provides body, otherwise fallback
             {
                 char buf[MAX_BODY + MAX_USERNAME + 4];
-                if (packet.body[0]) {
+                if (packet->body[0]) {
                     // Prefer: "<username> <message>"
                     snprintf(buf, sizeof(buf), "%s %s",
-                             (packet.source_user[0] ? packet.source_user : "Server"),
-                             packet.body);
+                             (packet->source_user[0] ? packet->source_user : "Server"),
+                             packet->body);
                 } else {
-                    snprintf(buf, sizeof(buf), "Friend update: %s", packet.source_user);
+                    snprintf(buf, sizeof(buf), "Friend update: %s", packet->source_user);
                 }
                 ui_add_log(buf);
             }
             break;
 
         case MSG_TYPE_GROUP_LIST_RESPONSE:
-            ui_add_log(packet.body);
+            ui_add_log(packet->body);
+            break;
+
+        case MSG_TYPE_HELLO:
+            // Server chấp nhận phiên bản nào thì từ frame kế tiếp dùng phiên bản đó
+            if (atoi(packet->body) >= FRAME_PROTO_V2) proto_version = FRAME_PROTO_V2;
+            break;
+
+        case MSG_TYPE_OFFLINE_ACK:
+            // Đã hiển thị hết trang tin offline trước marker: báo server để nó xóa và gửi trang sau
+            send_packet(packet);
             break;
 
         default:
             // (Phản hồi cho /friends, /group... sẽ rơi vào đây)
             snprintf(buffer, sizeof(buffer), "Server: %.*s",
-                     (int)MAX_BODY, packet.body);
+                     (int)MAX_BODY, packet->body);
             ui_add_log(buffer);
     }
 }
 
+// Đọc những gì server đã gửi và xử lý từng frame trọn vẹn (v1 hoặc v2)
+void handle_server_message(int sock_fd) {
+    static unsigned char rx[FRAME_MAX_SIZE * 4];
+    static size_t rx_len = 0;
+
+    ssize_t bytes_read = read(sock_fd, rx + rx_len, sizeof(rx) - rx_len);
+    if (bytes_read <= 0) {
+        ui_destroy();
+        printf("Server disconnected. Exiting.\n");
+        exit(0);
+    }
+    rx_len += (size_t)bytes_read;
+
+    size_t off = 0;
+    while (off < rx_len) {
+        long frame_len = frame_length(rx + off, rx_len - off);
+        if (frame_len < 0) {
+            ui_destroy();
+            printf("Malformed frame from server. Exiting.\n");
+            exit(1);
+        }
+        if (frame_len == 0 || (size_t)frame_len > rx_len - off) break; // chờ phần còn lại
+        ChatPacket packet;
+        frame_decode(rx + off, (size_t)frame_len, &packet);
+        off += (size_t)frame_len;
+        handle_server_packet(&packet);
+    }
+    memmove(rx, rx + off, rx_len - off);
+    rx_len -= off;
+}
+
 // Hàm kết nối (giữ nguyên)
 int connect_to_server() {
     int sock_fd;
@@ -118,6 +118,7 @@ void ui_update_options(ClientState state) {
         mvwprintw(win_option, y++, 1, "USAGE: /<option>");
         mvwprintw(win_option, y++, 1, "-------------------");
         mvwprintw(win_option, y++, 1, "Private Chat (/msg )");
+        mvwprintw(win_option, y++, 1, "Online Users (/online)");
         mvwprintw(win_option, y++, 1, "-------------------");
         mvwprintw(win_option, y++, 1, "List Friends(/friends)");
         mvwprintw(win_option, y++, 1, "Add Friend (/add)");
@@ -0,0 +1,353 @@
+#include "admin.h"
+#include "server.h"
+#include "db_pool.h"
+#include "db_handler.h"
+#include "metrics.h"
+#include "session_registry.h"
+#include "presence.h"
+#include "log.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define ADMIN_REQUEST_MAX 2048
+#define ADMIN_SNDBUF (1024 * 1024)  // cả response được ghi 1 lần, không chờ EPOLLOUT
+
+typedef struct {
+    int fd;                         // -1 = slot trống
+    unsigned gen;                   // tăng mỗi lần slot nhận kết nối mới
+    size_t len;
+    char request[ADMIN_REQUEST_MAX];
+} AdminConn;
+
+static int listener_fd = -1;
+static admin_arm_fn arm_fd = NULL;
+static AdminConn conns[ADMIN_MAX_CONNS];
+static unsigned next_gen;
+
+// Chuỗi tăng dần cho response
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+    int failed;
+} Text;
+
+static void text_printf(Text* t, const char* fmt, ...) {
+    if (t->failed) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(t->data ? t->data + t->len : NULL, t->data ? t->cap - t->len : 0, fmt, ap);
+        va_end(ap);
+        if (n < 0) { t->failed = 1; return; }
+        if (t->data && t->len + (size_t)n < t->cap) {
+            t->len += (size_t)n;
+            return;
+        }
+        size_t cap = t->cap ? t->cap * 2 : 16384;
+        while (cap <= t->len + (size_t)n) cap *= 2;
+        char* grown = realloc(t->data, cap);
+        if (!grown) { t->failed = 1; return; }
+        t->data = grown;
+        t->cap = cap;
+    }
+}
+
+// ----- Số liệu -----
+
+// Cận trên các bucket xuất ra (giây); số đếm lấy theo bucket HDR nằm trọn dưới cận
+static const double export_bounds[] = {
+    1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5, 1, 5,
+};
+#define EXPORT_BOUNDS ((int)(sizeof(export_bounds) / sizeof(export_bounds[0])))
+
+static void header(Text* t, const char* name, const char* type, const char* help) {
+    text_printf(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// labels: "" hoặc dạng `type="X"`
+static void histogram(Text* t, const char* name, const char* labels, const Histogram* h) {
+    const char* sep = labels[0] ? "," : "";
+    for (int i = 0; i < EXPORT_BOUNDS; i++) {
+        uint64_t bound_ns = (uint64_t)(export_bounds[i] * 1e9 + 0.5);
+        text_printf(t, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, sep, export_bounds[i],
+                    (unsigned long long)metrics_count_at_most(h, bound_ns));
+    }
+    text_printf(t, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)h->count);
+    const char* open = labels[0] ? "{" : "";
+    const char* close = labels[0] ? "}" : "";
+    text_printf(t, "%s_sum%s%s%s %.9f\n", name, open, labels, close, h->sum_ns / 1e9);
+    text_printf(t, "%s_count%s%s%s %llu\n", name, open, labels, close, (unsigned long long)h->count);
+}
+
+static void type_label(char* out, size_t size, int type) {
+    const char* name = metrics_type_name(type);
+    if (name) snprintf(out, size, "type=\"%s\"", name);
+    else snprintf(out, size, "type=\"%d\"", type);
+}
+
+// 1 counter theo loại packet; chỉ in các loại có giá trị khác 0
+static void per_type_counter(Text* t, const MetricsBlock* s, const char* name, const char* help,
+                             uint64_t (*pick)(const TypeMetrics*)) {
+    header(t, name, "counter", help);
+    char labels[64];
+    for (int i = 0; i < METRICS_MAX_TYPES; i++) {
+        uint64_t v = pick(&s->types[i]);
+        if (v == 0) continue;
+        type_label(labels, sizeof(labels), i);
+        text_printf(t, "%s{%s} %llu\n", name, labels, (unsigned long long)v);
+    }
+}
+
+static uint64_t pick_in(const TypeMetrics* m) { return m->handler.count; }
+static uint64_t pick_in_bytes(const TypeMetrics* m) { return m->in_bytes; }
+static uint64_t pick_out(const TypeMetrics* m) { return m->out_count; }
+static uint64_t pick_out_bytes(const TypeMetrics* m) { return m->out_bytes; }
+
+static void render_metrics(Text* t, int backlog_ok, long long private_backlog, long long group_backlog) {
+    MetricsBlock* s = malloc(sizeof(MetricsBlock));
+    if (!s) { t->failed = 1; return; }
+    metrics_snapshot(s);
+
+    ReactorStats rs;
+    header(t, "chat_sessions", "gauge", "Open client connections per reactor.");
+    for (int i = 0; server_reactor_stats(i, &rs) == 0; i++) {
+        text_printf(t, "chat_sessions{reactor=\"%d\"} %d\n", i, rs.sessions);
+    }
+    header(t, "chat_logged_in_users", "gauge", "Users currently logged in.");
+    text_printf(t, "chat_logged_in_users %d\n", registry_user_count());
+    header(t, "chat_outbound_queue_bytes", "gauge", "Bytes queued for clients and not yet written, per reactor.");
+    for (int i = 0; server_reactor_stats(i, &rs) == 0; i++) {
+        text_printf(t, "chat_outbound_queue_bytes{reactor=\"%d\"} %zu\n", i, rs.out_queued);
+    }
+
+    per_type_counter(t, s, "chat_packets_received_total", "Packets received, by message type.", pick_in);
+    per_type_counter(t, s, "chat_packets_received_bytes_total", "Bytes of received packets, by message type.",
+                     pick_in_bytes);
+    per_type_counter(t, s, "chat_packets_sent_total", "Packets queued to clients, by message type.", pick_out);
+    per_type_counter(t, s, "chat_packets_sent_bytes_total", "Bytes of packets queued to clients, by message type.",
+                     pick_out_bytes);
+
+    char labels[64];
+    header(t, "chat_handler_seconds", "histogram", "Time spent in the dispatcher for one packet, by message type.");
+    for (int i = 0; i < METRICS_MAX_TYPES; i++) {
+        if (s->types[i].handler.count == 0) continue;
+        type_label(labels, sizeof(labels), i);
+        histogram(t, "chat_handler_seconds", labels, &s->types[i].handler);
+    }
+    header(t, "chat_db_seconds", "histogram", "Database time caused by a packet, by message type.");
+    for (int i = 0; i < METRICS_MAX_TYPES; i++) {
+        if (s->types[i].db.count == 0) continue;
+        type_label(labels, sizeof(labels), i);
+        histogram(t, "chat_db_seconds", labels, &s->types[i].db);
+    }
+    header(t, "chat_db_commit_seconds", "histogram", "Time of one writer transaction COMMIT.");
+    histogram(t, "chat_db_commit_seconds", "", &s->db_commit);
+
+    header(t, "chat_db_statements_total", "counter", "Executions of each SQL statement.");
+    for (int i = 0; i < db_stmt_count(); i++) {
+        uint64_t calls, ns;
+        db_stmt_stats(i, &calls, &ns);
+        text_printf(t, "chat_db_statements_total{stmt=\"%s\"} %llu\n", db_stmt_name(i), (unsigned long long)calls);
+    }
+    header(t, "chat_db_statement_seconds_total", "counter", "Total execution time of each SQL statement.");
+    for (int i = 0; i < db_stmt_count(); i++) {
+        uint64_t calls, ns;
+        db_stmt_stats(i, &calls, &ns);
+        text_printf(t, "chat_db_statement_seconds_total{stmt=\"%s\"} %.9f\n", db_stmt_name(i), ns / 1e9);
+    }
+
+    if (backlog_ok) {
+        header(t, "chat_offline_backlog_messages", "gauge",
+               "Stored offline messages: private messages not yet acknowledged, group log rows.");
+        text_printf(t, "chat_offline_backlog_messages{kind=\"private\"} %lld\n", private_backlog);
+        text_printf(t, "chat_offline_backlog_messages{kind=\"group\"} %lld\n", group_backlog);
+    }
+
+    PresenceStats ps;
+    presence_get_stats(&ps);
+    header(t, "chat_presence_events_total", "counter", "Login and logout events seen by presence.");
+    text_printf(t, "chat_presence_events_total %lu\n", ps.events);
+    header(t, "chat_presence_coalesced_total", "counter",
+           "Presence events not sent to peers because they cancelled out or merged within a flush window.");
+    text_printf(t, "chat_presence_coalesced_total %lu\n", ps.coalesced);
+    header(t, "chat_presence_published_total", "counter", "Presence changes published to peers.");
+    text_printf(t, "chat_presence_published_total %lu\n", ps.published);
+    header(t, "chat_presence_delta_packets_total", "counter", "Batched presence delta packets sent.");
+    text_printf(t, "chat_presence_delta_packets_total %lu\n", ps.packets);
+    header(t, "chat_presence_group_notices_total", "counter", "Batched \"went offline\" group notices sent.");
+    text_printf(t, "chat_presence_group_notices_total %lu\n", ps.notices);
+
+    header(t, "chat_socket_write_seconds", "histogram", "Time of one writev to a client socket (epoll backend).");
+    histogram(t, "chat_socket_write_seconds", "", &s->write);
+    header(t, "chat_socket_write_bytes_total", "counter", "Bytes written to client sockets (epoll backend).");
+    text_printf(t, "chat_socket_write_bytes_total %llu\n", (unsigned long long)s->write_bytes);
+    header(t, "chat_loop_iteration_seconds", "histogram", "Busy time of one event loop iteration, all reactors.");
+    histogram(t, "chat_loop_iteration_seconds", "", &s->loop);
+    free(s);
+}
+
+// ----- Kết nối -----
+
+static AdminConn* find_conn(int fd) {
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (conns[i].fd == fd) return &conns[i];
+    }
+    return NULL;
+}
+
+static void close_conn(AdminConn* c) {
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+// Ghi cả response 1 lần (SO_SNDBUF đủ lớn cho vài trăm KB); client không đọc kịp thì bỏ phần còn lại
+static void respond(AdminConn* c, const char* status, const char* content_type, const char* body, size_t len) {
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                     status, content_type, len);
+    struct iovec iov[2] = { { head, (size_t)n }, { (void*)body, len } };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    ssize_t w = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (w >= 0 && (size_t)w < (size_t)n + len) {
+        LOG_WARN("Admin: response truncated (%zd of %zu bytes).", w, (size_t)n + len);
+    }
+    close_conn(c);
+}
+
+typedef struct {
+    AdminConn* conn;
+    unsigned gen;               // conn->gen lúc gửi job: khác nhau = kết nối đã đóng, slot/fd đã dùng lại
+    int ok;
+    sqlite3_int64 private_count;
+    sqlite3_int64 group_count;
+} BacklogJob;
+
+static void backlog_work(sqlite3* db, void* arg) {
+    BacklogJob* job = (BacklogJob*)arg;
+    job->ok = db_get_offline_backlog(db, &job->private_count, &job->group_count) == 0;
+}
+
+static void backlog_done(sqlite3* db, void* arg, int status) {
+    (void)db;
+    (void)status;
+    BacklogJob* job = (BacklogJob*)arg;
+    AdminConn* c = job->conn;
+    if (c->fd != -1 && c->gen == job->gen) {
+        Text t = { NULL, 0, 0, 0 };
+        render_metrics(&t, job->ok, (long long)job->private_count, (long long)job->group_count);
+        if (t.failed) respond(c, "500 Internal Server Error", "text/plain", "out of memory\n", 14);
+        else respond(c, "200 OK", "text/plain; version=0.0.4", t.data, t.len);
+        free(t.data);
+    }
+    free(job);
+}
+
+static void handle_request(AdminConn* c) {
+    if (strncmp(c->request, "GET /metrics ", 13) != 0 && strncmp(c->request, "GET /metrics?", 13) != 0) {
+        const char* body = "Only GET /metrics is served here.\n";
+        respond(c, "404 Not Found", "text/plain", body, strlen(body));
+        return;
+    }
+    BacklogJob* job = calloc(1, sizeof(BacklogJob));
+    if (job) {
+        job->conn = c;
+        job->gen = c->gen;
+        if (db_pool_submit("admin", backlog_work, backlog_done, job) == 0) return;
+        free(job);
+    }
+    respond(c, "503 Service Unavailable", "text/plain", "busy\n", 5);
+}
+
+static void accept_conns(void) {
+    for (;;) {
+        int fd = accept(listener_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) LOG_ERROR("Admin: accept() failed: %s", strerror(errno));
+            return;
+        }
+        AdminConn* c = find_conn(-1);
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        int sndbuf = ADMIN_SNDBUF;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        c->fd = fd;
+        c->gen = ++next_gen;
+        c->len = 0;
+        arm_fd(fd);
+    }
+}
+
+void admin_on_readable(int fd) {
+    if (fd == listener_fd) {
+        accept_conns();
+        return;
+    }
+    AdminConn* c = find_conn(fd);
+    if (!c) return;
+    ssize_t r = recv(fd, c->request + c->len, ADMIN_REQUEST_MAX - 1 - c->len, 0);
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        arm_fd(fd);
+        return;
+    }
+    if (r <= 0) {
+        close_conn(c);
+        return;
+    }
+    c->len += (size_t)r;
+    c->request[c->len] = '\0';
+    if (strstr(c->request, "\r\n\r\n") || strstr(c->request, "\n\n")) {
+        handle_request(c);
+    } else if (c->len >= ADMIN_REQUEST_MAX - 1) {
+        respond(c, "400 Bad Request", "text/plain", "request too large\n", 18);
+    } else {
+        arm_fd(fd);
+    }
+}
+
+int admin_open(int port, admin_arm_fn arm) {
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) conns[i].fd = -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) { LOG_ERROR("Admin: socket() failed: %s", strerror(errno)); return -1; }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // chỉ máy local
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        LOG_ERROR("Admin: bind/listen failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    listener_fd = fd;
+    arm_fd = arm;
+    return fd;
+}
+
+void admin_close(void) {
+    for (int i = 0; i < ADMIN_MAX_CONNS; i++) {
+        if (conns[i].fd != -1) close_conn(&conns[i]);
+    }
+    if (listener_fd != -1) close(listener_fd);
+    listener_fd = -1;
+}
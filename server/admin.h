@@ -0,0 +1,23 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+// Cổng quản trị: HTTP tối giản trên 127.0.0.1, phục vụ bởi reactor 0 trong cùng vòng lặp.
+// GET /metrics trả về số liệu dạng Prometheus text exposition (version 0.0.4): session,
+// user đang login, packet vào/ra theo loại, hàng đợi gửi, DB, backlog tin offline, vòng lặp.
+// Mỗi request 1 kết nối (server đóng sau khi trả lời); số tin offline đếm trên thread DB rồi
+// mới trả lời nên vòng lặp không chờ đĩa.
+
+#define ADMIN_DEFAULT_PORT 9888
+#define ADMIN_MAX_CONNS 16          // kết nối quản trị đồng thời, vượt quá bị đóng ngay
+
+// Reactor báo 1 lần (one-shot) khi fd đọc được bằng cách gọi admin_on_readable(fd)
+typedef void (*admin_arm_fn)(int fd);
+
+// Mở listener trên 127.0.0.1:port (non-blocking). Listener được reactor theo dõi liên tục;
+// kết nối mới được arm qua `arm`. Trả về fd của listener, -1 nếu lỗi.
+int admin_open(int port, admin_arm_fn arm);
+// Gọi trên reactor 0 khi listener hoặc 1 kết nối quản trị đọc được
+void admin_on_readable(int fd);
+void admin_close(void);
+
+#endif
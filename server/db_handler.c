@@ -1,33 +1,538 @@
 #include "db_handler.h"
+#include "log.h"
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+// ----- Cache prepared statement -----
+// Mỗi kết nối (mỗi reactor có 1 kết nối riêng) prepare toàn bộ câu lệnh 1 lần trong db_open,
+// sau đó mỗi lần gọi chỉ reset + bind lại.
+typedef enum {
+    STMT_REGISTER_USER = 0,
+    STMT_LOGIN_USER,
+    STMT_STORE_OFFLINE,
+    STMT_SELECT_PENDING,
+    STMT_DELETE_PENDING,
+    STMT_USER_ID,
+    STMT_FRIEND_REQUEST,
+    STMT_FRIEND_ACCEPT,
+    STMT_FRIEND_DECLINE,
+    STMT_FRIEND_UNFRIEND,
+    STMT_FRIEND_LIST,
+    STMT_CREATE_GROUP,
+    STMT_GROUP_EXISTS,
+    STMT_ADD_GROUP_MEMBER,
+    STMT_REMOVE_GROUP_MEMBER,
+    STMT_IS_GROUP_OWNER,
+    STMT_GROUP_MEMBERS,
+    STMT_GROUPS_FOR_USER,
+    STMT_ALL_GROUPS,
+    STMT_IS_GROUP_MEMBER,
+    STMT_GROUP_OWNER,
+    STMT_APPEND_GROUP_MSG,
+    STMT_SELECT_GROUP_PENDING,
+    STMT_GROUP_LOG_HEAD,
+    STMT_ADVANCE_GROUP_CURSORS,
+    STMT_PRUNE_GROUP_LOG,
+    STMT_OFFLINE_BACKLOG,
+    STMT_COUNT
+} DbStmtId;
+
+static const char* stmt_sql[STMT_COUNT] = {
+    [STMT_REGISTER_USER]       = "INSERT INTO users (username, password) VALUES (?, ?);",
+    [STMT_LOGIN_USER]          = "SELECT password FROM users WHERE username = ?;",
+    // Tên người gửi/nhận đổi sang id ngay trong câu lệnh; người nhận không tồn tại -> không lưu gì
+    [STMT_STORE_OFFLINE]       = "INSERT INTO offline_messages (from_user_id, to_user_id, message) "
+                                 "SELECT f.id, t.id, ? FROM users f, users t WHERE f.username = ? AND t.username = ?;",
+    [STMT_SELECT_PENDING]      = "SELECT m.id, u.username, m.message FROM offline_messages m "
+                                 "JOIN users u ON u.id = m.from_user_id "
+                                 "WHERE m.to_user_id = ? AND m.id > ? ORDER BY m.id ASC LIMIT ?;",
+    [STMT_DELETE_PENDING]      = "DELETE FROM offline_messages WHERE to_user_id = ? AND id <= ?;",
+    [STMT_USER_ID]             = "SELECT id FROM users WHERE username = ?;",
+    [STMT_FRIEND_REQUEST]      = "INSERT INTO friends (user_a_id, user_b_id, status) VALUES (?, ?, 0);",
+    [STMT_FRIEND_ACCEPT]       = "UPDATE friends SET status = 1 WHERE user_a_id = ? AND user_b_id = ? AND status = 0;",
+    [STMT_FRIEND_DECLINE]      = "DELETE FROM friends WHERE user_a_id = ? AND user_b_id = ? AND status = 0;",
+    [STMT_FRIEND_UNFRIEND]     = "DELETE FROM friends WHERE status = 1 AND "
+                                 "((user_a_id = ? AND user_b_id = ?) OR (user_a_id = ? AND user_b_id = ?));",
+    [STMT_FRIEND_LIST]         = "SELECT u.id, u.username FROM friends f JOIN users u ON u.id = f.user_b_id "
+                                 "WHERE f.user_a_id = ? AND f.status = 1 "
+                                 "UNION "
+                                 "SELECT u.id, u.username FROM friends f JOIN users u ON u.id = f.user_a_id "
+                                 "WHERE f.user_b_id = ? AND f.status = 1;",
+    [STMT_CREATE_GROUP]        = "INSERT INTO groups (group_name, owner_id) VALUES (?, ?);",
+    [STMT_GROUP_EXISTS]        = "SELECT 1 FROM groups WHERE group_name = ? LIMIT 1;",
+    // Thành viên mới chỉ đọc các tin gửi sau khi vào group. Group không tồn tại -> 0 dòng.
+    [STMT_ADD_GROUP_MEMBER]    = "INSERT INTO group_members (group_id, user_id, last_read_id) "
+                                 "SELECT group_id, ?, (SELECT IFNULL(MAX(id), 0) FROM group_messages) "
+                                 "FROM groups WHERE group_name = ?;",
+    [STMT_REMOVE_GROUP_MEMBER] = "DELETE FROM group_members "
+                                 "WHERE group_id = (SELECT group_id FROM groups WHERE group_name = ?) AND user_id = ?;",
+    [STMT_IS_GROUP_OWNER]      = "SELECT 1 FROM groups WHERE group_name = ? AND owner_id = ? LIMIT 1;",
+    [STMT_GROUP_MEMBERS]       = "SELECT u.id, u.username FROM groups g "
+                                 "JOIN group_members gm ON gm.group_id = g.group_id "
+                                 "JOIN users u ON u.id = gm.user_id "
+                                 "WHERE g.group_name = ?;",
+    [STMT_GROUPS_FOR_USER]     = "SELECT g.group_name FROM group_members gm "
+                                 "JOIN groups g ON g.group_id = gm.group_id "
+                                 "WHERE gm.user_id = ?;",
+    [STMT_ALL_GROUPS]          = "SELECT group_name FROM groups;",
+    [STMT_IS_GROUP_MEMBER]     = "SELECT 1 FROM group_members gm "
+                                 "JOIN groups g ON g.group_id = gm.group_id "
+                                 "WHERE g.group_name = ? AND gm.user_id = ? LIMIT 1;",
+    [STMT_GROUP_OWNER]         = "SELECT owner_id FROM groups WHERE group_name = ? LIMIT 1;",
+    [STMT_APPEND_GROUP_MSG]    = "INSERT INTO group_messages (group_id, from_user_id, message) "
+                                 "SELECT group_id, ?, ? FROM groups WHERE group_name = ?;",
+    [STMT_SELECT_GROUP_PENDING] = "SELECT m.id, g.group_name, u.username, m.message FROM group_members gm "
+                                 "JOIN group_messages m ON m.group_id = gm.group_id AND m.id > gm.last_read_id "
+                                 "JOIN groups g ON g.group_id = gm.group_id "
+                                 "JOIN users u ON u.id = m.from_user_id "
+                                 "WHERE gm.user_id = ? AND m.id > ? AND m.id <= ? AND m.from_user_id <> gm.user_id "
+                                 "ORDER BY m.id ASC LIMIT ?;",
+    [STMT_GROUP_LOG_HEAD]      = "SELECT IFNULL(MAX(id), 0) FROM group_messages;",
+    [STMT_ADVANCE_GROUP_CURSORS] = "UPDATE group_members SET last_read_id = ? WHERE user_id = ? AND last_read_id < ?;",
+    // Xóa phần đầu log mà mọi thành viên của group đã đọc qua (chỉ các group của user vừa đọc)
+    [STMT_PRUNE_GROUP_LOG]     = "DELETE FROM group_messages "
+                                 "WHERE group_id IN (SELECT group_id FROM group_members WHERE user_id = ?) "
+                                 "AND id <= (SELECT MIN(gm.last_read_id) FROM group_members gm "
+                                 "WHERE gm.group_id = group_messages.group_id);",
+    [STMT_OFFLINE_BACKLOG]     = "SELECT (SELECT COUNT(*) FROM offline_messages), (SELECT COUNT(*) FROM group_messages);",
+};
+
+// Tên câu lệnh cho số liệu (nhãn "stmt" của cổng quản trị)
+static const char* stmt_name[STMT_COUNT] = {
+    [STMT_REGISTER_USER]       = "register_user",
+    [STMT_LOGIN_USER]          = "login_user",
+    [STMT_STORE_OFFLINE]       = "store_offline",
+    [STMT_SELECT_PENDING]      = "select_pending",
+    [STMT_DELETE_PENDING]      = "delete_pending",
+    [STMT_USER_ID]             = "user_id",
+    [STMT_FRIEND_REQUEST]      = "friend_request",
+    [STMT_FRIEND_ACCEPT]       = "friend_accept",
+    [STMT_FRIEND_DECLINE]      = "friend_decline",
+    [STMT_FRIEND_UNFRIEND]     = "friend_unfriend",
+    [STMT_FRIEND_LIST]         = "friend_list",
+    [STMT_CREATE_GROUP]        = "create_group",
+    [STMT_GROUP_EXISTS]        = "group_exists",
+    [STMT_ADD_GROUP_MEMBER]    = "add_group_member",
+    [STMT_REMOVE_GROUP_MEMBER] = "remove_group_member",
+    [STMT_IS_GROUP_OWNER]      = "is_group_owner",
+    [STMT_GROUP_MEMBERS]       = "group_members",
+    [STMT_GROUPS_FOR_USER]     = "groups_for_user",
+    [STMT_ALL_GROUPS]          = "all_groups",
+    [STMT_IS_GROUP_MEMBER]     = "is_group_member",
+    [STMT_GROUP_OWNER]         = "group_owner",
+    [STMT_APPEND_GROUP_MSG]    = "append_group_msg",
+    [STMT_SELECT_GROUP_PENDING] = "select_group_pending",
+    [STMT_GROUP_LOG_HEAD]      = "group_log_head",
+    [STMT_ADVANCE_GROUP_CURSORS] = "advance_group_cursors",
+    [STMT_PRUNE_GROUP_LOG]     = "prune_group_log",
+    [STMT_OFFLINE_BACKLOG]     = "offline_backlog",
+};
+
+// Số lần chạy và tổng thời gian (từ acquire tới release) của từng câu lệnh, cộng mọi kết nối.
+// Thời điểm acquire giữ theo thread: mỗi kết nối chỉ được 1 thread dùng.
+static uint64_t stmt_calls[STMT_COUNT];
+static uint64_t stmt_total_ns[STMT_COUNT];
+static __thread uint64_t stmt_started[STMT_COUNT];
+
+static uint64_t stmt_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int db_stmt_count(void) {
+    return STMT_COUNT;
+}
+
+const char* db_stmt_name(int id) {
+    return id >= 0 && id < STMT_COUNT ? stmt_name[id] : NULL;
+}
+
+void db_stmt_stats(int id, uint64_t* calls, uint64_t* total_ns) {
+    *calls = id >= 0 && id < STMT_COUNT ? __atomic_load_n(&stmt_calls[id], __ATOMIC_RELAXED) : 0;
+    *total_ns = id >= 0 && id < STMT_COUNT ? __atomic_load_n(&stmt_total_ns[id], __ATOMIC_RELAXED) : 0;
+}
+
+#define MAX_DB_CONNECTIONS 128
+
+typedef struct {
+    sqlite3* db;
+    sqlite3_stmt* stmts[STMT_COUNT];
+} DbStmtCache;
+
+// Chỉ thêm entry mới (trong db_open); entry được ghi xong trước khi tăng cache_count
+static DbStmtCache stmt_caches[MAX_DB_CONNECTIONS];
+static int stmt_cache_count = 0;
+static pthread_mutex_t stmt_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static DbStmtCache* find_stmt_cache(sqlite3* db) {
+    int n = __atomic_load_n(&stmt_cache_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++) {
+        if (stmt_caches[i].db == db) return &stmt_caches[i];
+    }
+    return NULL;
+}
+
+static void stmt_cache_open(sqlite3* db) {
+    pthread_mutex_lock(&stmt_cache_lock);
+    DbStmtCache* cache = NULL;
+    for (int i = 0; i < stmt_cache_count; i++) {
+        if (stmt_caches[i].db == NULL) { cache = &stmt_caches[i]; break; } // slot của kết nối đã đóng
+    }
+    if (!cache && stmt_cache_count < MAX_DB_CONNECTIONS) cache = &stmt_caches[stmt_cache_count];
+    if (!cache) {
+        pthread_mutex_unlock(&stmt_cache_lock);
+        LOG_WARN("Statement cache full; connection will prepare per call.");
+        return;
+    }
+
+    memset(cache->stmts, 0, sizeof(cache->stmts));
+    for (int i = 0; i < STMT_COUNT; i++) {
+        if (sqlite3_prepare_v3(db, stmt_sql[i], -1, SQLITE_PREPARE_PERSISTENT, &cache->stmts[i], NULL) != SQLITE_OK) {
+            // Bảng có thể chưa tồn tại; sẽ prepare lại ở lần dùng đầu tiên
+            LOG_ERROR("Failed to prepare cached statement %d: %s", i, sqlite3_errmsg(db));
+            cache->stmts[i] = NULL;
+        }
+    }
+    __atomic_store_n(&cache->db, db, __ATOMIC_RELEASE);
+    if (cache == &stmt_caches[stmt_cache_count]) {
+        __atomic_store_n(&stmt_cache_count, stmt_cache_count + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&stmt_cache_lock);
+}
+
+static void stmt_cache_close(sqlite3* db) {
+    pthread_mutex_lock(&stmt_cache_lock);
+    DbStmtCache* cache = find_stmt_cache(db);
+    if (cache) {
+        for (int i = 0; i < STMT_COUNT; i++) {
+            if (cache->stmts[i]) sqlite3_finalize(cache->stmts[i]);
+            cache->stmts[i] = NULL;
+        }
+        __atomic_store_n(&cache->db, NULL, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&stmt_cache_lock);
+}
+
+// Lấy statement đã prepare cho kết nối này. Nếu statement đang được dùng dở
+// (callback gọi lồng cùng truy vấn) hoặc kết nối không có cache thì prepare tạm 1 bản mới.
+// Luôn trả lại bằng db_stmt_release().
+static sqlite3_stmt* db_stmt_acquire(sqlite3* db, DbStmtId id) {
+    stmt_started[id] = stmt_clock_ns();
+    DbStmtCache* cache = find_stmt_cache(db);
+    if (cache) {
+        if (!cache->stmts[id]) {
+            sqlite3_prepare_v3(db, stmt_sql[id], -1, SQLITE_PREPARE_PERSISTENT, &cache->stmts[id], NULL);
+        }
+        if (cache->stmts[id] && !sqlite3_stmt_busy(cache->stmts[id])) return cache->stmts[id];
+    }
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, stmt_sql[id], -1, &stmt, NULL) != SQLITE_OK) {
+        LOG_ERROR("Failed to prepare statement: %s", sqlite3_errmsg(db));
+        if (stmt) sqlite3_finalize(stmt);
+        return NULL;
+    }
+    return stmt;
+}
+
+static void db_stmt_release(sqlite3* db, DbStmtId id, sqlite3_stmt* stmt) {
+    if (!stmt) return;
+    uint64_t now = stmt_clock_ns();
+    __atomic_add_fetch(&stmt_calls[id], 1, __ATOMIC_RELAXED);
+    if (now > stmt_started[id]) __atomic_add_fetch(&stmt_total_ns[id], now - stmt_started[id], __ATOMIC_RELAXED);
+    DbStmtCache* cache = find_stmt_cache(db);
+    if (cache && cache->stmts[id] == stmt) {
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+    } else {
+        sqlite3_finalize(stmt);
+    }
+}
+
+// ----- Migration schema -----
+// PRAGMA user_version = số bước đã chạy. Mỗi bước chạy đúng 1 lần, theo thứ tự, trong cùng
+// transaction với việc tăng user_version. Chỉ thêm bước mới vào cuối, không sửa bước cũ.
+// Bước 1 dùng IF NOT EXISTS: chat.db cũ (tạo tay theo scheme_database.txt) có version 0.
+
+// Thêm cột nếu chưa có (chat.db đã được bản server trước thêm cột mà chưa có user_version)
+static int add_column_if_missing(sqlite3* db, const char* table, const char* column, const char* decl) {
+    char sql[256];
+    sqlite3_stmt* probe = NULL;
+    snprintf(sql, sizeof(sql), "SELECT %s FROM %s LIMIT 0;", column, table);
+    int exists = sqlite3_prepare_v2(db, sql, -1, &probe, NULL) == SQLITE_OK;
+    sqlite3_finalize(probe);
+    if (exists) return SQLITE_OK;
+    snprintf(sql, sizeof(sql), "ALTER TABLE %s ADD COLUMN %s %s;", table, column, decl);
+    return sqlite3_exec(db, sql, NULL, NULL, NULL);
+}
+
+static int migrate_group_cursor(sqlite3* db) {
+    return add_column_if_missing(db, "group_members", "last_read_id", "INTEGER NOT NULL DEFAULT 0");
+}
+
+typedef struct {
+    const char* sql;
+    int (*fn)(sqlite3* db);     // chạy sau sql (có thể NULL)
+} Migration;
+
+static const Migration migrations[] = {
+    // 1: schema gốc (scheme_database.txt)
+    { "CREATE TABLE IF NOT EXISTS users ("
+      "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    username TEXT NOT NULL UNIQUE,"
+      "    password TEXT NOT NULL);"
+      "CREATE TABLE IF NOT EXISTS friends ("
+      "    user_a TEXT NOT NULL,"
+      "    user_b TEXT NOT NULL,"
+      "    status INTEGER NOT NULL,"
+      "    PRIMARY KEY (user_a, user_b),"
+      "    FOREIGN KEY (user_a) REFERENCES users(username),"
+      "    FOREIGN KEY (user_b) REFERENCES users(username));"
+      "CREATE TABLE IF NOT EXISTS offline_messages ("
+      "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    to_user TEXT NOT NULL,"
+      "    from_user TEXT NOT NULL,"
+      "    message TEXT NOT NULL,"
+      "    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
+      "    FOREIGN KEY (to_user) REFERENCES users(username),"
+      "    FOREIGN KEY (from_user) REFERENCES users(username));"
+      "CREATE TABLE IF NOT EXISTS groups ("
+      "    group_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    group_name TEXT NOT NULL UNIQUE,"
+      "    owner_username TEXT NOT NULL,"
+      "    FOREIGN KEY (owner_username) REFERENCES users(username));"
+      "CREATE TABLE IF NOT EXISTS group_members ("
+      "    group_id INTEGER NOT NULL,"
+      "    username TEXT NOT NULL,"
+      "    PRIMARY KEY (group_id, username),"
+      "    FOREIGN KEY (group_id) REFERENCES groups(group_id),"
+      "    FOREIGN KEY (username) REFERENCES users(username));",
+      NULL },
+    // 2: log tin nhắn group + con trỏ đọc của từng thành viên
+    { "CREATE TABLE IF NOT EXISTS group_messages ("
+      "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    group_id INTEGER NOT NULL,"
+      "    from_user TEXT NOT NULL,"
+      "    message TEXT NOT NULL,"
+      "    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
+      "    FOREIGN KEY (group_id) REFERENCES groups(group_id));"
+      "CREATE INDEX IF NOT EXISTS idx_group_messages_group ON group_messages (group_id);",
+      migrate_group_cursor },
+    // 3: index cho các truy vấn nóng (xem make check-schema)
+    { "CREATE INDEX IF NOT EXISTS idx_offline_to_user ON offline_messages (to_user, id);"  // tin chờ theo người nhận
+      "CREATE INDEX IF NOT EXISTS idx_friends_user_b ON friends (user_b, status);"         // nhánh 2 của friend list
+      "CREATE INDEX IF NOT EXISTS idx_group_members_user ON group_members (username);",   // group của 1 user
+      NULL },
+    // 4: khóa user bằng users.id thay cho username (so sánh/index số nguyên, tên chỉ nằm ở bảng users).
+    // SQLite không đổi được kiểu cột: tạo bảng mới, chép dữ liệu (dòng trỏ tới user/group không còn
+    // tồn tại bị bỏ), xóa bảng cũ, đổi tên. Giữ sqlite_sequence để id tin nhắn không bị dùng lại
+    // (con trỏ last_read_id so sánh theo id).
+    { "CREATE TABLE groups_v4 ("
+      "    group_id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    group_name TEXT NOT NULL UNIQUE,"
+      "    owner_id INTEGER NOT NULL,"
+      "    FOREIGN KEY (owner_id) REFERENCES users(id));"
+      "INSERT INTO sqlite_sequence (name, seq) SELECT 'groups_v4', seq FROM sqlite_sequence WHERE name = 'groups';"
+      "INSERT INTO groups_v4 (group_id, group_name, owner_id) "
+      "    SELECT g.group_id, g.group_name, u.id FROM groups g JOIN users u ON u.username = g.owner_username;"
+      "CREATE TABLE group_members_v4 ("
+      "    group_id INTEGER NOT NULL,"
+      "    user_id INTEGER NOT NULL,"
+      "    last_read_id INTEGER NOT NULL DEFAULT 0,"
+      "    PRIMARY KEY (group_id, user_id),"
+      "    FOREIGN KEY (group_id) REFERENCES groups(group_id),"
+      "    FOREIGN KEY (user_id) REFERENCES users(id));"
+      "INSERT INTO group_members_v4 (group_id, user_id, last_read_id) "
+      "    SELECT gm.group_id, u.id, gm.last_read_id FROM group_members gm "
+      "    JOIN users u ON u.username = gm.username JOIN groups_v4 g ON g.group_id = gm.group_id;"
+      "CREATE TABLE friends_v4 ("
+      "    user_a_id INTEGER NOT NULL,"
+      "    user_b_id INTEGER NOT NULL,"
+      "    status INTEGER NOT NULL,"
+      "    PRIMARY KEY (user_a_id, user_b_id),"
+      "    FOREIGN KEY (user_a_id) REFERENCES users(id),"
+      "    FOREIGN KEY (user_b_id) REFERENCES users(id));"
+      "INSERT INTO friends_v4 (user_a_id, user_b_id, status) "
+      "    SELECT a.id, b.id, f.status FROM friends f "
+      "    JOIN users a ON a.username = f.user_a JOIN users b ON b.username = f.user_b;"
+      "CREATE TABLE offline_messages_v4 ("
+      "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    to_user_id INTEGER NOT NULL,"
+      "    from_user_id INTEGER NOT NULL,"
+      "    message TEXT NOT NULL,"
+      "    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
+      "    FOREIGN KEY (to_user_id) REFERENCES users(id),"
+      "    FOREIGN KEY (from_user_id) REFERENCES users(id));"
+      "INSERT INTO sqlite_sequence (name, seq) "
+      "    SELECT 'offline_messages_v4', seq FROM sqlite_sequence WHERE name = 'offline_messages';"
+      "INSERT INTO offline_messages_v4 (id, to_user_id, from_user_id, message, timestamp) "
+      "    SELECT m.id, t.id, f.id, m.message, m.timestamp FROM offline_messages m "
+      "    JOIN users t ON t.username = m.to_user JOIN users f ON f.username = m.from_user;"
+      "CREATE TABLE group_messages_v4 ("
+      "    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+      "    group_id INTEGER NOT NULL,"
+      "    from_user_id INTEGER NOT NULL,"
+      "    message TEXT NOT NULL,"
+      "    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,"
+      "    FOREIGN KEY (group_id) REFERENCES groups(group_id),"
+      "    FOREIGN KEY (from_user_id) REFERENCES users(id));"
+      "INSERT INTO sqlite_sequence (name, seq) "
+      "    SELECT 'group_messages_v4', seq FROM sqlite_sequence WHERE name = 'group_messages';"
+      "INSERT INTO group_messages_v4 (id, group_id, from_user_id, message, timestamp) "
+      "    SELECT m.id, m.group_id, f.id, m.message, m.timestamp FROM group_messages m "
+      "    JOIN users f ON f.username = m.from_user JOIN groups_v4 g ON g.group_id = m.group_id;"
+      "DROP TABLE group_messages;"
+      "DROP TABLE offline_messages;"
+      "DROP TABLE friends;"
+      "DROP TABLE group_members;"
+      "DROP TABLE groups;"
+      "ALTER TABLE groups_v4 RENAME TO groups;"
+      "ALTER TABLE group_members_v4 RENAME TO group_members;"
+      "ALTER TABLE friends_v4 RENAME TO friends;"
+      "ALTER TABLE offline_messages_v4 RENAME TO offline_messages;"
+      "ALTER TABLE group_messages_v4 RENAME TO group_messages;"
+      "CREATE INDEX idx_offline_to_user ON offline_messages (to_user_id, id);"
+      "CREATE INDEX idx_friends_user_b ON friends (user_b_id, status);"
+      "CREATE INDEX idx_group_members_user ON group_members (user_id);"
+      "CREATE INDEX idx_group_messages_group ON group_messages (group_id);",
+      NULL },
+};
+
+#define DB_SCHEMA_VERSION ((int)(sizeof(migrations) / sizeof(migrations[0])))
+
+static int schema_version(sqlite3* db) {
+    sqlite3_stmt* stmt = NULL;
+    int version = -1;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL) == SQLITE_OK &&
+        sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+// Đưa schema lên DB_SCHEMA_VERSION. Kết nối đầu tiên (hoặc tiến trình đầu tiên) chạy các bước,
+// các kết nối sau chỉ đọc user_version. 0 = OK.
+static int db_migrate(sqlite3* db) {
+    if (schema_version(db) == DB_SCHEMA_VERSION) return 0;
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+        LOG_ERROR("Schema migration: cannot lock database: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    // Đọc lại trong transaction: kết nối khác có thể vừa migrate xong
+    int version = schema_version(db);
+    if (version > DB_SCHEMA_VERSION) {
+        LOG_ERROR("Database schema version %d is newer than this server (%d).", version, DB_SCHEMA_VERSION);
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return 1;
+    }
+    for (int v = version; v < DB_SCHEMA_VERSION; v++) {
+        const Migration* m = &migrations[v];
+        char* err = NULL;
+        int rc = sqlite3_exec(db, m->sql, NULL, NULL, &err);
+        if (rc == SQLITE_OK && m->fn) rc = m->fn(db);
+        if (rc != SQLITE_OK) {
+            LOG_ERROR("Schema migration %d failed: %s", v + 1, err ? err : sqlite3_errmsg(db));
+            sqlite3_free(err);
+            sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+            return 1;
+        }
+    }
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA user_version = %d;", DB_SCHEMA_VERSION);
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK ||
+        sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK) {
+        LOG_ERROR("Schema migration commit failed: %s", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+        return 1;
+    }
+    if (version < DB_SCHEMA_VERSION) LOG_INFO("Database schema migrated from version %d to %d.", version, DB_SCHEMA_VERSION);
+    return 0;
+}
+
 // Hàm db_open từ Ngày 1
 int db_open(const char* db_file, sqlite3 **db) {
     int rc = sqlite3_open(db_file, db);
     if (rc != SQLITE_OK) {
-        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(*db));
+        LOG_ERROR("Cannot open database: %s", sqlite3_errmsg(*db));
         sqlite3_close(*db);
         return 1;
     }
-    printf("Database connection established.\n");
+    // Mỗi reactor có kết nối riêng -> chờ khi reactor khác đang ghi thay vì lỗi SQLITE_BUSY
+    sqlite3_busy_timeout(*db, 5000);
+    // WAL: đọc (reactor, worker) không chặn writer và ngược lại; commit chỉ append + fsync file WAL.
+    // synchronous = FULL: transaction đã COMMIT thì không mất khi mất điện (done của job ghi
+    // chỉ chạy sau COMMIT, xem db_pool.h)
+    if (sqlite3_exec(*db, "PRAGMA journal_mode = WAL;", NULL, NULL, NULL) != SQLITE_OK) {
+        LOG_ERROR("Cannot enable WAL: %s", sqlite3_errmsg(*db));
+    }
+    sqlite3_exec(*db, "PRAGMA synchronous = FULL;", NULL, NULL, NULL);
+    // Tạo / nâng cấp schema trước khi prepare các câu lệnh
+    if (db_migrate(*db) != 0) {
+        sqlite3_close(*db);
+        return 1;
+    }
+    stmt_cache_open(*db);
+    LOG_INFO("Database connection established.");
     return 0;
 }
 
+// Câu lệnh được phép quét cả bảng (liệt kê toàn bộ theo yêu cầu)
+static int stmt_full_scan_ok(DbStmtId id) {
+    return id == STMT_ALL_GROUPS || id == STMT_OFFLINE_BACKLOG;
+}
+
+// EXPLAIN QUERY PLAN mọi câu lệnh trong cache; đếm số câu lệnh quét cả bảng ("SCAN <bảng>",
+// kể cả qua covering index) mà không nằm trong danh sách cho phép. In plan của các câu lệnh đó
+// ra out (verbose: in tất cả).
+int db_check_query_plans(sqlite3* db, FILE* out, int verbose) {
+    int bad = 0;
+    for (int id = 0; id < STMT_COUNT; id++) {
+        char sql[2048];
+        snprintf(sql, sizeof(sql), "EXPLAIN QUERY PLAN %s", stmt_sql[id]);
+        sqlite3_stmt* stmt = NULL;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+            fprintf(out, "[%d] %s\n      cannot prepare: %s\n", id, stmt_sql[id], sqlite3_errmsg(db));
+            sqlite3_finalize(stmt);
+            bad++;
+            continue;
+        }
+        char plan[2048] = "";
+        size_t used = 0;
+        int scans = 0;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* detail = (const char*)sqlite3_column_text(stmt, 3);
+            if (!detail) continue;
+            int scan = strncmp(detail, "SCAN ", 5) == 0 && strcmp(detail, "SCAN CONSTANT ROW") != 0;
+            scans += scan;
+            if (used < sizeof(plan)) {
+                used += snprintf(plan + used, sizeof(plan) - used, "      %s%s\n", detail,
+                                 scan && !stmt_full_scan_ok((DbStmtId)id) ? "   <-- full scan" : "");
+            }
+        }
+        sqlite3_finalize(stmt);
+        int failed = scans && !stmt_full_scan_ok((DbStmtId)id);
+        if (failed || verbose) fprintf(out, "[%d] %s\n%s", id, stmt_sql[id], plan);
+        bad += failed;
+    }
+    return bad;
+}
+
 // Hàm db_close từ Ngày 1
 void db_close(sqlite3 *db) {
+    stmt_cache_close(db);
     sqlite3_close(db);
-    printf("Database connection closed.\n");
+    LOG_INFO("Database connection closed.");
 }
 
 // HÀM MỚI: Đăng ký
 int db_register_user(sqlite3 *db, const char* user, const char* pass) {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO users (username, password) VALUES (?, ?);";
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_REGISTER_USER);
     int rc;
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+    if (!stmt) {
         return 2; // Lỗi CSDL
     }
 
@@ -37,29 +542,26 @@ int db_register_user(sqlite3 *db, const char* user, const char* pass) {
 
     rc = sqlite3_step(stmt); // Thực thi
     if (rc == SQLITE_DONE) {
-        printf("User '%s' registered successfully.\n", user);
+        LOG_INFO("User '%s' registered successfully.", user);
         rc = 0; // Thành công
     } else if (rc == SQLITE_CONSTRAINT) {
-        fprintf(stderr, "User '%s' already exists.\n", user);
+        LOG_INFO("User '%s' already exists.", user);
         rc = 1; // User tồn tại (vi phạm UNIQUE)
     } else {
-        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        LOG_ERROR("SQL error: %s", sqlite3_errmsg(db));
         rc = 2; // Lỗi SQL khác
     }
 
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_REGISTER_USER, stmt);
     return rc;
 }
 
 // HÀM MỚI: Đăng nhập
 int db_login_user(sqlite3 *db, const char* user, const char* pass) {
-    sqlite3_stmt *stmt;
-    const char *sql = "SELECT password FROM users WHERE username = ?;";
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_LOGIN_USER);
     int rc;
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+    if (!stmt) {
         return 2; // Lỗi CSDL
     }
 
@@ -69,119 +571,258 @@ int db_login_user(sqlite3 *db, const char* user, const char* pass) {
     if (rc == SQLITE_ROW) { // Tìm thấy user
         const char *db_pass = (const char*)sqlite3_column_text(stmt, 0);
         if (strcmp(pass, db_pass) == 0) {
-            printf("User '%s' logged in successfully.\n", user);
+            LOG_DEBUG("User '%s' logged in successfully.", user);
             rc = 0; // Thành công
         } else {
-            printf("User '%s' provided wrong password.\n", user);
+            LOG_DEBUG("User '%s' provided wrong password.", user);
             rc = 1; // Sai mật khẩu
         }
     } else if (rc == SQLITE_DONE) { // Không tìm thấy user
-        printf("User '%s' not found.\n", user);
+        LOG_DEBUG("User '%s' not found.", user);
         rc = 1; // User không tồn tại
     } else {
-        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+        LOG_ERROR("SQL error: %s", sqlite3_errmsg(db));
         rc = 2; // Lỗi SQL khác
     }
 
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_LOGIN_USER, stmt);
     return rc;
 }
 
 // HÀM MỚI: Lưu tin nhắn offline
 int db_store_offline_message(sqlite3 *db, const char* from, const char* to, const char* msg) {
-    sqlite3_stmt *stmt;
-    const char *sql = "INSERT INTO offline_messages (from_user, to_user, message) VALUES (?, ?, ?);";
-    
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_STORE_OFFLINE);
+    if (!stmt) {
         return 1;
     }
 
-    sqlite3_bind_text(stmt, 1, from, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, to, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, msg, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 1, msg, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, from, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, to, -1, SQLITE_STATIC);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        fprintf(stderr, "SQL error storing offline message: %s\n", sqlite3_errmsg(db));
-        sqlite3_finalize(stmt);
+        LOG_ERROR("SQL error storing offline message: %s", sqlite3_errmsg(db));
+        db_stmt_release(db, STMT_STORE_OFFLINE, stmt);
+        return 1;
+    }
+    if (sqlite3_changes(db) == 0) {
+        LOG_WARN("Offline message from '%s' to unknown user '%s' dropped.", from, to);
+        db_stmt_release(db, STMT_STORE_OFFLINE, stmt);
         return 1;
     }
 
-    printf("Stored offline message from '%s' to '%s'\n", from, to);
-    sqlite3_finalize(stmt);
+    LOG_DEBUG("Stored offline message from '%s' to '%s'", from, to);
+    db_stmt_release(db, STMT_STORE_OFFLINE, stmt);
     return 0;
 }
 
-// HÀM MỚI: Gửi tin nhắn đang chờ (phức tạp hơn)
-int db_send_pending_messages(sqlite3 *db, const char* user, void (*callback)(void*, ChatPacket*), void* arg) {
-    sqlite3_stmt *stmt_select, *stmt_delete;
-    const char *sql_select = "SELECT from_user, message FROM offline_messages WHERE to_user = ? ORDER BY timestamp ASC;";
-    const char *sql_delete = "DELETE FROM offline_messages WHERE to_user = ?;";
+// Đọc tối đa limit tin nhắn offline có id > after_id theo thứ tự lưu; không xóa
+// (xem db_delete_pending_messages). Trả về số tin đã đọc qua *count.
+int db_get_pending_messages(sqlite3 *db, UserId user, sqlite3_int64 after_id, int limit,
+                            void (*callback)(void*, ChatPacket*), void* arg, sqlite3_int64* last_id, int* count) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_SELECT_PENDING);
+    if (!stmt) {
+        return 1;
+    }
+    sqlite3_bind_int64(stmt, 1, user);
+    sqlite3_bind_int64(stmt, 2, after_id);
+    sqlite3_bind_int(stmt, 3, limit);
+
     int rc;
+    int n = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *from_user = (const char*)sqlite3_column_text(stmt, 1);
+        const char *message = (const char*)sqlite3_column_text(stmt, 2);
 
-    // 1. Chuẩn bị câu lệnh SELECT
-    rc = sqlite3_prepare_v2(db, sql_select, -1, &stmt_select, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare select pending: %s\n", sqlite3_errmsg(db));
+        ChatPacket packet;
+        memset(&packet, 0, sizeof(ChatPacket));
+        packet.type = MSG_TYPE_SEND_OFFLINE_MSG;
+        strncpy(packet.source_user, from_user, sizeof(packet.source_user) - 1);
+        packet.source_user[sizeof(packet.source_user) - 1] = '\0';
+        strncpy(packet.body, message, sizeof(packet.body) - 1);
+        packet.body[sizeof(packet.body) - 1] = '\0';
+
+        callback(arg, &packet);
+        if (last_id) *last_id = sqlite3_column_int64(stmt, 0);
+        n++;
+    }
+    if (count) *count = n;
+    db_stmt_release(db, STMT_SELECT_PENDING, stmt);
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to read pending messages: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    return 0;
+}
+
+// Xóa các tin nhắn offline đã giao (id <= up_to_id); tin lưu sau đó vẫn được giữ
+int db_delete_pending_messages(sqlite3 *db, UserId user, sqlite3_int64 up_to_id) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_DELETE_PENDING);
+    if (!stmt) {
+        return 1;
+    }
+    sqlite3_bind_int64(stmt, 1, user);
+    sqlite3_bind_int64(stmt, 2, up_to_id);
+
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(db, STMT_DELETE_PENDING, stmt);
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to delete pending messages: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    LOG_DEBUG("Cleared pending messages for user id %u", user);
+    return 0;
+}
+
+// ----- Log tin nhắn group (fan-out khi đọc) -----
+
+// Lưu 1 bản tin cho group; thành viên offline đọc qua con trỏ của mình lúc login.
+// Id của dòng mới vào *id_out (nếu khác NULL).
+int db_append_group_message(sqlite3 *db, const char* group_name, UserId from, const char* msg,
+                            sqlite3_int64* id_out) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_APPEND_GROUP_MSG);
+    if (!stmt) {
         return 1;
     }
-    sqlite3_bind_text(stmt_select, 1, user, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, from);
+    sqlite3_bind_text(stmt, 2, msg, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, group_name, -1, SQLITE_STATIC);
 
-    // 2. Lặp qua từng tin nhắn và gửi đi
-    while ((rc = sqlite3_step(stmt_select)) == SQLITE_ROW) {
-        const char *from_user = (const char*)sqlite3_column_text(stmt_select, 0);
-        const char *message = (const char*)sqlite3_column_text(stmt_select, 1);
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(db, STMT_APPEND_GROUP_MSG, stmt);
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("SQL error storing group message: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    if (id_out) *id_out = sqlite3_last_insert_rowid(db);
+    return 0;
+}
+
+// Đọc tối đa limit tin group chưa đọc của user có after_id < id <= up_to_id (bỏ tin do chính user gửi)
+int db_get_pending_group_messages(sqlite3 *db, UserId user, sqlite3_int64 after_id, sqlite3_int64 up_to_id,
+                                  int limit, void (*callback)(void*, ChatPacket*), void* arg,
+                                  sqlite3_int64* last_id, int* count) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_SELECT_GROUP_PENDING);
+    if (!stmt) {
+        return 1;
+    }
+    sqlite3_bind_int64(stmt, 1, user);
+    sqlite3_bind_int64(stmt, 2, after_id);
+    sqlite3_bind_int64(stmt, 3, up_to_id);
+    sqlite3_bind_int(stmt, 4, limit);
+
+    int rc;
+    int n = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char *group_name = (const char*)sqlite3_column_text(stmt, 1);
+        const char *from_user = (const char*)sqlite3_column_text(stmt, 2);
+        const char *message = (const char*)sqlite3_column_text(stmt, 3);
 
         ChatPacket packet;
         memset(&packet, 0, sizeof(ChatPacket));
-        packet.type = MSG_TYPE_SEND_OFFLINE_MSG;
-        strncpy(packet.source_user, from_user, MAX_USERNAME);
-        strncpy(packet.body, message, MAX_BODY);
+        packet.type = MSG_TYPE_RECEIVE_GROUP_MESSAGE;
+        strncpy(packet.source_user, from_user, sizeof(packet.source_user) - 1);
+        packet.source_user[sizeof(packet.source_user) - 1] = '\0';
+        strncpy(packet.target_user, group_name, sizeof(packet.target_user) - 1);
+        packet.target_user[sizeof(packet.target_user) - 1] = '\0';
+        strncpy(packet.body, message, sizeof(packet.body) - 1);
+        packet.body[sizeof(packet.body) - 1] = '\0';
 
-        // Gọi callback để gửi packet (chính là gửi qua socket)
         callback(arg, &packet);
+        if (last_id) *last_id = sqlite3_column_int64(stmt, 0);
+        n++;
     }
-    sqlite3_finalize(stmt_select);
+    if (count) *count = n;
+    db_stmt_release(db, STMT_SELECT_GROUP_PENDING, stmt);
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to read pending group messages: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    return 0;
+}
 
-    // 3. Chuẩn bị câu lệnh DELETE (Xóa tất cả tin nhắn đã gửi)
-    rc = sqlite3_prepare_v2(db, sql_delete, -1, &stmt_delete, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare delete pending: %s\n", sqlite3_errmsg(db));
+// id lớn nhất trong log (0 nếu rỗng)
+sqlite3_int64 db_get_group_log_head(sqlite3 *db) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_GROUP_LOG_HEAD);
+    if (!stmt) return 0;
+    sqlite3_int64 head = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW) head = sqlite3_column_int64(stmt, 0);
+    db_stmt_release(db, STMT_GROUP_LOG_HEAD, stmt);
+    return head;
+}
+
+// Số tin offline đang chờ (chưa được xác nhận) và số tin trong log group; đếm cả bảng nên chỉ
+// dùng cho số liệu (cổng quản trị), chạy trên thread DB
+int db_get_offline_backlog(sqlite3 *db, sqlite3_int64* private_count, sqlite3_int64* group_count) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_OFFLINE_BACKLOG);
+    if (!stmt) return 1;
+    int rc = 1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        *private_count = sqlite3_column_int64(stmt, 0);
+        *group_count = sqlite3_column_int64(stmt, 1);
+        rc = 0;
+    }
+    db_stmt_release(db, STMT_OFFLINE_BACKLOG, stmt);
+    return rc;
+}
+
+// Dời con trỏ đọc của user trong mọi group tới up_to_id (không lùi lại)
+int db_advance_group_cursors(sqlite3 *db, UserId user, sqlite3_int64 up_to_id) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_ADVANCE_GROUP_CURSORS);
+    if (!stmt) {
         return 1;
     }
-    sqlite3_bind_text(stmt_delete, 1, user, -1, SQLITE_STATIC);
-    
-    rc = sqlite3_step(stmt_delete);
+    sqlite3_bind_int64(stmt, 1, up_to_id);
+    sqlite3_bind_int64(stmt, 2, user);
+    sqlite3_bind_int64(stmt, 3, up_to_id);
+
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(db, STMT_ADVANCE_GROUP_CURSORS, stmt);
     if (rc != SQLITE_DONE) {
-        fprintf(stderr, "Failed to delete pending messages: %s\n", sqlite3_errmsg(db));
-    } else {
-        printf("Cleared pending messages for user '%s'\n", user);
+        LOG_ERROR("Failed to advance group cursors: %s", sqlite3_errmsg(db));
+        return 1;
+    }
+    return 0;
+}
+
+// Xóa các tin group mà mọi thành viên đã đọc qua, trong các group của user
+int db_prune_group_messages(sqlite3 *db, UserId user) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_PRUNE_GROUP_LOG);
+    if (!stmt) {
+        return 1;
     }
-    sqlite3_finalize(stmt_delete);
+    sqlite3_bind_int64(stmt, 1, user);
 
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(db, STMT_PRUNE_GROUP_LOG, stmt);
+    if (rc != SQLITE_DONE) {
+        LOG_ERROR("Failed to prune group messages: %s", sqlite3_errmsg(db));
+        return 1;
+    }
     return 0;
 }
 
-// Check whether a user exists in the users table.
-// Returns 1 if exists, 0 otherwise.
-int db_user_exists(sqlite3* db, const char* username) {
+// Id của user (users.id), 0 nếu không tồn tại
+UserId db_get_user_id(sqlite3* db, const char* username) {
     if (!db || !username) return 0;
-    const char *sql = "SELECT 1 FROM users WHERE username = ? LIMIT 1;";
-    sqlite3_stmt *stmt = NULL;
-    int exists = 0;
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_USER_ID);
+    UserId id = 0;
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+    if (!stmt) {
         return 0;
     }
 
     sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
-    int rc = sqlite3_step(stmt);
-    if (rc == SQLITE_ROW) exists = 1;
-    sqlite3_finalize(stmt);
-    return exists;
+    if (sqlite3_step(stmt) == SQLITE_ROW) id = (UserId)sqlite3_column_int64(stmt, 0);
+    db_stmt_release(db, STMT_USER_ID, stmt);
+    return id;
+}
+
+// Check whether a user exists in the users table.
+// Returns 1 if exists, 0 otherwise.
+int db_user_exists(sqlite3* db, const char* username) {
+    return db_get_user_id(db, username) != 0;
 }
 
 // Adapter for old name: delegate to db_login_user if available.
@@ -192,21 +833,17 @@ int db_authenticate_user(sqlite3* db, const char* username, const char* password
     return 0; // any non-zero = failure
 }
 
-int db_friend_request(sqlite3 *db, const char* sender, const char* receiver) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "INSERT INTO friends (user_a, user_b, status) VALUES (?, ?, 0);";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare friend_request: %s\n", sqlite3_errmsg(db));
-        if (stmt) sqlite3_finalize(stmt);
+int db_friend_request(sqlite3 *db, UserId sender, UserId receiver) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_FRIEND_REQUEST);
+    if (!stmt) {
         return 1;
     }
 
-    sqlite3_bind_text(stmt, 1, sender, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, receiver, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, sender);
+    sqlite3_bind_int64(stmt, 2, receiver);
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(db, STMT_FRIEND_REQUEST, stmt);
 
     if (rc == SQLITE_DONE) {
         return 0;
@@ -214,264 +851,227 @@ int db_friend_request(sqlite3 *db, const char* sender, const char* receiver) {
         // already exists or violates constraint
         return 1;
     } else {
-        fprintf(stderr, "SQL error in friend_request: %s\n", sqlite3_errmsg(db));
+        LOG_ERROR("SQL error in friend_request: %s", sqlite3_errmsg(db));
         return 1;
     }
 }
 
 // (MỚI) Chấp nhận (status = 1)
-int db_friend_accept(sqlite3 *db, const char* accepter, const char* sender) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "UPDATE friends SET status = 1 WHERE user_a = ? AND user_b = ? AND status = 0;";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare friend_accept: %s\n", sqlite3_errmsg(db));
-        if (stmt) sqlite3_finalize(stmt);
+int db_friend_accept(sqlite3 *db, UserId accepter, UserId sender) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_FRIEND_ACCEPT);
+    if (!stmt) {
         return 1;
     }
-    sqlite3_bind_text(stmt, 1, sender, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, accepter, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, sender);
+    sqlite3_bind_int64(stmt, 2, accepter);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     int changes = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_FRIEND_ACCEPT, stmt);
 
     return (rc == SQLITE_DONE && changes > 0) ? 0 : 1;
 }
 
 // (MỚI) Từ chối hoặc Hủy bạn
-int db_friend_decline(sqlite3 *db, const char* decliner, const char* sender) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "DELETE FROM friends WHERE user_a = ? AND user_b = ? AND status = 0;";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare friend_decline: %s\n", sqlite3_errmsg(db));
-        if (stmt) sqlite3_finalize(stmt);
+int db_friend_decline(sqlite3 *db, UserId decliner, UserId sender) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_FRIEND_DECLINE);
+    if (!stmt) {
         return 1;
     }
-    sqlite3_bind_text(stmt, 1, sender, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, decliner, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, sender);
+    sqlite3_bind_int64(stmt, 2, decliner);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     int changes = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_FRIEND_DECLINE, stmt);
 
     return (rc == SQLITE_DONE && changes > 0) ? 0 : 1;
 }
 
-int db_friend_unfriend(sqlite3 *db, const char* user1, const char* user2) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "DELETE FROM friends WHERE status = 1 AND ((user_a = ? AND user_b = ?) OR (user_a = ? AND user_b = ?));";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare friend_unfriend: %s\n", sqlite3_errmsg(db));
-        if (stmt) sqlite3_finalize(stmt);
+int db_friend_unfriend(sqlite3 *db, UserId user1, UserId user2) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_FRIEND_UNFRIEND);
+    if (!stmt) {
         return 1;
     }
-    sqlite3_bind_text(stmt, 1, user1, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, user2, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 3, user2, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 4, user1, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, user1);
+    sqlite3_bind_int64(stmt, 2, user2);
+    sqlite3_bind_int64(stmt, 3, user2);
+    sqlite3_bind_int64(stmt, 4, user1);
 
-    rc = sqlite3_step(stmt);
+    int rc = sqlite3_step(stmt);
     int changes = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_FRIEND_UNFRIEND, stmt);
 
     return (rc == SQLITE_DONE && changes > 0) ? 0 : 1;
 }
 
 // (MỚI) Lấy danh sách bạn bè (status = 1)
-int db_get_friend_list(sqlite3 *db, const char* user, db_friend_list_callback callback, void* arg) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT user_b FROM friends WHERE user_a = ? AND status = 1 "
-                      "UNION "
-                      "SELECT user_a FROM friends WHERE user_b = ? AND status = 1;";
-    
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare get_friend_list: %s\n", sqlite3_errmsg(db));
-        if (stmt) sqlite3_finalize(stmt);
+int db_get_friend_list(sqlite3 *db, UserId user, db_user_callback callback, void* arg) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_FRIEND_LIST);
+    if (!stmt) {
         return 1;
     }
 
-    sqlite3_bind_text(stmt, 1, user, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, user, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, user);
+    sqlite3_bind_int64(stmt, 2, user);
 
+    int rc;
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        const char *friend_name = (const char*)sqlite3_column_text(stmt, 0);
-        callback(arg, friend_name); // Gọi callback cho mỗi người bạn
+        UserId friend_id = (UserId)sqlite3_column_int64(stmt, 0);
+        const char *friend_name = (const char*)sqlite3_column_text(stmt, 1);
+        callback(arg, friend_id, friend_name); // Gọi callback cho mỗi người bạn
     }
     
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_FRIEND_LIST, stmt);
     return 0;
 }
 
 // --- NEW: Group DB functions ---
 
-int db_create_group(sqlite3 *db, const char* group_name, const char* owner) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "INSERT INTO groups (group_name, owner_username) VALUES (?, ?);";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        fprintf(stderr, "Failed to prepare create_group: %s\n", sqlite3_errmsg(db));
-        if (stmt) sqlite3_finalize(stmt);
+int db_create_group(sqlite3 *db, const char* group_name, UserId owner) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_CREATE_GROUP);
+    if (!stmt) {
         return 1;
     }
     sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, owner, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_bind_int64(stmt, 2, owner);
+    int rc = sqlite3_step(stmt);
+    db_stmt_release(db, STMT_CREATE_GROUP, stmt);
     if (rc == SQLITE_DONE) return 0;
-    fprintf(stderr, "SQL error create_group: %s\n", sqlite3_errmsg(db));
+    LOG_ERROR("SQL error create_group: %s", sqlite3_errmsg(db));
     return 1;
 }
 
 int db_group_exists(sqlite3 *db, const char* group_name) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT 1 FROM groups WHERE group_name = ? LIMIT 1;";
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_GROUP_EXISTS);
     int exists = 0;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+    if (!stmt) {
         return 0;
     }
     sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
     int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW) exists = 1;
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_GROUP_EXISTS, stmt);
     return exists;
 }
 
-int db_add_group_member(sqlite3 *db, const char* group_name, const char* username) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql_group_id = "SELECT group_id FROM groups WHERE group_name = ? LIMIT 1;";
-    int rc = sqlite3_prepare_v2(db, sql_group_id, -1, &stmt, 0);
-    if (rc != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 1; }
-    sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) { sqlite3_finalize(stmt); return 1; }
-    int group_id = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-
-    const char *sql = "INSERT INTO group_members (group_id, username) VALUES (?, ?);";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 1; }
-    sqlite3_bind_int(stmt, 1, group_id);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    return (rc == SQLITE_DONE) ? 0 : 1;
+// group_id lấy ngay trong câu lệnh (subquery theo group_name), không cần SELECT riêng
+int db_add_group_member(sqlite3 *db, const char* group_name, UserId user) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_ADD_GROUP_MEMBER);
+    if (!stmt) return 1;
+    sqlite3_bind_int64(stmt, 1, user);
+    sqlite3_bind_text(stmt, 2, group_name, -1, SQLITE_STATIC);
+    int rc = sqlite3_step(stmt);
+    int changes = sqlite3_changes(db);
+    db_stmt_release(db, STMT_ADD_GROUP_MEMBER, stmt);
+    return (rc == SQLITE_DONE && changes > 0) ? 0 : 1;
 }
 
-int db_remove_group_member(sqlite3 *db, const char* group_name, const char* username) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql_group_id = "SELECT group_id FROM groups WHERE group_name = ? LIMIT 1;";
-    int rc = sqlite3_prepare_v2(db, sql_group_id, -1, &stmt, 0);
-    if (rc != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 1; }
+int db_remove_group_member(sqlite3 *db, const char* group_name, UserId user) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_REMOVE_GROUP_MEMBER);
+    if (!stmt) return 1;
     sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) { sqlite3_finalize(stmt); return 1; }
-    int group_id = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-
-    const char *sql = "DELETE FROM group_members WHERE group_id = ? AND username = ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, 0) != SQLITE_OK) { if (stmt) sqlite3_finalize(stmt); return 1; }
-    sqlite3_bind_int(stmt, 1, group_id);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_STATIC);
-    rc = sqlite3_step(stmt);
+    sqlite3_bind_int64(stmt, 2, user);
+    int rc = sqlite3_step(stmt);
     int changes = sqlite3_changes(db);
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_REMOVE_GROUP_MEMBER, stmt);
     return (rc == SQLITE_DONE && changes > 0) ? 0 : 1;
 }
 
-int db_is_group_owner(sqlite3 *db, const char* group_name, const char* username) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT 1 FROM groups WHERE group_name = ? AND owner_username = ? LIMIT 1;";
+int db_is_group_owner(sqlite3 *db, const char* group_name, UserId user) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_IS_GROUP_OWNER);
     int is_owner = 0;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+    if (!stmt) {
         return 0;
     }
     sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, user);
     int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW) is_owner = 1;
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_IS_GROUP_OWNER, stmt);
     return is_owner;
 }
 
-int db_get_group_members(sqlite3 *db, const char* group_name, db_group_member_callback callback, void* arg) {
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT gm.username FROM group_members gm "
-                      "JOIN groups g ON g.group_id = gm.group_id "
-                      "WHERE g.group_name = ?;";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, 0);
-    if (rc != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+// Id của owner vào *owner_out. Returns 0 if group exists, 1 if not, -1 on DB error.
+int db_get_group_owner(sqlite3 *db, const char* group_name, UserId* owner_out) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_GROUP_OWNER);
+    int rc = -1;
+    if (!stmt) {
+        return -1;
+    }
+    sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
+    int step = sqlite3_step(stmt);
+    if (step == SQLITE_ROW) {
+        *owner_out = (UserId)sqlite3_column_int64(stmt, 0);
+        rc = 0;
+    } else if (step == SQLITE_DONE) {
+        rc = 1;
+    }
+    db_stmt_release(db, STMT_GROUP_OWNER, stmt);
+    return rc;
+}
+
+int db_get_group_members(sqlite3 *db, const char* group_name, db_user_callback callback, void* arg) {
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_GROUP_MEMBERS);
+    if (!stmt) {
         return 1;
     }
     sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
+    int rc;
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        const char *member = (const char*)sqlite3_column_text(stmt, 0);
-        callback(arg, member);
+        UserId member_id = (UserId)sqlite3_column_int64(stmt, 0);
+        const char *member = (const char*)sqlite3_column_text(stmt, 1);
+        callback(arg, member_id, member);
     }
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_GROUP_MEMBERS, stmt);
     return 0;
 }
 
 // --- NEW: Group listing helpers ---
 
-int db_get_groups_for_user(sqlite3 *db, const char* username, db_group_list_callback callback, void* arg) {
-    if (!db || !username || !callback) return 1;
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT g.group_name FROM groups g "
-                      "JOIN group_members gm ON g.group_id = gm.group_id "
-                      "WHERE gm.username = ?;";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+int db_get_groups_for_user(sqlite3 *db, UserId user, db_group_list_callback callback, void* arg) {
+    if (!db || !user || !callback) return 1;
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_GROUPS_FOR_USER);
+    if (!stmt) {
         return 1;
     }
-    sqlite3_bind_text(stmt, 1, username, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, user);
+    int rc;
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
         const char *gname = (const char*)sqlite3_column_text(stmt, 0);
         callback(arg, gname);
     }
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_GROUPS_FOR_USER, stmt);
     return 0;
 }
 
 int db_get_all_groups(sqlite3 *db, db_group_list_callback callback, void* arg) {
     if (!db || !callback) return 1;
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT group_name FROM groups;";
-    int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_ALL_GROUPS);
+    if (!stmt) {
         return 1;
     }
+    int rc;
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
         const char *gname = (const char*)sqlite3_column_text(stmt, 0);
         callback(arg, gname);
     }
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_ALL_GROUPS, stmt);
     return 0;
 }
 
 // --- NEW: Check if a user is a member of a group ---
-int db_is_group_member(sqlite3 *db, const char* group_name, const char* username) {
-    if (!db || !group_name || !username) return 0;
-    sqlite3_stmt *stmt = NULL;
-    const char *sql = "SELECT 1 FROM group_members gm "
-                      "JOIN groups g ON g.group_id = gm.group_id "
-                      "WHERE g.group_name = ? AND gm.username = ? LIMIT 1;";
+int db_is_group_member(sqlite3 *db, const char* group_name, UserId user) {
+    if (!db || !group_name || !user) return 0;
+    sqlite3_stmt *stmt = db_stmt_acquire(db, STMT_IS_GROUP_MEMBER);
     int is_member = 0;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
-        if (stmt) sqlite3_finalize(stmt);
+    if (!stmt) {
         return 0;
     }
     sqlite3_bind_text(stmt, 1, group_name, -1, SQLITE_STATIC);
-    sqlite3_bind_text(stmt, 2, username, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, user);
     int rc = sqlite3_step(stmt);
     if (rc == SQLITE_ROW) is_member = 1;
-    sqlite3_finalize(stmt);
+    db_stmt_release(db, STMT_IS_GROUP_MEMBER, stmt);
     return is_member;
-}
\ No newline at end of file
+}
@@ -1,12 +1,20 @@
 #ifndef DB_HANDLER_H
 #define DB_HANDLER_H
 #include "server.h"
+#include "user_ids.h"
+#include <stdio.h>
 #include <sqlite3.h>
 #include "../shared/protocol.h"
 
-// Mở và đóng database
+// Mở (tạo / nâng cấp schema bằng migration nếu cần) và đóng database
 int db_open(const char* db_path, sqlite3** db);
 void db_close(sqlite3* db);
+// EXPLAIN QUERY PLAN các câu lệnh của db_handler; trả về số câu lệnh quét cả bảng
+int db_check_query_plans(sqlite3* db, FILE* out, int verbose);
+// Số liệu theo câu lệnh (cộng mọi kết nối): số lần chạy, tổng thời gian ns
+int db_stmt_count(void);
+const char* db_stmt_name(int id);
+void db_stmt_stats(int id, uint64_t* calls, uint64_t* total_ns);
 
 // Xử lý đăng ký và xác thực
 void handle_register(int client_fd, ChatPacket* packet, sqlite3* db);
@@ -14,39 +22,55 @@ int db_authenticate_user(sqlite3* db, const char* username, const char* password
 int db_register_user(sqlite3* db, const char* username, const char* password);
 int db_login_user(sqlite3* db, const char* username, const char* password);
 int db_user_exists(sqlite3* db, const char* username); // Kiểm tra sự tồn tại của người dùng
+UserId db_get_user_id(sqlite3* db, const char* username); // users.id, 0 nếu không tồn tại
 
-// Xử lý tin nhắn offline
+// Các bảng khóa user bằng users.id. Hàm nhận UserId khi caller đã biết id (session, cache);
+// nhận username khi tên đến thẳng từ packet (đổi sang id ngay trong câu lệnh SQL).
+// Callback trả về cả id lẫn tên để cache intern (xem user_ids.h).
+typedef void (*db_user_callback)(void* arg, UserId id, const char* username);
+
+// Xử lý tin nhắn offline (người nhận không tồn tại -> không lưu, trả về 1)
 int db_store_offline_message(sqlite3* db, const char* sender, const char* receiver, const char* message);
-int db_send_pending_messages(sqlite3* db, const char* user, void (*callback)(void* arg, ChatPacket* packet), void* arg);
+int db_get_pending_messages(sqlite3* db, UserId user, sqlite3_int64 after_id, int limit,
+                            void (*callback)(void* arg, ChatPacket* packet), void* arg,
+                            sqlite3_int64* last_id, int* count);
+int db_delete_pending_messages(sqlite3* db, UserId user, sqlite3_int64 up_to_id);
 
 // friend 
-int db_friend_request(sqlite3 *db, const char* sender, const char* receiver);
-int db_friend_accept(sqlite3 *db, const char* accepter, const char* sender);
-int db_friend_decline(sqlite3 *db, const char* decliner, const char* sender);
-int db_friend_unfriend(sqlite3 *db, const char* user1, const char* user2);
+int db_friend_request(sqlite3 *db, UserId sender, UserId receiver);
+int db_friend_accept(sqlite3 *db, UserId accepter, UserId sender);
+int db_friend_decline(sqlite3 *db, UserId decliner, UserId sender);
+int db_friend_unfriend(sqlite3 *db, UserId user1, UserId user2);
 
-// Hàm callback để xử lý từng dòng kết quả
-typedef int (*db_friend_list_callback)(void* arg, const char* friend_name);
-int db_get_friend_list(sqlite3 *db, const char* user, db_friend_list_callback callback, void* arg);
+// Gọi callback cho từng người bạn (status = 1)
+int db_get_friend_list(sqlite3 *db, UserId user, db_user_callback callback, void* arg);
 
 // --- NEW: Group DB APIs ---
-int db_create_group(sqlite3 *db, const char* group_name, const char* owner);
+int db_create_group(sqlite3 *db, const char* group_name, UserId owner);
 int db_group_exists(sqlite3 *db, const char* group_name);
-int db_add_group_member(sqlite3 *db, const char* group_name, const char* username);
-int db_remove_group_member(sqlite3 *db, const char* group_name, const char* username);
-int db_is_group_owner(sqlite3 *db, const char* group_name, const char* username);
-/**
- * callback signature: void cb(void* arg, const char* member_name)
- */
-typedef void (*db_group_member_callback)(void* arg, const char* member_name);
-int db_get_group_members(sqlite3 *db, const char* group_name, db_group_member_callback callback, void* arg);
+int db_add_group_member(sqlite3 *db, const char* group_name, UserId user);
+int db_remove_group_member(sqlite3 *db, const char* group_name, UserId user);
+int db_is_group_owner(sqlite3 *db, const char* group_name, UserId user);
+int db_get_group_owner(sqlite3 *db, const char* group_name, UserId* owner_out); // 0 = found, 1 = not found, -1 = DB error
+int db_get_group_members(sqlite3 *db, const char* group_name, db_user_callback callback, void* arg);
 
 // NEW: list groups a user has joined / list all groups
 typedef int (*db_group_list_callback)(void* arg, const char* group_name);
-int db_get_groups_for_user(sqlite3 *db, const char* username, db_group_list_callback callback, void* arg);
+int db_get_groups_for_user(sqlite3 *db, UserId user, db_group_list_callback callback, void* arg);
 int db_get_all_groups(sqlite3 *db, db_group_list_callback callback, void* arg);
 
 // NEW: check membership
-int db_is_group_member(sqlite3 *db, const char* group_name, const char* username);
+int db_is_group_member(sqlite3 *db, const char* group_name, UserId user);
+
+// Log tin nhắn group: lưu 1 lần, mỗi thành viên đọc theo con trỏ last_read_id
+int db_append_group_message(sqlite3 *db, const char* group_name, UserId from, const char* msg,
+                            sqlite3_int64* id_out);
+int db_get_pending_group_messages(sqlite3 *db, UserId user, sqlite3_int64 after_id, sqlite3_int64 up_to_id,
+                                  int limit, void (*callback)(void* arg, ChatPacket* packet), void* arg,
+                                  sqlite3_int64* last_id, int* count);
+sqlite3_int64 db_get_group_log_head(sqlite3 *db);
+int db_advance_group_cursors(sqlite3 *db, UserId user, sqlite3_int64 up_to_id);
+int db_prune_group_messages(sqlite3 *db, UserId user);
+int db_get_offline_backlog(sqlite3 *db, sqlite3_int64* private_count, sqlite3_int64* group_count);
 
 #endif // DB_HANDLER_H
\ No newline at end of file
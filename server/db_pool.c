@@ -0,0 +1,343 @@
+#include "db_pool.h"
+#include "db_handler.h"
+#include "name_set.h"
+#include "server.h"
+#include "metrics.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct {
+    pthread_t thread;
+    sqlite3* db;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    DbJob* head;
+    DbJob* tail;
+    int stop;
+    unsigned long jobs;         // writer: số job ghi / số transaction đã chạy
+    unsigned long commits;
+} DbWorker;
+
+static DbWorker workers[DB_POOL_MAX_WORKERS];
+static int worker_count = 0;
+static DbWorker writer;
+static int writer_running = 0;
+
+// Chờ và lấy cả hàng đợi 1 lần: reactor gửi thêm job không phải chờ lô này chạy xong.
+// NULL khi worker được yêu cầu dừng và hàng đợi đã rỗng.
+static DbJob* take_jobs(DbWorker* w) {
+    pthread_mutex_lock(&w->lock);
+    while (!w->head && !w->stop) pthread_cond_wait(&w->cond, &w->lock);
+    DbJob* job = w->head;
+    w->head = w->tail = NULL;
+    pthread_mutex_unlock(&w->lock);
+    return job;
+}
+
+static void finish_job(DbJob* job) {
+    if (job->done && job->reactor) {
+        server_post_db_completion(job->reactor, job);
+        return;
+    }
+    if (!job->done) free(job->arg);
+    free(job);
+}
+
+static void* worker_loop(void* arg) {
+    DbWorker* w = (DbWorker*)arg;
+    DbJob* job;
+    char name[16];
+    snprintf(name, sizeof(name), "db %d", (int)(w - workers));
+    log_set_thread_name(name);
+    while ((job = take_jobs(w)) != NULL) {
+        while (job) {
+            DbJob* next = job->next;
+            job->next = NULL;
+            uint64_t start = metrics_now();
+            job->work(w->db, job->arg);
+            metrics_record_db(job->msg_type, start);
+            finish_job(job);
+            job = next;
+        }
+    }
+    return NULL;
+}
+
+// Chạy tối đa DB_WRITE_BATCH_MAX job đầu danh sách trong 1 transaction rồi mới báo done;
+// trả về phần còn lại của danh sách
+static DbJob* run_write_batch(DbWorker* w, DbJob* job) {
+    DbJob* batch = job;
+    int n = 0;
+    int in_txn = sqlite3_exec(w->db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) == SQLITE_OK;
+    if (!in_txn) {
+        // Không lấy được khóa ghi (vd. tiến trình khác giữ DB quá busy timeout): mỗi câu lệnh
+        // tự commit như trước và tự báo lỗi của nó
+        LOG_WARN("DB writer: BEGIN failed (%s); writing without a batch.", sqlite3_errmsg(w->db));
+    }
+    for (; job && n < DB_WRITE_BATCH_MAX; job = job->next, n++) {
+        uint64_t start = metrics_now();
+        job->work(w->db, job->arg);
+        metrics_record_db(job->msg_type, start);
+    }
+    uint64_t commit_start = metrics_now();
+    int status = SQLITE_OK;
+    if (in_txn && (status = sqlite3_exec(w->db, "COMMIT;", NULL, NULL, NULL)) != SQLITE_OK) {
+        LOG_ERROR("DB writer: COMMIT of %d write(s) failed: %s", n, sqlite3_errmsg(w->db));
+        sqlite3_exec(w->db, "ROLLBACK;", NULL, NULL, NULL);
+    }
+    if (in_txn) metrics_record_commit(commit_start);
+    w->jobs += (unsigned long)n;
+    w->commits++;
+
+    DbJob* it = batch;
+    for (int i = 0; i < n; i++, it = it->next) {
+        it->status = status;
+        // Không ai chờ kết quả (tin offline, tin group...): ghi lại riêng từng job, mỗi câu
+        // lệnh tự commit và tự báo lỗi của nó
+        if (status != SQLITE_OK && !it->done) {
+            it->work(w->db, it->arg);
+            it->status = SQLITE_OK;
+        }
+    }
+
+    // Chỉ báo done sau COMMIT
+    for (int i = 0; i < n; i++) {
+        DbJob* next = batch->next;
+        batch->next = NULL;
+        finish_job(batch);
+        batch = next;
+    }
+    return job;
+}
+
+static void* writer_loop(void* arg) {
+    DbWorker* w = (DbWorker*)arg;
+    DbJob* job;
+    log_set_thread_name("db writer");
+    // Trong lúc 1 lô đang fsync, job mới dồn lại trong hàng đợi và vào chung lô sau
+    while ((job = take_jobs(w)) != NULL) {
+        while (job) job = run_write_batch(w, job);
+    }
+    return NULL;
+}
+
+static int start_thread(DbWorker* w, const char* db_path, void* (*loop)(void*)) {
+    memset(w, 0, sizeof(DbWorker));
+    if (db_open(db_path, &w->db) != 0) return -1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, loop, w) != 0) {
+        LOG_ERROR("pthread_create() failed: %s", strerror(errno));
+        db_close(w->db);
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_thread(DbWorker* w) {
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int db_pool_start(const char* db_path, int count) {
+    if (count < 0) count = 0;
+    if (count > DB_POOL_MAX_WORKERS) count = DB_POOL_MAX_WORKERS;
+    for (int i = 0; i < count; i++) {
+        if (start_thread(&workers[i], db_path, worker_loop) != 0) return -1;
+        worker_count = i + 1;
+    }
+    if (count > 0) {
+        if (start_thread(&writer, db_path, writer_loop) != 0) return -1;
+        writer_running = 1;
+    }
+    return 0;
+}
+
+void db_pool_stop(void) {
+    for (int i = 0; i < worker_count; i++) stop_thread(&workers[i]);
+    if (writer_running) stop_thread(&writer);
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        db_close(workers[i].db);
+    }
+    worker_count = 0;
+    if (writer_running) {
+        pthread_join(writer.thread, NULL);
+        LOG_INFO("DB writer: %lu write(s) in %lu transaction(s).", writer.jobs, writer.commits);
+        db_close(writer.db);
+        writer_running = 0;
+    }
+}
+
+static int submit(int owner_fd, int flags, const char* key, db_job_fn work, db_done_fn done, void* arg) {
+    Reactor* r = current_reactor;
+    if (worker_count == 0) {
+        // Không có worker: chạy ngay trên reactor
+        if (!r) return -1;
+        uint64_t start = metrics_now();
+        work(r->db, arg);
+        metrics_record_db(metrics_current_type(), start);
+        if (done) done(r->db, arg, SQLITE_OK);
+        else free(arg);
+        return 0;
+    }
+
+    DbJob* job = malloc(sizeof(DbJob));
+    if (!job) return -1;
+    job->next = NULL;
+    job->reactor = done ? r : NULL;
+    job->work = work;
+    job->done = done;
+    job->arg = arg;
+    job->owner_fd = -1;
+    job->owner_gen = 0;
+    job->barrier = 0;
+    job->write = (flags & DB_JOB_WRITE) != 0;
+    job->msg_type = metrics_current_type();
+    job->status = SQLITE_OK;
+    ClientSession* owner = owner_fd >= 0 && done ? get_session(owner_fd) : NULL;
+    if (owner) {
+        job->owner_fd = owner_fd;
+        job->owner_gen = owner->gen;
+        owner->db_inflight++;
+        if (flags & DB_JOB_BARRIER) {
+            job->barrier = 1;
+            owner->db_barrier++;
+        }
+    }
+
+    DbWorker* w = job->write ? &writer : &workers[(key ? name_hash(key) : 0) % (uint32_t)worker_count];
+    pthread_mutex_lock(&w->lock);
+    if (w->tail) w->tail->next = job;
+    else w->head = job;
+    w->tail = job;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+int db_pool_submit(const char* key, db_job_fn work, db_done_fn done, void* arg) {
+    return submit(-1, 0, key, work, done, arg);
+}
+
+int db_pool_submit_write(db_job_fn work, db_done_fn done, void* arg) {
+    return submit(-1, DB_JOB_WRITE, NULL, work, done, arg);
+}
+
+int db_pool_submit_for(int owner_fd, int flags, const char* key, db_job_fn work, db_done_fn done, void* arg) {
+    return submit(owner_fd, flags, key, work, done, arg);
+}
+
+void db_pool_complete(DbJob* job, sqlite3* db) {
+    // Job gửi tiếp trong done (vd. trang tin offline sau login) tính cho loại packet ban đầu
+    int prev_type = metrics_current_type();
+    metrics_set_current_type(job->msg_type);
+    job->done(db, job->arg, job->status);
+    metrics_set_current_type(prev_type);
+    if (job->owner_fd >= 0) {
+        SessionRef ref = { job->owner_fd, job->owner_gen };
+        server_db_job_finished(ref, job->barrier);
+    }
+    free(job);
+}
+
+// ----- Job dùng chung -----
+
+typedef struct {
+    char from[MAX_USERNAME];
+    char to[MAX_USERNAME];
+    char message[MAX_BODY];
+} StoreOfflineJob;
+
+static void store_offline_work(sqlite3* db, void* arg) {
+    StoreOfflineJob* j = (StoreOfflineJob*)arg;
+    db_store_offline_message(db, j->from, j->to, j->message);
+}
+
+void db_pool_store_offline_message(const char* from, const char* to, const char* message) {
+    StoreOfflineJob* j = calloc(1, sizeof(StoreOfflineJob));
+    if (!j) {
+        LOG_ERROR("Out of memory: offline message from '%s' to '%s' dropped.", from, to);
+        return;
+    }
+    strncpy(j->from, from, MAX_USERNAME - 1);
+    strncpy(j->to, to, MAX_USERNAME - 1);
+    strncpy(j->message, message, MAX_BODY - 1);
+    if (db_pool_submit_write(store_offline_work, NULL, j) != 0) {
+        LOG_ERROR("Failed to queue offline message from '%s' to '%s'.", from, to);
+        free(j);
+    }
+}
+
+typedef struct {
+    char group[MAX_USERNAME];
+    UserId from;
+    char message[MAX_BODY];
+    sqlite3_int64 id;           // id của dòng vừa lưu, 0 nếu lỗi
+} AppendGroupJob;
+
+// Id lớn nhất trong log group đã COMMIT mà reactor biết (cập nhật sau mỗi lần lưu tin)
+static sqlite3_int64 group_log_head;
+
+static void append_group_work(sqlite3* db, void* arg) {
+    AppendGroupJob* j = (AppendGroupJob*)arg;
+    if (db_append_group_message(db, j->group, j->from, j->message, &j->id) != 0) j->id = 0;
+}
+
+static void append_group_done(sqlite3* db, void* arg, int status) {
+    (void)db;
+    AppendGroupJob* j = (AppendGroupJob*)arg;
+    if (status == SQLITE_OK && j->id) {
+        sqlite3_int64 head = __atomic_load_n(&group_log_head, __ATOMIC_RELAXED);
+        while (head < j->id &&
+               !__atomic_compare_exchange_n(&group_log_head, &head, j->id, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+    free(j);
+}
+
+void db_pool_append_group_message(const char* group, UserId from, const char* message) {
+    AppendGroupJob* j = calloc(1, sizeof(AppendGroupJob));
+    if (!j) {
+        LOG_ERROR("Out of memory: group message from user %u to '%s' dropped.", from, group);
+        return;
+    }
+    strncpy(j->group, group, MAX_USERNAME - 1);
+    j->from = from;
+    strncpy(j->message, message, MAX_BODY - 1);
+    if (db_pool_submit_write(append_group_work, append_group_done, j) != 0) {
+        LOG_ERROR("Failed to queue group message from user %u to '%s'.", from, group);
+        free(j);
+    }
+}
+
+sqlite3_int64 db_pool_group_log_head(void) {
+    return __atomic_load_n(&group_log_head, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+    UserId user;
+    sqlite3_int64 up_to_id;
+} MarkGroupReadJob;
+
+// User vừa offline đã nhận trực tiếp mọi tin group tới up_to_id (đầu log lúc logout): dời
+// con trỏ tới đó rồi dọn phần log mà cả group đã đọc. Tin lưu sau lúc logout (kể cả khi được
+// ghi trước job này) vẫn nằm sau con trỏ.
+static void mark_group_read_work(sqlite3* db, void* arg) {
+    MarkGroupReadJob* j = (MarkGroupReadJob*)arg;
+    if (j->up_to_id) db_advance_group_cursors(db, j->user, j->up_to_id);
+    db_prune_group_messages(db, j->user);
+}
+
+void db_pool_mark_group_messages_read(UserId user, sqlite3_int64 up_to_id) {
+    MarkGroupReadJob* j = malloc(sizeof(MarkGroupReadJob));
+    if (!j) return;
+    j->user = user;
+    j->up_to_id = up_to_id;
+    if (db_pool_submit_write(mark_group_read_work, NULL, j) != 0) free(j);
+}
@@ -0,0 +1,78 @@
+#ifndef DB_POOL_H
+#define DB_POOL_H
+
+#include <stdint.h>
+#include <sqlite3.h>
+#include "user_ids.h"
+
+// Pool thread làm việc với SQLite: reactor không bao giờ chờ đĩa.
+//  - Mỗi worker có kết nối DB riêng và 1 hàng đợi job.
+//  - `work` chạy trên worker với kết nối của worker; `done` chạy lại trên reactor đã gửi job
+//    (hàng đợi completion của reactor, đánh thức bằng wake eventfd) với kết nối của reactor,
+//    nên done được gọi server_send_packet, đọc session... như handler bình thường.
+//  - Job cùng key (vd. username, tên group) luôn vào cùng 1 worker: chạy đúng thứ tự gửi.
+//  - Job ghi (DB_JOB_WRITE) đi vào 1 writer thread duy nhất, theo đúng thứ tự gửi. Writer gom
+//    các job đang chờ (tối đa DB_WRITE_BATCH_MAX) vào 1 transaction: 1 fsync cho cả lô thay vì
+//    1 fsync mỗi câu lệnh. done của job ghi chỉ chạy sau khi lô đã COMMIT (đã bền trên đĩa).
+//  - COMMIT lỗi thì cả lô bị ROLLBACK: done nhận status khác SQLITE_OK và phải coi như work
+//    chưa ghi gì (trả lỗi cho client, không cập nhật cache). Job không có done được chạy lại
+//    riêng từng job (tự commit từng câu lệnh) để tin nhắn offline không mất lặng lẽ.
+// Handler giữ fd + gen của session (SessionRef) vì session có thể đã đóng khi done chạy.
+
+typedef void (*db_job_fn)(sqlite3* db, void* arg);
+// status: SQLITE_OK, hoặc mã lỗi COMMIT của lô chứa job ghi (mọi thay đổi của work đã bị hủy)
+typedef void (*db_done_fn)(sqlite3* db, void* arg, int status);
+
+typedef struct DbJob {
+    struct DbJob* next;
+    struct Reactor* reactor;    // nhận completion; NULL nếu không có done
+    int owner_fd;               // session gửi job (-1 nếu không có), xem SESSION_DB_INFLIGHT_MAX
+    uint32_t owner_gen;
+    int barrier;                // session ngưng xử lý frame tiếp theo cho tới khi done chạy xong
+    int write;                  // chạy trên writer (DB_JOB_WRITE)
+    int msg_type;               // loại packet đang xử lý lúc gửi job (metrics), 0 = không có
+    int status;                 // kết quả COMMIT của lô (job ghi), SQLITE_OK nếu không lỗi
+    db_job_fn work;
+    db_done_fn done;
+    void* arg;
+} DbJob;
+
+#define DB_POOL_DEFAULT_WORKERS 2
+#define DB_POOL_MAX_WORKERS 32
+#define DB_WRITE_BATCH_MAX 256      // số job ghi tối đa trong 1 transaction của writer
+
+// Cờ cho db_pool_submit_for
+#define DB_JOB_WRITE   0x1  // job có ghi DB: chạy trên writer, done chạy sau COMMIT; key bị bỏ qua
+#define DB_JOB_BARRIER 0x2  // các frame sau của session chỉ được xử lý khi done đã chạy
+                            // (vd. login: request kế tiếp cần session->username đã được gán)
+
+// Mở `workers` kết nối + thread đọc và 1 writer. workers = 0: job chạy đồng bộ trên reactor (như trước).
+int db_pool_start(const char* db_path, int workers);
+// Chạy nốt các job đã gửi rồi dừng worker (completion chưa nhận sẽ bị bỏ)
+void db_pool_stop(void);
+
+// Gửi job từ thread reactor. arg do done giải phóng; done NULL (fire-and-forget): pool free(arg)
+// sau khi work xong (job ghi: sau COMMIT) nên work không được tự giải phóng arg.
+// Trả về 0; -1 nếu không tạo được job (hết bộ nhớ) -> chưa chạy gì, caller tự dọn arg.
+int db_pool_submit(const char* key, db_job_fn work, db_done_fn done, void* arg);
+// Như db_pool_submit nhưng chạy trên writer
+int db_pool_submit_write(db_job_fn work, db_done_fn done, void* arg);
+// Job xử lý request của session owner_fd (done bắt buộc, flags: DB_JOB_*): tính vào số job đang
+// chờ của session để ngưng đọc input của client gửi request nhanh hơn DB xử lý kịp
+int db_pool_submit_for(int owner_fd, int flags, const char* key, db_job_fn work, db_done_fn done, void* arg);
+
+// Gọi trên reactor nhận completion: chạy done rồi giải phóng job
+void db_pool_complete(DbJob* job, sqlite3* db);
+
+// Job dùng chung: lưu tin nhắn offline (copy các chuỗi), ghi trên writer
+void db_pool_store_offline_message(const char* from, const char* to, const char* message);
+// Lưu 1 bản tin group cho các thành viên đang offline (xem db_append_group_message)
+void db_pool_append_group_message(const char* group, UserId from, const char* message);
+// Id lớn nhất trong log group đã COMMIT qua db_pool_append_group_message (0 = chưa có tin
+// nào từ lúc server chạy; tin cũ hơn đã được đọc lúc login)
+sqlite3_int64 db_pool_group_log_head(void);
+// Gọi khi user offline với up_to_id = db_pool_group_log_head() đọc lúc logout: đánh dấu đã
+// đọc các tin group tới đó và dọn log
+void db_pool_mark_group_messages_read(UserId user, sqlite3_int64 up_to_id);
+
+#endif
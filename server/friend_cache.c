@@ -0,0 +1,184 @@
+#include "friend_cache.h"
+#include "metrics.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Entry không bị xóa nên con trỏ luôn hợp lệ; user chưa từng login/được tra cứu thì không có entry
+typedef struct {
+    IdSet* friends;                 // đổi dưới write lock
+} FriendEntry;
+
+#define FRIEND_GEN_STRIPES 64       // luôn là lũy thừa của 2
+#define FRIEND_LOAD_RETRIES 3       // số lần nạp lại khi bị cập nhật chen ngang
+
+static IdTable friend_table;        // UserId -> FriendEntry*
+static pthread_rwlock_t friend_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Đếm cập nhật theo nhóm user (id & (FRIEND_GEN_STRIPES - 1)), đổi dưới write lock.
+// Lần nạp chạy ngoài lock chỉ được cache nếu nhóm của user không đổi trong lúc đọc DB:
+// accept/unfriend commit giữa chừng bị update_edge bỏ qua (user chưa có entry) nên
+// kết quả vừa đọc có thể đã cũ.
+static unsigned friend_gen[FRIEND_GEN_STRIPES];
+
+typedef struct {
+    UserId* ids;
+    int count;
+    int cap;
+    int failed;
+} FriendLoader;
+
+static void load_friend_cb(void* arg, UserId id, const char* username) {
+    FriendLoader* l = (FriendLoader*)arg;
+    if (l->failed || user_ids_intern(id, username) != 0) return;
+    if (l->count == l->cap) {
+        int new_cap = l->cap ? l->cap * 2 : 16;
+        void* grown = realloc(l->ids, sizeof(UserId) * new_cap);
+        if (!grown) { l->failed = 1; return; }
+        l->ids = grown;
+        l->cap = new_cap;
+    }
+    l->ids[l->count++] = id;
+}
+
+// Đọc tập bạn từ DB, không giữ lock. NULL nếu lỗi DB / hết bộ nhớ.
+static IdSet* load_friends(sqlite3* db, UserId user) {
+    FriendLoader l = { NULL, 0, 0, 0 };
+    uint64_t start = metrics_now();
+    int rc = db_get_friend_list(db, user, load_friend_cb, &l);
+    metrics_record_db(metrics_current_type(), start);
+    IdSet* friends = (rc == 0 && !l.failed) ? id_set_build(l.ids, l.count) : NULL;
+    free(l.ids);
+    return friends;
+}
+
+// Đưa tập vừa nạp vào bảng; gọi khi giữ write lock. NULL nếu hết bộ nhớ (tập vẫn thuộc caller).
+static FriendEntry* insert_locked(UserId user, IdSet* friends) {
+    FriendEntry* e = calloc(1, sizeof(FriendEntry));
+    void** slot = e ? id_table_slot(&friend_table, user, 1) : NULL;
+    if (!slot) {
+        free(e);
+        return NULL;
+    }
+    e->friends = friends;
+    __atomic_store_n(slot, e, __ATOMIC_RELEASE);
+    return e;
+}
+
+// Lấy (retain) tập bạn của user, nạp từ DB nếu chưa có. NULL nếu không nạp được.
+// Truy vấn DB chạy ngoài lock để 1 lần đọc đĩa chậm không chặn reactor khác; write lock
+// chỉ giữ lúc đưa kết quả vào bảng.
+static IdSet* acquire_friends(sqlite3* db, UserId user) {
+    unsigned* gen = &friend_gen[user & (FRIEND_GEN_STRIPES - 1)];
+
+    for (int attempt = 1;; attempt++) {
+        IdSet* set = NULL;
+        pthread_rwlock_rdlock(&friend_lock);
+        FriendEntry* e = id_table_get(&friend_table, user);
+        if (e) {
+            set = e->friends;
+            id_set_retain(set);
+        }
+        unsigned seen = *gen;
+        pthread_rwlock_unlock(&friend_lock);
+        if (e || !db) return set;
+
+        IdSet* friends = load_friends(db, user);
+
+        pthread_rwlock_wrlock(&friend_lock);
+        // Thread khác có thể đã nạp xong trước: dùng entry của nó, bỏ bản vừa đọc
+        e = id_table_get(&friend_table, user);
+        int stale = !e && friends && *gen != seen;
+        if (!e && friends && !stale) {
+            e = insert_locked(user, friends);
+            if (e) friends = NULL;
+        }
+        if (e) {
+            set = e->friends;
+            id_set_retain(set);
+        }
+        pthread_rwlock_unlock(&friend_lock);
+
+        if (e) {
+            id_set_release(friends);
+            return set;
+        }
+        if (stale && attempt < FRIEND_LOAD_RETRIES) {
+            id_set_release(friends);
+            continue;
+        }
+        // Không cache được (hết bộ nhớ / bị accept/unfriend chen ngang mãi): chỉ dùng cho lần gọi này
+        return friends;
+    }
+}
+
+typedef struct {
+    user_id_fn callback;
+    void* arg;
+} DirectCtx;
+
+static void direct_friend_cb(void* arg, UserId id, const char* username) {
+    DirectCtx* ctx = (DirectCtx*)arg;
+    if (user_ids_intern(id, username) == 0) ctx->callback(ctx->arg, id);
+}
+
+int friend_cache_for_each_friend(sqlite3* db, UserId user, user_id_fn callback, void* arg) {
+    if (!user || !callback) return 1;
+    IdSet* friends = acquire_friends(db, user);
+    if (!friends) {
+        if (!db) return 1;
+        // Không cache được (hết bộ nhớ / lỗi DB): đọc thẳng từ DB
+        DirectCtx ctx = { callback, arg };
+        return db_get_friend_list(db, user, direct_friend_cb, &ctx);
+    }
+    for (int i = 0; i < friends->count; i++) {
+        callback(arg, friends->ids[i]);
+    }
+    id_set_release(friends);
+    return 0;
+}
+
+int friend_cache_ready(UserId user) {
+    pthread_rwlock_rdlock(&friend_lock);
+    int ready = id_table_get(&friend_table, user) != NULL;
+    pthread_rwlock_unlock(&friend_lock);
+    return ready;
+}
+
+// Thêm/bớt `other` trong tập bạn của `user` nếu user đã có trong cache; gọi khi giữ write lock
+static void update_edge_locked(UserId user, UserId other, int add, IdSet** old) {
+    FriendEntry* e = id_table_get(&friend_table, user);
+    // Chưa nạp thì bỏ qua: lần nạp sau sẽ đọc dữ liệu mới từ DB
+    if (!e || id_set_contains(e->friends, other) == add) return;
+    IdSet* set = id_set_with_change(e->friends, other, add);
+    if (!set) {
+        LOG_ERROR("Friend cache: out of memory updating user %u.", user);
+        return;
+    }
+    *old = e->friends;
+    e->friends = set;
+}
+
+static void update_edge(UserId user_a, UserId user_b, int add) {
+    if (!user_a || !user_b) return;
+    IdSet* old_a = NULL;
+    IdSet* old_b = NULL;
+
+    pthread_rwlock_wrlock(&friend_lock);
+    friend_gen[user_a & (FRIEND_GEN_STRIPES - 1)]++;
+    friend_gen[user_b & (FRIEND_GEN_STRIPES - 1)]++;
+    update_edge_locked(user_a, user_b, add, &old_a);
+    update_edge_locked(user_b, user_a, add, &old_b);
+    pthread_rwlock_unlock(&friend_lock);
+    id_set_release(old_a);
+    id_set_release(old_b);
+}
+
+void friend_cache_on_accept(UserId user_a, UserId user_b) {
+    update_edge(user_a, user_b, 1);
+}
+
+void friend_cache_on_unfriend(UserId user_a, UserId user_b) {
+    update_edge(user_a, user_b, 0);
+}
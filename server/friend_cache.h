@@ -0,0 +1,26 @@
+#ifndef FRIEND_CACHE_H
+#define FRIEND_CACHE_H
+
+#include <sqlite3.h>
+#include "db_handler.h"
+#include "id_set.h"
+
+// Đồ thị bạn bè (status = 1) trong bộ nhớ: UserId -> tập id bạn bè, dùng chung cho mọi reactor.
+//  - Danh sách bạn của 1 user được nạp lười từ DB (db_get_friend_list) ở lần đầu cần đến;
+//    tên của các bạn được intern lúc nạp nên user_ids_name dùng được cho mọi id trả về.
+//  - friend_cache_on_* được gọi sau khi accept / unfriend đã COMMIT (friend_done): nạp lười
+//    trước lúc đó đọc dữ liệu cũ rồi được cập nhật, nạp sau đó đã thấy dữ liệu mới.
+//  - Truy vấn lúc nạp chạy ngoài lock; nếu accept/unfriend của user đó chen ngang thì
+//    kết quả không được cache mà nạp lại.
+
+// Gọi callback cho từng người bạn của user (thứ tự theo id). Trả về 0 nếu thành công.
+// db = NULL (reactor): chỉ đọc cache, trả về 1 nếu user chưa được nạp.
+int friend_cache_for_each_friend(sqlite3* db, UserId user, user_id_fn callback, void* arg);
+// 1 nếu tập bạn của user đã nằm trong cache (đọc được với db = NULL)
+int friend_cache_ready(UserId user);
+
+// Cập nhật cạnh (user_a, user_b) ở cả 2 phía
+void friend_cache_on_accept(UserId user_a, UserId user_b);
+void friend_cache_on_unfriend(UserId user_a, UserId user_b);
+
+#endif
@@ -1,7 +1,10 @@
 #include "friend_manager.h"
 #include "db_handler.h"
+#include "friend_cache.h"
+#include "presence.h"
 #include "server.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -20,226 +23,337 @@ void send_packet_to_fd(int fd, MessageType type, const char* body, const char* s
     if (body) strncpy(packet.body, body, MAX_BODY);
     if (source) strncpy(packet.source_user, source, MAX_USERNAME);
     
-    write(fd, &packet, sizeof(ChatPacket));
+    server_send_packet(fd, &packet);
 }
 
 /**
- * @brief Tìm kiếm session của user dựa trên username.
- * (Hàm này PHẢI được định nghĩa trong server.c và khai báo trong server.h)
+ * @brief Giống send_packet_to_fd nhưng gửi theo UserId (user có thể ở reactor khác).
+ * @return 1 nếu user đang online.
  */
-extern ClientSession* find_session_by_username(const char* user, ClientSession* sessions);
+static int send_packet_to_id(UserId user, MessageType type, const char* body, const char* source) {
+    ChatPacket packet;
+    memset(&packet, 0, sizeof(ChatPacket));
+    packet.type = type;
+    if (body) strncpy(packet.body, body, MAX_BODY);
+    if (source) strncpy(packet.source_user, source, MAX_USERNAME);
+
+    return server_send_to_id(user, &packet);
+}
 
 // --- Logic Bạn bè Chính ---
+// Ghi DB chạy trên worker (friend_work), phần thông báo chạy lại trên reactor (friend_done).
 
-/**
- * @brief Xử lý khi user (sender) gửi lời mời kết bạn cho (receiver).
- * Gửi: MSG_TYPE_FRIEND_REQUEST
- */
-void handle_friend_request(int sender_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
-    const char* sender = packet->source_user;
-    const char* receiver = packet->target_user;
+typedef enum {
+    FRIEND_OP_REQUEST,
+    FRIEND_OP_ACCEPT,
+    FRIEND_OP_DECLINE,
+    FRIEND_OP_UNFRIEND,
+} FriendOp;
 
-    if (strcmp(sender, receiver) == 0) {
-        send_packet_to_fd(sender_fd, MSG_TYPE_FRIEND_UPDATE, "You cannot add yourself.", "Server");
-        return;
-    }
+#define FRIEND_USER_NOT_FOUND -1
+
+typedef struct {
+    SessionRef ref;
+    FriendOp op;
+    char user[MAX_USERNAME];    // người ra lệnh
+    char other[MAX_USERNAME];   // receiver / sender của request / người bị hủy kết bạn
+    UserId user_id;
+    UserId other_id;            // tra trong friend_work
+    int rc;                     // kết quả db_friend_* (0 = thành công) hoặc FRIEND_USER_NOT_FOUND
+} FriendJob;
 
-    // New: ensure receiver exists
-    if (!db_user_exists(db, receiver)) {
-        send_packet_to_fd(sender_fd, MSG_TYPE_FRIEND_UPDATE, "User not found.", "Server");
+static void friend_work(sqlite3 *db, void* arg) {
+    FriendJob* job = (FriendJob*)arg;
+    // New: ensure the other user exists
+    job->other_id = user_ids_resolve(db, job->other);
+    if (!job->other_id) {
+        job->rc = FRIEND_USER_NOT_FOUND;
         return;
     }
+    switch (job->op) {
+        case FRIEND_OP_REQUEST:  job->rc = db_friend_request(db, job->user_id, job->other_id); break;
+        case FRIEND_OP_ACCEPT:   job->rc = db_friend_accept(db, job->user_id, job->other_id); break;
+        case FRIEND_OP_DECLINE:  job->rc = db_friend_decline(db, job->user_id, job->other_id); break;
+        case FRIEND_OP_UNFRIEND: job->rc = db_friend_unfriend(db, job->user_id, job->other_id); break;
+    }
+}
 
-    if (db_friend_request(db, sender, receiver) == 0) {
-        send_packet_to_fd(sender_fd, MSG_TYPE_FRIEND_UPDATE, "Friend request sent.", "Server");
-        
-        ClientSession* receiver_session = find_session_by_username(receiver, sessions);
-        if (receiver_session) {
-            // Notify receiver with source_user = sender so client UI can show "/accept <sender>"
-            send_packet_to_fd(receiver_session->fd, MSG_TYPE_FRIEND_REQUEST_INCOMING,
-                              "You have a new friend request.", sender);
-        }
-    } else {
-        send_packet_to_fd(sender_fd, MSG_TYPE_FRIEND_UPDATE, "Failed to send request (already sent or already friends?).", "Server");
+// Trả lời người ra lệnh nếu kết nối của họ vẫn còn (fd có thể đã được dùng lại)
+static void reply_friend_update(const FriendJob* job, const char* body) {
+    if (server_session_deref(job->ref)) {
+        send_packet_to_fd(job->ref.fd, MSG_TYPE_FRIEND_UPDATE, body, "Server");
     }
 }
 
-/**
- * @brief Xử lý khi user (accepter) chấp nhận lời mời từ (sender).
- * Gửi: MSG_TYPE_FRIEND_ACCEPT
- */
-void handle_friend_accept(int accepter_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
-    const char* accepter = packet->source_user;
-    const char* sender = packet->target_user; // Người đã gửi request
+static void friend_done(sqlite3 *db, void* arg, int status) {
+    FriendJob* job = (FriendJob*)arg;
+    const char* user = job->user;
+    const char* other = job->other;
+    UserId user_id = job->user_id;
+    UserId other_id = job->other_id;
+    char body[MAX_BODY];
 
-    // Ensure sender exists
-    if (!db_user_exists(db, sender)) {
-        send_packet_to_fd(accepter_fd, MSG_TYPE_FRIEND_UPDATE, "User not found.", "Server");
+    if (status != SQLITE_OK) {
+        // COMMIT lỗi, thay đổi đã bị ROLLBACK: không cập nhật cache, không báo người kia
+        reply_friend_update(job, "Server error, try again.");
+        free(job);
+        return;
+    }
+    if (job->rc == FRIEND_USER_NOT_FOUND) {
+        reply_friend_update(job, "User not found.");
+        free(job);
         return;
     }
 
-    if (db_friend_accept(db, accepter, sender) == 0) {
-        char body[MAX_BODY];
-        snprintf(body, MAX_BODY, "You are now friends with %s.", sender);
-        send_packet_to_fd(accepter_fd, MSG_TYPE_FRIEND_UPDATE, body, "Server");
-        
-        ClientSession* sender_session = find_session_by_username(sender, sessions);
-        if (sender_session) {
-            snprintf(body, MAX_BODY, "%s accepted your friend request.", accepter);
-            send_packet_to_fd(sender_session->fd, MSG_TYPE_FRIEND_UPDATE, body, "Server");
-        }
-        
-        handle_friend_list_request(accepter_fd, accepter, sessions, db);
-        if (sender_session) {
-            handle_friend_list_request(sender_session->fd, sender, sessions, db);
-        }
-    } else {
-        send_packet_to_fd(accepter_fd, MSG_TYPE_FRIEND_UPDATE, "Failed to accept request (request not found?).", "Server");
+    switch (job->op) {
+        case FRIEND_OP_REQUEST:
+            if (job->rc == 0) {
+                reply_friend_update(job, "Friend request sent.");
+                // Notify receiver with source_user = sender so client UI can show "/accept <sender>"
+                send_packet_to_id(other_id, MSG_TYPE_FRIEND_REQUEST_INCOMING,
+                                    "You have a new friend request.", user);
+            } else {
+                reply_friend_update(job, "Failed to send request (already sent or already friends?).");
+            }
+            break;
+
+        case FRIEND_OP_ACCEPT: // other = người đã gửi request
+            if (job->rc == 0) {
+                friend_cache_on_accept(user_id, other_id); // giữ cache đồ thị bạn bè khớp với DB
+                snprintf(body, MAX_BODY, "You are now friends with %s.", other);
+                reply_friend_update(job, body);
+
+                snprintf(body, MAX_BODY, "%s accepted your friend request.", user);
+                int sender_online = send_packet_to_id(other_id, MSG_TYPE_FRIEND_UPDATE, body, "Server");
+
+                if (server_session_deref(job->ref)) handle_friend_list_request(job->ref.fd, user_id, db);
+                if (sender_online) {
+                    send_friend_list_to_user(other_id, db);
+                    presence_introduce(user_id, other_id);
+                }
+            } else {
+                reply_friend_update(job, "Failed to accept request (request not found?).");
+            }
+            break;
+
+        case FRIEND_OP_DECLINE: // other = người đã gửi request
+            if (job->rc == 0) {
+                snprintf(body, MAX_BODY, "You declined the request from %s.", other);
+                reply_friend_update(job, body);
+            } else {
+                reply_friend_update(job, "Failed to decline request (request not found?).");
+            }
+            break;
+
+        case FRIEND_OP_UNFRIEND:
+            if (job->rc == 0) {
+                friend_cache_on_unfriend(user_id, other_id);
+                snprintf(body, MAX_BODY, "You are no longer friends with %s.", other);
+                reply_friend_update(job, body);
+
+                snprintf(body, MAX_BODY, "%s has unfriended you.", user);
+                int target_online = send_packet_to_id(other_id, MSG_TYPE_FRIEND_UPDATE, body, "Server");
+
+                if (server_session_deref(job->ref)) handle_friend_list_request(job->ref.fd, user_id, db);
+                if (target_online) {
+                    send_friend_list_to_user(other_id, db);
+                }
+            } else {
+                // Provide clearer feedback on failure
+                reply_friend_update(job, "Failed to unfriend (not friends or DB error).");
+            }
+            break;
+    }
+    free(job);
+}
+
+static void submit_friend_job(int fd, FriendOp op, const ChatPacket* packet) {
+    ClientSession* session = get_session(fd);
+    FriendJob* job = session ? calloc(1, sizeof(FriendJob)) : NULL;
+    if (job) {
+        job->ref = server_session_ref(fd);
+        job->op = op;
+        job->user_id = session->user_id;
+        strncpy(job->user, packet->source_user, MAX_USERNAME - 1);
+        strncpy(job->other, packet->target_user, MAX_USERNAME - 1);
+        // Mọi thao tác ghi đi qua 1 writer: request/accept từ 2 phía chạy đúng thứ tự nhận
+        if (db_pool_submit_for(fd, DB_JOB_WRITE | DB_JOB_BARRIER, NULL, friend_work, friend_done, job) == 0) return;
+        free(job);
     }
+    send_packet_to_fd(fd, MSG_TYPE_FRIEND_UPDATE, "Server busy, try again.", "Server");
 }
 
 /**
- * @brief Xử lý khi user (decliner) từ chối lời mời từ (sender).
- * Gửi: MSG_TYPE_FRIEND_DECLINE
+ * @brief Xử lý khi user (sender) gửi lời mời kết bạn cho (receiver).
+ * Gửi: MSG_TYPE_FRIEND_REQUEST
  */
-void handle_friend_decline(int decliner_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
-    const char* decliner = packet->source_user;
-    const char* sender = packet->target_user; // Người đã gửi request
-
-    // Ensure sender exists
-    if (!db_user_exists(db, sender)) {
-        send_packet_to_fd(decliner_fd, MSG_TYPE_FRIEND_UPDATE, "User not found.", "Server");
+void handle_friend_request(int sender_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
+    if (strcmp(packet->source_user, packet->target_user) == 0) {
+        send_packet_to_fd(sender_fd, MSG_TYPE_FRIEND_UPDATE, "You cannot add yourself.", "Server");
         return;
     }
+    submit_friend_job(sender_fd, FRIEND_OP_REQUEST, packet);
+}
 
-    if (db_friend_decline(db, decliner, sender) == 0) {
-        char body[MAX_BODY];
-        snprintf(body, MAX_BODY, "You declined the request from %s.", sender);
-        send_packet_to_fd(decliner_fd, MSG_TYPE_FRIEND_UPDATE, body, "Server");
-    } else {
-        send_packet_to_fd(decliner_fd, MSG_TYPE_FRIEND_UPDATE, "Failed to decline request (request not found?).", "Server");
-    }
+/**
+ * @brief Xử lý khi user (accepter) chấp nhận lời mời từ (sender = target_user).
+ * Gửi: MSG_TYPE_FRIEND_ACCEPT
+ */
+void handle_friend_accept(int accepter_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
+    submit_friend_job(accepter_fd, FRIEND_OP_ACCEPT, packet);
+}
+
+/**
+ * @brief Xử lý khi user (decliner) từ chối lời mời từ (sender = target_user).
+ * Gửi: MSG_TYPE_FRIEND_DECLINE
+ */
+void handle_friend_decline(int decliner_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
+    submit_friend_job(decliner_fd, FRIEND_OP_DECLINE, packet);
 }
 
 /**
  * @brief Xử lý khi user (unfriender) hủy kết bạn với (target).
  * Gửi: MSG_TYPE_FRIEND_UNFRIEND
  */
-void handle_friend_unfriend(int unfriender_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
-    const char* unfriender = packet->source_user;
-    const char* target = packet->target_user;
-
-    // Ensure target exists
-    if (!db_user_exists(db, target)) {
-        send_packet_to_fd(unfriender_fd, MSG_TYPE_FRIEND_UPDATE, "User not found.", "Server");
-        return;
-    }
-
-    if (db_friend_unfriend(db, unfriender, target) == 0) {
-        char body[MAX_BODY];
-        snprintf(body, MAX_BODY, "You are no longer friends with %s.", target);
-        send_packet_to_fd(unfriender_fd, MSG_TYPE_FRIEND_UPDATE, body, "Server");
-        
-        ClientSession* target_session = find_session_by_username(target, sessions);
-        if (target_session) {
-            snprintf(body, MAX_BODY, "%s has unfriended you.", unfriender);
-            send_packet_to_fd(target_session->fd, MSG_TYPE_FRIEND_UPDATE, body, "Server");
-        }
-        
-        handle_friend_list_request(unfriender_fd, unfriender, sessions, db);
-        if (target_session) {
-            handle_friend_list_request(target_session->fd, target, sessions, db);
-        }
-    } else {
-        // Provide clearer feedback on failure
-        send_packet_to_fd(unfriender_fd, MSG_TYPE_FRIEND_UPDATE, "Failed to unfriend (not friends or DB error).", "Server");
-    }
+void handle_friend_unfriend(int unfriender_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
+    submit_friend_job(unfriender_fd, FRIEND_OP_UNFRIEND, packet);
 }
 
 
 // --- Logic Lấy Danh sách Bạn bè + Status ---
 
-// Cấu trúc để build chuỗi
+// Cấu trúc để build chuỗi: gom tên rồi sắp xếp để danh sách theo thứ tự tên như trước
 typedef struct {
-    char list_str[MAX_BODY];
-    ClientSession* sessions; // Cần để kiểm tra status online
+    UserId id;
+    const char* name;
+} FriendEntryRef;
+
+typedef struct {
+    FriendEntryRef* friends;
+    int count;
+    int cap;
 } FriendListBuilder;
 
 /**
- * @brief Callback được gọi bởi db_get_friend_list cho mỗi người bạn.
- * Nó sẽ build chuỗi friend list KÈM STATUS (ONL/OFF).
+ * @brief Callback được gọi bởi friend_cache_for_each_friend cho mỗi người bạn.
+ * Chỉ gom tên; status (ONL/OFF) được thêm lúc dựng chuỗi.
  */
-int build_friend_list_callback(void* arg, const char* friend_name) {
+static void build_friend_list_callback(void* arg, UserId friend_id) {
     FriendListBuilder* builder = (FriendListBuilder*)arg;
-    
-    // Kiểm tra status online
-    ClientSession* friend_session = find_session_by_username(friend_name, builder->sessions);
-
-    const char* status = (friend_session) ? "(ONL)" : "(OFF)";
-    
-    char entry[MAX_USERNAME + 10];
-    snprintf(entry, sizeof(entry), "%s %s, ", friend_name, status);
-    
-    // Nối vào chuỗi kết quả, chừa 1 byte cho NULL
-    if (strlen(builder->list_str) + strlen(entry) < MAX_BODY - 1) {
-        strcat(builder->list_str, entry);
+    const char* name = user_ids_name(friend_id);
+    if (!name) return;
+    if (builder->count == builder->cap) {
+        int new_cap = builder->cap ? builder->cap * 2 : 16;
+        void* grown = realloc(builder->friends, sizeof(FriendEntryRef) * new_cap);
+        if (!grown) return;
+        builder->friends = grown;
+        builder->cap = new_cap;
     }
-    return 0; // Tiếp tục
+    builder->friends[builder->count].id = friend_id;
+    builder->friends[builder->count].name = name;
+    builder->count++;
+}
+
+static int compare_name(const void* a, const void* b) {
+    return strcmp(((const FriendEntryRef*)a)->name, ((const FriendEntryRef*)b)->name);
 }
 
 /**
- * @brief Xử lý khi user yêu cầu danh sách bạn.
- * Gửi: MSG_TYPE_FRIEND_LIST_REQUEST
+ * @brief Build nội dung phản hồi danh sách bạn (kèm status) vào response_body.
  */
-void handle_friend_list_request(int user_fd, const char* username, ClientSession* sessions, sqlite3 *db) {
-    FriendListBuilder builder;
-    memset(&builder.list_str, 0, MAX_BODY);
-    builder.sessions = sessions;
+static void build_friend_list_response(UserId user, sqlite3 *db, char* response_body) {
+    FriendListBuilder builder = { NULL, 0, 0 };
+    char list_str[MAX_BODY];
+    memset(list_str, 0, MAX_BODY);
+
+    // 1. Duyệt đồ thị bạn bè trong bộ nhớ, gọi `build_friend_list_callback` cho mỗi người bạn
+    friend_cache_for_each_friend(db, user, build_friend_list_callback, &builder);
+    qsort(builder.friends, builder.count, sizeof(FriendEntryRef), compare_name);
 
-    // 1. Gọi DB, DB sẽ gọi callback `build_friend_list_callback` cho mỗi người bạn
-    db_get_friend_list(db, username, build_friend_list_callback, &builder);
+    for (int i = 0; i < builder.count; i++) {
+        // Kiểm tra status online
+        const char* status = server_is_id_online(builder.friends[i].id) ? "(ONL)" : "(OFF)";
+
+        char entry[MAX_USERNAME + 10];
+        snprintf(entry, sizeof(entry), "%s %s, ", builder.friends[i].name, status);
+
+        // Nối vào chuỗi kết quả, chừa 1 byte cho NULL
+        if (strlen(list_str) + strlen(entry) < MAX_BODY - 1) {
+            strcat(list_str, entry);
+        }
+    }
+    free(builder.friends);
 
-    char response_body[MAX_BODY];
-    if (strlen(builder.list_str) > 0) {
+    if (strlen(list_str) > 0) {
         // Xóa dấu phẩy và khoảng trắng cuối cùng
-        builder.list_str[strlen(builder.list_str) - 2] = '\0'; 
-        snprintf(response_body, MAX_BODY, "Your friends: %s", builder.list_str);
+        list_str[strlen(list_str) - 2] = '\0';
+        snprintf(response_body, MAX_BODY, "Your friends: %.*s",
+                 (int)(MAX_BODY - sizeof("Your friends: ")), list_str);
     } else {
         strcpy(response_body, "You have no friends yet.");
     }
-    
-    // 2. Gửi list (đã kèm status) về cho client
-    send_packet_to_fd(user_fd, MSG_TYPE_FRIEND_LIST_RESPONSE, response_body, "Server");
 }
 
+// Tập bạn chưa có trong cache (lần nạp lúc login bị lỗi / bị chen ngang): dựng danh sách
+// trên worker DB, reactor chỉ gửi kết quả
+typedef struct {
+    SessionRef ref;             // người yêu cầu; fd = -1: gửi theo id tới reactor đang giữ user
+    UserId user;
+    char body[MAX_BODY];
+} FriendListJob;
 
-// --- Logic Thông báo Status (Online/Offline) ---
+static void friend_list_work(sqlite3 *db, void* arg) {
+    FriendListJob* job = (FriendListJob*)arg;
+    build_friend_list_response(job->user, db, job->body);
+}
 
-/**
- * @brief Callback được gọi bởi db_get_friend_list.
- * Chỉ dùng để thông báo cho từng người bạn.
- */
-int notify_friend_callback(void* arg, const char* friend_name) {
-    NotifyArgs* args = (NotifyArgs*)arg;
-    
-    ClientSession* friend_session = find_session_by_username(friend_name, args->sessions);
-    
-    // Nếu người bạn đó online, gửi thông báo
-    if (friend_session) {
-        send_packet_to_fd(friend_session->fd, MSG_TYPE_FRIEND_UPDATE, args->status_message, args->user_who_changed);
+static void friend_list_done(sqlite3 *db, void* arg, int status) {
+    (void)db;
+    (void)status;               // job đọc, không có COMMIT
+    FriendListJob* job = (FriendListJob*)arg;
+    if (job->ref.fd < 0) {
+        send_packet_to_id(job->user, MSG_TYPE_FRIEND_LIST_RESPONSE, job->body, "Server");
+    } else if (server_session_deref(job->ref)) {
+        send_packet_to_fd(job->ref.fd, MSG_TYPE_FRIEND_LIST_RESPONSE, job->body, "Server");
+    }
+    free(job);
+}
+
+// Gửi danh sách bạn cho user_fd (hoặc theo id nếu user_fd < 0). Reactor chỉ đọc cache.
+static void send_friend_list(int user_fd, UserId user) {
+    if (friend_cache_ready(user)) {
+        char response_body[MAX_BODY];
+        build_friend_list_response(user, NULL, response_body);
+        if (user_fd >= 0) send_packet_to_fd(user_fd, MSG_TYPE_FRIEND_LIST_RESPONSE, response_body, "Server");
+        else send_packet_to_id(user, MSG_TYPE_FRIEND_LIST_RESPONSE, response_body, "Server");
+        return;
     }
-    return 0; // Tiếp tục
+    FriendListJob* job = calloc(1, sizeof(FriendListJob));
+    if (!job) return;
+    job->ref.fd = -1;
+    if (user_fd >= 0) job->ref = server_session_ref(user_fd);
+    job->user = user;
+    const char* key = user_ids_name(user);
+    // Người yêu cầu: request sau của họ chờ danh sách này để phản hồi không bị đảo thứ tự
+    int rc = user_fd >= 0 ? db_pool_submit_for(user_fd, DB_JOB_BARRIER, key, friend_list_work, friend_list_done, job)
+                          : db_pool_submit(key, friend_list_work, friend_list_done, job);
+    if (rc != 0) free(job);
 }
 
 /**
- * @brief Gửi thông báo cho TẤT CẢ bạn bè của 'user' rằng họ vừa online/offline.
+ * @brief Xử lý khi user yêu cầu danh sách bạn.
+ * Gửi: MSG_TYPE_FRIEND_LIST_REQUEST
  */
-void broadcast_status_to_friends(const char* user, ClientSession* sessions, sqlite3 *db, int is_online) {
-    NotifyArgs args;
-    args.sessions = sessions;
-    args.user_who_changed = user;
-    args.status_message = is_online ? "is now online." : "is now offline.";
-    
-    // Gọi DB, DB sẽ gọi `notify_friend_callback` cho mỗi người bạn
-    db_get_friend_list(db, user, notify_friend_callback, &args);
-}
\ No newline at end of file
+void handle_friend_list_request(int user_fd, UserId user, sqlite3 *db) {
+    (void)db;
+    send_friend_list(user_fd, user);
+}
+
+void send_friend_list_to_user(UserId user, sqlite3 *db) {
+    (void)db;
+    send_friend_list(-1, user);
+}
@@ -8,26 +8,18 @@ typedef struct sqlite3 sqlite3;
 
 #include <sqlite3.h>
 #include "../shared/protocol.h"
+#include "user_ids.h"
 #include "server.h"
 
 // Fix prototypes to match implementations in friend_manager.c
-void handle_friend_request(int sender_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db);
-void handle_friend_accept(int accepter_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db);
-void handle_friend_decline(int decliner_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db);
-void handle_friend_unfriend(int user_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db);
+void handle_friend_request(int sender_fd, ChatPacket* packet, sqlite3 *db);
+void handle_friend_accept(int accepter_fd, ChatPacket* packet, sqlite3 *db);
+void handle_friend_decline(int decliner_fd, ChatPacket* packet, sqlite3 *db);
+void handle_friend_unfriend(int user_fd, ChatPacket* packet, sqlite3 *db);
 
-// Corrected prototype: include username parameter
-void handle_friend_list_request(int user_fd, const char* username, ClientSession* sessions, sqlite3 *db);
+// Corrected prototype: include user id parameter
+void handle_friend_list_request(int user_fd, UserId user, sqlite3 *db);
 
-// (Hàm quan trọng) Gửi danh sách status bạn bè
-void send_friend_status_list(int user_fd, const char* username, ClientSession* sessions, sqlite3 *db);
-// (Hàm quan trọng) Thông báo cho bạn bè
-void broadcast_status_to_friends(const char* user, ClientSession* sessions, sqlite3 *db, int is_online);
-
-// Provide NotifyArgs here so .c doesn't redeclare it
-typedef struct {
-    ClientSession* sessions;      // 1. Danh sách session
-    const char* user_who_changed; // 2. Tên user
-    const char* status_message;   // 3. Tin nhắn
-} NotifyArgs;
+// Gửi danh sách bạn bè cho 1 user đang online (có thể ở reactor khác)
+void send_friend_list_to_user(UserId user, sqlite3 *db);
 #endif
\ No newline at end of file
@@ -0,0 +1,577 @@
+#include "group_cache.h"
+#include "session_registry.h"
+#include "name_set.h"
+#include "metrics.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define GROUP_TABLE_INITIAL_CAPACITY 64   // luôn là lũy thừa của 2
+#define GROUP_GEN_STRIPES 64              // luôn là lũy thừa của 2
+#define GROUP_LOAD_RETRIES 3              // số lần nạp ngoài lock khi bị cập nhật chen ngang
+#define GROUP_MISSING_MAX 4096            // số tên group không tồn tại được nhớ (cache âm)
+
+// Khóa của entry group trong bảng hash theo tên
+typedef struct {
+    char name[MAX_USERNAME];
+    uint32_t hash;
+} EntryKey;
+
+// Bảng open addressing, linear probing. Entry không bao giờ bị xóa
+// (không có thao tác xóa group/user) nên con trỏ entry luôn hợp lệ.
+typedef struct {
+    EntryKey** slots;
+    size_t capacity;                // luôn là lũy thừa của 2
+    size_t count;
+} EntryTable;
+
+typedef struct {
+    EntryKey key;                   // tên group
+    UserId owner;
+    IdSet* members;                 // đổi dưới write lock
+    IdSet* online;                  // thành viên đang online (tập con của members), đổi dưới write lock
+    int missing;                    // group không tồn tại (cache âm, tập rỗng), đổi dưới write lock
+} GroupEntry;
+
+// Chỉ mục ngược user -> các group đã tham gia, để login/logout không phải hỏi DB
+typedef struct {
+    NameSet* groups;                // đổi dưới write lock
+} UserGroupsEntry;
+
+static EntryTable group_table = { NULL, 0, 0 };
+static IdTable user_table;          // UserId -> UserGroupsEntry*
+// 1 lock cho cả 2 bảng để cập nhật 2 chiều của quan hệ thành viên cùng lúc
+static pthread_rwlock_t group_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Đếm cập nhật theo nhóm (hash tên group / id user & (GROUP_GEN_STRIPES - 1)), đổi dưới write lock.
+// Lần nạp chạy ngoài lock chỉ được cache nếu nhóm không đổi trong lúc đọc DB: thay đổi
+// commit giữa chừng bị bỏ qua (chưa có entry) nên kết quả vừa đọc có thể đã cũ.
+static unsigned group_gen[GROUP_GEN_STRIPES];
+static unsigned user_gen[GROUP_GEN_STRIPES];
+static int missing_count;           // số entry cache âm, đổi dưới write lock
+
+// ----- Bảng hash -----
+
+static EntryKey* table_find_locked(const EntryTable* t, const char* name, uint32_t hash) {
+    if (!t->slots) return NULL;
+    size_t mask = t->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        EntryKey* e = t->slots[i];
+        if (!e) return NULL;
+        if (e->hash == hash && strncmp(e->name, name, MAX_USERNAME) == 0) return e;
+    }
+}
+
+static void table_place_locked(EntryTable* t, EntryKey* e) {
+    size_t mask = t->capacity - 1;
+    size_t i = e->hash & mask;
+    while (t->slots[i]) i = (i + 1) & mask;
+    t->slots[i] = e;
+}
+
+static int table_insert_locked(EntryTable* t, EntryKey* e) {
+    if ((t->count + 1) * 2 > t->capacity) {
+        size_t new_capacity = t->capacity ? t->capacity * 2 : GROUP_TABLE_INITIAL_CAPACITY;
+        EntryKey** fresh = calloc(new_capacity, sizeof(EntryKey*));
+        if (!fresh) return -1;
+        EntryKey** old = t->slots;
+        size_t old_capacity = t->capacity;
+        t->slots = fresh;
+        t->capacity = new_capacity;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i]) table_place_locked(t, old[i]);
+        }
+        free(old);
+    }
+    table_place_locked(t, e);
+    t->count++;
+    return 0;
+}
+
+static GroupEntry* find_entry_locked(const char* group_name, uint32_t hash) {
+    return (GroupEntry*)table_find_locked(&group_table, group_name, hash);
+}
+
+static UserGroupsEntry* find_user_locked(UserId user) {
+    return (UserGroupsEntry*)id_table_get(&user_table, user);
+}
+
+static GroupEntry* new_entry(const char* group_name, UserId owner, IdSet* members, IdSet* online) {
+    GroupEntry* e = calloc(1, sizeof(GroupEntry));
+    if (!e) return NULL;
+    strncpy(e->key.name, group_name, MAX_USERNAME - 1);
+    e->owner = owner;
+    e->key.hash = name_hash(e->key.name);
+    e->members = members;
+    e->online = online;
+    return e;
+}
+
+typedef struct {
+    char (*names)[MAX_USERNAME];
+    int count;
+    int cap;
+    int failed;
+} NameLoader;
+
+static void loader_add(NameLoader* l, const char* name) {
+    if (l->failed || !name) return;
+    if (l->count == l->cap) {
+        int new_cap = l->cap ? l->cap * 2 : 16;
+        void* grown = realloc(l->names, sizeof(*l->names) * new_cap);
+        if (!grown) { l->failed = 1; return; }
+        l->names = grown;
+        l->cap = new_cap;
+    }
+    memset(l->names[l->count], 0, MAX_USERNAME);
+    strncpy(l->names[l->count], name, MAX_USERNAME - 1);
+    l->count++;
+}
+
+typedef struct {
+    UserId* ids;
+    int count;
+    int cap;
+    int failed;
+} IdLoader;
+
+// Thành viên đọc từ DB kèm tên: intern luôn để fan-out/presence tra tên theo id
+static void load_member_cb(void* arg, UserId id, const char* username) {
+    IdLoader* l = (IdLoader*)arg;
+    if (l->failed || user_ids_intern(id, username) != 0) return;
+    if (l->count == l->cap) {
+        int new_cap = l->cap ? l->cap * 2 : 16;
+        void* grown = realloc(l->ids, sizeof(UserId) * new_cap);
+        if (!grown) { l->failed = 1; return; }
+        l->ids = grown;
+        l->cap = new_cap;
+    }
+    l->ids[l->count++] = id;
+}
+
+static int load_group_cb(void* arg, const char* group_name) {
+    loader_add((NameLoader*)arg, group_name);
+    return 0;
+}
+
+// Đọc owner + thành viên của group từ DB, không giữ lock. 0 nếu OK, 1 nếu group không tồn tại,
+// -1 nếu lỗi DB.
+static int load_group(sqlite3* db, const char* group_name, UserId* owner, IdLoader* l) {
+    uint64_t start = metrics_now();
+    int rc = db_get_group_owner(db, group_name, owner);
+    if (rc == 0) db_get_group_members(db, group_name, load_member_cb, l);
+    metrics_record_db(metrics_current_type(), start);
+    return rc;
+}
+
+// Dựng entry từ dữ liệu vừa đọc, chưa đưa vào bảng. NULL nếu hết bộ nhớ.
+// Tập online lấy từ danh bạ lúc dựng nên entry đưa vào bảng phải được dựng dưới write lock
+// để login/logout chen ngang không bị bỏ sót.
+static GroupEntry* build_loaded_entry(const char* group_name, UserId owner, IdLoader* l) {
+    IdSet* m = l->failed ? NULL : id_set_build(l->ids, l->count);
+    int online_count = 0;
+    for (int i = 0; m && i < l->count; i++) {
+        if (registry_lookup_user(l->ids[i], NULL, NULL) == 0) {
+            l->ids[online_count++] = l->ids[i];
+        }
+    }
+    IdSet* online = m ? id_set_build(l->ids, online_count) : NULL;
+    GroupEntry* e = (m && online) ? new_entry(group_name, owner, m, online) : NULL;
+    if (!e) {
+        id_set_release(m);
+        id_set_release(online);
+    }
+    return e;
+}
+
+static void free_entry(GroupEntry* e) {
+    id_set_release(e->members);
+    id_set_release(e->online);
+    free(e);
+}
+
+// Dựng entry và đưa vào bảng; gọi khi giữ write lock.
+static GroupEntry* insert_loaded_locked(const char* group_name, UserId owner, IdLoader* l) {
+    GroupEntry* e = build_loaded_entry(group_name, owner, l);
+    if (e && table_insert_locked(&group_table, &e->key) != 0) {
+        free_entry(e);
+        e = NULL;
+    }
+    return e;
+}
+
+// Ghi nhớ group không tồn tại; gọi khi giữ write lock. Quá GROUP_MISSING_MAX tên thì
+// không nhớ nữa (tên rác gửi liên tục không làm bảng phình mãi).
+static void insert_missing_locked(const char* group_name) {
+    if (missing_count >= GROUP_MISSING_MAX) return;
+    IdSet* m = id_set_build(NULL, 0);
+    IdSet* online = id_set_build(NULL, 0);
+    GroupEntry* e = (m && online) ? new_entry(group_name, 0, m, online) : NULL;
+    if (!e) {
+        id_set_release(m);
+        id_set_release(online);
+        return;
+    }
+    e->missing = 1;
+    if (table_insert_locked(&group_table, &e->key) != 0) {
+        free_entry(e);
+        return;
+    }
+    missing_count++;
+}
+
+// Tìm entry, nạp từ DB nếu chưa có trong cache. Trả về NULL nếu group không tồn tại.
+// Truy vấn DB chạy ngoài lock, write lock chỉ giữ lúc đưa kết quả vào bảng. Thêm/bớt thành
+// viên (hoặc tạo group) chen ngang thì nạp lại; bị chen ngang quá GROUP_LOAD_RETRIES lần thì
+// bản vừa đọc chỉ dùng cho lần gọi này: *uncached = 1 và caller trả lại entry bằng put_entry.
+static GroupEntry* lookup_or_load(sqlite3* db, const char* group_name, int* uncached) {
+    *uncached = 0;
+    if (!group_name || group_name[0] == '\0') return NULL;
+    uint32_t hash = name_hash(group_name);
+    unsigned* gen = &group_gen[hash & (GROUP_GEN_STRIPES - 1)];
+
+    for (int attempt = 1;; attempt++) {
+        pthread_rwlock_rdlock(&group_lock);
+        GroupEntry* e = find_entry_locked(group_name, hash);
+        int known = e != NULL;
+        if (e && e->missing) e = NULL;
+        unsigned seen = *gen;
+        pthread_rwlock_unlock(&group_lock);
+        if (known || !db) return e;
+
+        UserId owner = 0;
+        IdLoader l = { NULL, 0, 0, 0 };
+        int rc = load_group(db, group_name, &owner, &l);
+
+        pthread_rwlock_wrlock(&group_lock);
+        // Thread khác có thể đã nạp xong trước: dùng entry của nó, bỏ bản vừa đọc
+        e = find_entry_locked(group_name, hash);
+        int stale = !e && rc >= 0 && *gen != seen;
+        if (!e && rc == 0 && !stale) {
+            e = insert_loaded_locked(group_name, owner, &l);
+            if (!e) LOG_WARN("Group cache: cannot load group '%s'.", group_name);
+        } else if (!e && rc > 0 && !stale) {
+            insert_missing_locked(group_name);
+        }
+        if (e && e->missing) e = NULL;
+        pthread_rwlock_unlock(&group_lock);
+
+        if (stale && attempt >= GROUP_LOAD_RETRIES) {
+            e = rc == 0 ? build_loaded_entry(group_name, owner, &l) : NULL;
+            if (e) *uncached = 1;
+            else if (rc == 0) LOG_WARN("Group cache: cannot load group '%s'.", group_name);
+            stale = 0;
+        }
+        free(l.ids);
+        if (!stale) return e;
+    }
+}
+
+// Trả lại entry lấy từ lookup_or_load: bản không được cache thì giải phóng
+static void put_entry(GroupEntry* e, int uncached) {
+    if (e && uncached) free_entry(e);
+}
+
+static IdSet* acquire_set(IdSet** set) {
+    pthread_rwlock_rdlock(&group_lock);
+    IdSet* m = *set;
+    id_set_retain(m);
+    pthread_rwlock_unlock(&group_lock);
+    return m;
+}
+
+// Thêm/bớt id trong 1 tập của group; gọi khi đang giữ write lock.
+// Bản cũ được trả về qua *old để release sau khi mở lock.
+static void set_contains_locked(const char* group_name, IdSet** set, UserId id, int want, IdSet** old) {
+    if (id_set_contains(*set, id) == want) return;
+    IdSet* m = id_set_with_change(*set, id, want);
+    if (!m) {
+        LOG_ERROR("Group cache: out of memory updating '%s'.", group_name);
+        return;
+    }
+    *old = *set;
+    *set = m;
+}
+
+// Như trên cho tập tên group của 1 user
+static void groups_contains_locked(UserId user, NameSet** set, const char* group_name, int want, NameSet** old) {
+    if ((name_set_find(*set, group_name) >= 0) == want) return;
+    NameSet* m = name_set_with_change(*set, group_name, want);
+    if (!m) {
+        LOG_ERROR("Group cache: out of memory updating groups of user %u.", user);
+        return;
+    }
+    *old = *set;
+    *set = m;
+}
+
+// Đồng bộ trạng thái online của user trong group theo danh bạ.
+// Login/logout ở reactor khác có thể chen ngang nên luôn đọc lại danh bạ dưới lock
+// thay vì tin vào sự kiện vừa nhận.
+static void sync_online_locked(GroupEntry* e, UserId user, IdSet** old) {
+    int want = id_set_contains(e->members, user) && registry_lookup_user(user, NULL, NULL) == 0;
+    set_contains_locked(e->key.name, &e->online, user, want, old);
+}
+
+// ----- API -----
+
+int group_cache_ready(const char* group_name) {
+    if (!group_name || group_name[0] == '\0') return 1;
+    pthread_rwlock_rdlock(&group_lock);
+    int ready = find_entry_locked(group_name, name_hash(group_name)) != NULL;
+    pthread_rwlock_unlock(&group_lock);
+    return ready;
+}
+
+int group_cache_exists(sqlite3* db, const char* group_name) {
+    int uncached;
+    GroupEntry* e = lookup_or_load(db, group_name, &uncached);
+    put_entry(e, uncached);
+    return e != NULL;
+}
+
+int group_cache_is_member(sqlite3* db, const char* group_name, UserId user) {
+    if (!user) return 0;
+    int uncached;
+    GroupEntry* e = lookup_or_load(db, group_name, &uncached);
+    if (!e) return 0;
+    IdSet* m = acquire_set(&e->members);
+    int is_member = id_set_contains(m, user);
+    id_set_release(m);
+    put_entry(e, uncached);
+    return is_member;
+}
+
+int group_cache_is_owner(sqlite3* db, const char* group_name, UserId user) {
+    if (!user) return 0;
+    int uncached;
+    GroupEntry* e = lookup_or_load(db, group_name, &uncached);
+    int is_owner = e && e->owner == user;
+    put_entry(e, uncached);
+    return is_owner;
+}
+
+int group_cache_for_each_member(sqlite3* db, const char* group_name, user_id_fn callback, void* arg) {
+    int uncached;
+    GroupEntry* e = lookup_or_load(db, group_name, &uncached);
+    if (!e) return 1;
+    IdSet* m = acquire_set(&e->members);
+    for (int i = 0; i < m->count; i++) {
+        callback(arg, m->ids[i]);
+    }
+    id_set_release(m);
+    put_entry(e, uncached);
+    return 0;
+}
+
+int group_cache_for_each_online_member(sqlite3* db, const char* group_name, user_id_fn callback, void* arg) {
+    int uncached;
+    GroupEntry* e = lookup_or_load(db, group_name, &uncached);
+    if (!e) return 1;
+    IdSet* m = acquire_set(&e->online);
+    for (int i = 0; i < m->count; i++) {
+        callback(arg, m->ids[i]);
+    }
+    id_set_release(m);
+    put_entry(e, uncached);
+    return 0;
+}
+
+int group_cache_for_each_member_by_presence(sqlite3* db, const char* group_name,
+                                            user_id_fn online_cb,
+                                            user_id_fn offline_cb, void* arg) {
+    int uncached;
+    GroupEntry* e = lookup_or_load(db, group_name, &uncached);
+    if (!e) return 1;
+    // Cùng 1 snapshot cho cả 2 lượt để user login/logout giữa chừng không bị bỏ sót
+    IdSet* online = acquire_set(&e->online);
+    for (int i = 0; online_cb && i < online->count; i++) {
+        online_cb(arg, online->ids[i]);
+    }
+    if (offline_cb) {
+        IdSet* m = acquire_set(&e->members);
+        for (int i = 0; i < m->count; i++) {
+            if (!id_set_contains(online, m->ids[i])) offline_cb(arg, m->ids[i]);
+        }
+        id_set_release(m);
+    }
+    id_set_release(online);
+    put_entry(e, uncached);
+    return 0;
+}
+
+void group_cache_on_create(const char* group_name, UserId owner) {
+    uint32_t hash = name_hash(group_name);
+
+    NameSet* old_groups = NULL;
+    IdSet* old_members = NULL;
+    IdSet* old_online = NULL;
+    pthread_rwlock_wrlock(&group_lock);
+    group_gen[hash & (GROUP_GEN_STRIPES - 1)]++;
+    user_gen[owner & (GROUP_GEN_STRIPES - 1)]++;
+    UserGroupsEntry* u = find_user_locked(owner);
+    if (u) groups_contains_locked(owner, &u->groups, group_name, 1, &old_groups);
+    GroupEntry* found = find_entry_locked(group_name, hash);
+    if (!found || found->missing) {
+        int owner_online = registry_lookup_user(owner, NULL, NULL) == 0;
+        IdSet* m = id_set_build(&owner, 1);
+        IdSet* online = id_set_build(&owner, owner_online ? 1 : 0);
+        if (found && m && online) {
+            // Tên từng được nhớ là không tồn tại: dùng lại entry đó
+            old_members = found->members;
+            old_online = found->online;
+            found->members = m;
+            found->online = online;
+            found->owner = owner;
+            found->missing = 0;
+            missing_count--;
+        } else {
+            GroupEntry* e = (!found && m && online) ? new_entry(group_name, owner, m, online) : NULL;
+            if (!e || table_insert_locked(&group_table, &e->key) != 0) {
+                // Không cache được: lần truy cập sau sẽ nạp lại từ DB
+                id_set_release(m);
+                id_set_release(online);
+                free(e);
+            }
+        }
+    }
+    pthread_rwlock_unlock(&group_lock);
+    name_set_release(old_groups);
+    id_set_release(old_members);
+    id_set_release(old_online);
+}
+
+static void apply_member_change(const char* group_name, UserId user, int add) {
+    uint32_t hash = name_hash(group_name);
+    IdSet* old_members = NULL;
+    IdSet* old_online = NULL;
+    NameSet* old_groups = NULL;
+
+    pthread_rwlock_wrlock(&group_lock);
+    group_gen[hash & (GROUP_GEN_STRIPES - 1)]++;
+    user_gen[user & (GROUP_GEN_STRIPES - 1)]++;
+    GroupEntry* e = find_entry_locked(group_name, hash);
+    // Entry chưa được nạp thì không cần làm gì, lần nạp sau sẽ đọc dữ liệu mới từ DB
+    if (e && !e->missing) {
+        set_contains_locked(group_name, &e->members, user, add, &old_members);
+        sync_online_locked(e, user, &old_online);
+    }
+    UserGroupsEntry* u = find_user_locked(user);
+    if (u) groups_contains_locked(user, &u->groups, group_name, add, &old_groups);
+    pthread_rwlock_unlock(&group_lock);
+    id_set_release(old_members);
+    id_set_release(old_online);
+    name_set_release(old_groups);
+}
+
+void group_cache_on_member_added(const char* group_name, UserId user) {
+    if (!group_name || !user) return;
+    apply_member_change(group_name, user, 1);
+}
+
+void group_cache_on_member_removed(const char* group_name, UserId user) {
+    if (!group_name || !user) return;
+    apply_member_change(group_name, user, 0);
+}
+
+// Đọc tên các group user đã tham gia từ DB, không giữ lock. NULL nếu lỗi DB / hết bộ nhớ.
+static NameSet* load_user_groups(sqlite3* db, UserId user) {
+    NameLoader l = { NULL, 0, 0, 0 };
+    uint64_t start = metrics_now();
+    int rc = db_get_groups_for_user(db, user, load_group_cb, &l);
+    metrics_record_db(metrics_current_type(), start);
+    NameSet* set = (rc == 0 && !l.failed) ? name_set_build(l.names, l.count) : NULL;
+    free(l.names);
+    return set;
+}
+
+// Lấy (retain) tập group của user, nạp từ DB nếu chưa có. NULL nếu không nạp được.
+// Như lookup_or_load, truy vấn chạy ngoài lock; bị chen ngang quá GROUP_LOAD_RETRIES lần
+// thì bản vừa đọc chỉ dùng cho lần gọi này, không cache.
+static NameSet* acquire_user_groups(sqlite3* db, UserId user) {
+    unsigned* gen = &user_gen[user & (GROUP_GEN_STRIPES - 1)];
+
+    for (int attempt = 1;; attempt++) {
+        NameSet* groups = NULL;
+        pthread_rwlock_rdlock(&group_lock);
+        UserGroupsEntry* u = find_user_locked(user);
+        if (u) {
+            groups = u->groups;
+            name_set_retain(groups);
+        }
+        unsigned seen = *gen;
+        pthread_rwlock_unlock(&group_lock);
+        if (u || !db) return groups;
+
+        NameSet* set = load_user_groups(db, user);
+        if (!set) LOG_WARN("Group cache: cannot load groups of user %u.", user);
+
+        pthread_rwlock_wrlock(&group_lock);
+        u = find_user_locked(user);
+        int stale = !u && set && *gen != seen;
+        if (!u && set && !stale) {
+            u = calloc(1, sizeof(UserGroupsEntry));
+            void** slot = u ? id_table_slot(&user_table, user, 1) : NULL;
+            if (slot) {
+                u->groups = set;
+                set = NULL;
+                __atomic_store_n(slot, u, __ATOMIC_RELEASE);
+            } else {
+                free(u);
+                u = NULL;
+            }
+        }
+        if (u) {
+            groups = u->groups;
+            name_set_retain(groups);
+        }
+        pthread_rwlock_unlock(&group_lock);
+
+        if (u) {
+            name_set_release(set);
+            return groups;
+        }
+        if (stale && attempt < GROUP_LOAD_RETRIES) {
+            name_set_release(set);
+            continue;
+        }
+        return set;
+    }
+}
+
+int group_cache_for_each_user_group(sqlite3* db, UserId user, db_group_list_callback callback, void* arg) {
+    if (!user || !callback) return 1;
+    NameSet* groups = acquire_user_groups(db, user);
+    if (!groups) {
+        return db ? db_get_groups_for_user(db, user, callback, arg) : 1;
+    }
+    for (int i = 0; i < groups->count; i++) {
+        callback(arg, groups->names[i]);
+    }
+    name_set_release(groups);
+    return 0;
+}
+
+// Group chưa nạp thì không có gì để sửa: lần nạp sau lấy tập online từ danh bạ
+static int presence_group_cb(void* arg, const char* group_name) {
+    UserId user = *(const UserId*)arg;
+    IdSet* old = NULL;
+
+    pthread_rwlock_wrlock(&group_lock);
+    GroupEntry* e = find_entry_locked(group_name, name_hash(group_name));
+    if (e) sync_online_locked(e, user, &old);
+    pthread_rwlock_unlock(&group_lock);
+    id_set_release(old);
+    return 0;
+}
+
+void group_cache_on_user_online(UserId user) {
+    if (!user) return;
+    group_cache_for_each_user_group(NULL, user, presence_group_cb, &user);
+}
+
+void group_cache_on_user_offline(UserId user) {
+    if (!user) return;
+    group_cache_for_each_user_group(NULL, user, presence_group_cb, &user);
+}
@@ -0,0 +1,51 @@
+#ifndef GROUP_CACHE_H
+#define GROUP_CACHE_H
+
+#include <sqlite3.h>
+#include "db_handler.h"
+#include "id_set.h"
+
+// Cache trong bộ nhớ cho metadata + danh sách thành viên của group, dùng chung cho mọi reactor.
+//  - Nạp lười (lazy) từ DB ở lần truy cập đầu tiên; truy vấn chạy ngoài lock, bị cập nhật
+//    chen ngang thì nạp lại.
+//  - Write-through: handler ghi DB trước, thành công rồi mới gọi group_cache_on_*.
+//  - Mỗi group giữ thêm tập thành viên đang online để fan-out chỉ duyệt người online.
+//  - Group không tồn tại cũng được nhớ (cache âm, tối đa GROUP_MISSING_MAX tên) cho tới khi
+//    được tạo.
+// Danh sách thành viên là copy-on-write nên duyệt thành viên không giữ lock.
+// Reactor truyền db = NULL: chỉ đọc cache, group chưa nạp coi như không có. Handler kiểm tra
+// group_cache_ready trước, chưa có thì nạp trên worker DB (gọi hàm bất kỳ với db của worker).
+
+// 1 nếu group (hoặc việc group không tồn tại) đã nằm trong cache: trả lời được với db = NULL
+int group_cache_ready(const char* group_name);
+
+// 1 nếu group tồn tại, 0 nếu không
+int group_cache_exists(sqlite3* db, const char* group_name);
+int group_cache_is_member(sqlite3* db, const char* group_name, UserId user);
+int group_cache_is_owner(sqlite3* db, const char* group_name, UserId user);
+
+// Gọi callback cho từng thành viên. Trả về 0 nếu thành công, 1 nếu group không tồn tại.
+int group_cache_for_each_member(sqlite3* db, const char* group_name, user_id_fn callback, void* arg);
+
+// Chỉ duyệt thành viên đang online: O(số người online) thay vì O(số thành viên)
+int group_cache_for_each_online_member(sqlite3* db, const char* group_name, user_id_fn callback, void* arg);
+// Gọi online_cb cho thành viên online, offline_cb cho những người còn lại (callback có thể NULL)
+int group_cache_for_each_member_by_presence(sqlite3* db, const char* group_name,
+                                            user_id_fn online_cb,
+                                            user_id_fn offline_cb, void* arg);
+
+// Các group user đã tham gia (chỉ mục ngược, nạp lười từ DB). Trả về 0 nếu thành công,
+// 1 nếu lỗi hoặc chưa nạp mà db = NULL.
+int group_cache_for_each_user_group(sqlite3* db, UserId user, db_group_list_callback callback, void* arg);
+
+// Gọi trên reactor sau khi user đã claim id (login) / đã rời danh bạ (logout): cập nhật tập
+// online của mọi group user tham gia đã có trong cache (presence_prefetch nạp sẵn lúc login).
+void group_cache_on_user_online(UserId user);
+void group_cache_on_user_offline(UserId user);
+
+// Cập nhật sau khi DB đã ghi thành công
+void group_cache_on_create(const char* group_name, UserId owner);
+void group_cache_on_member_added(const char* group_name, UserId user);
+void group_cache_on_member_removed(const char* group_name, UserId user);
+
+#endif
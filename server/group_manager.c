@@ -1,6 +1,9 @@
 #include "group_manager.h"
 #include "db_handler.h"
+#include "group_cache.h"
+#include "presence.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -13,64 +16,370 @@ static void send_packet_fd(int fd, MessageType type, const char* source, const c
     if (source) strncpy(p.source_user, source, MAX_USERNAME-1);
     if (target) strncpy(p.target_user, target, MAX_USERNAME-1);
     if (body) strncpy(p.body, body, MAX_BODY-1);
-    write(fd, &p, sizeof(ChatPacket));
+    server_send_packet(fd, &p);
 }
 
-// find_session_by_username is in message_handler.c
-extern ClientSession* find_session_by_username(const char* user, ClientSession* sessions);
+// helper to send packet to an online user (may live on another reactor)
+static int send_packet_user(UserId user, MessageType type, const char* source, const char* target, const char* body) {
+    ChatPacket p;
+    memset(&p, 0, sizeof(p));
+    p.type = type;
+    if (source) strncpy(p.source_user, source, MAX_USERNAME-1);
+    if (target) strncpy(p.target_user, target, MAX_USERNAME-1);
+    if (body) strncpy(p.body, body, MAX_BODY-1);
+    return server_send_to_id(user, &p);
+}
+
+// UserId của client đã login trên fd này (0 nếu chưa login)
+static UserId session_user_id(int fd) {
+    ClientSession* session = get_session(fd);
+    return session ? session->user_id : 0;
+}
+
+// ----- Thao tác ghi DB -----
+// Kiểm tra trên cache (bộ nhớ) làm ngay trên reactor; ghi DB chạy trên worker (group_work),
+// cập nhật cache + thông báo chạy lại trên reactor (group_done) khi DB đã ghi xong.
+// Key của job là người ra lệnh: các lệnh của cùng 1 user chạy theo thứ tự.
+
+typedef enum {
+    GROUP_OP_CREATE,
+    GROUP_OP_JOIN,
+    GROUP_OP_INVITE,
+    GROUP_OP_REMOVE,
+    GROUP_OP_LEAVE,
+    GROUP_OP_LIST_JOINED,
+    GROUP_OP_LIST_ALL,
+} GroupOp;
+
+#define GROUP_USER_NOT_FOUND -1
+
+typedef struct {
+    SessionRef ref;
+    GroupOp op;
+    char user[MAX_USERNAME];    // người ra lệnh
+    char member[MAX_USERNAME];  // người được mời / bị xóa
+    UserId user_id;
+    UserId member_id;           // tra trong group_work
+    char group[MAX_BODY];
+    int rc;                     // 0 = DB ghi thành công, GROUP_USER_NOT_FOUND nếu member không tồn tại
+    char list[MAX_BODY];        // kết quả GROUP_OP_LIST_*
+} GroupJob;
+
+typedef struct {
+    char acc[MAX_BODY];
+} GroupListBuilder;
 
-void handle_create_group(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+static int group_list_cb(void* arg, const char* group_name) {
+    GroupListBuilder* b = (GroupListBuilder*)arg;
+    if (strlen(b->acc) + strlen(group_name) + 3 < sizeof(b->acc)) {
+        if (b->acc[0] != '\0') strcat(b->acc, ", ");
+        strcat(b->acc, group_name);
+    }
+    return 0;
+}
+
+static void group_work(sqlite3 *db, void* arg) {
+    GroupJob* job = (GroupJob*)arg;
+    GroupListBuilder b; b.acc[0] = '\0';
+    if (job->op == GROUP_OP_INVITE || job->op == GROUP_OP_REMOVE) {
+        job->member_id = user_ids_resolve(db, job->member);
+        if (!job->member_id) {
+            job->rc = GROUP_USER_NOT_FOUND;
+            return;
+        }
+    }
+    switch (job->op) {
+        case GROUP_OP_CREATE:
+            job->rc = db_create_group(db, job->group, job->user_id);
+            if (job->rc == 0) db_add_group_member(db, job->group, job->user_id); // owner is member
+            break;
+        case GROUP_OP_JOIN:
+            job->rc = db_add_group_member(db, job->group, job->user_id);
+            break;
+        case GROUP_OP_INVITE:
+            job->rc = db_add_group_member(db, job->group, job->member_id);
+            break;
+        case GROUP_OP_REMOVE:
+            job->rc = db_remove_group_member(db, job->group, job->member_id);
+            break;
+        case GROUP_OP_LEAVE:
+            job->rc = db_remove_group_member(db, job->group, job->user_id);
+            break;
+        case GROUP_OP_LIST_JOINED:
+            job->rc = db_get_groups_for_user(db, job->user_id, group_list_cb, &b);
+            memcpy(job->list, b.acc, sizeof(job->list));
+            break;
+        case GROUP_OP_LIST_ALL:
+            job->rc = db_get_all_groups(db, group_list_cb, &b);
+            memcpy(job->list, b.acc, sizeof(job->list));
+            break;
+    }
+}
+
+// Trả lời người ra lệnh nếu kết nối của họ vẫn còn (fd có thể đã được dùng lại)
+static void reply_group(const GroupJob* job, MessageType type, const char* body) {
+    if (server_session_deref(job->ref)) send_packet_fd(job->ref.fd, type, "Server", NULL, body);
+}
+
+static void group_created(GroupJob* job) {
+    if (job->rc == 0) {
+        group_cache_on_create(job->group, job->user_id);
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Group created successfully.");
+    } else {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Failed to create group.");
+    }
+}
+
+// Callback duyệt thành viên online của các thông báo group
+typedef struct {
+    UserId joiner;
+    OutBuf* out;
+} JoinNotifyArg;
+
+static void join_notify_cb(void* arg, UserId member) {
+    JoinNotifyArg* na = (JoinNotifyArg*)arg;
+    if (member != na->joiner) {
+        server_send_outbuf_to_id(member, na->out);
+        presence_introduce(member, na->joiner); // giờ là peer của nhau
+    }
+}
+
+static void introduce_cb(void* arg, UserId member) {
+    presence_introduce(member, *(const UserId*)arg);
+}
+
+static void send_outbuf_cb(void* arg, UserId member) {
+    server_send_outbuf_to_id(member, (OutBuf*)arg);
+}
+
+static void group_joined(GroupJob* job) {
+    const char* user = job->user;
+    const char* group_name = job->group;
+    if (job->rc != 0) {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Failed to join group (maybe already a member).");
+        return;
+    }
+    group_cache_on_member_added(group_name, job->user_id);
+    // Notify group members that user joined (1 packet dùng chung cho mọi thành viên)
+    char body[MAX_BODY];
+    snprintf(body, sizeof(body), "%.*s joined the group %.*s.",
+             (int)MAX_USERNAME, user, (int)MAX_USERNAME, group_name);
+    JoinNotifyArg arg = { job->user_id, outbuf_make(MSG_TYPE_RECEIVE_GROUP_MESSAGE, user, group_name, body) };
+    group_cache_for_each_online_member(NULL, group_name, join_notify_cb, &arg);
+    outbuf_release(arg.out);
+
+    reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Joined group.");
+}
+
+static void group_invited(GroupJob* job) {
+    const char* inviter = job->user;
+    const char* group_name = job->group;
+    if (job->rc == GROUP_USER_NOT_FOUND) {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "User not found.");
+        return;
+    }
+    if (job->rc != 0) {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Failed to add user to group (maybe already a member).");
+        return;
+    }
+    group_cache_on_member_added(group_name, job->member_id);
+    // notify invitee if online
+    char body[MAX_BODY];
+    snprintf(body, sizeof(body), "You were added to group %.*s by %.*s",
+             (int)MAX_USERNAME, group_name, (int)MAX_USERNAME, inviter);
+    send_packet_user(job->member_id, MSG_TYPE_GROUP_RESPONSE, inviter, group_name, body);
+    // invitee và các thành viên online giờ là peer của nhau
+    group_cache_for_each_online_member(NULL, group_name, introduce_cb, &job->member_id);
+    reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Invite processed (user added).");
+}
+
+static void group_member_removed(GroupJob* job) {
+    const char* requester = job->user;
+    const char* target = job->member;
+    const char* group_name = job->group;
+    if (job->rc == GROUP_USER_NOT_FOUND) {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "User not found.");
+        return;
+    }
+    if (job->rc != 0) {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Failed to remove member (not a member?).");
+        return;
+    }
+    group_cache_on_member_removed(group_name, job->member_id);
+    // notify removed user if online
+    char body[MAX_BODY];
+    snprintf(body, sizeof(body), "You were removed from group %.*s by %.*s",
+             (int)MAX_USERNAME, group_name, (int)MAX_USERNAME, requester);
+    send_packet_user(job->member_id, MSG_TYPE_GROUP_RESPONSE, "Server", group_name, body);
+    // notify remaining members
+    snprintf(body, sizeof(body), "%.*s was removed from group %.*s.",
+             (int)MAX_USERNAME, target, (int)MAX_USERNAME, group_name);
+    OutBuf* out = outbuf_make(MSG_TYPE_RECEIVE_GROUP_MESSAGE, "Server", group_name, body);
+    group_cache_for_each_online_member(NULL, group_name, send_outbuf_cb, out);
+    outbuf_release(out);
+    reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Member removed.");
+}
+
+static void group_left(GroupJob* job) {
+    const char* leaver = job->user;
+    const char* group_name = job->group;
+    if (job->rc != 0) {
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Failed to leave group (maybe not a member).");
+        return;
+    }
+    group_cache_on_member_removed(group_name, job->user_id);
+    // announce to others
+    char body[MAX_BODY];
+    snprintf(body, sizeof(body), "%.*s left the group %.*s.",
+             (int)MAX_USERNAME, leaver, (int)MAX_USERNAME, group_name);
+    OutBuf* out = outbuf_make(MSG_TYPE_RECEIVE_GROUP_MESSAGE, leaver, group_name, body);
+    group_cache_for_each_online_member(NULL, group_name, send_outbuf_cb, out);
+    outbuf_release(out);
+    reply_group(job, MSG_TYPE_GROUP_RESPONSE, "You left the group.");
+}
+
+static void group_listed(GroupJob* job) {
+    char body[MAX_BODY];
+    if (job->op == GROUP_OP_LIST_JOINED) {
+        if (job->list[0] == '\0') snprintf(body, MAX_BODY, "You have not joined any groups.");
+        else snprintf(body, MAX_BODY, "Joined groups: %.*s",
+                      (int)(MAX_BODY - sizeof("Joined groups: ")), job->list);
+    } else {
+        if (job->list[0] == '\0') snprintf(body, MAX_BODY, "No groups available.");
+        else snprintf(body, MAX_BODY, "Available groups: %.*s",
+                      (int)(MAX_BODY - sizeof("Available groups: ")), job->list);
+    }
+    reply_group(job, MSG_TYPE_GROUP_LIST_RESPONSE, body);
+}
+
+static void group_done(sqlite3 *db, void* arg, int status) {
+    (void)db;
+    GroupJob* job = (GroupJob*)arg;
+    if (status != SQLITE_OK) {
+        // COMMIT lỗi, thay đổi đã bị ROLLBACK: không cập nhật cache, không gửi thông báo
+        reply_group(job, MSG_TYPE_GROUP_RESPONSE, "Server error, try again.");
+        free(job);
+        return;
+    }
+    switch (job->op) {
+        case GROUP_OP_CREATE:      group_created(job); break;
+        case GROUP_OP_JOIN:        group_joined(job); break;
+        case GROUP_OP_INVITE:      group_invited(job); break;
+        case GROUP_OP_REMOVE:      group_member_removed(job); break;
+        case GROUP_OP_LEAVE:       group_left(job); break;
+        case GROUP_OP_LIST_JOINED:
+        case GROUP_OP_LIST_ALL:    group_listed(job); break;
+    }
+    free(job);
+}
+
+static void submit_group_job(int client_fd, GroupOp op, const char* user, const char* member, const char* group) {
+    GroupJob* job = calloc(1, sizeof(GroupJob));
+    if (job) {
+        job->ref = server_session_ref(client_fd);
+        job->op = op;
+        job->user_id = session_user_id(client_fd);
+        strncpy(job->user, user, MAX_USERNAME - 1);
+        if (member) strncpy(job->member, member, MAX_USERNAME - 1);
+        if (group) strncpy(job->group, group, MAX_BODY - 1);
+        // Đọc danh sách: worker bất kỳ. Ghi: writer, và request sau của client chờ COMMIT
+        // (vd. GROUP_MESSAGE ngay sau JOIN phải thấy mình đã là thành viên)
+        int is_list = op == GROUP_OP_LIST_JOINED || op == GROUP_OP_LIST_ALL;
+        int flags = is_list ? 0 : DB_JOB_WRITE | DB_JOB_BARRIER;
+        if (db_pool_submit_for(client_fd, flags, job->user, group_work, group_done, job) == 0) return;
+        free(job);
+    }
+    send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Server busy, try again.");
+}
+
+// ----- Nạp group vào cache -----
+// Handler chạy trên reactor chỉ đọc cache. Group chưa có trong cache (kể cả cache âm) thì
+// nạp trên worker rồi chạy lại handler trên reactor; DB_JOB_BARRIER giữ thứ tự các request
+// sau của client.
+
+typedef void (*group_handler_fn)(int client_fd, ChatPacket* packet, sqlite3 *db);
+
+typedef struct {
+    SessionRef ref;
+    group_handler_fn handler;
+    ChatPacket packet;
+    char group[MAX_BODY];
+} GroupLoadJob;
+
+// Group vừa được nạp cho handler đang chạy lại: không nạp lần nữa dù cache vẫn chưa có
+// (lỗi DB, hoặc bị cập nhật chen ngang quá nhiều lần) -> handler dùng những gì cache có
+static __thread const char* loaded_group;
+
+static void group_load_work(sqlite3 *db, void* arg) {
+    GroupLoadJob* job = (GroupLoadJob*)arg;
+    group_cache_exists(db, job->group);
+}
+
+static void group_load_done(sqlite3 *db, void* arg, int status) {
+    (void)db;
+    (void)status;               // job đọc, không có COMMIT
+    GroupLoadJob* job = (GroupLoadJob*)arg;
+    if (server_session_deref(job->ref)) {
+        loaded_group = job->group;
+        job->handler(job->ref.fd, &job->packet, NULL);
+        loaded_group = NULL;
+    }
+    free(job);
+}
+
+// 0: group đã có trong cache, handler xử lý tiếp. 1: đã gửi job nạp (handler sẽ chạy lại)
+// hoặc đã trả lời lỗi, handler dừng.
+static int defer_until_cached(int client_fd, const ChatPacket* packet, const char* group_name,
+                              group_handler_fn handler) {
+    if (group_cache_ready(group_name)) return 0;
+    if (loaded_group && strcmp(loaded_group, group_name) == 0) return 0;
+    GroupLoadJob* job = calloc(1, sizeof(GroupLoadJob));
+    if (job) {
+        job->ref = server_session_ref(client_fd);
+        job->handler = handler;
+        job->packet = *packet;
+        strncpy(job->group, group_name, MAX_BODY - 1);
+        if (db_pool_submit_for(client_fd, DB_JOB_BARRIER, job->group, group_load_work, group_load_done, job) == 0) return 1;
+        free(job);
+    }
+    send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Server busy, try again.");
+    return 1;
+}
+
+void handle_create_group(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     const char* owner = packet->source_user;
     const char* group_name = packet->target_user;
     if (!group_name || strlen(group_name) == 0) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group name required.");
         return;
     }
-    if (db_group_exists(db, group_name)) {
+    if (defer_until_cached(client_fd, packet, group_name, handle_create_group)) return;
+    if (group_cache_exists(NULL, group_name)) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group already exists.");
         return;
     }
-    if (db_create_group(db, group_name, owner) == 0) {
-        db_add_group_member(db, group_name, owner); // owner is member
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group created successfully.");
-    } else {
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Failed to create group.");
-    }
+    submit_group_job(client_fd, GROUP_OP_CREATE, owner, NULL, group_name);
 }
 
-void handle_join_group_request(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+void handle_join_group_request(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     const char* user = packet->source_user;
     const char* group_name = packet->target_user;
     if (!group_name || strlen(group_name) == 0) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group name required.");
         return;
     }
-    if (!db_group_exists(db, group_name)) {
+    if (defer_until_cached(client_fd, packet, group_name, handle_join_group_request)) return;
+    if (!group_cache_exists(NULL, group_name)) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group not found.");
         return;
     }
-    if (db_add_group_member(db, group_name, user) != 0) {
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Failed to join group (maybe already a member).");
-        return;
-    }
-    // Notify group members that user joined
-    typedef struct { ClientSession* sessions; const char* joiner; const char* group; } NotifyArg;
-    NotifyArg arg = { sessions, user, group_name };
-    void cb(void* a, const char* member) {
-        NotifyArg* na = (NotifyArg*)a;
-        ClientSession* s = find_session_by_username(member, na->sessions);
-        if (s && s->fd != client_fd) {
-            char body[MAX_BODY];
-            snprintf(body, sizeof(body), "%s joined the group %s.", na->joiner, na->group);
-            send_packet_fd(s->fd, MSG_TYPE_RECEIVE_GROUP_MESSAGE, na->joiner, na->group, body);
-        }
-    }
-    db_get_group_members(db, group_name, (db_group_member_callback)cb, &arg);
-
-    send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Joined group.");
+    submit_group_job(client_fd, GROUP_OP_JOIN, user, NULL, group_name);
 }
 
-void handle_invite_to_group(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+void handle_invite_to_group(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     // packet->target_user = username to invite
     // packet->body = group_name
     const char* inviter = packet->source_user;
@@ -80,29 +389,20 @@ void handle_invite_to_group(int client_fd, ChatPacket* packet, ClientSession* se
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Invite requires username and group name (body).");
         return;
     }
-    if (!db_group_exists(db, group_name)) {
+    if (defer_until_cached(client_fd, packet, group_name, handle_invite_to_group)) return;
+    if (!group_cache_exists(NULL, group_name)) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group not found.");
         return;
     }
-    if (!db_is_group_owner(db, group_name, inviter)) {
+    if (!group_cache_is_owner(NULL, group_name, session_user_id(client_fd))) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Only owner can invite.");
         return;
     }
-    if (db_add_group_member(db, group_name, invitee) == 0) {
-        // notify invitee if online
-        ClientSession* s = find_session_by_username(invitee, sessions);
-        if (s) {
-            char body[MAX_BODY];
-            snprintf(body, sizeof(body), "You were added to group %s by %s", group_name, inviter);
-            send_packet_fd(s->fd, MSG_TYPE_GROUP_RESPONSE, inviter, group_name, body);
-        }
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Invite processed (user added).");
-    } else {
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Failed to add user to group (maybe already a member).");
-    }
+    submit_group_job(client_fd, GROUP_OP_INVITE, inviter, invitee, group_name);
 }
 
-void handle_remove_from_group(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+void handle_remove_from_group(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     // packet->target_user = username to remove
     // packet->body = group_name
     const char* requester = packet->source_user;
@@ -112,175 +412,101 @@ void handle_remove_from_group(int client_fd, ChatPacket* packet, ClientSession*
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Remove requires username and group name in body.");
         return;
     }
-    if (!db_group_exists(db, group_name)) {
+    if (defer_until_cached(client_fd, packet, group_name, handle_remove_from_group)) return;
+    if (!group_cache_exists(NULL, group_name)) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group not found.");
         return;
     }
-    if (!db_is_group_owner(db, group_name, requester)) {
+    if (!group_cache_is_owner(NULL, group_name, session_user_id(client_fd))) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Only owner can remove members.");
         return;
     }
-    if (db_remove_group_member(db, group_name, target) == 0) {
-        // notify removed user if online
-        ClientSession* s = find_session_by_username(target, sessions);
-        if (s) {
-            char body[MAX_BODY];
-            snprintf(body, sizeof(body), "You were removed from group %s by %s", group_name, requester);
-            send_packet_fd(s->fd, MSG_TYPE_GROUP_RESPONSE, "Server", group_name, body);
-        }
-        // notify remaining members
-        typedef struct { ClientSession* sessions; const char* who; const char* group; } RemArg;
-        RemArg r = { sessions, target, group_name };
-        void cb2(void* a, const char* member) {
-            RemArg* ra = (RemArg*)a;
-            ClientSession* s2 = find_session_by_username(member, ra->sessions);
-            if (s2) {
-                char body2[MAX_BODY];
-                snprintf(body2, sizeof(body2), "%s was removed from group %s.", ra->who, ra->group);
-                send_packet_fd(s2->fd, MSG_TYPE_RECEIVE_GROUP_MESSAGE, "Server", ra->group, body2);
-            }
-        }
-        db_get_group_members(db, group_name, (db_group_member_callback)cb2, &r);
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Member removed.");
-    } else {
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Failed to remove member (not a member?).");
-    }
+    submit_group_job(client_fd, GROUP_OP_REMOVE, requester, target, group_name);
 }
 
-void handle_leave_group(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+void handle_leave_group(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     const char* leaver = packet->source_user;
     const char* group_name = packet->target_user;
     if (!group_name) {
         send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group name required.");
         return;
     }
-    if (db_remove_group_member(db, group_name, leaver) != 0) {
-        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Failed to leave group (maybe not a member).");
-        return;
-    }
-    // announce to others
-    typedef struct { ClientSession* sessions; const char* who; const char* group; } LArg;
-    LArg la = { sessions, leaver, group_name };
-    void cb(void* a, const char* member) {
-        LArg* lar = (LArg*)a;
-        ClientSession* s = find_session_by_username(member, lar->sessions);
-        if (s) {
-            char body[MAX_BODY];
-            snprintf(body, sizeof(body), "%s left the group %s.", lar->who, lar->group);
-            send_packet_fd(s->fd, MSG_TYPE_RECEIVE_GROUP_MESSAGE, lar->who, lar->group, body);
-        }
-    }
-    db_get_group_members(db, group_name, (db_group_member_callback)cb, &la);
-    send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "You left the group.");
+    // group_left báo cho các thành viên online qua cache
+    if (defer_until_cached(client_fd, packet, group_name, handle_leave_group)) return;
+    submit_group_job(client_fd, GROUP_OP_LEAVE, leaver, NULL, group_name);
 }
 
 // File-scope context for forwarding to members
 typedef struct {
-    ClientSession* sessions;
-    const char* sender;
-    const char* group;
-    ChatPacket* pkt;
-    sqlite3* db;
+    UserId sender_id;
+    OutBuf* out;        // packet chuyển tiếp, mã hóa 1 lần cho cả group
+    int has_offline;    // có thành viên lỡ tin -> lưu tin vào log group
 } GArg_forward;
 
-// static callback used by db_get_group_members
-static void member_forward_cb(void* arg, const char* member) {
+// online callback used by group_cache_for_each_member_by_presence
+static void member_forward_cb(void* arg, UserId member) {
     GArg_forward* g = (GArg_forward*)arg;
-    if (!g || !member) return;
-    if (strcmp(member, g->sender) == 0) return;
-    ClientSession* s = find_session_by_username(member, g->sessions);
-    if (s && s->fd != -1) {
-        ChatPacket out;
-        memset(&out, 0, sizeof(out));
-        out.type = MSG_TYPE_RECEIVE_GROUP_MESSAGE;
-        strncpy(out.source_user, g->sender, MAX_USERNAME-1);
-        strncpy(out.target_user, g->group, MAX_USERNAME-1);
-        strncpy(out.body, g->pkt->body, MAX_BODY-1);
-        write(s->fd, &out, sizeof(ChatPacket));
-    } else {
-        // offline -> store as offline message for that member
-        if (g->db) db_store_offline_message(g->db, g->sender, member, g->pkt->body);
-    }
+    if (!g || member == g->sender_id) return;
+    // forward (possibly to another reactor); member logged out meanwhile -> đọc lại từ log group
+    if (!server_deliver_group_outbuf_to_id(member, g->out)) g->has_offline = 1;
 }
 
-void handle_group_message(ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+// offline callback used by group_cache_for_each_member_by_presence:
+// chỉ đánh dấu, tin được lưu 1 lần vào log của group (member đọc theo con trỏ khi login)
+static void member_store_offline_cb(void* arg, UserId member) {
+    GArg_forward* g = (GArg_forward*)arg;
+    if (!g || member == g->sender_id) return;
+    g->has_offline = 1;
+}
+
+void handle_group_message(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     const char* group_name = packet->target_user;
     const char* sender = packet->source_user;
+    UserId sender_id = session_user_id(client_fd);
 
     // 1. Basic validation
     if (!group_name || strlen(group_name) == 0) {
-        ClientSession* s = find_session_by_username(sender, sessions);
-        if (s) send_packet_fd(s->fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Missing group name.");
+        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Missing group name.");
         return;
     }
 
     // 2. Check group existence
-    if (!db_group_exists(db, group_name)) {
-        ClientSession* s = find_session_by_username(sender, sessions);
-        if (s) send_packet_fd(s->fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group not found.");
+    if (defer_until_cached(client_fd, packet, group_name, handle_group_message)) return;
+    if (!group_cache_exists(NULL, group_name)) {
+        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "Group not found.");
         return;
     }
 
     // 3. Check membership: only group members may send messages
-    if (!db_is_group_member(db, group_name, sender)) {
-        ClientSession* s = find_session_by_username(sender, sessions);
-        if (s) send_packet_fd(s->fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "You are not a member of this group.");
+    if (!group_cache_is_member(NULL, group_name, sender_id)) {
+        send_packet_fd(client_fd, MSG_TYPE_GROUP_RESPONSE, "Server", NULL, "You are not a member of this group.");
         return;
     }
 
-    // 4. Broadcast to all group members except sender (and store offline for offline members)
+    // 4. Broadcast to online members except sender, then store offline for the rest
     GArg_forward ga;
-    ga.sessions = sessions;
-    ga.sender = sender;
-    ga.group = group_name;
-    ga.pkt = packet;
-    ga.db = db;
+    ga.sender_id = sender_id;
+    ga.out = outbuf_make(MSG_TYPE_RECEIVE_GROUP_MESSAGE, sender, group_name, packet->body);
+    ga.has_offline = 0;
 
-    db_get_group_members(db, group_name, (db_group_member_callback)member_forward_cb, &ga);
+    group_cache_for_each_member_by_presence(NULL, group_name, member_forward_cb, member_store_offline_cb, &ga);
+    // Không tạo được packet (hết bộ nhớ): mọi thành viên lỡ tin, đọc lại từ log
+    int store = ga.out ? server_group_outbuf_sent(ga.out, ga.has_offline) : ga.has_offline;
+    if (store) db_pool_append_group_message(group_name, sender_id, packet->body);
+    outbuf_release(ga.out);
 }
 
-// --- NEW: helpers to build list responses ---
-
-typedef struct {
-    char acc[MAX_BODY];
-} GroupListBuilder;
+// --- NEW: list responses (đọc DB trên worker) ---
 
-static int group_list_cb(void* arg, const char* group_name) {
-    GroupListBuilder* b = (GroupListBuilder*)arg;
-    if (strlen(b->acc) + strlen(group_name) + 3 < sizeof(b->acc)) {
-        if (b->acc[0] != '\0') strcat(b->acc, ", ");
-        strcat(b->acc, group_name);
-    }
-    return 0;
-}
-
-void handle_group_list_joined(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
+void handle_group_list_joined(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
     // packet->source_user is the user; return groups this user joined
-    GroupListBuilder b; b.acc[0] = '\0';
-    db_get_groups_for_user(db, packet->source_user, group_list_cb, &b);
-
-    ChatPacket resp; memset(&resp, 0, sizeof(resp));
-    resp.type = MSG_TYPE_GROUP_LIST_RESPONSE;
-    strncpy(resp.source_user, "Server", MAX_USERNAME-1);
-    if (b.acc[0] == '\0') {
-        snprintf(resp.body, MAX_BODY, "You have not joined any groups.");
-    } else {
-        snprintf(resp.body, MAX_BODY, "Joined groups: %s", b.acc);
-    }
-    write(client_fd, &resp, sizeof(ChatPacket));
+    submit_group_job(client_fd, GROUP_OP_LIST_JOINED, packet->source_user, NULL, NULL);
 }
 
-void handle_group_list_all(int client_fd, ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
-    GroupListBuilder b; b.acc[0] = '\0';
-    db_get_all_groups(db, group_list_cb, &b);
-
-    ChatPacket resp; memset(&resp, 0, sizeof(resp));
-    resp.type = MSG_TYPE_GROUP_LIST_RESPONSE;
-    strncpy(resp.source_user, "Server", MAX_USERNAME-1);
-    if (b.acc[0] == '\0') {
-        snprintf(resp.body, MAX_BODY, "No groups available.");
-    } else {
-        snprintf(resp.body, MAX_BODY, "Available groups: %s", b.acc);
-    }
-    write(client_fd, &resp, sizeof(ChatPacket));
+void handle_group_list_all(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
+    submit_group_job(client_fd, GROUP_OP_LIST_ALL, packet->source_user, NULL, NULL);
 }
@@ -0,0 +1,71 @@
+#include "id_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+void id_set_retain(IdSet* set) {
+    if (set) __atomic_add_fetch(&set->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void id_set_release(IdSet* set) {
+    if (!set) return;
+    if (__atomic_sub_fetch(&set->refcount, 1, __ATOMIC_ACQ_REL) == 0) free(set);
+}
+
+static IdSet* alloc_set(int count) {
+    IdSet* set = malloc(sizeof(IdSet) + sizeof(UserId) * (count > 0 ? count : 1));
+    if (!set) return NULL;
+    set->refcount = 1;
+    set->count = 0;
+    return set;
+}
+
+static int compare_id(const void* a, const void* b) {
+    UserId x = *(const UserId*)a;
+    UserId y = *(const UserId*)b;
+    return (x > y) - (x < y);
+}
+
+IdSet* id_set_build(const UserId* ids, int count) {
+    IdSet* set = alloc_set(count);
+    if (!set) return NULL;
+    if (count > 0) memcpy(set->ids, ids, sizeof(UserId) * count);
+    qsort(set->ids, count, sizeof(UserId), compare_id);
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (set->ids[i] == 0 || (n > 0 && set->ids[n - 1] == set->ids[i])) continue;
+        set->ids[n++] = set->ids[i];
+    }
+    set->count = n;
+    return set;
+}
+
+// Vị trí đầu tiên có ids[pos] >= id
+static int lower_bound(const IdSet* set, UserId id) {
+    int lo = 0, hi = set ? set->count : 0;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (set->ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int id_set_contains(const IdSet* set, UserId id) {
+    int pos = lower_bound(set, id);
+    return set && pos < set->count && set->ids[pos] == id;
+}
+
+IdSet* id_set_with_change(const IdSet* old, UserId id, int add) {
+    int n = old ? old->count : 0;
+    int pos = lower_bound(old, id);
+    int present = pos < n && old->ids[pos] == id;
+    IdSet* set = alloc_set(n + 1);
+    if (!set) return NULL;
+    if (pos > 0) memcpy(set->ids, old->ids, sizeof(UserId) * pos);
+    int count = pos;
+    if (add && id != 0) set->ids[count++] = id;
+    int rest = pos + (present ? 1 : 0);
+    if (rest < n) memcpy(set->ids + count, old->ids + rest, sizeof(UserId) * (n - rest));
+    set->count = count + (n - rest);
+    return set;
+}
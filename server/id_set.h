@@ -0,0 +1,27 @@
+#ifndef ID_SET_H
+#define ID_SET_H
+
+#include "user_ids.h"
+
+// Tập UserId bất biến (sắp tăng dần), dùng chung cho các cache: thành viên group, bạn bè, peer.
+// Như NameSet: mỗi thay đổi tạo bản mới (copy-on-write); reader giữ 1 reference trong lúc duyệt
+// nên writer chỉ cần đổi con trỏ dưới lock rồi release bản cũ.
+typedef struct {
+    int refcount;
+    int count;
+    UserId ids[];
+} IdSet;
+
+typedef void (*user_id_fn)(void* arg, UserId id);
+
+// Tạo tập mới từ mảng id (bỏ 0/trùng, mảng không bị sửa); refcount = 1. NULL nếu hết bộ nhớ.
+IdSet* id_set_build(const UserId* ids, int count);
+// Bản sao của `old` (có thể NULL) có thêm (add = 1) hoặc bớt (add = 0) id
+IdSet* id_set_with_change(const IdSet* old, UserId id, int add);
+
+int id_set_contains(const IdSet* set, UserId id);
+
+void id_set_retain(IdSet* set);
+void id_set_release(IdSet* set);
+
+#endif
@@ -0,0 +1,438 @@
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_HEADER_SIZE 20
+#define LOG_ARG_BYTES (LOG_RECORD_SIZE - LOG_HEADER_SIZE)
+#define LOG_LINE_MAX 2048           // dòng dài hơn bị cắt khi format
+#define LOG_OUT_BUF (1 << 16)
+#define LOG_IDLE_MIN_US 1000        // thread nền ngủ 1ms khi không có gì, tăng dần tới 10ms
+#define LOG_IDLE_MAX_US 10000
+
+// 1 bản ghi: format (chuỗi hằng của caller) + tham số đóng gói theo thứ tự xuất hiện trong format.
+// Số nguyên / con trỏ / số thực: 8 byte; chuỗi: 2 byte độ dài + nội dung (không có '\0').
+typedef struct {
+    uint64_t ts_ns;                 // CLOCK_REALTIME
+    const char* fmt;
+    uint8_t level;
+    uint8_t truncated;              // thiếu chỗ: phần tham số sau bị bỏ
+    uint16_t len;                   // số byte đã dùng trong args
+    unsigned char args[LOG_ARG_BYTES];
+} LogRecord;
+
+_Static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "LogRecord layout");
+_Static_assert((LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0, "LOG_RING_SLOTS must be a power of 2");
+
+// Ring của 1 thread: chỉ thread đó ghi head, chỉ thread nền ghi tail
+typedef struct LogRing {
+    struct LogRing* next;
+    char name[16];
+    uint64_t dropped;               // thread sở hữu ghi
+    uint64_t reported;              // thread nền: số bản ghi bỏ đã báo
+    uint32_t limit;                 // thread nền: head chụp lúc bắt đầu 1 lượt gom
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    LogRecord slots[LOG_RING_SLOTS];
+} LogRing;
+
+int log_runtime_level = LOG_LEVEL_INFO;
+
+// Ring của mọi thread đã từng log; chỉ thêm vào đầu (CAS), không bao giờ giải phóng
+static LogRing* rings = NULL;
+static int ring_count = 0;
+static __thread LogRing* local_ring = NULL;
+static __thread char thread_name[16];
+
+static int running = 0;             // thread nền đang nhận bản ghi
+static int stopping = 0;
+static pthread_t log_thread;
+
+// Trạng thái của thread nền
+static const char* out_path = NULL;
+static int out_fd = STDOUT_FILENO;
+static size_t out_bytes = 0;        // cỡ file hiện tại
+static size_t rotate_bytes = 0;
+static int rotate_keep = 0;
+static char out_buf[LOG_OUT_BUF];
+static size_t out_len = 0;
+
+static const char* level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+void log_set_level(int level) {
+    __atomic_store_n(&log_runtime_level, level, __ATOMIC_RELAXED);
+}
+
+int log_level_from_name(const char* name) {
+    static const char* names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = 0; i <= LOG_LEVEL_OFF; i++) {
+        if (strcmp(name, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Ring của thread hiện tại, cấp lần đầu thread log. NULL nếu hết bộ nhớ (bỏ bản ghi).
+static LogRing* get_ring(void) {
+    LogRing* r = local_ring;
+    if (r) return r;
+    if (posix_memalign((void**)&r, 64, sizeof(LogRing)) != 0) return NULL;
+    memset(r, 0, sizeof(LogRing));
+    int id = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+    if (thread_name[0]) memcpy(r->name, thread_name, sizeof(r->name));
+    else snprintf(r->name, sizeof(r->name), "t%d", id);
+    r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    local_ring = r;
+    return r;
+}
+
+void log_set_thread_name(const char* name) {
+    snprintf(thread_name, sizeof(thread_name), "%s", name);
+    if (!local_ring) get_ring();
+}
+
+// 1 đặc tả chuyển đổi của printf: text = "%" + flag/width/precision (không có length)
+typedef struct {
+    char text[24];
+    char length;                    // 'H' = hh, 'h', 'l', 'L' = ll, 'z', 'j', 't', 0
+    char conv;                      // 0 nếu format kết thúc giữa chừng
+} Spec;
+
+// p trỏ ngay sau '%'; trả về vị trí sau ký tự chuyển đổi
+static const char* parse_spec(const char* p, Spec* s) {
+    size_t n = 0;
+    s->text[n++] = '%';
+    while (*p && strchr("-+ #0'", *p)) {
+        if (n < sizeof(s->text) - 4) s->text[n++] = *p;
+        p++;
+    }
+    while ((*p >= '0' && *p <= '9') || *p == '.') {
+        if (n < sizeof(s->text) - 4) s->text[n++] = *p;
+        p++;
+    }
+    s->text[n] = '\0';
+    s->length = 0;
+    if (*p == 'h') { p++; s->length = 'h'; if (*p == 'h') { p++; s->length = 'H'; } }
+    else if (*p == 'l') { p++; s->length = 'l'; if (*p == 'l') { p++; s->length = 'L'; } }
+    else if (*p == 'z' || *p == 'j' || *p == 't') s->length = *p++;
+    s->conv = *p;
+    return *p ? p + 1 : p;
+}
+
+static int is_signed_conv(char c) { return c == 'd' || c == 'i'; }
+static int is_unsigned_conv(char c) { return c == 'u' || c == 'x' || c == 'X' || c == 'o'; }
+static int is_float_conv(char c) { return c && strchr("fFeEgGaA", c) != NULL; }
+
+// Đọc tham số theo format và chép vào rec (chạy trên thread gọi log)
+static void pack_record(LogRecord* rec, int level, const char* fmt, va_list ap) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    rec->fmt = fmt;
+    rec->level = (uint8_t)level;
+    rec->truncated = 0;
+    size_t len = 0;
+    for (const char* p = fmt; *p;) {
+        if (*p++ != '%') continue;
+        if (*p == '%') { p++; continue; }
+        Spec s;
+        p = parse_spec(p, &s);
+        uint64_t v;
+        if (is_signed_conv(s.conv)) {
+            long long x;
+            switch (s.length) {
+                case 'l': x = va_arg(ap, long); break;
+                case 'L': x = va_arg(ap, long long); break;
+                case 'z': x = va_arg(ap, ssize_t); break;
+                case 'j': x = va_arg(ap, intmax_t); break;
+                case 't': x = va_arg(ap, ptrdiff_t); break;
+                case 'H': x = (signed char)va_arg(ap, int); break;
+                case 'h': x = (short)va_arg(ap, int); break;
+                default: x = va_arg(ap, int); break;
+            }
+            v = (uint64_t)x;
+        } else if (is_unsigned_conv(s.conv)) {
+            switch (s.length) {
+                case 'l': v = va_arg(ap, unsigned long); break;
+                case 'L': v = va_arg(ap, unsigned long long); break;
+                case 'z': v = va_arg(ap, size_t); break;
+                case 'j': v = va_arg(ap, uintmax_t); break;
+                case 't': v = (uint64_t)va_arg(ap, ptrdiff_t); break;
+                case 'H': v = (unsigned char)va_arg(ap, unsigned); break;
+                case 'h': v = (unsigned short)va_arg(ap, unsigned); break;
+                default: v = va_arg(ap, unsigned); break;
+            }
+        } else if (s.conv == 'c') {
+            v = (uint64_t)va_arg(ap, int);
+        } else if (s.conv == 'p') {
+            v = (uint64_t)(uintptr_t)va_arg(ap, void*);
+        } else if (is_float_conv(s.conv)) {
+            double d = va_arg(ap, double);
+            memcpy(&v, &d, sizeof(v));
+        } else if (s.conv == 's') {
+            const char* str = va_arg(ap, const char*);
+            if (!str) str = "(null)";
+            if (len + 2 > LOG_ARG_BYTES) { rec->truncated = 1; break; }
+            size_t n = strlen(str);
+            if (n > LOG_ARG_BYTES - len - 2) { n = LOG_ARG_BYTES - len - 2; rec->truncated = 1; }
+            uint16_t n16 = (uint16_t)n;
+            memcpy(rec->args + len, &n16, 2);
+            memcpy(rec->args + len + 2, str, n);
+            len += 2 + n;
+            continue;
+        } else {
+            // Chuyển đổi không hỗ trợ: không biết kiểu tham số nên dừng ở đây
+            rec->truncated = 1;
+            break;
+        }
+        if (len + 8 > LOG_ARG_BYTES) { rec->truncated = 1; break; }
+        memcpy(rec->args + len, &v, 8);
+        len += 8;
+    }
+    rec->len = (uint16_t)len;
+}
+
+// Kẹp kết quả của snprintf vào số byte thực sự nằm trong buffer cỡ cap
+static size_t clamp(int n, size_t cap) {
+    if (n < 0) return 0;
+    return (size_t)n < cap ? (size_t)n : cap - 1;
+}
+
+// Dòng hoàn chỉnh (có '\n') của rec vào out (cap >= 64); trả về độ dài
+static size_t format_record(const LogRecord* rec, const char* thread, char* out, size_t cap) {
+    time_t sec = (time_t)(rec->ts_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    size_t n = strftime(out, cap, "%Y-%m-%d %H:%M:%S", &tm);
+    int level = rec->level <= LOG_LEVEL_ERROR ? rec->level : LOG_LEVEL_ERROR;
+    n += (size_t)snprintf(out + n, cap - n, ".%06u %-5s [%s] ", (unsigned)(rec->ts_ns % 1000000000ULL / 1000),
+                          level_names[level], thread);
+    size_t end = cap - 2;           // chừa chỗ cho '\n' và '\0'
+    size_t off = 0;
+    const char* p = rec->fmt;
+    while (*p && n < end) {
+        if (*p != '%') { out[n++] = *p++; continue; }
+        p++;
+        if (*p == '%') { out[n++] = '%'; p++; continue; }
+        Spec s;
+        p = parse_spec(p, &s);
+        int integer = is_signed_conv(s.conv) || is_unsigned_conv(s.conv);
+        if (!integer && !is_float_conv(s.conv) && s.conv != 's' && s.conv != 'c' && s.conv != 'p') break;
+        char f[40];
+        snprintf(f, sizeof(f), "%s%s%c", s.text, integer ? "ll" : "", s.conv);
+        size_t room = end - n + 1;
+        if (s.conv == 's') {
+            uint16_t len16;
+            if (off + 2 > rec->len) break;
+            memcpy(&len16, rec->args + off, 2);
+            char str[LOG_ARG_BYTES];
+            memcpy(str, rec->args + off + 2, len16);
+            str[len16] = '\0';
+            off += 2 + (size_t)len16;
+            n += clamp(snprintf(out + n, room, f, str), room);
+            continue;
+        }
+        uint64_t v;
+        if (off + 8 > rec->len) break;
+        memcpy(&v, rec->args + off, 8);
+        off += 8;
+        if (is_signed_conv(s.conv)) n += clamp(snprintf(out + n, room, f, (long long)v), room);
+        else if (integer) n += clamp(snprintf(out + n, room, f, (unsigned long long)v), room);
+        else if (s.conv == 'c') n += clamp(snprintf(out + n, room, f, (int)v), room);
+        else if (s.conv == 'p') n += clamp(snprintf(out + n, room, f, (void*)(uintptr_t)v), room);
+        else {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            n += clamp(snprintf(out + n, room, f, d), room);
+        }
+    }
+    if (rec->truncated && n + 4 <= end) { memcpy(out + n, " ...", 4); n += 4; }
+    if (n > end) n = end;
+    out[n++] = '\n';
+    out[n] = '\0';
+    return n;
+}
+
+// Không có thread nền: format và in ngay trên thread gọi
+static void write_direct(const LogRecord* rec) {
+    char line[LOG_LINE_MAX];
+    format_record(rec, thread_name[0] ? thread_name : "main", line, sizeof(line));
+    fputs(line, rec->level >= LOG_LEVEL_WARN ? stderr : stdout);
+}
+
+void log_write(int level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        LogRecord rec;
+        pack_record(&rec, level, fmt, ap);
+        va_end(ap);
+        write_direct(&rec);
+        return;
+    }
+    LogRing* r = get_ring();
+    if (!r) { va_end(ap); return; }
+    uint32_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+        // Thread nền không theo kịp: bỏ bản ghi thay vì chờ
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        va_end(ap);
+        return;
+    }
+    pack_record(&r->slots[head & (LOG_RING_SLOTS - 1)], level, fmt, ap);
+    va_end(ap);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// ---- Thread nền ----
+
+static int open_log_file(void) {
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1) return -1;
+    struct stat st;
+    out_bytes = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    out_fd = fd;
+    return 0;
+}
+
+// path.(keep-1) -> path.keep, ..., path -> path.1, rồi mở path mới
+static void rotate(void) {
+    close(out_fd);
+    char from[4096], to[4096];
+    for (int i = rotate_keep - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", out_path, i);
+        snprintf(to, sizeof(to), "%s.%d", out_path, i + 1);
+        rename(from, to);
+    }
+    if (rotate_keep > 0) {
+        snprintf(to, sizeof(to), "%s.1", out_path);
+        rename(out_path, to);
+    } else {
+        unlink(out_path);
+    }
+    if (open_log_file() != 0) {
+        // Không mở lại được file: ghi tiếp ra stderr thay vì mất log
+        fprintf(stderr, "Log: cannot reopen %s (%s); logging to stderr.\n", out_path, strerror(errno));
+        out_fd = STDERR_FILENO;
+        out_path = NULL;
+    }
+}
+
+static void flush_out(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        ssize_t w = write(out_fd, out_buf + done, out_len - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;                  // đĩa đầy / fd hỏng: bỏ phần còn lại
+        }
+        done += (size_t)w;
+    }
+    out_bytes += done;
+    out_len = 0;
+    if (out_path && rotate_bytes && out_bytes >= rotate_bytes) rotate();
+}
+
+static void emit_record(const LogRecord* rec, const char* thread) {
+    if (out_len + LOG_LINE_MAX > sizeof(out_buf)) flush_out();
+    out_len += format_record(rec, thread, out_buf + out_len, LOG_LINE_MAX);
+}
+
+// Dòng do chính thread nền sinh ra (vd. báo bản ghi bị bỏ)
+static void emit(int level, const char* fmt, ...) {
+    LogRecord rec;
+    va_list ap;
+    va_start(ap, fmt);
+    pack_record(&rec, level, fmt, ap);
+    va_end(ap);
+    emit_record(&rec, "log");
+}
+
+// Gom mọi bản ghi đang có theo thứ tự thời gian; trả về số bản ghi đã ghi
+static unsigned long drain(void) {
+    LogRing* list = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (LogRing* r = list; r; r = r->next) r->limit = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    unsigned long count = 0;
+    for (;;) {
+        LogRing* best = NULL;
+        uint64_t best_ts = 0;
+        for (LogRing* r = list; r; r = r->next) {
+            if (r->tail == r->limit) continue;
+            uint64_t ts = r->slots[r->tail & (LOG_RING_SLOTS - 1)].ts_ns;
+            if (!best || ts < best_ts) { best = r; best_ts = ts; }
+        }
+        if (!best) break;
+        emit_record(&best->slots[best->tail & (LOG_RING_SLOTS - 1)], best->name);
+        __atomic_store_n(&best->tail, best->tail + 1, __ATOMIC_RELEASE);
+        count++;
+    }
+    for (LogRing* r = list; r; r = r->next) {
+        uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+        if (dropped != r->reported) {
+            emit(LOG_LEVEL_WARN, "%llu record(s) from thread '%s' dropped: log ring full",
+                 (unsigned long long)(dropped - r->reported), r->name);
+            r->reported = dropped;
+        }
+    }
+    return count;
+}
+
+static void* log_loop(void* arg) {
+    (void)arg;
+    long idle_us = LOG_IDLE_MIN_US;
+    for (;;) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        unsigned long n = drain();
+        if (out_len) flush_out();
+        if (stop) break;
+        // Không đánh thức bằng syscall từ thread gọi log: thread nền tự thăm dò, ngủ lâu dần khi rảnh
+        if (n) {
+            idle_us = LOG_IDLE_MIN_US;
+        } else {
+            struct timespec ts = {0, idle_us * 1000};
+            nanosleep(&ts, NULL);
+            if (idle_us < LOG_IDLE_MAX_US) idle_us *= 2;
+        }
+    }
+    return NULL;
+}
+
+int log_start(const char* path, size_t max_bytes, int keep) {
+    out_path = path;
+    rotate_bytes = max_bytes;
+    rotate_keep = keep < 0 ? 0 : keep;
+    if (path && open_log_file() != 0) {
+        LOG_ERROR("Cannot open log file %s: %s", path, strerror(errno));
+        out_path = NULL;
+        return -1;
+    }
+    fflush(stdout);
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELAXED);
+    if (pthread_create(&log_thread, NULL, log_loop, NULL) != 0) {
+        if (path) close(out_fd);
+        out_fd = STDOUT_FILENO;
+        out_path = NULL;
+        return -1;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_stop(void) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(log_thread, NULL);
+    if (out_path) close(out_fd);
+    out_fd = STDOUT_FILENO;
+    out_path = NULL;
+}
@@ -0,0 +1,68 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Log bất đồng bộ: LOG_INFO(...) trên thread gọi chỉ lấy giờ, chép con trỏ format và các
+// tham số (dạng nhị phân) vào ring buffer riêng của thread đó (SPSC, không lock, không
+// syscall). 1 thread nền gom ring của mọi thread theo thứ tự thời gian, format thành dòng
+//   2026-10-18 09:01:02.123456 INFO  [reactor 0] User 'a' logged in ...
+// và ghi ra stdout hoặc file (xoay vòng khi đủ dung lượng). Ring đầy thì bản ghi bị bỏ và đếm
+// lại (thread gọi không bao giờ chờ thread log); thread nền báo số bản ghi bị bỏ trong log.
+//
+// Format phải là chuỗi hằng (chỉ con trỏ được lưu) và chỉ dùng các chuyển đổi của printf
+// sau: d i u x X o c s p f e g a %, với flag/width/precision dạng số và length hh h l ll z j t
+// (không hỗ trợ '*', %n, L). Chuỗi %s được chép vào bản ghi, phần vượt quá chỗ trống bị cắt.
+//
+// Lọc mức: lúc biên dịch (LOG_COMPILE_LEVEL, vd. make LOG_LEVEL=INFO bỏ hẳn mọi LOG_DEBUG khỏi
+// binary) và lúc chạy (log_set_level, tham số -L của server) - lời gọi dưới mức chỉ tốn 1 phép so sánh.
+// Trước log_start (và sau log_stop) bản ghi được format và in ngay ra stdout (DEBUG/INFO) hoặc
+// stderr (WARN/ERROR), nên tool dùng chung module (bench/) không cần thread log.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_RING_SLOTS 1024          // bản ghi chờ ghi tối đa của 1 thread (lũy thừa của 2)
+#define LOG_RECORD_SIZE 256          // byte mỗi bản ghi, gồm cả header
+#define LOG_ROTATE_BYTES (16 << 20)  // file log đạt cỡ này thì xoay: path -> path.1 -> path.2 ...
+#define LOG_ROTATE_KEEP 5            // số file cũ giữ lại
+
+extern int log_runtime_level;
+
+void log_write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...)                                                                          \
+    do {                                                                                           \
+        if ((level) >= LOG_COMPILE_LEVEL && (level) >= __atomic_load_n(&log_runtime_level, __ATOMIC_RELAXED)) \
+            log_write((level), __VA_ARGS__);                                                       \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Mức tối thiểu lúc chạy (mặc định LOG_LEVEL_INFO); đổi được khi server đang chạy
+void log_set_level(int level);
+// "debug", "info", "warn", "error", "off" -> LOG_LEVEL_*, -1 nếu không hợp lệ
+int log_level_from_name(const char* name);
+
+// Tên thread in trong mỗi dòng (tối đa 15 ký tự), gọi ở đầu hàm thread trước khi log
+void log_set_thread_name(const char* name);
+
+// Chạy thread nền. path NULL: ghi ra stdout, không xoay vòng; ngược lại ghi nối vào file path,
+// khi vượt max_bytes thì đổi tên thành path.1 (path.1 -> path.2 ..., giữ `keep` file cũ).
+// Trả về 0 nếu OK, -1 nếu không mở được file hoặc không tạo được thread.
+int log_start(const char* path, size_t max_bytes, int keep);
+// Ghi nốt các bản ghi còn lại rồi dừng thread nền; gọi sau khi các thread khác đã ngừng log
+void log_stop(void);
+
+#endif
@@ -1,113 +1,291 @@
 #include "message_handler.h"
 #include "db_handler.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
 #include "server.h"
-#include "friend_manager.h" // add to call broadcast_status_to_friends
+#include "presence.h"
+#include "log.h"
 
-// Hàm này sẽ gửi danh sách online cho mọi người
-extern void broadcast_online_list(ClientSession* sessions);
+static void send_login_fail(int client_fd, const char* reason) {
+    ChatPacket fail_packet;
+    memset(&fail_packet, 0, sizeof(ChatPacket));
+    fail_packet.type = MSG_TYPE_LOGIN_FAIL;
+    snprintf(fail_packet.body, MAX_BODY, "%s", reason);
+    server_send_packet(client_fd, &fail_packet);
+}
+
+// ----- Tin nhắn offline -----
+// Gửi theo trang (tối đa OFFLINE_PAGE_SIZE tin): worker đọc 1 trang, reactor xếp trang vào hàng
+// đợi gửi của session rồi chờ client xác nhận cả trang (marker MSG_TYPE_OFFLINE_ACK được client
+// gửi lại) mới hẹn lượt kế tiếp trên writer: xóa trang vừa gửi (id <= acked_id) và đọc trang sau.
+// Client cũ không xác nhận: coi trang đã tới khi nó được ghi hết vào socket (server_on_flushed).
+// Giữa 2 trang reactor phục vụ các client khác, hàng đợi gửi chỉ giữ 1 trang. Client ngắt giữa
+// chừng -> trang chưa xác nhận không bị xóa, được gửi lại ở lần login sau.
+// Tin được lưu trong lúc đó có id lớn hơn nên không bị xóa nhầm; các trang sau lấy nốt.
+// Tin group nằm trong log chung của group: thay vì xóa, dời con trỏ last_read_id của user.
+// Tin group gửi sau lúc login được giao trực tiếp nên chỉ đọc log tới group_until (đầu log
+// ở lượt ghi đầu tiên sau login, khi user đã online với mọi người gửi).
+
+#define OFFLINE_PAGE_SIZE 128
+
+typedef struct {
+    SessionRef ref;
+    char username[MAX_USERNAME];
+    UserId user_id;             // gán khi xác thực xong
+    sqlite3_int64 acked_id;     // client đã nhận tới đây -> xóa trước khi đọc tiếp
+    sqlite3_int64 last_id;      // id lớn nhất đã đọc
+    sqlite3_int64 group_acked_id;   // như trên, cho log tin group
+    sqlite3_int64 group_last_id;
+    sqlite3_int64 group_until;
+    int settled;                // đã qua lượt đầu trên writer (group_until đã chốt)
+    ChatPacket* packets;        // 1 trang, cấp phát ở lần đọc đầu
+    int count;
+    int acked_count;            // số tin của trang vừa được xác nhận
+    int failed;
+} PendingJob;
 
-// Hàm callback để gửi gói tin đến client
-void send_packet_callback(void* arg, ChatPacket* packet) {
-    int client_fd = *(int*)arg;
-    if (client_fd > 0) {
-        write(client_fd, packet, sizeof(ChatPacket));
+static void collect_pending_cb(void* arg, ChatPacket* packet) {
+    PendingJob* job = (PendingJob*)arg;
+    job->packets[job->count++] = *packet;
+}
+
+// Đọc 1 trang: tin riêng sau last_id, còn chỗ thì tin group sau group_last_id
+static void read_pending(sqlite3* db, PendingJob* job) {
+    job->count = 0;
+    if (!job->packets) job->packets = malloc(sizeof(ChatPacket) * OFFLINE_PAGE_SIZE);
+    if (!job->packets) {
+        job->failed = 1;
+        return;
+    }
+    int n = 0;
+    sqlite3_int64 until = job->settled ? job->group_until : INT64_MAX;
+    if (db_get_pending_messages(db, job->user_id, job->last_id, OFFLINE_PAGE_SIZE,
+                                collect_pending_cb, job, &job->last_id, &n) != 0 ||
+        (n < OFFLINE_PAGE_SIZE &&
+         db_get_pending_group_messages(db, job->user_id, job->group_last_id, until, OFFLINE_PAGE_SIZE - n,
+                                       collect_pending_cb, job, &job->group_last_id, NULL) != 0)) {
+        // Phần đã đọc vẫn gửi được; phần còn lại ở lại DB cho lần login sau
+        job->failed = 1;
     }
 }
 
-// Hàm tìm kiếm 1 user đang online bằng username
-// (Hàm này nên nằm trong server.c, nhưng để tạm ở đây cho nhanh)
-ClientSession* find_session_by_username(const char* user, ClientSession* sessions) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd != -1 && strcmp(sessions[i].username, user) == 0) {
-            return &sessions[i];
-        }
+static void ack_pending(sqlite3* db, PendingJob* job) {
+    db_delete_pending_messages(db, job->user_id, job->acked_id);
+    if (job->group_acked_id) db_advance_group_cursors(db, job->user_id, job->group_acked_id);
+}
+
+static void pending_work(sqlite3* db, void* arg) {
+    PendingJob* job = (PendingJob*)arg;
+    ack_pending(db, job);
+    if (!job->settled) {
+        job->group_until = db_get_group_log_head(db);
+        job->settled = 1;
     }
-    return NULL; // Không tìm thấy (offline)
+    read_pending(db, job);
 }
 
-void handle_login(int client_fd, ChatPacket* packet, sqlite3 *db, ClientSession* sessions) {
-    ClientSession* session = get_session(client_fd);
-    if (!session) return;
+static void free_pending(PendingJob* job) {
+    free(job->packets);
+    free(job);
+}
 
-    // Kiểm tra xem user đã đăng nhập ở session khác chưa
-    if (find_session_by_username(packet->source_user, sessions) != NULL) {
-        printf("Login failed: User '%s' is already logged in.\n", packet->source_user);
-        ChatPacket fail_packet;
-        memset(&fail_packet, 0, sizeof(ChatPacket));
-        fail_packet.type = MSG_TYPE_LOGIN_FAIL;
-        snprintf(fail_packet.body, MAX_BODY, "Login failed: User is already logged in elsewhere.");
-        write(client_fd, &fail_packet, sizeof(ChatPacket));
+// Lượt cuối: chỉ xóa những tin đã gửi (job không có done: pool giải phóng job sau COMMIT)
+static void ack_pending_work(sqlite3* db, void* arg) {
+    PendingJob* job = (PendingJob*)arg;
+    free(job->packets);
+    job->packets = NULL;
+    ack_pending(db, job);
+}
+
+static void pending_done(sqlite3* db, void* arg, int status);
+
+// Trang hiện tại đã tới client: hẹn lượt xóa trang đó + đọc trang sau
+static void page_delivered(void* arg, int ok) {
+    PendingJob* job = (PendingJob*)arg;
+    if (!ok) {
+        // Session đóng trước khi trang tới nơi: giữ trong DB cho lần login sau
+        free_pending(job);
         return;
     }
+    job->acked_id = job->last_id;
+    job->group_acked_id = job->group_last_id;
+    job->acked_count = job->count;
+    if (!job->failed && db_pool_submit_write(pending_work, pending_done, job) == 0) return;
+    // Không đọc tiếp được: vẫn phải xóa những tin đã gửi
+    if (db_pool_submit_write(ack_pending_work, NULL, job) != 0) free_pending(job);
+}
 
-    // --- NEW: kiểm tra user có tồn tại trong DB trước ---
-    if (!db_user_exists(db, packet->source_user)) {
-        printf("Login failed: User '%s' not found.\n", packet->source_user);
-        ChatPacket fail_packet;
-        memset(&fail_packet, 0, sizeof(ChatPacket));
-        fail_packet.type = MSG_TYPE_LOGIN_FAIL;
-        snprintf(fail_packet.body, MAX_BODY, "Login failed: User not found.");
-        write(client_fd, &fail_packet, sizeof(ChatPacket));
+// Xếp trang vừa đọc vào hàng đợi gửi; hết tin (sau lượt đầu trên writer) thì dừng
+static void deliver_pending(PendingJob* job) {
+    ClientSession* session = server_session_deref(job->ref);
+    if ((job->settled && job->count == 0) || !session) {
+        free_pending(job);
         return;
     }
+    for (int i = 0; i < job->count; i++) server_send_packet(job->ref.fd, &job->packets[i]);
+    int rc;
+    if (session->offline_ack && job->count > 0) {
+        ChatPacket marker;
+        memset(&marker, 0, sizeof(ChatPacket));
+        marker.type = MSG_TYPE_OFFLINE_ACK;
+        snprintf(marker.body, MAX_BODY, "%d", job->count);
+        server_send_packet(job->ref.fd, &marker);
+        rc = server_on_offline_ack(job->ref.fd, page_delivered, job);
+    } else {
+        rc = server_on_flushed(job->ref.fd, page_delivered, job);
+    }
+    if (rc != 0) free_pending(job);
+}
+
+static void pending_done(sqlite3* db, void* arg, int status) {
+    (void)db;
+    PendingJob* job = (PendingJob*)arg;
+    if (status != SQLITE_OK && job->acked_count > 0) {
+        // Lượt xóa trang trước bị ROLLBACK: trang mới vẫn đúng (chỉ đọc tin sau last_id), lượt
+        // xóa kế tiếp xóa luôn tới acked_id mới; đứt giữa chừng thì login sau nhận lại vài tin
+        LOG_WARN("Offline messages of user %u: acknowledged page not deleted, may be delivered again.",
+                 job->user_id);
+        if (server_session_deref(job->ref)) {
+            ChatPacket notice;
+            memset(&notice, 0, sizeof(ChatPacket));
+            notice.type = MSG_TYPE_SEND_OFFLINE_MSG;
+            strncpy(notice.source_user, "Server", MAX_USERNAME - 1);
+            snprintf(notice.body, MAX_BODY, "Server error: offline messages already shown could not be marked "
+                     "as read, some may be shown again.");
+            server_send_packet(job->ref.fd, &notice);
+        }
+    }
+    deliver_pending(job);
+}
+
+// ----- Đăng nhập -----
 
-    // Xác thực với DB
-    if (db_authenticate_user(db, packet->source_user, packet->body)) {
+typedef enum { LOGIN_OK = 0, LOGIN_NOT_FOUND, LOGIN_BAD_PASSWORD } LoginResult;
+
+typedef struct {
+    char password[MAX_BODY];
+    LoginResult result;
+    PendingJob* pending;        // trang tin nhắn offline đầu tiên, đọc cùng lượt xác thực
+} LoginJob;
+
+// Chạy trên worker DB: xác thực, intern id của user, đọc sẵn tin nhắn offline và nạp cache presence
+static void login_work(sqlite3* db, void* arg) {
+    LoginJob* job = (LoginJob*)arg;
+    const char* username = job->pending->username;
+
+    // --- NEW: kiểm tra user có tồn tại trong DB trước ---
+    UserId id = user_ids_resolve(db, username);
+    if (!id) {
+        job->result = LOGIN_NOT_FOUND;
+    } else if (!db_authenticate_user(db, username, job->password)) {
+        job->result = LOGIN_BAD_PASSWORD;
+    } else {
+        job->result = LOGIN_OK;
+        job->pending->user_id = id;
+        presence_prefetch(db, id);
+        read_pending(db, job->pending);
+    }
+}
+
+// Chạy lại trên reactor của client
+static void login_done(sqlite3* db, void* arg, int status) {
+    (void)status;               // job đọc, không có COMMIT
+    LoginJob* job = (LoginJob*)arg;
+    PendingJob* pending = job->pending;
+    const char* username = pending->username;
+    int client_fd = pending->ref.fd;
+    ClientSession* session = server_session_deref(pending->ref);
+    LoginResult result = job->result;
+    free(job);
+
+    if (!session) {
+        // Client đã ngắt trong lúc xác thực
+    } else if (result == LOGIN_NOT_FOUND) {
+        LOG_INFO("Login failed: User '%s' not found.", username);
+        send_login_fail(client_fd, "Login failed: User not found.");
+    } else if (result != LOGIN_OK) {
+        // --- ĐĂNG NHẬP THẤT BẠI ---
+        LOG_INFO("Login failed for user '%s': Invalid credentials.", username);
+        send_login_fail(client_fd, "Login failed. Check username/password.");
+    } else if (session->username[0] != '\0') {
+        send_login_fail(client_fd, "Login failed: Already logged in.");
+    } else if (server_claim_user(pending->user_id, client_fd) != 0) {
+        // Giữ chỗ username trong danh bạ chung; 2 reactor có thể cùng xác thực 1 user
+        LOG_INFO("Login failed: User '%s' is already logged in.", username);
+        send_login_fail(client_fd, "Login failed: User is already logged in elsewhere.");
+    } else {
         // --- ĐĂNG NHẬP THÀNH CÔNG ---
-        printf("User '%s' logged in successfully from fd %d.\n", packet->source_user, client_fd);
-        
-        // Gán username cho session
-        strncpy(session->username, packet->source_user, MAX_USERNAME);
+        LOG_INFO("User '%s' logged in successfully from fd %d.", username, client_fd);
+
+        // Gán username + id cho session
+        strncpy(session->username, username, MAX_USERNAME);
+        session->user_id = pending->user_id;
 
         // Gửi gói tin thành công cho client
         ChatPacket success_packet;
         memset(&success_packet, 0, sizeof(ChatPacket));
         success_packet.type = MSG_TYPE_LOGIN_SUCCESS;
-        strncpy(success_packet.source_user, packet->source_user, MAX_USERNAME);
-        snprintf(success_packet.body, MAX_BODY, "Login successful! Welcome %s", packet->source_user);
-        write(client_fd, &success_packet, sizeof(ChatPacket));
-        
-        // Gửi tin nhắn offline và broadcast danh sách online
-        db_send_pending_messages(db, packet->source_user, send_packet_callback, &client_fd);
-        broadcast_online_list(sessions);
-
-        // Notify friends that this user is now online
-        broadcast_status_to_friends(packet->source_user, sessions, db, 1); // 1 = online
-    } else {
-        // --- ĐĂNG NHẬP THẤT BẠI ---
-        printf("Login failed for user '%s': Invalid credentials.\n", packet->source_user);
-        ChatPacket fail_packet;
-        memset(&fail_packet, 0, sizeof(ChatPacket));
-        fail_packet.type = MSG_TYPE_LOGIN_FAIL;
-        snprintf(fail_packet.body, MAX_BODY, "Login failed. Check username/password.");
-        write(client_fd, &fail_packet, sizeof(ChatPacket));
+        strncpy(success_packet.source_user, username, MAX_USERNAME);
+        snprintf(success_packet.body, MAX_BODY, "Login successful! Welcome %s", username);
+        server_send_packet(client_fd, &success_packet);
+
+        // Đánh dấu online trong các group, gửi snapshot presence cho user;
+        // bạn bè và các peer được báo ở lần flush presence kế tiếp
+        presence_user_online(pending->user_id, client_fd);
+
+        // Gửi trang tin nhắn offline đầu tiên (đọc sẵn cùng lượt xác thực). Luôn có thêm ít nhất
+        // 1 lượt trên writer: tin lưu trước lúc claim username (người gửi còn thấy user offline)
+        // nằm trước lượt đó trong hàng đợi ghi.
+        deliver_pending(pending);
+        return;
     }
+    free_pending(pending);
 }
 
-void handle_private_message(ChatPacket* packet, ClientSession* sessions, sqlite3 *db) {
-    printf("Routing private message from '%s' to '%s'\n", packet->source_user, packet->target_user);
+void handle_login(int client_fd, ChatPacket* packet, sqlite3 *db) {
+    (void)db;
+    ClientSession* session = get_session(client_fd);
+    if (!session) return;
 
-    ClientSession* target_session = find_session_by_username(packet->target_user, sessions);
+    // Kiểm tra xem user đã đăng nhập ở session khác chưa (có thể ở reactor khác)
+    if (server_is_user_online(packet->source_user)) {
+        LOG_INFO("Login failed: User '%s' is already logged in.", packet->source_user);
+        send_login_fail(client_fd, "Login failed: User is already logged in elsewhere.");
+        return;
+    }
+
+    // Xác thực với DB trên worker; kết quả xử lý tiếp ở login_done
+    LoginJob* job = calloc(1, sizeof(LoginJob));
+    PendingJob* pending = calloc(1, sizeof(PendingJob));
+    if (job && pending) {
+        job->pending = pending;
+        pending->ref = server_session_ref(client_fd);
+        strncpy(pending->username, packet->source_user, MAX_USERNAME - 1);
+        strncpy(job->password, packet->body, MAX_BODY - 1);
+        if (db_pool_submit_for(client_fd, DB_JOB_BARRIER, pending->username, login_work, login_done, job) == 0) return;
+    }
+    free(job);
+    free(pending);
+    send_login_fail(client_fd, "Login failed: Server busy, try again.");
+}
+
+void handle_private_message(ChatPacket* packet, sqlite3 *db) {
+    LOG_DEBUG("Routing private message from '%s' to '%s'", packet->source_user, packet->target_user);
 
-    if (target_session != NULL) {
-        // --- NGƯỜI NHẬN ĐANG ONLINE ---
-        ChatPacket forward_packet;
-        memset(&forward_packet, 0, sizeof(ChatPacket));
-        
-        forward_packet.type = MSG_TYPE_RECEIVE_PRIVATE;
-        strncpy(forward_packet.source_user, packet->source_user, MAX_USERNAME); // Ai gửi
-        strncpy(forward_packet.body, packet->body, MAX_BODY); // Nội dung
+    ChatPacket forward_packet;
+    memset(&forward_packet, 0, sizeof(ChatPacket));
 
-        // Gửi thẳng đến socket của người nhận
-        write(target_session->fd, &forward_packet, sizeof(ChatPacket));
-        printf("Message forwarded to fd %d\n", target_session->fd);
+    forward_packet.type = MSG_TYPE_RECEIVE_PRIVATE;
+    strncpy(forward_packet.source_user, packet->source_user, MAX_USERNAME); // Ai gửi
+    strncpy(forward_packet.body, packet->body, MAX_BODY); // Nội dung
 
+    // Chuyển tới reactor đang giữ người nhận; nếu offline thì lưu vào DB
+    if (server_deliver_to_user(packet->target_user, &forward_packet)) {
+        LOG_DEBUG("Message forwarded to '%s'", packet->target_user);
     } else {
-        // --- NGƯỜI NHẬN ĐANG OFFLINE ---
-        printf("User '%s' is offline. Storing message.\n", packet->target_user);
-        db_store_offline_message(db, packet->source_user, packet->target_user, packet->body);
+        LOG_DEBUG("User '%s' is offline. Stored message.", packet->target_user);
     }
-}
\ No newline at end of file
+}
@@ -9,13 +9,13 @@
  * @brief Xử lý tin nhắn riêng tư.
  * Định tuyến tin nhắn đến user đích nếu online, hoặc lưu offline nếu không.
  */
-void handle_private_message(ChatPacket* packet, ClientSession* sessions, sqlite3 *db);
+void handle_private_message(ChatPacket* packet, sqlite3 *db);
 
 /**
  * @brief Xử lý yêu cầu đăng nhập từ client.
  * Kiểm tra thông tin đăng nhập và thiết lập phiên làm việc nếu hợp lệ.
  */
-void handle_login(int client_fd, ChatPacket* packet, sqlite3 *db, ClientSession* sessions);
+void handle_login(int client_fd, ChatPacket* packet, sqlite3 *db);
 
 /**
  * @brief Xử lý yêu cầu đăng ký từ client.
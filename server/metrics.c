@@ -0,0 +1,293 @@
+#include "metrics.h"
+#include "presence.h"
+#include "../shared/protocol.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Block của mọi thread đã từng ghi số liệu; chỉ thêm vào đầu (CAS), không bao giờ giải phóng
+static MetricsBlock* blocks = NULL;
+static __thread MetricsBlock* local_block = NULL;
+static __thread int current_type = 0;
+
+static const char* type_names[METRICS_MAX_TYPES] = {
+    [MSG_TYPE_UNKNOWN] = "UNKNOWN",
+    [MSG_TYPE_REGISTER_REQUEST] = "REGISTER_REQUEST",
+    [MSG_TYPE_LOGIN_REQUEST] = "LOGIN_REQUEST",
+    [MSG_TYPE_LOGOUT_REQUEST] = "LOGOUT_REQUEST",
+    [MSG_TYPE_GROUP_MESSAGE] = "GROUP_MESSAGE",
+    [MSG_TYPE_PRIVATE_MESSAGE] = "PRIVATE_MESSAGE",
+    [MSG_TYPE_SEND_MESSAGE] = "SEND_MESSAGE",
+    [MSG_TYPE_FRIEND_REQUEST] = "FRIEND_REQUEST",
+    [MSG_TYPE_FRIEND_ACCEPT] = "FRIEND_ACCEPT",
+    [MSG_TYPE_ACCEPT_FRIEND_REQUEST] = "ACCEPT_FRIEND_REQUEST",
+    [MSG_TYPE_FRIEND_DECLINE] = "FRIEND_DECLINE",
+    [MSG_TYPE_FRIEND_UNFRIEND] = "FRIEND_UNFRIEND",
+    [MSG_TYPE_FRIEND_LIST_REQUEST] = "FRIEND_LIST_REQUEST",
+    [MSG_TYPE_CREATE_GROUP_REQUEST] = "CREATE_GROUP_REQUEST",
+    [MSG_TYPE_JOIN_GROUP_REQUEST] = "JOIN_GROUP_REQUEST",
+    [MSG_TYPE_INVITE_TO_GROUP_REQUEST] = "INVITE_TO_GROUP_REQUEST",
+    [MSG_TYPE_REMOVE_FROM_GROUP_REQUEST] = "REMOVE_FROM_GROUP_REQUEST",
+    [MSG_TYPE_LEAVE_GROUP_REQUEST] = "LEAVE_GROUP_REQUEST",
+    [MSG_TYPE_GROUP_LIST_JOINED_REQUEST] = "GROUP_LIST_JOINED_REQUEST",
+    [MSG_TYPE_GROUP_LIST_ALL_REQUEST] = "GROUP_LIST_ALL_REQUEST",
+    [MSG_TYPE_REGISTER_SUCCESS] = "REGISTER_SUCCESS",
+    [MSG_TYPE_REGISTER_FAIL] = "REGISTER_FAIL",
+    [MSG_TYPE_LOGIN_SUCCESS] = "LOGIN_SUCCESS",
+    [MSG_TYPE_LOGIN_FAIL] = "LOGIN_FAIL",
+    [MSG_TYPE_RECEIVE_PRIVATE] = "RECEIVE_PRIVATE",
+    [MSG_TYPE_RECEIVE_GROUP_MESSAGE] = "RECEIVE_GROUP_MESSAGE",
+    [MSG_TYPE_RECEIVE_GROUP_MESSAGE_LEGACY] = "RECEIVE_GROUP_MESSAGE_LEGACY",
+    [MSG_TYPE_ONLINE_LIST_UPDATE] = "ONLINE_LIST_UPDATE",
+    [MSG_TYPE_SEND_OFFLINE_MSG] = "SEND_OFFLINE_MSG",
+    [MSG_TYPE_FRIEND_REQUEST_INCOMING] = "FRIEND_REQUEST_INCOMING",
+    [MSG_TYPE_FRIEND_UPDATE] = "FRIEND_UPDATE",
+    [MSG_TYPE_FRIEND_LIST_RESPONSE] = "FRIEND_LIST_RESPONSE",
+    [MSG_TYPE_FRIEND_REQUEST_RESPONSE] = "FRIEND_REQUEST_RESPONSE",
+    [MSG_TYPE_GROUP_RESPONSE] = "GROUP_RESPONSE",
+    [MSG_TYPE_GROUP_LIST_RESPONSE] = "GROUP_LIST_RESPONSE",
+    [MSG_TYPE_PRESENCE_DELTA] = "PRESENCE_DELTA",
+    [MSG_TYPE_HELLO] = "HELLO",
+    [MSG_TYPE_OFFLINE_ACK] = "OFFLINE_ACK",
+};
+
+const char* metrics_type_name(int type) {
+    return type >= 0 && type < METRICS_MAX_TYPES ? type_names[type] : NULL;
+}
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Block của thread hiện tại, cấp lần đầu thread ghi số liệu. NULL nếu hết bộ nhớ (bỏ mẫu).
+static MetricsBlock* get_block(void) {
+    MetricsBlock* b = local_block;
+    if (b) return b;
+    b = calloc(1, sizeof(MetricsBlock));
+    if (!b) return NULL;
+    b->next = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&blocks, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    local_block = b;
+    return b;
+}
+
+// Chỉ thread sở hữu block ghi: load + store thay cho atomic RMW, reader đọc bằng atomic load
+static inline void bump(uint64_t* field, uint64_t n) {
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static int type_index(int type) {
+    return type > 0 && type < METRICS_MAX_TYPES ? type : MSG_TYPE_UNKNOWN;
+}
+
+static int bucket_of(uint64_t v) {
+    if (v < METRICS_SUB_COUNT) return (int)v;
+    int exp = 63 - __builtin_clzll(v);
+    if (exp >= METRICS_MAX_EXP) return METRICS_BUCKETS - 1;
+    int sub = (int)((v >> (exp - METRICS_SUB_BITS)) & (METRICS_SUB_COUNT - 1));
+    return (exp - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT + sub;
+}
+
+// Giá trị lớn nhất thuộc bucket i
+static uint64_t bucket_upper(int i) {
+    if (i < METRICS_SUB_COUNT) return (uint64_t)i;
+    int exp = i / METRICS_SUB_COUNT - 1 + METRICS_SUB_BITS;
+    uint64_t sub = (uint64_t)(i % METRICS_SUB_COUNT);
+    return ((METRICS_SUB_COUNT + sub + 1) << (exp - METRICS_SUB_BITS)) - 1;
+}
+
+static void record(Histogram* h, uint64_t ns) {
+    bump(&h->count, 1);
+    bump(&h->sum_ns, ns);
+    if (ns > h->max_ns) __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+    bump(&h->buckets[bucket_of(ns)], 1);
+}
+
+static uint64_t elapsed_since(uint64_t start) {
+    uint64_t now = metrics_now();
+    return now > start ? now - start : 0;
+}
+
+int metrics_current_type(void) {
+    return current_type;
+}
+
+void metrics_set_current_type(int type) {
+    current_type = type;
+}
+
+uint64_t metrics_packet_begin(int type) {
+    current_type = type;
+    return metrics_now();
+}
+
+void metrics_packet_end(int type, size_t bytes, uint64_t start) {
+    uint64_t ns = elapsed_since(start);
+    current_type = 0;
+    MetricsBlock* b = get_block();
+    if (!b) return;
+    TypeMetrics* t = &b->types[type_index(type)];
+    bump(&t->in_bytes, bytes);
+    record(&t->handler, ns);
+}
+
+void metrics_record_db(int type, uint64_t start) {
+    uint64_t ns = elapsed_since(start);
+    MetricsBlock* b = get_block();
+    if (b) record(&b->types[type_index(type)].db, ns);
+}
+
+void metrics_record_commit(uint64_t start) {
+    uint64_t ns = elapsed_since(start);
+    MetricsBlock* b = get_block();
+    if (b) record(&b->db_commit, ns);
+}
+
+void metrics_record_write(size_t bytes, uint64_t start) {
+    uint64_t ns = elapsed_since(start);
+    MetricsBlock* b = get_block();
+    if (!b) return;
+    bump(&b->write_bytes, bytes);
+    record(&b->write, ns);
+}
+
+void metrics_record_loop(uint64_t start) {
+    uint64_t ns = elapsed_since(start);
+    MetricsBlock* b = get_block();
+    if (b) record(&b->loop, ns);
+}
+
+void metrics_record_out(int type, size_t bytes) {
+    MetricsBlock* b = get_block();
+    if (!b) return;
+    TypeMetrics* t = &b->types[type_index(type)];
+    bump(&t->out_count, 1);
+    bump(&t->out_bytes, bytes);
+}
+
+// ----- Đọc -----
+
+static uint64_t load(const uint64_t* field) {
+    return __atomic_load_n(field, __ATOMIC_RELAXED);
+}
+
+static void add_histogram(Histogram* to, const Histogram* from) {
+    to->count += load(&from->count);
+    to->sum_ns += load(&from->sum_ns);
+    uint64_t max = load(&from->max_ns);
+    if (max > to->max_ns) to->max_ns = max;
+    for (int i = 0; i < METRICS_BUCKETS; i++) to->buckets[i] += load(&from->buckets[i]);
+}
+
+void metrics_snapshot(MetricsBlock* out) {
+    memset(out, 0, sizeof(MetricsBlock));
+    for (MetricsBlock* b = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+        for (int t = 0; t < METRICS_MAX_TYPES; t++) {
+            TypeMetrics* to = &out->types[t];
+            const TypeMetrics* from = &b->types[t];
+            to->in_bytes += load(&from->in_bytes);
+            to->out_count += load(&from->out_count);
+            to->out_bytes += load(&from->out_bytes);
+            add_histogram(&to->handler, &from->handler);
+            add_histogram(&to->db, &from->db);
+        }
+        add_histogram(&out->db_commit, &b->db_commit);
+        add_histogram(&out->write, &b->write);
+        out->write_bytes += load(&b->write_bytes);
+        add_histogram(&out->loop, &b->loop);
+    }
+}
+
+uint64_t metrics_percentile(const Histogram* h, double q) {
+    // count có thể lệch tổng bucket vài mẫu (đọc lúc đang ghi): tính theo tổng bucket
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) total += h->buckets[i];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < h->max_ns ? upper : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+uint64_t metrics_count_at_most(const Histogram* h, uint64_t ns) {
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS && bucket_upper(i) <= ns; i++) total += h->buckets[i];
+    return total;
+}
+
+static double us(uint64_t ns) {
+    return ns / 1000.0;
+}
+
+void metrics_print(FILE* out) {
+    MetricsBlock* s = malloc(sizeof(MetricsBlock));
+    if (!s) return;
+    metrics_snapshot(s);
+
+    fprintf(out, "--- Metrics (latency in us) ---\n");
+    fprintf(out, "%-26s %9s %11s %8s %8s %9s %8s %8s %8s %9s %11s\n", "type", "in", "in_bytes", "p50", "p99",
+            "max", "db", "db_p50", "db_p99", "out", "out_bytes");
+    for (int t = 0; t < METRICS_MAX_TYPES; t++) {
+        const TypeMetrics* m = &s->types[t];
+        if (m->handler.count == 0 && m->db.count == 0 && m->out_count == 0) continue;
+        const char* name = metrics_type_name(t);
+        char unnamed[16];
+        if (!name) {
+            snprintf(unnamed, sizeof(unnamed), "type %d", t);
+            name = unnamed;
+        }
+        fprintf(out, "%-26s %9llu %11llu %8.1f %8.1f %9.1f %8llu %8.1f %8.1f %9llu %11llu\n", name,
+                (unsigned long long)m->handler.count, (unsigned long long)m->in_bytes,
+                us(metrics_percentile(&m->handler, 0.50)), us(metrics_percentile(&m->handler, 0.99)),
+                us(m->handler.max_ns), (unsigned long long)m->db.count, us(metrics_percentile(&m->db, 0.50)),
+                us(metrics_percentile(&m->db, 0.99)), (unsigned long long)m->out_count,
+                (unsigned long long)m->out_bytes);
+    }
+    fprintf(out, "db commit: %llu, p50 %.1f p99 %.1f max %.1f\n", (unsigned long long)s->db_commit.count,
+            us(metrics_percentile(&s->db_commit, 0.50)), us(metrics_percentile(&s->db_commit, 0.99)),
+            us(s->db_commit.max_ns));
+    fprintf(out, "socket write: %llu call(s), %llu byte(s), p50 %.1f p99 %.1f max %.1f\n",
+            (unsigned long long)s->write.count, (unsigned long long)s->write_bytes,
+            us(metrics_percentile(&s->write, 0.50)), us(metrics_percentile(&s->write, 0.99)), us(s->write.max_ns));
+    fprintf(out, "loop iteration: %llu, p50 %.1f p99 %.1f max %.1f\n", (unsigned long long)s->loop.count,
+            us(metrics_percentile(&s->loop, 0.50)), us(metrics_percentile(&s->loop, 0.99)), us(s->loop.max_ns));
+    PresenceStats ps;
+    presence_get_stats(&ps);
+    fprintf(out, "presence: %lu event(s), %lu coalesced, %lu published, %lu delta packet(s), %lu group notice(s)\n",
+            ps.events, ps.coalesced, ps.published, ps.packets, ps.notices);
+    fflush(out);
+    free(s);
+}
+
+static void* signal_loop(void* arg) {
+    sigset_t* set = (sigset_t*)arg;
+    int sig;
+    while (sigwait(set, &sig) == 0) {
+        if (sig == SIGUSR1) metrics_print(stdout);
+    }
+    return NULL;
+}
+
+int metrics_start(void) {
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    // Thread tạo sau kế thừa mask: SIGUSR1 chỉ được nhận bởi sigwait bên dưới
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) return -1;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, signal_loop, &set) != 0) return -1;
+    pthread_detach(thread);
+    return 0;
+}
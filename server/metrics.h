@@ -0,0 +1,83 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Bộ đếm + histogram độ trễ theo MessageType, đọc được lúc server đang chạy (kill -USR1 <pid>
+// in bảng ra stdout). Mỗi thread ghi vào block riêng của nó (không lock, không atomic RMW),
+// reader cộng các block lại nên số liệu có thể lệch nhau vài mẫu.
+//  - handler: thời gian chạy nhánh switch của process_packet (count = số packet nhận)
+//  - db:      thời gian SQLite do packet loại đó gây ra: work của job DB (trên worker, hoặc
+//             ngay trên reactor khi -d 0) và nạp cache khi miss. Job tạo trong done của job
+//             khác (vd. trang tin offline sau login) được tính cho loại của job đầu.
+//  - write:   thời gian mỗi lần writev ra socket (chung cho mọi loại vì 1 writev gom nhiều frame)
+//  - loop:    thời gian xử lý 1 vòng lặp của reactor (không tính lúc chờ sự kiện)
+// Bảng in kèm số liệu gộp presence (sự kiện / bị gộp / đã công bố / packet delta).
+// Histogram kiểu HDR: 8 bucket tuyến tính cho mỗi lũy thừa của 2 (sai số <= 12.5%), đơn vị ns.
+
+#define METRICS_MAX_TYPES 64        // MessageType >= giá trị này tính vào MSG_TYPE_UNKNOWN
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_EXP 40          // giá trị >= 2^40 ns (~18 phút) rơi vào bucket cuối
+#define METRICS_BUCKETS ((METRICS_MAX_EXP - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[METRICS_BUCKETS];
+} Histogram;
+
+typedef struct {
+    uint64_t in_bytes;
+    uint64_t out_count;     // số frame xếp vào hàng đợi gửi của session
+    uint64_t out_bytes;
+    Histogram handler;
+    Histogram db;
+} TypeMetrics;
+
+typedef struct MetricsBlock {
+    struct MetricsBlock* next;
+    TypeMetrics types[METRICS_MAX_TYPES];
+    Histogram db_commit;    // COMMIT của 1 lô ghi (fsync), chung cho các job trong lô
+    Histogram write;
+    uint64_t write_bytes;
+    Histogram loop;
+} MetricsBlock;
+
+uint64_t metrics_now(void);
+
+// Bắt đầu / kết thúc 1 packet nhận được trên thread hiện tại.
+// Giữa 2 lời gọi, thời gian DB và job DB gửi đi được tính cho `type`.
+uint64_t metrics_packet_begin(int type);
+void metrics_packet_end(int type, size_t bytes, uint64_t start);
+
+// Loại packet đang được xử lý trên thread hiện tại (0 = không có)
+int metrics_current_type(void);
+void metrics_set_current_type(int type);
+
+// Các hàm ghi nhận: thời gian = metrics_now() - start
+void metrics_record_db(int type, uint64_t start);
+void metrics_record_commit(uint64_t start);
+void metrics_record_write(size_t bytes, uint64_t start);
+void metrics_record_loop(uint64_t start);
+void metrics_record_out(int type, size_t bytes);
+
+// Cộng block của mọi thread vào out (caller cấp phát, hàm tự xóa trắng trước)
+void metrics_snapshot(MetricsBlock* out);
+// Giá trị (ns) mà tỉ lệ q mẫu không vượt quá, 0 nếu histogram rỗng
+uint64_t metrics_percentile(const Histogram* h, double q);
+// Số mẫu chắc chắn <= ns (bucket có giá trị lớn nhất <= ns), dùng cho bucket "le" của Prometheus
+uint64_t metrics_count_at_most(const Histogram* h, uint64_t ns);
+// Tên loại packet (vd. "PRIVATE_MESSAGE"), NULL nếu loại không có tên
+const char* metrics_type_name(int type);
+
+// In bảng số liệu hiện tại
+void metrics_print(FILE* out);
+// Chặn SIGUSR1 trên thread hiện tại và các thread tạo sau (gọi trước khi tạo thread),
+// rồi chạy 1 thread in bảng mỗi lần nhận SIGUSR1. Trả về 0 nếu OK.
+int metrics_start(void);
+
+#endif
@@ -0,0 +1,86 @@
+#include "name_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t name_hash(const char* s) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (int i = 0; i < MAX_USERNAME && s[i]; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void name_set_retain(NameSet* set) {
+    if (set) __atomic_add_fetch(&set->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void name_set_release(NameSet* set) {
+    if (!set) return;
+    if (__atomic_sub_fetch(&set->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(set->index);
+        free(set->names);
+        free(set);
+    }
+}
+
+long name_set_find(const NameSet* set, const char* name) {
+    uint32_t h = name_hash(name);
+    for (int i = h & set->index_mask;; i = (i + 1) & set->index_mask) {
+        int pos = set->index[i];
+        if (pos == 0) return -1;
+        if (strncmp(set->names[pos - 1], name, MAX_USERNAME) == 0) return pos - 1;
+    }
+}
+
+NameSet* name_set_build(char (*names)[MAX_USERNAME], int count) {
+    NameSet* set = calloc(1, sizeof(NameSet));
+    int cap = 8;
+    while (cap < count * 2) cap <<= 1;
+    if (!set) return NULL;
+    set->index = calloc(cap, sizeof(int));
+    set->names = malloc(sizeof(*set->names) * (count > 0 ? count : 1));
+    if (!set->index || !set->names) {
+        free(set->index);
+        free(set->names);
+        free(set);
+        return NULL;
+    }
+    set->refcount = 1;
+    set->index_mask = cap - 1;
+    for (int i = 0; i < count; i++) {
+        if (names[i][0] == '\0' || name_set_find(set, names[i]) >= 0) continue;
+        memcpy(set->names[set->count], names[i], MAX_USERNAME);
+        set->names[set->count][MAX_USERNAME - 1] = '\0';
+        uint32_t h = name_hash(set->names[set->count]);
+        int slot = h & set->index_mask;
+        while (set->index[slot] != 0) slot = (slot + 1) & set->index_mask;
+        set->index[slot] = ++set->count;
+    }
+    return set;
+}
+
+NameSet* name_set_with_change(const NameSet* old, const char* name, int add) {
+    int n = old ? old->count : 0;
+    char (*names)[MAX_USERNAME] = malloc(sizeof(*names) * (n + 1));
+    int count = 0;
+    int inserted = !add;
+    if (!names) return NULL;
+    for (int i = 0; i < n; i++) {
+        if (!add && strncmp(old->names[i], name, MAX_USERNAME) == 0) continue;
+        // Chèn trước phần tử lớn hơn đầu tiên: tập nạp từ DB theo thứ tự tên vẫn giữ thứ tự đó
+        if (!inserted && strncmp(old->names[i], name, MAX_USERNAME) > 0) {
+            memset(names[count], 0, MAX_USERNAME);
+            strncpy(names[count++], name, MAX_USERNAME - 1);
+            inserted = 1;
+        }
+        memcpy(names[count++], old->names[i], MAX_USERNAME);
+    }
+    if (!inserted) {
+        memset(names[count], 0, MAX_USERNAME);
+        strncpy(names[count++], name, MAX_USERNAME - 1);
+    }
+    NameSet* set = name_set_build(names, count);
+    free(names);
+    return set;
+}
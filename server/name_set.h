@@ -0,0 +1,31 @@
+#ifndef NAME_SET_H
+#define NAME_SET_H
+
+#include <stdint.h>
+#include "../shared/protocol.h"
+
+// Tập username/tên group bất biến, có chỉ mục hash, dùng chung cho các cache.
+// Mỗi thay đổi tạo bản mới (copy-on-write); reader giữ 1 reference trong lúc duyệt
+// nên writer chỉ cần đổi con trỏ dưới lock rồi release bản cũ.
+typedef struct {
+    int refcount;
+    int count;
+    int index_mask;                 // index_cap - 1
+    int* index;                     // hash -> (vị trí trong names) + 1, 0 = trống
+    char (*names)[MAX_USERNAME];    // theo thứ tự thêm vào (bản with_change giữ thứ tự strcmp)
+} NameSet;
+
+uint32_t name_hash(const char* name); // FNV-1a, tối đa MAX_USERNAME ký tự
+
+// Tạo tập mới từ danh sách tên (bỏ tên rỗng/trùng); refcount = 1. NULL nếu hết bộ nhớ.
+NameSet* name_set_build(char (*names)[MAX_USERNAME], int count);
+// Bản sao của `old` (có thể NULL) có thêm (add = 1) hoặc bớt (add = 0) name
+NameSet* name_set_with_change(const NameSet* old, const char* name, int add);
+
+// Vị trí của name trong set->names, -1 nếu không có
+long name_set_find(const NameSet* set, const char* name);
+
+void name_set_retain(NameSet* set);
+void name_set_release(NameSet* set);
+
+#endif
@@ -0,0 +1,45 @@
+#include "outbuf.h"
+#include "../shared/frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+OutBuf* outbuf_create(const ChatPacket* packet) {
+    unsigned char v2[FRAME_MAX_SIZE];
+    size_t v2_len = frame_encode_v2(packet, v2);
+
+    OutBuf* buf = malloc(sizeof(OutBuf) + v2_len);
+    if (!buf) return NULL;
+    buf->refcount = 1;
+    buf->log_state = 0;
+    buf->v2_len = v2_len;
+    memcpy(&buf->packet, packet, sizeof(ChatPacket));
+    memcpy(buf->v2, v2, v2_len);
+    return buf;
+}
+
+OutBuf* outbuf_make(MessageType type, const char* source, const char* target, const char* body) {
+    ChatPacket p;
+    memset(&p, 0, sizeof(p));
+    p.type = type;
+    if (source) strncpy(p.source_user, source, MAX_USERNAME - 1);
+    if (target) strncpy(p.target_user, target, MAX_USERNAME - 1);
+    if (body) strncpy(p.body, body, MAX_BODY - 1);
+    return outbuf_create(&p);
+}
+
+void outbuf_retain(OutBuf* buf) {
+    if (buf) __atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void outbuf_release(OutBuf* buf) {
+    if (buf && __atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) == 0) free(buf);
+}
+
+const unsigned char* outbuf_wire(const OutBuf* buf, int proto_version, size_t* len) {
+    if (proto_version >= FRAME_PROTO_V2) {
+        *len = buf->v2_len;
+        return buf->v2;
+    }
+    *len = sizeof(ChatPacket);
+    return (const unsigned char*)&buf->packet;
+}
@@ -0,0 +1,30 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include "../shared/protocol.h"
+
+// Packet gửi đi đã được mã hóa sẵn, bất biến và đếm tham chiếu.
+// Fan-out tạo 1 OutBuf rồi xếp cùng 1 tham chiếu vào hàng đợi của mọi người nhận
+// (kể cả qua mailbox sang reactor khác); bản cuối cùng được giải phóng khi
+// người nhận cuối cùng gửi xong.
+typedef struct OutBuf {
+    int refcount;           // atomic
+    int log_state;          // atomic, chỉ dùng cho fan-out tin group (xem server_group_outbuf_sent)
+    size_t v2_len;
+    ChatPacket packet;      // dạng v1 trên dây, đồng thời dùng để lưu offline
+    unsigned char v2[];     // frame v2 (v2_len byte)
+} OutBuf;
+
+// Mã hóa packet 1 lần cho mọi phiên bản frame; refcount = 1. NULL nếu hết bộ nhớ.
+OutBuf* outbuf_create(const ChatPacket* packet);
+// Tạo packet đơn giản (field NULL = rỗng)
+OutBuf* outbuf_make(MessageType type, const char* source, const char* target, const char* body);
+
+void outbuf_retain(OutBuf* buf);
+void outbuf_release(OutBuf* buf);
+
+// Dữ liệu cần gửi cho client dùng proto_version
+const unsigned char* outbuf_wire(const OutBuf* buf, int proto_version, size_t* len);
+
+#endif
@@ -0,0 +1,463 @@
+#include "presence.h"
+#include "server.h"
+#include "id_set.h"
+#include "group_cache.h"
+#include "friend_cache.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+// ----- Hàng đợi thay đổi presence (gộp theo user) -----
+
+typedef struct {
+    UserId user;
+    int published;      // trạng thái peer đang thấy khi cửa sổ bắt đầu
+} PendingChange;
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static PendingChange* pending = NULL;
+static int pending_count = 0;
+static int pending_cap = 0;
+static int* pending_index = NULL;       // hash(id) -> (vị trí trong pending) + 1, 0 = trống
+static int pending_index_cap = 0;       // luôn là lũy thừa của 2
+static unsigned long window_events = 0; // số sự kiện trong cửa sổ hiện tại
+static PresenceStats stats;
+static int timer_fd = -1;
+
+static uint32_t id_hash(UserId id) {
+    return id * 2654435761u; // Fibonacci hashing: id liên tiếp rải đều trên bảng
+}
+
+static void index_place_locked(int pos) {
+    int mask = pending_index_cap - 1;
+    int i = (int)(id_hash(pending[pos].user) & (uint32_t)mask);
+    while (pending_index[i]) i = (i + 1) & mask;
+    pending_index[i] = pos + 1;
+}
+
+static int find_pending_locked(UserId user) {
+    if (!pending_index) return -1;
+    int mask = pending_index_cap - 1;
+    for (int i = (int)(id_hash(user) & (uint32_t)mask);; i = (i + 1) & mask) {
+        int pos = pending_index[i] - 1;
+        if (pos < 0) return -1;
+        if (pending[pos].user == user) return pos;
+    }
+}
+
+static int add_pending_locked(UserId user, int published) {
+    if (pending_count == pending_cap) {
+        int new_cap = pending_cap ? pending_cap * 2 : 64;
+        PendingChange* grown = realloc(pending, sizeof(PendingChange) * new_cap);
+        if (!grown) return -1;
+        pending = grown;
+        pending_cap = new_cap;
+    }
+    if ((pending_count + 1) * 2 > pending_index_cap) {
+        int new_cap = pending_index_cap ? pending_index_cap * 2 : 128;
+        int* fresh = calloc(new_cap, sizeof(int));
+        if (!fresh) return -1;
+        free(pending_index);
+        pending_index = fresh;
+        pending_index_cap = new_cap;
+        for (int i = 0; i < pending_count; i++) index_place_locked(i);
+    }
+    PendingChange* c = &pending[pending_count];
+    c->user = user;
+    c->published = published;
+    index_place_locked(pending_count++);
+    return 0;
+}
+
+static void arm_timer(void) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = PRESENCE_FLUSH_INTERVAL_MS / 1000;
+    its.it_value.tv_nsec = (PRESENCE_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+    if (timerfd_settime(timer_fd, 0, &its, NULL) == -1) LOG_ERROR("timerfd_settime() failed: %s", strerror(errno));
+}
+
+// Ghi nhận user vừa chuyển sang is_online. Trả về 0 nếu đã xếp hàng, -1 nếu phải flush ngay.
+static int queue_change(UserId user, int is_online) {
+    int rc = 0;
+    pthread_mutex_lock(&pending_lock);
+    stats.events++;
+    window_events++;
+    // Chỉ sự kiện đầu tiên của cửa sổ cho biết peer đang thấy gì; các sự kiện sau
+    // chỉ cần đánh dấu user là "dirty", trạng thái cuối lấy từ danh bạ lúc flush.
+    if (find_pending_locked(user) < 0) {
+        int was_empty = pending_count == 0;
+        if (add_pending_locked(user, !is_online) != 0) rc = -1;
+        else if (was_empty && timer_fd >= 0) arm_timer();
+    }
+    pthread_mutex_unlock(&pending_lock);
+    return timer_fd >= 0 ? rc : -1;
+}
+
+// ----- Thu thập peer -----
+
+// Gom id các peer (có thể trùng, IdSet sẽ lọc)
+typedef struct {
+    UserId self;
+    UserId* ids;
+    int count;
+    int cap;
+} PeerCollector;
+
+static void collect_peer_cb(void* arg, UserId id) {
+    PeerCollector* c = (PeerCollector*)arg;
+    if (id == c->self) return;
+    if (c->count == c->cap) {
+        int new_cap = c->cap ? c->cap * 2 : 32;
+        void* grown = realloc(c->ids, sizeof(UserId) * new_cap);
+        if (!grown) return;
+        c->ids = grown;
+        c->cap = new_cap;
+    }
+    c->ids[c->count++] = id;
+}
+
+// Chỉ thành viên đang online mới cần biết (người offline sẽ nhận snapshot khi login)
+static int collect_group_cb(void* arg, const char* group_name) {
+    PeerCollector* c = (PeerCollector*)arg;
+    group_cache_for_each_online_member(NULL, group_name, collect_peer_cb, c);
+    return 0;
+}
+
+// Bạn bè + thành viên online của các group; trả về tập đã lọc trùng (NULL nếu hết bộ nhớ).
+// Chạy trên reactor nên chỉ đọc cache (db = NULL): dữ liệu của user đã được presence_prefetch
+// nạp lúc login.
+static IdSet* collect_peers(UserId user) {
+    PeerCollector c = { user, NULL, 0, 0 };
+    friend_cache_for_each_friend(NULL, user, collect_peer_cb, &c);
+    group_cache_for_each_user_group(NULL, user, collect_group_cb, &c);
+    IdSet* peers = id_set_build(c.ids, c.count);
+    free(c.ids);
+    return peers;
+}
+
+// ----- Gửi -----
+
+// Delta: body là danh sách "+user," / "-user,"
+static void send_delta(UserId to, UserId who, int is_online) {
+    const char* name = user_ids_name(who);
+    if (!name) return;
+    ChatPacket p;
+    memset(&p, 0, sizeof(p));
+    p.type = MSG_TYPE_PRESENCE_DELTA;
+    snprintf(p.body, MAX_BODY, "%c%s,", is_online ? '+' : '-', name);
+    server_send_to_id(to, &p);
+}
+
+// Snapshot: user + các peer đang online, chia nhiều packet nếu vượt MAX_BODY.
+// Peer lấy từ cache nên đã được intern: tên tra theo id ngay lúc dựng packet.
+static void send_snapshot(UserId self, IdSet* peers, int fd) {
+    const char* self_name = user_ids_name(self);
+    ChatPacket p;
+    memset(&p, 0, sizeof(p));
+    p.type = MSG_TYPE_ONLINE_LIST_UPDATE;
+    int offset = snprintf(p.body, MAX_BODY, "%s,", self_name ? self_name : "");
+
+    for (int i = 0; peers && i < peers->count; i++) {
+        const char* name = user_ids_name(peers->ids[i]);
+        if (!name || !server_is_id_online(peers->ids[i])) continue;
+        size_t len = strnlen(name, MAX_USERNAME) + 1;
+        if (offset + len >= MAX_BODY) {
+            server_send_packet(fd, &p);
+            memset(p.body, 0, MAX_BODY);
+            strcpy(p.target_user, "+"); // các chunk sau: client cộng dồn thay vì thay thế
+            offset = 0;
+        }
+        offset += snprintf(p.body + offset, MAX_BODY - offset, "%s,", name);
+    }
+    server_send_packet(fd, &p);
+}
+
+// ----- Thông báo "went offline" trong group (gộp theo group) -----
+
+// 1 cặp (group, thay đổi offline) cần báo cho thành viên group đó
+typedef struct {
+    char* group;            // bản sao: entry group trong cache có thể bị thay khi gửi
+    int change;
+} GroupNotice;
+
+typedef struct {
+    GroupNotice* items;
+    size_t count;
+    size_t cap;
+    int change;             // thay đổi đang duyệt group
+} GroupNoticeList;
+
+static int collect_offline_group_cb(void* arg, const char* group_name) {
+    GroupNoticeList* l = (GroupNoticeList*)arg;
+    if (l->count == l->cap) {
+        size_t new_cap = l->cap ? l->cap * 2 : 64;
+        GroupNotice* grown = realloc(l->items, sizeof(GroupNotice) * new_cap);
+        if (!grown) return 1;
+        l->items = grown;
+        l->cap = new_cap;
+    }
+    char* copy = strdup(group_name);
+    if (!copy) return 1;
+    l->items[l->count].group = copy;
+    l->items[l->count].change = l->change;
+    l->count++;
+    return 0;
+}
+
+static int compare_notice(const void* a, const void* b) {
+    const GroupNotice* x = (const GroupNotice*)a;
+    const GroupNotice* y = (const GroupNotice*)b;
+    int c = strcmp(x->group, y->group);
+    return c ? c : x->change - y->change;
+}
+
+typedef struct {
+    OutBuf* out;            // thông báo của group hiện tại, dùng chung cho mọi thành viên
+    unsigned long sent;
+} MemberNotifyCtx;
+
+static void member_notify_cb(void* arg, UserId member) {
+    MemberNotifyCtx* mc = (MemberNotifyCtx*)arg;
+    server_send_outbuf_to_id(member, mc->out);
+    mc->sent++;
+}
+
+// 1 dòng delta cần gửi: recipient thấy changes[change] đổi trạng thái
+typedef struct {
+    UserId recipient;
+    int change;
+} DeltaItem;
+
+static int compare_delta(const void* a, const void* b) {
+    const DeltaItem* x = (const DeltaItem*)a;
+    const DeltaItem* y = (const DeltaItem*)b;
+    if (x->recipient != y->recipient) return x->recipient < y->recipient ? -1 : 1;
+    return x->change - y->change;
+}
+
+typedef struct {
+    UserId user;
+    const char* username;   // chuỗi của bảng intern, không cần copy
+    int is_online;
+} PublishedChange;
+
+// Gửi delta theo lô: sắp theo người nhận rồi gói nhiều "+user,"/"-user," vào 1 packet
+static unsigned long send_batched_deltas(DeltaItem* items, size_t count, const PublishedChange* changes) {
+    unsigned long packets = 0;
+    qsort(items, count, sizeof(DeltaItem), compare_delta);
+
+    ChatPacket p;
+    size_t i = 0;
+    while (i < count) {
+        UserId to = items[i].recipient;
+        memset(&p, 0, sizeof(p));
+        p.type = MSG_TYPE_PRESENCE_DELTA;
+        int offset = 0;
+        for (; i < count && items[i].recipient == to; i++) {
+            const PublishedChange* ch = &changes[items[i].change];
+            size_t len = strnlen(ch->username, MAX_USERNAME) + 2;
+            if (offset + len >= MAX_BODY) {
+                server_send_to_id(to, &p);
+                packets++;
+                memset(p.body, 0, MAX_BODY);
+                offset = 0;
+            }
+            offset += snprintf(p.body + offset, MAX_BODY - offset, "%c%s,", ch->is_online ? '+' : '-', ch->username);
+        }
+        server_send_to_id(to, &p);
+        packets++;
+    }
+    return packets;
+}
+
+static void send_group_notice(const char* group, const char* source, const char* body,
+                              MemberNotifyCtx* mc) {
+    mc->out = outbuf_make(MSG_TYPE_RECEIVE_GROUP_MESSAGE, source, group, body);
+    if (!mc->out) return;
+    // Người vừa offline đã bị gỡ khỏi tập online nên không nhận lại thông báo của mình
+    group_cache_for_each_online_member(NULL, group, member_notify_cb, mc);
+    outbuf_release(mc->out);
+}
+
+// 1 thông báo cho mỗi group có thành viên vừa offline trong cửa sổ: "a, b went offline."
+// (1 người thì gửi dưới tên người đó như trước), chỉ thành viên đang online nhận.
+// Trả về số packet đã xếp hàng.
+static unsigned long send_group_notices(GroupNotice* items, size_t count,
+                                        const PublishedChange* changes) {
+    static const char suffix[] = " went offline.";
+    MemberNotifyCtx mc = { NULL, 0 };
+    qsort(items, count, sizeof(GroupNotice), compare_notice);
+
+    char body[MAX_BODY];
+    size_t i = 0;
+    while (i < count) {
+        const char* group = items[i].group;
+        size_t offset = 0;
+        int names = 0;
+        const char* first = NULL;
+        for (; i < count && strcmp(items[i].group, group) == 0; i++) {
+            const char* name = changes[items[i].change].username;
+            size_t len = strnlen(name, MAX_USERNAME) + 2;
+            if (names && offset + len + sizeof(suffix) >= MAX_BODY) {
+                snprintf(body + offset, MAX_BODY - offset, "%s", suffix);
+                send_group_notice(group, names == 1 ? first : "Server", body, &mc);
+                offset = 0;
+                names = 0;
+            }
+            if (names == 0) first = name;
+            offset += snprintf(body + offset, MAX_BODY - offset, "%s%.*s", names ? ", " : "",
+                               (int)MAX_USERNAME, name);
+            names++;
+        }
+        snprintf(body + offset, MAX_BODY - offset, "%s", suffix);
+        send_group_notice(group, names == 1 ? first : "Server", body, &mc);
+    }
+    return mc.sent;
+}
+
+static void flush_pending(void) {
+    pthread_mutex_lock(&pending_lock);
+    PendingChange* batch = pending;
+    int batch_count = pending_count;
+    unsigned long events = window_events;
+    pending = NULL;
+    pending_count = pending_cap = 0;
+    if (pending_index) memset(pending_index, 0, sizeof(int) * pending_index_cap);
+    window_events = 0;
+    pthread_mutex_unlock(&pending_lock);
+    if (batch_count == 0) {
+        free(batch);
+        return;
+    }
+
+    // Trạng thái cuối lấy từ danh bạ: login/logout ở reactor khác có thể đến không theo thứ tự
+    PublishedChange* changes = malloc(sizeof(PublishedChange) * batch_count);
+    int change_count = 0;
+    for (int i = 0; changes && i < batch_count; i++) {
+        int is_online = server_is_id_online(batch[i].user);
+        if (is_online == batch[i].published) continue; // flap trong cửa sổ: không ai cần biết
+        const char* name = user_ids_name(batch[i].user);
+        if (!name) continue;
+        changes[change_count].user = batch[i].user;
+        changes[change_count].username = name;
+        changes[change_count].is_online = is_online;
+        change_count++;
+    }
+    free(batch);
+
+    // Bạn bè nằm trong tập peer nên trạng thái của họ đi chung packet delta của mỗi người nhận
+    // (không còn 1 FRIEND_UPDATE cho mỗi người bạn); thông báo offline trong group gộp theo group.
+    DeltaItem* items = NULL;
+    size_t item_count = 0, item_cap = 0;
+    GroupNoticeList notices = { NULL, 0, 0, 0 };
+    for (int i = 0; i < change_count; i++) {
+        UserId user = changes[i].user;
+        if (!changes[i].is_online) {
+            notices.change = i;
+            group_cache_for_each_user_group(NULL, user, collect_offline_group_cb, &notices);
+        }
+
+        IdSet* peers = collect_peers(user);
+        for (int k = 0; peers && k < peers->count; k++) {
+            if (item_count == item_cap) {
+                size_t new_cap = item_cap ? item_cap * 2 : 256;
+                DeltaItem* grown = realloc(items, sizeof(DeltaItem) * new_cap);
+                if (!grown) break;
+                items = grown;
+                item_cap = new_cap;
+            }
+            items[item_count].recipient = peers->ids[k];
+            items[item_count].change = i;
+            item_count++;
+        }
+        id_set_release(peers);
+    }
+    unsigned long packets = item_count ? send_batched_deltas(items, item_count, changes) : 0;
+    unsigned long notice_packets = notices.count ? send_group_notices(notices.items, notices.count, changes) : 0;
+    for (size_t k = 0; k < notices.count; k++) free(notices.items[k].group);
+    free(notices.items);
+    free(items);
+    free(changes);
+
+    pthread_mutex_lock(&pending_lock);
+    stats.published += change_count;
+    stats.coalesced += events - change_count;
+    stats.packets += packets;
+    stats.notices += notice_packets;
+    PresenceStats total = stats;
+    pthread_mutex_unlock(&pending_lock);
+
+    LOG_DEBUG("Presence flush: %lu events -> %d changes, %lu delta + %lu group notice packets "
+              "(total: %lu events, %lu coalesced, %lu published)",
+              events, change_count, packets, notice_packets, total.events, total.coalesced, total.published);
+}
+
+// ----- API -----
+
+int presence_init(void) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) LOG_ERROR("timerfd_create() failed, presence changes will not be coalesced: %s", strerror(errno));
+    return timer_fd;
+}
+
+void presence_on_timer(void) {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) return;
+    flush_pending();
+}
+
+void presence_user_online(UserId user, int fd) {
+    // Tập online của group phải đúng ngay để định tuyến tin nhắn group
+    group_cache_on_user_online(user);
+
+    IdSet* peers = collect_peers(user);
+    send_snapshot(user, peers, fd);
+    id_set_release(peers);
+
+    if (queue_change(user, 1) != 0) flush_pending();
+}
+
+static void prefetch_friend_cb(void* arg, UserId friend_id) {
+    (void)arg; (void)friend_id;
+}
+
+static int prefetch_group_cb(void* arg, const char* group_name) {
+    group_cache_exists((sqlite3*)arg, group_name); // nạp entry group (owner + thành viên)
+    return 0;
+}
+
+void presence_prefetch(sqlite3* db, UserId user) {
+    friend_cache_for_each_friend(db, user, prefetch_friend_cb, NULL);
+    group_cache_for_each_user_group(db, user, prefetch_group_cb, db);
+}
+
+void presence_user_offline(UserId user) {
+    group_cache_on_user_offline(user);
+    if (queue_change(user, 0) != 0) flush_pending();
+}
+
+void presence_send_snapshot(UserId user, int fd) {
+    IdSet* peers = collect_peers(user);
+    send_snapshot(user, peers, fd);
+    id_set_release(peers);
+}
+
+void presence_introduce(UserId user_a, UserId user_b) {
+    if (user_a == user_b) return;
+    if (!server_is_id_online(user_a) || !server_is_id_online(user_b)) return;
+    send_delta(user_a, user_b, 1);
+    send_delta(user_b, user_a, 1);
+}
+
+void presence_get_stats(PresenceStats* out) {
+    pthread_mutex_lock(&pending_lock);
+    *out = stats;
+    pthread_mutex_unlock(&pending_lock);
+}
@@ -0,0 +1,55 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <sqlite3.h>
+#include "db_handler.h"
+#include "user_ids.h"
+
+// Presence: client nhận 1 snapshot (MSG_TYPE_ONLINE_LIST_UPDATE) khi login, sau đó chỉ
+// nhận delta (MSG_TYPE_PRESENCE_DELTA). Chỉ "peer" của user mới nhận delta:
+// bạn bè + thành viên các group user tham gia.
+//
+// Thông báo cho peer không gửi ngay mà được gom theo user trong 1 cửa sổ
+// PRESENCE_FLUSH_INTERVAL_MS: offline -> online trong cùng cửa sổ triệt tiêu nhau,
+// phần còn lại được flush theo lô (1 packet delta chứa nhiều user cho mỗi người nhận,
+// bạn bè cũng nhận qua delta này; 1 thông báo "went offline" cho mỗi group).
+
+#define PRESENCE_FLUSH_INTERVAL_MS 250
+
+typedef struct {
+    unsigned long events;       // số sự kiện login/logout đã nhận
+    unsigned long coalesced;    // số sự kiện không phải gửi đi (bị gộp/triệt tiêu)
+    unsigned long published;    // số thay đổi trạng thái đã công bố cho peer
+    unsigned long packets;      // số packet delta đã gửi
+    unsigned long notices;      // số packet "went offline" gửi cho thành viên group
+} PresenceStats;
+
+// Tạo timer flush. Trả về fd (timerfd) để đăng ký vào epoll của 1 reactor, -1 nếu lỗi.
+int presence_init(void);
+
+// Các hàm gọi trên reactor chỉ đọc cache, không bao giờ hỏi DB.
+
+// Gọi trên reactor sở hữu timer khi fd của presence_init readable: flush các thay đổi đang chờ
+void presence_on_timer(void);
+
+// Gọi sau khi user đã claim username: đánh dấu online trong group cache,
+// gửi snapshot cho user ngay và xếp hàng delta "online" cho các peer.
+void presence_user_online(UserId user, int fd);
+
+// Nạp sẵn đồ thị bạn bè + các group của user vào cache (chạy trên worker DB trước khi login
+// hoàn tất) để presence_user_online trên reactor không phải đọc DB
+void presence_prefetch(sqlite3* db, UserId user);
+
+// Gọi sau khi user đã rời danh bạ: gỡ khỏi tập online của group cache ngay,
+// xếp hàng thông báo offline cho bạn bè/thành viên group.
+void presence_user_offline(UserId user);
+
+// Gửi lại snapshot cho 1 session (vd. sau khi delta bị bỏ vì client chậm)
+void presence_send_snapshot(UserId user, int fd);
+
+// 2 user vừa thành peer (kết bạn / vào chung group): báo cho nhau nếu cả 2 đang online
+void presence_introduce(UserId user_a, UserId user_b);
+
+void presence_get_stats(PresenceStats* out);
+
+#endif
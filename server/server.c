@@ -5,6 +5,13 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
 #include "message_handler.h" // <-- THÊM MỚI
 #include <errno.h>
 #include <fcntl.h> // Cho non-blocking
@@ -13,149 +20,661 @@
 #include "server.h" // File .h ta vừa tạo
 #include "friend_manager.h" // <-- ADD: declare friend-related handlers
 #include "group_manager.h"  // <-- NEW: may contain group helpers
+#include "session_registry.h"
+#include "presence.h"
+#include "metrics.h"
+#include "admin.h"
+#include "log.h"
 
 #define PORT 8888
-#define MAX_EVENTS 10
+#define MAX_EVENTS 64
+#define DB_PATH "server/chat.db"
 
-// ----- Quản lý Session Toàn cục -----
-ClientSession sessions[MAX_CLIENTS];
-sqlite3 *db; // DB toàn cục
-int epoll_fd; // epoll FD toàn cục
+// ----- Reactor -----
+static Reactor reactors[MAX_REACTORS];
+static int num_reactors = 1;
+static int cork_mode = 0;   // -c: cork socket khi 1 lần flush cần nhiều writev
+static int use_uring = 0;   // -b uring: dùng io_uring thay cho epoll (tự quay về epoll nếu kernel không hỗ trợ)
+static int db_workers = DB_POOL_DEFAULT_WORKERS; // -d: số thread DB (0 = chạy DB trên reactor)
+static int admin_port = ADMIN_DEFAULT_PORT; // -a: cổng quản trị trên 127.0.0.1 (0 = tắt)
+__thread Reactor* current_reactor = NULL;
 
-void init_sessions() {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        sessions[i].fd = -1; // -1 = slot trống
-        sessions[i].buffer_len = 0;
-        memset(sessions[i].username, 0, MAX_USERNAME);
+int server_claim_user(UserId id, int fd) {
+    if (!current_reactor) return -1;
+    return registry_claim_user(id, current_reactor->id, fd);
+}
+
+int server_reactor_stats(int id, ReactorStats* out) {
+    if (id < 0 || id >= num_reactors) return -1;
+    out->sessions = __atomic_load_n(&reactors[id].session_count, __ATOMIC_RELAXED);
+    out->out_queued = __atomic_load_n(&reactors[id].out_queued, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int server_is_id_online(UserId id) {
+    return registry_lookup_user(id, NULL, NULL) == 0;
+}
+
+// User online thì luôn đã được intern lúc login: tên chưa biết = offline
+int server_is_user_online(const char* username) {
+    return server_is_id_online(user_ids_find(username));
+}
+
+// ----- Quản lý Session (theo shard của reactor hiện tại) -----
+
+// Lấy 1 session trống từ pool; cấp thêm slab khi hết
+static ClientSession* session_alloc(Reactor* r) {
+    if (!r->free_sessions) {
+        SessionSlab* slab = malloc(sizeof(SessionSlab));
+        if (!slab) return NULL;
+        slab->next = r->slabs;
+        r->slabs = slab;
+        for (int i = SESSION_SLAB_SIZE - 1; i >= 0; i--) {
+            ClientSession* s = &slab->sessions[i];
+            memset(s, 0, sizeof(ClientSession));
+            s->fd = -1; // -1 = slot trống
+            s->reactor_id = r->id;
+            s->next_free = r->free_sessions;
+            r->free_sessions = s;
+        }
     }
+    ClientSession* s = r->free_sessions;
+    r->free_sessions = s->next_free;
+    s->next_free = NULL;
+    __atomic_add_fetch(&r->session_count, 1, __ATOMIC_RELAXED);
+    return s;
 }
 
+static void session_free(Reactor* r, ClientSession* s) {
+    free(s->rx);
+    free(s->rx_spill);
+    memset(s, 0, sizeof(ClientSession));
+    s->fd = -1;
+    s->reactor_id = r->id;
+    s->next_free = r->free_sessions;
+    r->free_sessions = s;
+    __atomic_sub_fetch(&r->session_count, 1, __ATOMIC_RELAXED);
+}
+
+// O(1): tra bảng fd của registry, chỉ trả về session thuộc reactor hiện tại
 ClientSession* get_session(int fd) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd == fd) return &sessions[i];
+    if (!current_reactor) return NULL;
+    ClientSession* s = registry_get_fd(fd);
+    if (!s || s->fd != fd || s->reactor_id != current_reactor->id) return NULL;
+    return s;
+}
+
+SessionRef server_session_ref(int fd) {
+    SessionRef ref = { fd, 0 };
+    ClientSession* s = get_session(fd);
+    if (s) ref.gen = s->gen;
+    return ref;
+}
+
+ClientSession* server_session_deref(SessionRef ref) {
+    ClientSession* s = get_session(ref.fd);
+    return (s && s->gen == ref.gen && !s->closing) ? s : NULL;
+}
+
+int add_session(int fd) {
+    if (fd >= registry_max_fds()) {
+        LOG_WARN("Cannot add session: fd %d exceeds registry size.", fd);
+        close(fd);
+        return -1;
     }
-    return NULL;
+    ClientSession* session = session_alloc(current_reactor);
+    if (!session) {
+        LOG_ERROR("Cannot add session: out of memory.");
+        close(fd);
+        return -1;
+    }
+    session->fd = fd;
+    session->gen = ++current_reactor->next_gen;
+    session->proto_version = FRAME_PROTO_V1;
+    registry_bind_fd(fd, session);
+    LOG_DEBUG("New session added for fd %d (%d sessions)", fd, current_reactor->session_count);
+    return 0;
 }
 
-void add_session(int fd) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd == -1) {
-            sessions[i].fd = fd;
-            sessions[i].buffer_len = 0;
-            printf("New session added for fd %d\n", fd);
-            return;
-        }
+// ----- Gửi packet (hàng đợi outbound + backpressure) -----
+
+static void update_epoll_events(ClientSession* s) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLET | (s->want_write ? EPOLLOUT : 0);
+    event.data.fd = s->fd;
+    if (epoll_ctl(current_reactor->epoll_fd, EPOLL_CTL_MOD, s->fd, &event) == -1) {
+        LOG_ERROR("epoll_ctl MOD client failed: %s", strerror(errno));
     }
-    printf("Cannot add session: server is full.\n");
-    close(fd);
 }
 
-// Hàm này sẽ gửi danh sách online cho mọi người (tạm thời)
-// Ngày 5 sẽ sửa lại chỉ gửi cho bạn bè
-void broadcast_online_list(ClientSession* sessions) {
-    printf("Broadcasting online list...\n");
-    ChatPacket packet;
-    memset(&packet, 0, sizeof(ChatPacket));
-    packet.type = MSG_TYPE_ONLINE_LIST_UPDATE;
-
-    // Xây dựng nội dung (body) là danh sách user, cách nhau bằng dấu phẩy
-    int offset = 0;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd != -1 && sessions[i].username[0] != '\0') {
-            int len = snprintf(packet.body + offset, MAX_BODY - offset, "%s,", sessions[i].username);
-            if (offset + len >= MAX_BODY) break;
-            offset += len;
+// Đánh dấu session cần đóng; reactor đóng nó sau khi xử lý xong sự kiện hiện tại
+// (không đóng ngay vì caller có thể vẫn đang giữ con trỏ tới session).
+static void mark_session_closing(ClientSession* s) {
+    if (s->closing) return;
+    s->closing = 1;
+    Reactor* r = current_reactor;
+    if (r->pending_close_count == r->pending_close_cap) {
+        int cap = r->pending_close_cap ? r->pending_close_cap * 2 : 64;
+        int* grown = realloc(r->pending_close, sizeof(int) * cap);
+        if (!grown) return; // closing=1 vẫn chặn mọi I/O; session sẽ đóng khi client ngắt
+        r->pending_close = grown;
+        r->pending_close_cap = cap;
+    }
+    r->pending_close[r->pending_close_count++] = s->fd;
+}
+
+static void free_out_queue(ClientSession* s) {
+    OutFrame* f = s->out_head;
+    while (f) {
+        OutFrame* next = f->next;
+        outbuf_release(f->buf);
+        free(f);
+        f = next;
+    }
+    s->out_head = s->out_tail = NULL;
+    __atomic_sub_fetch(&current_reactor->out_queued, s->out_bytes, __ATOMIC_RELAXED);
+    s->out_bytes = 0;
+}
+
+// Bỏ `bytes` byte đầu hàng đợi vừa gửi xong, giải phóng các frame đã gửi trọn
+static void consume_sent(ClientSession* s, size_t bytes) {
+    s->out_bytes -= bytes;
+    __atomic_sub_fetch(&current_reactor->out_queued, bytes, __ATOMIC_RELAXED);
+    while (bytes > 0) {
+        OutFrame* f = s->out_head;
+        size_t remaining = f->len - f->sent;
+        if (bytes < remaining) {
+            f->sent += bytes; // gửi dở: frame này không được bỏ nữa
+            break;
         }
+        bytes -= remaining;
+        s->out_head = f->next;
+        if (!s->out_head) s->out_tail = NULL;
+        s->tx_frames++;
+        current_reactor->tx_frames++;
+        outbuf_release(f->buf);
+        free(f);
     }
-    // Gửi cho tất cả mọi người đang online
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd != -1 && sessions[i].username[0] != '\0') {
-            write(sessions[i].fd, &packet, sizeof(ChatPacket));
+}
+
+static void set_cork(int fd, int on) {
+#ifdef TCP_CORK
+    if (setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1) LOG_ERROR("setsockopt(TCP_CORK) failed: %s", strerror(errno));
+#else
+    (void)fd; (void)on;
+#endif
+}
+
+// Ghi hàng đợi ra socket bằng writev (tối đa FLUSH_IOV_MAX frame mỗi lần) cho tới khi
+// hết hoặc socket đầy. Trả về 0 nếu OK (có thể còn dư), -1 nếu socket lỗi.
+static int flush_out_queue(ClientSession* s) {
+    int corked = 0;
+    int rc = 0;
+    while (s->out_head) {
+        struct iovec iov[FLUSH_IOV_MAX];
+        int n = 0;
+        size_t want = 0;
+        OutFrame* f = s->out_head;
+        for (; f && n < FLUSH_IOV_MAX; f = f->next, n++) {
+            iov[n].iov_base = (void*)(f->data + f->sent);
+            iov[n].iov_len = f->len - f->sent;
+            want += iov[n].iov_len;
+        }
+        // Còn frame cho lần writev sau: cork để kernel không đẩy segment lẻ ở giữa
+        if (cork_mode && f && !corked) {
+            set_cork(s->fd, 1);
+            corked = 1;
+        }
+
+        uint64_t start = metrics_now();
+        ssize_t w = writev(s->fd, iov, n);
+        metrics_record_write(w > 0 ? (size_t)w : 0, start);
+        s->tx_writes++;
+        current_reactor->tx_writes++;
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) rc = -1;
+            break;
         }
+        consume_sent(s, (size_t)w);
+        if ((size_t)w < want) break; // socket đầy, EPOLLOUT sẽ báo khi ghi tiếp được
     }
+    if (corked) set_cork(s->fd, 0);
+    return rc;
 }
 
-// Helper: find session by username (local copy to avoid cross-file dependency)
-static ClientSession* find_session_by_username_local(const char* username) {
-    if (!username) return NULL;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd != -1 && sessions[i].username[0] != '\0' && strcmp(sessions[i].username, username) == 0) {
-            return &sessions[i];
+static int enqueue_frame(ClientSession* s, OutBuf* buf, const unsigned char* data, size_t len) {
+    OutFrame* f = malloc(sizeof(OutFrame));
+    if (!f) return -1;
+    outbuf_retain(buf);
+    f->next = NULL;
+    f->buf = buf;
+    f->data = data;
+    f->len = len;
+    f->sent = 0;
+    if (s->out_tail) s->out_tail->next = f;
+    else s->out_head = f;
+    s->out_tail = f;
+    s->out_bytes += len;
+    s->out_total += len;
+    __atomic_add_fetch(&current_reactor->out_queued, len, __ATOMIC_RELAXED);
+    metrics_record_out(buf->packet.type, len);
+    return 0;
+}
+
+// ----- Backend io_uring -----
+// user_data của SQE: 3 bit thấp là loại request. SEND mang con trỏ UringSend (malloc căn
+// lề >= 8 byte); các loại khác mang fd và gen của session để bỏ qua CQE của fd đã đóng.
+enum { UD_ACCEPT = 1, UD_WAKE, UD_TIMER, UD_RECV, UD_SEND, UD_CANCEL, UD_ADMIN };
+#define UD_TAG_MASK 7ULL
+
+static uint64_t ud_make(int tag, int fd, uint32_t gen) {
+    return ((uint64_t)gen << 32) | ((uint64_t)(uint32_t)fd << 3) | (uint64_t)tag;
+}
+static int ud_fd(uint64_t ud) { return (int)((ud & 0xFFFFFFFFULL) >> 3); }
+static uint32_t ud_gen(uint64_t ud) { return (uint32_t)(ud >> 32); }
+
+static void uring_arm_recv(ClientSession* s) {
+    struct io_uring_sqe* sqe = uring_get_sqe(current_reactor->uring);
+    if (!sqe) { mark_session_closing(s); return; }
+    uring_prep_recv_multishot(sqe, s->fd, ud_make(UD_RECV, s->fd, s->gen));
+    s->rx_armed = 1;
+}
+
+static UringSend* uring_send_alloc(Reactor* r) {
+    UringSend* op = r->free_sends;
+    if (op) r->free_sends = op->next_free;
+    else op = malloc(sizeof(UringSend));
+    return op;
+}
+
+static void uring_send_free(Reactor* r, UringSend* op) {
+    for (int i = 0; i < op->count; i++) outbuf_release(op->bufs[i]);
+    op->next_free = r->free_sends;
+    r->free_sends = op;
+}
+
+// Gửi hàng đợi bằng SENDMSG, mỗi lệnh tối đa FLUSH_IOV_MAX frame như 1 writev. Hàng đợi dài
+// hơn được chia thành nhiều lệnh nối nhau (IOSQE_IO_LINK): kernel chạy lần lượt theo thứ tự,
+// 1 lệnh gửi thiếu/lỗi làm hủy (-ECANCELED) phần còn lại của chuỗi. Mỗi session chỉ có 1
+// chuỗi chạy tại 1 thời điểm; chuỗi xong thì gửi tiếp phần còn lại.
+static void uring_flush(ClientSession* s) {
+    Reactor* r = current_reactor;
+    Uring* u = r->uring;
+    if (s->tx_inflight || !s->out_head || s->closing) return;
+
+    // Cả chuỗi phải nằm trong 1 lần submit, nếu không kernel coi phần đầu là 1 chuỗi riêng
+    unsigned space = uring_sq_space(u);
+    if (space == 0) {
+        uring_submit(u);
+        space = uring_sq_space(u);
+        if (space == 0) return; // io_uring_enter lỗi: thử lại ở lần gửi sau
+    }
+    unsigned limit = space < URING_SEND_CHAIN_MAX ? space : URING_SEND_CHAIN_MAX;
+
+    OutFrame* f = s->out_head;
+    struct io_uring_sqe* prev = NULL;
+    unsigned ops = 0;
+    while (f && ops < limit) {
+        UringSend* op = uring_send_alloc(r);
+        if (!op) break;
+        op->fd = s->fd;
+        op->gen = s->gen;
+        op->count = 0;
+        for (; f && op->count < FLUSH_IOV_MAX; f = f->next) {
+            op->iov[op->count].iov_base = (void*)(f->data + f->sent);
+            op->iov[op->count].iov_len = f->len - f->sent;
+            outbuf_retain(f->buf);
+            op->bufs[op->count++] = f->buf;
         }
+        memset(&op->msg, 0, sizeof(op->msg));
+        op->msg.msg_iov = op->iov;
+        op->msg.msg_iovlen = (size_t)op->count;
+
+        if (prev) prev->flags |= IOSQE_IO_LINK;
+        prev = uring_get_sqe(u);
+        uring_prep_sendmsg(prev, s->fd, &op->msg, MSG_NOSIGNAL | MSG_WAITALL, (uint64_t)(uintptr_t)op | UD_SEND);
+        ops++;
     }
-    return NULL;
+    s->tx_inflight = (int)ops;
+    s->tx_writes += ops;
+    r->tx_writes += ops;
+
+    // Hàng đợi lớn (vd. đang xử lý 1 lô recv dài): submit ngay như epoll ghi ngay,
+    // không đợi hết lô CQE hiện tại
+    if (s->out_bytes >= OUTBUF_LOW_WATERMARK) uring_submit_and_wait(u, 0);
 }
 
-// Context passed when notifying members of a specific group
-typedef struct {
-    const char* user;   // user who went offline
-    const char* group;  // group name for this callback
-} MemberNotifyCtx;
+// Ghi hàng đợi của session; đăng ký EPOLLOUT nếu còn dư
+static void flush_session(ClientSession* s) {
+    if (current_reactor->uring) {
+        uring_flush(s);
+        return;
+    }
+    if (flush_out_queue(s) != 0) {
+        mark_session_closing(s);
+        return;
+    }
+    if (s->out_head && !s->want_write) {
+        s->want_write = 1;
+        update_epoll_events(s);
+    }
+}
+
+// Đưa session vào danh sách flush cuối vòng lặp (mỗi session 1 lần)
+static void schedule_flush(ClientSession* s) {
+    if (s->flush_scheduled) return;
+    Reactor* r = current_reactor;
+    if (r->pending_flush_count == r->pending_flush_cap) {
+        int cap = r->pending_flush_cap ? r->pending_flush_cap * 2 : 64;
+        int* grown = realloc(r->pending_flush, sizeof(int) * cap);
+        if (!grown) { flush_session(s); return; } // không xếp được -> ghi ngay
+        r->pending_flush = grown;
+        r->pending_flush_cap = cap;
+    }
+    s->flush_scheduled = 1;
+    r->pending_flush[r->pending_flush_count++] = s->fd;
+}
 
-// db_group_member_callback signature: void (*cb)(void* arg, const char* member_name);
-static void member_notify_cb(void* arg, const char* member_name) {
-    MemberNotifyCtx* mc = (MemberNotifyCtx*)arg;
-    if (!mc || !member_name) return;
-    if (strcmp(member_name, mc->user) == 0) return;
+// Kết thúc việc đang chờ của session (cb có thể đăng ký việc mới)
+static void finish_wait(ClientSession* s, int ok) {
+    server_wait_fn cb = s->wait_cb;
+    s->wait_cb = NULL;
+    cb(s->wait_arg, ok);
+}
 
-    ClientSession* s = find_session_by_username_local(member_name);
-    if (s && s->fd != -1) {
-        ChatPacket pkt;
-        memset(&pkt, 0, sizeof(pkt));
-        pkt.type = MSG_TYPE_RECEIVE_GROUP_MESSAGE;
-        strncpy(pkt.source_user, mc->user, MAX_USERNAME - 1);
-        strncpy(pkt.target_user, mc->group, MAX_USERNAME - 1);
-        snprintf(pkt.body, MAX_BODY, "%s went offline.", mc->user);
-        write(s->fd, &pkt, sizeof(ChatPacket));
+// Báo cho server_on_flushed khi phần đã ghi vào socket vượt qua mốc đã hẹn
+static void check_flushed(ClientSession* s) {
+    if (!s->wait_cb || s->wait_ack || s->out_total - s->out_bytes < s->wait_mark) return;
+    finish_wait(s, 1);
+}
+
+// Cuối mỗi vòng epoll_wait: mỗi session có frame mới được ghi bằng 1 writev
+static void flush_pending_writes(Reactor* r) {
+    for (int i = 0; i < r->pending_flush_count; i++) {
+        ClientSession* s = get_session(r->pending_flush[i]);
+        if (!s || !s->flush_scheduled) continue; // đã đóng (fd có thể đã được dùng lại)
+        s->flush_scheduled = 0;
+        // Đang chờ EPOLLOUT thì socket còn đầy, handle_client_writable sẽ ghi
+        if (s->closing || s->want_write) continue;
+        flush_session(s);
+        if (!s->closing) check_flushed(s);
     }
+    r->pending_flush_count = 0;
 }
 
-// db_group_list_callback signature: int (*cb)(void* arg, const char* group_name);
-static int group_list_cb(void* arg, const char* group_name) {
-    const char* user = (const char*)arg;
-    if (!user || !group_name) return 0;
+// Packet có thể bỏ khi client chậm: session được đánh dấu presence_stale và
+// nhận lại snapshot khi hàng đợi xuống dưới low watermark
+static int is_sheddable(const ChatPacket* packet) {
+    return packet->type == MSG_TYPE_ONLINE_LIST_UPDATE || packet->type == MSG_TYPE_PRESENCE_DELTA;
+}
 
-    MemberNotifyCtx mc;
-    mc.user = user;
-    mc.group = group_name;
+int server_send_outbuf(int fd, OutBuf* buf) {
+    if (fd <= 0 || !buf) return -1;
+    ClientSession* s = get_session(fd);
+    if (!s || s->closing) return -1;
+
+    if (s->out_head && s->out_bytes >= OUTBUF_HIGH_WATERMARK && is_sheddable(&buf->packet)) {
+        s->presence_stale = 1;
+        return -1;
+    }
 
-    // For this group, notify each member (except user)
-    db_get_group_members(db, group_name, member_notify_cb, &mc);
+    size_t len;
+    const unsigned char* data = outbuf_wire(buf, s->proto_version, &len);
+    if (enqueue_frame(s, buf, data, len) != 0 || s->out_bytes > OUTBUF_MAX) {
+        LOG_WARN("Client fd %d (user: %s) is too slow (%zu bytes queued). Disconnecting.",
+                 fd, s->username, s->out_bytes);
+        mark_session_closing(s);
+        return -1;
+    }
+
+    if (s->want_write) {
+        // Socket đang đầy: chỉ xếp hàng, EPOLLOUT sẽ flush
+    } else if (s->out_bytes >= OUTBUF_LOW_WATERMARK) {
+        // 1 handler xếp quá nhiều (vd. hàng nghìn offline message): ghi ngay thay vì
+        // giữ cả lô trong bộ nhớ tới cuối vòng lặp
+        flush_session(s);
+    } else {
+        schedule_flush(s);
+    }
+    if (s->out_bytes >= OUTBUF_HIGH_WATERMARK && !s->throttled) {
+        s->throttled = 1; // ngưng đọc input cho tới khi client đọc bớt
+    }
     return 0;
 }
 
-// Helper: notify all group members (except 'user') that 'user' went offline.
-// Uses db_get_groups_for_user -> group_list_cb
-static void notify_user_offline_in_groups(const char* user) {
-    if (!user || !db) return;
-    db_get_groups_for_user(db, user, group_list_cb, (void*)user);
+static int set_wait(int fd, int wait_ack, server_wait_fn cb, void* arg) {
+    ClientSession* s = get_session(fd);
+    if (!s || s->closing || s->wait_cb) return -1;
+    s->wait_cb = cb;
+    s->wait_arg = arg;
+    s->wait_ack = wait_ack;
+    s->wait_mark = s->out_total;
+    // Kiểm tra ở cuối vòng lặp (kể cả khi hàng đợi đã rỗng)
+    if (!wait_ack && !s->want_write) schedule_flush(s);
+    return 0;
 }
 
-void remove_session(int fd) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i].fd == fd) {
-            printf("Session removed for fd %d (user: %s)\n", fd, sessions[i].username);
-            // Notify friends that this user is going offline BEFORE clearing username
-            if (sessions[i].username[0] != '\0') {
-                // broadcast status to friends
-                broadcast_status_to_friends(sessions[i].username, sessions, db, 0); // 0 = offline
-
-                // Notify group members that this user went offline
-                notify_user_offline_in_groups(sessions[i].username);
-            }
+int server_on_flushed(int fd, server_wait_fn cb, void* arg) {
+    return set_wait(fd, 0, cb, arg);
+}
 
-            close(sessions[i].fd);
-            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL); 
-            sessions[i].fd = -1; 
-            sessions[i].buffer_len = 0;
-            memset(sessions[i].username, 0, MAX_USERNAME);
+int server_on_offline_ack(int fd, server_wait_fn cb, void* arg) {
+    return set_wait(fd, 1, cb, arg);
+}
 
-            // THÊM MỚI: Thông báo cho mọi người user này đã offline (online list update)
-            broadcast_online_list(sessions); 
-            return;
+int server_send_packet(int fd, const ChatPacket* packet) {
+    if (fd <= 0 || !packet) return -1;
+    OutBuf* buf = outbuf_create(packet);
+    if (!buf) return -1;
+    int rc = server_send_outbuf(fd, buf);
+    outbuf_release(buf);
+    return rc;
+}
+
+static void reactor_wake(Reactor* r) {
+    uint64_t one = 1;
+    if (write(r->wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        LOG_ERROR("write(eventfd) failed: %s", strerror(errno));
+    }
+}
+
+// Packet tới reactor đích mà session đã biến mất (MailboxItem.store_offline)
+enum {
+    MISS_DROP = 0,
+    MISS_STORE_OFFLINE,         // lưu thành tin offline riêng
+    MISS_GROUP_LOG,             // tin group: lưu vào log group (xem group_log_update)
+};
+
+// Đẩy packet vào mailbox của reactor khác và đánh thức nó
+static void reactor_post(Reactor* r, UserId id, int fd, OutBuf* buf, int store_offline) {
+    MailboxItem* item = malloc(sizeof(MailboxItem));
+    if (!item) return;
+    item->next = NULL;
+    item->fd = fd;
+    item->store_offline = store_offline;
+    item->user_id = id;
+    outbuf_retain(buf);
+    item->buf = buf;
+
+    pthread_mutex_lock(&r->mailbox_lock);
+    if (r->mailbox_tail) r->mailbox_tail->next = item;
+    else r->mailbox_head = item;
+    r->mailbox_tail = item;
+    pthread_mutex_unlock(&r->mailbox_lock);
+
+    reactor_wake(r);
+}
+
+void server_post_db_completion(Reactor* r, DbJob* job) {
+    pthread_mutex_lock(&r->mailbox_lock);
+    if (r->db_done_tail) r->db_done_tail->next = job;
+    else r->db_done_head = job;
+    r->db_done_tail = job;
+    pthread_mutex_unlock(&r->mailbox_lock);
+    reactor_wake(r);
+}
+
+// Gửi tới session local nếu fd vẫn thuộc về đúng user; trả về 0 nếu gửi được
+static int send_local_checked(int fd, UserId id, OutBuf* buf) {
+    ClientSession* s = get_session(fd);
+    if (!s || s->user_id != id) return -1;
+    server_send_outbuf(fd, buf);
+    return 0;
+}
+
+static int route_to_user(UserId id, OutBuf* buf, int store_offline) {
+    int rid, fd;
+    if (registry_lookup_user(id, &rid, &fd) != 0) return 0;
+
+    if (current_reactor && current_reactor->id == rid) {
+        return send_local_checked(fd, id, buf) == 0;
+    }
+    reactor_post(&reactors[rid], id, fd, buf, store_offline);
+    return 1;
+}
+
+// Lưu tin của buf cho user offline (tên người nhận lấy từ bảng intern)
+static void store_offline_outbuf(UserId id, OutBuf* buf) {
+    const char* to = user_ids_name(id);
+    if (to && current_reactor) db_pool_store_offline_message(buf->packet.source_user, to, buf->packet.body);
+}
+
+int server_send_outbuf_to_id(UserId id, OutBuf* buf) {
+    if (!buf) return 0;
+    return route_to_user(id, buf, MISS_DROP);
+}
+
+int server_deliver_outbuf_to_id(UserId id, OutBuf* buf) {
+    if (!buf) return 0;
+    if (route_to_user(id, buf, MISS_STORE_OFFLINE)) return 1;
+    store_offline_outbuf(id, buf);
+    return 0;
+}
+
+// Trạng thái log của OutBuf tin group (buf->log_state)
+#define GROUP_LOG_SENT   0x1    // người gửi đã chuyển tin cho mọi thành viên
+#define GROUP_LOG_MISSED 0x2    // có thành viên lỡ tin
+#define GROUP_LOG_STORED 0x4    // đã có người nhận việc lưu tin vào log
+
+// Thêm bit add vào log_state. Trả về 1 nếu caller nhận việc lưu tin: người gửi đã xong, có
+// thành viên lỡ tin và chưa ai lưu. Người gửi và các reactor phát hiện lỡ tin có thể chạy
+// song song; chỉ 1 bên nhận được việc lưu.
+static int group_log_update(OutBuf* buf, int add) {
+    int old = __atomic_load_n(&buf->log_state, __ATOMIC_RELAXED);
+    for (;;) {
+        int state = old | add;
+        int store = (state & GROUP_LOG_SENT) && (state & GROUP_LOG_MISSED) && !(state & GROUP_LOG_STORED);
+        if (store) state |= GROUP_LOG_STORED;
+        if (__atomic_compare_exchange_n(&buf->log_state, &old, state, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return store;
         }
     }
 }
+
+int server_deliver_group_outbuf_to_id(UserId id, OutBuf* buf) {
+    if (!buf) return 0;
+    return route_to_user(id, buf, MISS_GROUP_LOG);
+}
+
+int server_group_outbuf_sent(OutBuf* buf, int has_offline) {
+    return group_log_update(buf, GROUP_LOG_SENT | (has_offline ? GROUP_LOG_MISSED : 0));
+}
+
+// Thành viên đã offline khi tin group chuyển sang reactor này tới nơi
+static void group_outbuf_missed(OutBuf* buf) {
+    if (!group_log_update(buf, GROUP_LOG_MISSED)) return;   // người gửi sẽ tự lưu / đã lưu
+    UserId from = user_ids_find(buf->packet.source_user);
+    if (from) db_pool_append_group_message(buf->packet.target_user, from, buf->packet.body);
+}
+
+// Bản 1 người nhận: chỉ tạo OutBuf khi user đang online
+int server_send_to_id(UserId id, const ChatPacket* packet) {
+    if (registry_lookup_user(id, NULL, NULL) != 0) return 0;
+    OutBuf* buf = outbuf_create(packet);
+    int rc = server_send_outbuf_to_id(id, buf);
+    outbuf_release(buf);
+    return rc;
+}
+
+int server_deliver_to_user(const char* username, const ChatPacket* packet) {
+    // Tên chưa intern = user chưa login lần nào từ lúc server chạy: chắc chắn offline
+    UserId id = user_ids_find(username);
+    OutBuf* buf = id ? outbuf_create(packet) : NULL;
+    if (!buf) {
+        if (current_reactor) db_pool_store_offline_message(packet->source_user, username, packet->body);
+        return 0;
+    }
+    int rc = server_deliver_outbuf_to_id(id, buf);
+    outbuf_release(buf);
+    return rc;
+}
+
+// Xử lý các packet reactor khác gửi sang và các job DB đã xong
+static void drain_mailbox(Reactor* r) {
+    uint64_t count;
+    while (read(r->wake_fd, &count, sizeof(count)) > 0) {}
+
+    pthread_mutex_lock(&r->mailbox_lock);
+    MailboxItem* item = r->mailbox_head;
+    r->mailbox_head = r->mailbox_tail = NULL;
+    DbJob* job = r->db_done_head;
+    r->db_done_head = r->db_done_tail = NULL;
+    pthread_mutex_unlock(&r->mailbox_lock);
+
+    while (job) {
+        DbJob* next = job->next;
+        db_pool_complete(job, r->db);
+        job = next;
+    }
+
+    while (item) {
+        MailboxItem* next = item->next;
+        if (send_local_checked(item->fd, item->user_id, item->buf) != 0) {
+            // User đã offline trong lúc packet đang chuyển -> lưu lại
+            if (item->store_offline == MISS_STORE_OFFLINE) store_offline_outbuf(item->user_id, item->buf);
+            else if (item->store_offline == MISS_GROUP_LOG) group_outbuf_missed(item->buf);
+        }
+        outbuf_release(item->buf);
+        free(item);
+        item = next;
+    }
+}
+
+void remove_session(int fd) {
+    ClientSession* session = get_session(fd);
+    if (!session) return;
+
+    UserId user_id = session->user_id;
+    LOG_DEBUG("Session removed for fd %d (user: %s)", fd, session->username);
+
+    if (session->wait_cb) finish_wait(session, 0);
+
+    if (current_reactor->uring) {
+        // recv/SEND đang chạy giữ socket: shutdown để chúng kết thúc (CQE cũ bị bỏ qua nhờ gen)
+        shutdown(fd, SHUT_RDWR);
+    } else {
+        epoll_ctl(current_reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    registry_unbind_fd(fd, session);
+    close(fd);
+    free_out_queue(session);
+    session_free(current_reactor, session);
+
+    if (user_id != 0) {
+        // Tin group đã COMMIT tới lúc này được định tuyến khi user còn trong danh bạ
+        sqlite3_int64 group_head = db_pool_group_log_head();
+
+        // Gỡ khỏi danh bạ trước để không ai định tuyến tới fd đã đóng
+        registry_release_user(user_id, current_reactor->id, fd);
+
+        // Bạn bè, thành viên group và các peer được báo ở lần flush presence kế tiếp
+        presence_user_offline(user_id);
+
+        // Tin group tới lúc này đã được giao trực tiếp; tin gửi sau đó đọc lại từ log khi login
+        db_pool_mark_group_messages_read(user_id, group_head);
+    }
+}
 // ----- Hết Quản lý Session -----
 
 // Hàm set non-blocking cho socket
@@ -163,239 +682,911 @@ void set_non_blocking(int fd) {
     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
 
+// Thỏa thuận định dạng frame: trả lời bằng định dạng cũ rồi mới chuyển,
+// để client biết từ frame nào trở đi là định dạng mới.
+// body = "<version>[ ack]": "ack" = client trả lời MSG_TYPE_OFFLINE_ACK sau mỗi trang tin offline
+static void handle_hello(ClientSession* session, const ChatPacket* packet) {
+    int version = atoi(packet->body);
+    session->offline_ack = strstr(packet->body, " ack") != NULL;
+    if (version > FRAME_PROTO_V2) version = FRAME_PROTO_V2;
+    if (version < FRAME_PROTO_V1) version = FRAME_PROTO_V1;
+
+    ChatPacket reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = MSG_TYPE_HELLO;
+    snprintf(reply.body, MAX_BODY, "%d", version);
+    server_send_packet(session->fd, &reply);
+    session->proto_version = version;
+}
+
 // Xử lý gói tin (Dispatcher)
 void process_packet(int client_fd, ChatPacket* packet) {
     ClientSession* session = get_session(client_fd);
     if (!session) return;
+    sqlite3* db = current_reactor->db;
 
     // Gán source_user cho các packet gửi từ client đã login
-    if (packet->type != MSG_TYPE_REGISTER_REQUEST && packet->type != MSG_TYPE_LOGIN_REQUEST) {
+    if (packet->type != MSG_TYPE_REGISTER_REQUEST && packet->type != MSG_TYPE_LOGIN_REQUEST &&
+        packet->type != MSG_TYPE_HELLO) {
         strncpy(packet->source_user, session->username, MAX_USERNAME);
     }
 
     switch (packet->type) {
+        case MSG_TYPE_HELLO:
+            handle_hello(session, packet);
+            break;
+        case MSG_TYPE_OFFLINE_ACK:
+            // Client đã nhận hết trang tin offline trước marker
+            if (session->wait_cb && session->wait_ack) finish_wait(session, 1);
+            break;
         case MSG_TYPE_REGISTER_REQUEST:
             handle_register(client_fd, packet, db);
             break;
         case MSG_TYPE_LOGIN_REQUEST:
             // Sửa lại: handle_login bây giờ là void và tự xử lý gửi packet
-            handle_login(client_fd, packet, db, sessions); 
+            handle_login(client_fd, packet, db);
             break;
         case MSG_TYPE_LOGOUT_REQUEST: // <-- THÊM CASE MỚI
-            printf("User '%s' logging out.\n", session->username);
+            LOG_INFO("User '%s' logging out.", session->username);
             remove_session(client_fd);
             break;
         case MSG_TYPE_PRIVATE_MESSAGE: // <-- THÊM CASE MỚI
-            handle_private_message(packet, sessions, db);
+            handle_private_message(packet, db);
             break;
 
         case MSG_TYPE_GROUP_MESSAGE:
-            handle_group_message(packet, sessions, db);
+            handle_group_message(client_fd, packet, db);
             break;
 
         case MSG_TYPE_FRIEND_REQUEST:
-            handle_friend_request(client_fd, packet, sessions, db);
+            handle_friend_request(client_fd, packet, db);
             break;
 
         case MSG_TYPE_FRIEND_ACCEPT:
-            handle_friend_accept(client_fd, packet, sessions, db);
+            handle_friend_accept(client_fd, packet, db);
             break;
 
         case MSG_TYPE_FRIEND_DECLINE:
-            handle_friend_decline(client_fd, packet, sessions, db);
+            handle_friend_decline(client_fd, packet, db);
             break;
 
         case MSG_TYPE_FRIEND_UNFRIEND:
-            handle_friend_unfriend(client_fd, packet, sessions, db);
+            handle_friend_unfriend(client_fd, packet, db);
             break;
 
         case MSG_TYPE_FRIEND_LIST_REQUEST:
             // session should be the current client's session; adjust name if different
-            handle_friend_list_request(client_fd, session->username, sessions, db);
+            handle_friend_list_request(client_fd, session->user_id, db);
             break;
 
         // --- Group ops ---
         case MSG_TYPE_CREATE_GROUP_REQUEST:
-            handle_create_group(client_fd, packet, sessions, db);
+            handle_create_group(client_fd, packet, db);
             break;
         case MSG_TYPE_JOIN_GROUP_REQUEST:
-            handle_join_group_request(client_fd, packet, sessions, db);
+            handle_join_group_request(client_fd, packet, db);
             break;
         case MSG_TYPE_INVITE_TO_GROUP_REQUEST:
-            handle_invite_to_group(client_fd, packet, sessions, db);
+            handle_invite_to_group(client_fd, packet, db);
             break;
         case MSG_TYPE_REMOVE_FROM_GROUP_REQUEST:
-            handle_remove_from_group(client_fd, packet, sessions, db);
+            handle_remove_from_group(client_fd, packet, db);
             break;
         case MSG_TYPE_LEAVE_GROUP_REQUEST:
-            handle_leave_group(client_fd, packet, sessions, db);
+            handle_leave_group(client_fd, packet, db);
             break;
 
         // NEW: group listing requests
         case MSG_TYPE_GROUP_LIST_JOINED_REQUEST:
-            handle_group_list_joined(client_fd, packet, sessions, db);
+            handle_group_list_joined(client_fd, packet, db);
             break;
         case MSG_TYPE_GROUP_LIST_ALL_REQUEST:
-            handle_group_list_all(client_fd, packet, sessions, db);
+            handle_group_list_all(client_fd, packet, db);
             break;
 
         default:
-            printf("Received unknown packet type from fd %d\n", client_fd);
+            LOG_WARN("Received unknown packet type from fd %d", client_fd);
     }
 }
 
-// Xử lý dữ liệu từ client (Stream Handling) - NÂNG CẤP
+#define RECV_RING_MASK (RECV_RING_SIZE - 1)
+
+// Trả về con trỏ tới len byte liên tục bắt đầu ở head: nằm sẵn trong vòng đệm,
+// hoặc được ghép vào frame_scratch nếu vắt qua cuối vòng đệm.
+static const unsigned char* ring_peek(Reactor* r, const RecvRing* ring, size_t len) {
+    size_t start = ring->head & RECV_RING_MASK;
+    size_t contiguous = RECV_RING_SIZE - start;
+    if (len <= contiguous) return ring->data + start;
+    memcpy(r->frame_scratch, ring->data + start, contiguous);
+    memcpy(r->frame_scratch + contiguous, ring->data, len - contiguous);
+    return r->frame_scratch;
+}
+
+// Ngưng xử lý input: client không đọc phản hồi (throttled), đang chờ job barrier (login, ghi DB)
+// hoặc đã có quá nhiều job DB
+static int input_blocked(const ClientSession* s) {
+    return s->throttled || s->db_barrier > 0 || s->db_inflight >= SESSION_DB_INFLIGHT_MAX;
+}
+
+// Xử lý các frame trọn vẹn trong vòng đệm (tại chỗ, không dồn dữ liệu).
+// Trả về 0 nếu OK, -1 nếu session đã bị đóng (vòng đệm có thể đã bị giải phóng).
+static int dispatch_frames(int client_fd, RecvRing* ring) {
+    Reactor* r = current_reactor;
+    ChatPacket packet;
+    ClientSession* session = get_session(client_fd);
+    // Kiểm tra trước mỗi frame: khi bị ngưng (throttle / job barrier), frame còn lại kể cả
+    // dữ liệu mới đến chỉ được xử lý trong resume_input
+    while (ring->tail != ring->head && !input_blocked(session)) {
+        size_t used = ring->tail - ring->head;
+        size_t header = used < FRAME_V2_HEADER_SIZE ? used : FRAME_V2_HEADER_SIZE;
+        long frame_len = frame_length(ring_peek(r, ring, header), header);
+        if (frame_len < 0) {
+            LOG_WARN("Client fd %d sent a malformed frame. Disconnecting.", client_fd);
+            remove_session(client_fd);
+            return -1;
+        }
+        if (frame_len == 0 || (size_t)frame_len > used) break; // frame chưa đủ
+
+        const unsigned char* frame = ring_peek(r, ring, (size_t)frame_len);
+        if (frame == r->frame_scratch) r->rx_wrapped++;
+        frame_decode(frame, (size_t)frame_len, &packet);
+        ring->head += (uint32_t)frame_len;
+        r->rx_frames++;
+
+        session->rx_frames++;
+        // process_packet có thể gọi remove_session()
+        uint64_t start = metrics_packet_begin(packet.type);
+        process_packet(client_fd, &packet);
+        metrics_packet_end(packet.type, (size_t)frame_len, start);
+
+        session = get_session(client_fd);
+        if (!session || session->closing) return -1;
+    }
+    return 0;
+}
+
+// Chép tối đa len byte vào chỗ trống của vòng đệm; trả về số byte đã chép
+static size_t ring_write(RecvRing* ring, const unsigned char* data, size_t len) {
+    size_t free_space = RECV_RING_SIZE - (ring->tail - ring->head);
+    if (len > free_space) len = free_space;
+    size_t start = ring->tail & RECV_RING_MASK;
+    size_t first = RECV_RING_SIZE - start < len ? RECV_RING_SIZE - start : len;
+    memcpy(ring->data + start, data, first);
+    memcpy(ring->data, data + first, len - first);
+    ring->tail += (uint32_t)len;
+    return len;
+}
+
+// Còn dữ liệu dở dang trong vòng đệm chung -> chuyển sang vòng đệm riêng của session
+static void keep_partial(ClientSession* session, RecvRing* ring) {
+    if (ring != &current_reactor->rx_scratch || ring->head == ring->tail) return;
+    session->rx = malloc(sizeof(RecvRing));
+    if (!session->rx) { remove_session(session->fd); return; }
+    size_t used = ring->tail - ring->head;
+    size_t start = ring->head & RECV_RING_MASK;
+    size_t first = RECV_RING_SIZE - start < used ? RECV_RING_SIZE - start : used;
+    memcpy(session->rx->data, ring->data + start, first);
+    memcpy(session->rx->data + first, ring->data, used - first);
+    session->rx->head = 0;
+    session->rx->tail = (uint32_t)used;
+}
+
+// Xử lý dữ liệu từ client (Stream Handling): mỗi lần đọc lấy hết chỗ trống của
+// vòng đệm (có thể chứa nhiều frame v1/v2), frame được parse tại chỗ.
 void handle_client_data(int client_fd) {
-    // We will re-query session each iteration because process_packet(...) may call remove_session()
-    // which clears the session slot; using a stale pointer caused use-after-free and segfault.
+    Reactor* r = current_reactor;
+    ClientSession* session = get_session(client_fd);
+    if (!session || session->closing) return;
+
+    // Session chưa có dữ liệu dở dang -> dùng vòng đệm chung của reactor; chỉ khi
+    // còn dư mới cấp vòng đệm riêng cho session.
+    RecvRing* ring = session->rx;
+    if (!ring) {
+        ring = &r->rx_scratch;
+        ring->head = ring->tail = 0;
+    }
+
     while (1) { // Đọc liên tục cho đến khi EAGAIN (với EPOLLET)
-        ClientSession* session = get_session(client_fd);
-        if (!session) return;
-        int bytes_to_read = sizeof(ChatPacket) - session->buffer_len;
-        if (bytes_to_read <= 0) return; // Buffer full or inconsistent; bail out
+        if (dispatch_frames(client_fd, ring) != 0) return;
+        // We re-query the session because process_packet(...) may have closed it
+        session = get_session(client_fd);
+        if (!session || session->closing) return;
+
+        if (ring->head == ring->tail) {
+            // Session idle không giữ bộ nhớ
+            free(session->rx);
+            session->rx = NULL;
+            ring = &r->rx_scratch;
+            ring->head = ring->tail = 0;
+        }
+        // Client không đọc phản hồi / còn nhiều job DB -> ngưng đọc request mới; resume_input sẽ gọi lại
+        if (input_blocked(session)) break;
 
-        ssize_t bytes_read = read(client_fd, session->read_buffer + session->buffer_len, bytes_to_read);
+        size_t free_space = RECV_RING_SIZE - (ring->tail - ring->head);
+        size_t start = ring->tail & RECV_RING_MASK;
+        size_t first = RECV_RING_SIZE - start;
+        if (first > free_space) first = free_space;
+        struct iovec iov[2] = {
+            { ring->data + start, first },
+            { ring->data, free_space - first },
+        };
+        ssize_t bytes_read = readv(client_fd, iov, iov[1].iov_len ? 2 : 1);
+        r->rx_reads++;
+        session->rx_reads++;
 
         if (bytes_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 // Không còn dữ liệu để đọc
                 break;
             }
+            if (errno == EINTR) continue;
             // Lỗi thật
-            perror("read() failed");
+            LOG_ERROR("read() failed: %s", strerror(errno));
             remove_session(client_fd);
             return;
         }
 
         if (bytes_read == 0) { // Client ngắt kết nối
-            printf("Client fd %d disconnected.\n", client_fd);
+            LOG_INFO("Client fd %d disconnected (rx: %lu frames in %lu reads, tx: %lu frames in %lu writes).",
+                     client_fd, session->rx_frames, session->rx_reads, session->tx_frames, session->tx_writes);
             remove_session(client_fd);
             return;
         }
+        ring->tail += (uint32_t)bytes_read;
+    }
 
-        session = get_session(client_fd);
-        if (!session) return;
-        session->buffer_len += bytes_read;
+    keep_partial(session, ring);
+}
+
+// io_uring: ngưng nhận khi client không đọc phản hồi (throttle) hoặc input tồn quá nhiều
+static int uring_input_paused(const ClientSession* s) {
+    return input_blocked(s) || s->rx_spill_len >= RX_BUDGET;
+}
 
-        // Xử lý tất cả các gói tin có trong buffer
-        while (1) {
-            session = get_session(client_fd);
-            if (!session) return; // session may have been removed by process_packet
-            if (session->buffer_len < (int)sizeof(ChatPacket)) break;
+static void uring_pause_recv(ClientSession* s) {
+    if (!s->rx_armed || s->rx_cancel) return;
+    struct io_uring_sqe* sqe = uring_get_sqe(current_reactor->uring);
+    if (!sqe) return;
+    uring_prep_cancel(sqe, ud_make(UD_RECV, s->fd, s->gen), ud_make(UD_CANCEL, s->fd, s->gen));
+    s->rx_cancel = 1;
+}
 
-            process_packet(client_fd, (ChatPacket*)session->read_buffer);
+// Xử lý tiếp input tồn ở cuối vòng lặp (mỗi session 1 lần)
+static void schedule_input(ClientSession* s) {
+    if (s->input_scheduled) return;
+    Reactor* r = current_reactor;
+    if (r->pending_input_count == r->pending_input_cap) {
+        int cap = r->pending_input_cap ? r->pending_input_cap * 2 : 64;
+        int* grown = realloc(r->pending_input, sizeof(int) * cap);
+        if (!grown) { mark_session_closing(s); return; }
+        r->pending_input = grown;
+        r->pending_input_cap = cap;
+    }
+    s->input_scheduled = 1;
+    r->pending_input[r->pending_input_count++] = s->fd;
+}
 
-            // If the session was removed during processing, stop immediately
-            session = get_session(client_fd);
-            if (!session) return;
+// io_uring: xử lý dữ liệu recv vừa nhận vào provided buffer (data = NULL, len = 0: xử lý
+// tiếp input tồn). Dữ liệu được chép vào vòng đệm rồi parse như epoll. Khác epoll, kernel
+// nhận hộ ta cả khi ta chưa xử lý kịp, nên mỗi vòng lặp chỉ xử lý tối đa RX_BUDGET byte
+// của 1 session: completion của SEND (nằm sau trong CQ) có cơ hội giải phóng hàng đợi gửi.
+static void uring_client_data(int client_fd, const unsigned char* data, size_t len) {
+    Reactor* r = current_reactor;
+    ClientSession* session = get_session(client_fd);
+    if (!session || session->closing) return;
+    if (session->rx_iter != r->iteration) {
+        session->rx_iter = r->iteration;
+        session->rx_used = 0;
+    }
 
-            int remaining = session->buffer_len - sizeof(ChatPacket);
-            if (remaining > 0) {
-                memmove(session->read_buffer, session->read_buffer + sizeof(ChatPacket), remaining);
-            }
-            session->buffer_len = remaining;
+    RecvRing* ring = session->rx;
+    if (!ring) {
+        ring = &r->rx_scratch;
+        ring->head = ring->tail = 0;
+    }
+
+    // Frame đã nằm trong vòng đệm từ lúc bị ngưng (throttle / job barrier) đi trước
+    if (ring->head != ring->tail) {
+        if (dispatch_frames(client_fd, ring) != 0) return;
+        session = get_session(client_fd);
+        if (!session || session->closing) return;
+    }
+
+    while (!input_blocked(session) && session->rx_used < RX_BUDGET) {
+        // Dữ liệu tồn đi trước dữ liệu mới
+        size_t n;
+        if (session->rx_spill_len > 0) {
+            n = ring_write(ring, session->rx_spill, session->rx_spill_len);
+            session->rx_spill_len -= n;
+            memmove(session->rx_spill, session->rx_spill + n, session->rx_spill_len);
+        } else if (len > 0) {
+            n = ring_write(ring, data, len);
+            data += n;
+            len -= n;
+        } else {
+            break;
         }
+        if (n == 0) break; // vòng đệm đầy frame chưa xử lý
+        session->rx_used += n;
+
+        if (dispatch_frames(client_fd, ring) != 0) return;
+        session = get_session(client_fd);
+        if (!session || session->closing) return;
+    }
+
+    if (len > 0) {
+        if (session->rx_spill_len + len > RX_SPILL_MAX) {
+            LOG_WARN("Client fd %d sent too much unprocessed input. Disconnecting.", client_fd);
+            remove_session(client_fd);
+            return;
+        }
+        unsigned char* grown = realloc(session->rx_spill, session->rx_spill_len + len);
+        if (!grown) { remove_session(client_fd); return; }
+        memcpy(grown + session->rx_spill_len, data, len);
+        session->rx_spill = grown;
+        session->rx_spill_len += len;
+    }
+    if (session->rx_spill_len == 0) {
+        free(session->rx_spill);
+        session->rx_spill = NULL;
+    } else if (!input_blocked(session)) {
+        schedule_input(session); // hết budget: tiếp tục ở cuối vòng lặp
+    }
+    if (uring_input_paused(session)) uring_pause_recv(session);
+
+    if (session->rx && session->rx->head == session->rx->tail) {
+        free(session->rx);
+        session->rx = NULL;
+    } else {
+        keep_partial(session, ring);
     }
 }
 
-// Xử lý kết nối mới
-void handle_new_connection(int listener_fd) {
-    struct sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd = accept(listener_fd, (struct sockaddr*)&client_addr, &client_len);
-    
-    if (client_fd == -1) {
-        perror("accept() failed");
+// Xử lý tiếp input tồn rồi bật lại recv nếu đã hết lý do tạm ngưng
+static void uring_resume_input(int client_fd) {
+    uring_client_data(client_fd, NULL, 0);
+    ClientSession* session = get_session(client_fd);
+    if (session && !session->closing && !session->rx_armed && !uring_input_paused(session)) {
+        uring_arm_recv(session);
+    }
+}
+
+static void process_pending_input(Reactor* r) {
+    // uring_client_data có thể thêm session vào cuối danh sách: chỉ xử lý phần đã có
+    int count = r->pending_input_count;
+    for (int i = 0; i < count; i++) {
+        ClientSession* s = get_session(r->pending_input[i]);
+        if (!s || !s->input_scheduled) continue; // đã đóng (fd có thể đã được dùng lại)
+        s->input_scheduled = 0;
+        if (s->closing || input_blocked(s)) continue; // resume_input xử lý khi hết throttle
+        uring_resume_input(s->fd);
+    }
+    r->pending_input_count -= count;
+    memmove(r->pending_input, r->pending_input + count, sizeof(int) * r->pending_input_count);
+}
+
+// Hết lý do ngưng đọc input: xử lý tiếp dữ liệu đã nhận
+static void resume_input(ClientSession* session) {
+    if (input_blocked(session)) return;
+    if (!current_reactor->uring) {
+        // Với EPOLLET, dữ liệu đến trong lúc bị throttle sẽ không báo lại -> đọc ngay
+        handle_client_data(session->fd);
         return;
     }
+    // io_uring: xử lý phần tồn rồi bật lại recv (nếu recv cũ đã kết thúc)
+    uring_resume_input(session->fd);
+}
 
-    printf("New connection accepted: fd %d\n", client_fd);
-    set_non_blocking(client_fd); // Rất quan trọng cho epoll
-    add_session(client_fd);
+// Hàng đợi gửi vừa được flush: gửi lại snapshot presence / gỡ backpressure khi đã đủ thấp
+static void after_flush(ClientSession* session) {
+    int client_fd = session->fd;
+    if (session->presence_stale && session->out_bytes <= OUTBUF_LOW_WATERMARK) {
+        // Đã bỏ delta trong lúc nghẽn -> tập online phía client không còn đúng, gửi lại snapshot
+        session->presence_stale = 0;
+        if (session->user_id != 0) presence_send_snapshot(session->user_id, client_fd);
+    }
+    if (session->throttled && session->out_bytes <= OUTBUF_LOW_WATERMARK) {
+        session->throttled = 0;
+        resume_input(session);
+    }
+    check_flushed(session);
+}
 
-    // Thêm client socket mới vào epoll
-    struct epoll_event event;
-    event.events = EPOLLIN | EPOLLET; // Đọc (IN) và Edge-Triggered (ET)
-    event.data.fd = client_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
-        perror("epoll_ctl ADD client failed");
-        close(client_fd);
+void server_db_job_finished(SessionRef ref, int barrier) {
+    ClientSession* session = server_session_deref(ref);
+    if (!session) return;
+    int was_blocked = input_blocked(session);
+    session->db_inflight--;
+    if (barrier) session->db_barrier--;
+    if (was_blocked) resume_input(session);
+}
+
+// Socket writable trở lại (EPOLLOUT): flush hàng đợi, gỡ backpressure khi đã đủ thấp
+void handle_client_writable(int client_fd) {
+    ClientSession* session = get_session(client_fd);
+    if (!session || session->closing) return;
+
+    if (flush_out_queue(session) != 0) {
+        mark_session_closing(session);
+        return;
+    }
+    session->flush_scheduled = 0; // đã flush, bỏ qua lượt cuối vòng lặp
+    if (!session->out_head && session->want_write) {
+        session->want_write = 0;
+        update_epoll_events(session);
     }
+    after_flush(session);
 }
 
-// Hàm main
-int main() {
-    int listener_fd;
-    struct sockaddr_in server_addr;
-    struct epoll_event event, events[MAX_EVENTS];
+// Đóng các session đã bị đánh dấu closing (ghi lỗi / client quá chậm)
+static void reap_closing_sessions(Reactor* r) {
+    // remove_session có thể gửi thông báo và đánh dấu thêm session khác
+    while (r->pending_close_count > 0) {
+        int fd = r->pending_close[--r->pending_close_count];
+        ClientSession* s = get_session(fd);
+        if (s && s->closing) remove_session(fd);
+    }
+}
 
-    init_sessions();
+// Cấu hình socket vừa accept và tạo session; trả về 0 nếu OK
+static int setup_client(int client_fd) {
+    // Server tự gom frame mỗi vòng lặp thành 1 writev -> không cần Nagle trì hoãn thêm
+    int nodelay = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return add_session(client_fd);
+}
 
-    if (db_open("server/chat.db", &db) != 0) return 1;
-    
-    listener_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listener_fd == -1) { perror("socket() failed"); return 1; }
+// Xử lý kết nối mới (accept hết backlog vì listener dùng chung epoll với client)
+void handle_new_connection(int listener_fd) {
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(listener_fd, (struct sockaddr*)&client_addr, &client_len);
 
-    // Allow quick reuse of address/port to avoid "Address already in use" on restart
-    {
-        int opt = 1;
-        if (setsockopt(listener_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-            perror("setsockopt(SO_REUSEADDR) failed");
+        if (client_fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) LOG_ERROR("accept() failed: %s", strerror(errno));
+            return;
         }
-#ifdef SO_REUSEPORT
-        if (setsockopt(listener_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
-            // not fatal; continue
+
+        LOG_DEBUG("New connection accepted: fd %d", client_fd);
+        set_non_blocking(client_fd); // Rất quan trọng cho epoll
+        if (setup_client(client_fd) != 0) continue;
+
+        // Thêm client socket mới vào epoll
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET; // Đọc (IN) và Edge-Triggered (ET)
+        event.data.fd = client_fd;
+        if (epoll_ctl(current_reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
+            LOG_ERROR("epoll_ctl ADD client failed: %s", strerror(errno));
+            remove_session(client_fd);
         }
-#endif
     }
-    
+}
+
+// ----- Xử lý CQE của io_uring -----
+
+static void uring_arm_accept(Reactor* r) {
+    struct io_uring_sqe* sqe = uring_get_sqe(r->uring);
+    if (sqe) uring_prep_accept_multishot(sqe, r->listener_fd, ud_make(UD_ACCEPT, r->listener_fd, 0));
+}
+
+static void uring_arm_poll(Reactor* r, int fd, int tag) {
+    struct io_uring_sqe* sqe = uring_get_sqe(r->uring);
+    if (sqe) uring_prep_poll_multishot(sqe, fd, ud_make(tag, fd, 0));
+}
+
+static void uring_on_accept(Reactor* r, const struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        int client_fd = cqe->res;
+        LOG_DEBUG("New connection accepted: fd %d", client_fd);
+        // Socket giữ chế độ blocking: io_uring tự chờ socket sẵn sàng thay vì trả EAGAIN
+        if (setup_client(client_fd) == 0) uring_arm_recv(get_session(client_fd));
+    } else {
+        errno = -cqe->res;
+        LOG_ERROR("accept() failed: %s", strerror(errno));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) uring_arm_accept(r); // multishot đã dừng
+}
+
+static void uring_on_recv(Reactor* r, const struct io_uring_cqe* cqe) {
+    int fd = ud_fd(cqe->user_data);
+    uint32_t gen = ud_gen(cqe->user_data);
+    ClientSession* s = get_session(fd);
+    if (s && s->gen != gen) s = NULL; // CQE của kết nối cũ đã đóng, fd đã được dùng lại
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (s && cqe->res > 0) {
+            r->rx_reads++;
+            s->rx_reads++;
+            uring_client_data(fd, uring_buffer(r->uring, bid), (size_t)cqe->res);
+            s = get_session(fd);
+            if (s && s->gen != gen) s = NULL;
+        }
+        uring_buffer_recycle(r->uring, bid);
+    }
+    if (!s || s->closing) return;
+
+    if (cqe->flags & IORING_CQE_F_MORE) return;
+
+    // Multishot recv đã kết thúc
+    s->rx_armed = 0;
+    s->rx_cancel = 0;
+    if (cqe->res == 0) { // Client ngắt kết nối
+        LOG_INFO("Client fd %d disconnected (rx: %lu frames in %lu reads, tx: %lu frames in %lu writes).",
+                 fd, s->rx_frames, s->rx_reads, s->tx_frames, s->tx_writes);
+        remove_session(fd);
+        return;
+    }
+    if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        errno = -cqe->res;
+        LOG_ERROR("recv() failed: %s", strerror(errno));
+        remove_session(fd);
+        return;
+    }
+    // Hết provided buffer / bị hủy do tạm ngưng: nhận tiếp khi có thể
+    // (nếu vẫn đang tạm ngưng thì after_flush / process_pending_input bật lại)
+    if (!uring_input_paused(s)) uring_arm_recv(s);
+}
+
+static void uring_on_send(Reactor* r, const struct io_uring_cqe* cqe) {
+    UringSend* op = (UringSend*)(uintptr_t)(cqe->user_data & ~UD_TAG_MASK);
+    ClientSession* s = get_session(op->fd);
+    if (s && s->gen != op->gen) s = NULL; // session đã đóng trong lúc gửi
+    uring_send_free(r, op);
+    if (!s) return;
+
+    s->tx_inflight--;
+    if (cqe->res > 0) {
+        consume_sent(s, (size_t)cqe->res);
+    } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        mark_session_closing(s);
+    }
+    if (s->tx_inflight == 0 && !s->closing) {
+        // Chuỗi đã xong (hoặc bị cắt do gửi thiếu): gửi phần còn lại
+        uring_flush(s);
+        after_flush(s);
+    }
+}
+
+static void uring_handle_cqe(Reactor* r, const struct io_uring_cqe* cqe) {
+    switch (cqe->user_data & UD_TAG_MASK) {
+        case UD_ACCEPT:
+            uring_on_accept(r, cqe);
+            break;
+        case UD_WAKE:
+            // Reactor khác gửi packet sang
+            drain_mailbox(r);
+            if (!(cqe->flags & IORING_CQE_F_MORE)) uring_arm_poll(r, r->wake_fd, UD_WAKE);
+            break;
+        case UD_TIMER:
+            presence_on_timer();
+            if (!(cqe->flags & IORING_CQE_F_MORE)) uring_arm_poll(r, r->timer_fd, UD_TIMER);
+            break;
+        case UD_RECV:
+            uring_on_recv(r, cqe);
+            break;
+        case UD_SEND:
+            uring_on_send(r, cqe);
+            break;
+        case UD_ADMIN:
+            // Listener: poll multishot; kết nối quản trị: poll 1 lần, admin tự arm lại
+            admin_on_readable(ud_fd(cqe->user_data));
+            if (ud_fd(cqe->user_data) == r->admin_fd && !(cqe->flags & IORING_CQE_F_MORE)) {
+                uring_arm_poll(r, r->admin_fd, UD_ADMIN);
+            }
+            break;
+        default:
+            break; // UD_CANCEL: kết quả hủy không cần xử lý
+    }
+}
+
+// Tạo listener riêng cho 1 reactor; SO_REUSEPORT để kernel chia đều kết nối
+static int create_listener(void) {
+    int listener_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener_fd == -1) { LOG_ERROR("socket() failed: %s", strerror(errno)); return -1; }
+
+    // Allow quick reuse of address/port to avoid "Address already in use" on restart
+    int opt = 1;
+    if (setsockopt(listener_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+        LOG_ERROR("setsockopt(SO_REUSEADDR) failed: %s", strerror(errno));
+    }
+#ifdef SO_REUSEPORT
+    if (setsockopt(listener_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+        // Bắt buộc khi có nhiều reactor cùng bind 1 port
+        if (num_reactors > 1) { LOG_ERROR("setsockopt(SO_REUSEPORT) failed: %s", strerror(errno)); close(listener_fd); return -1; }
+    }
+#endif
+
+    struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(PORT);
 
     if (bind(listener_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        perror("bind() failed"); close(listener_fd); return 1;
+        LOG_ERROR("bind() failed: %s", strerror(errno)); close(listener_fd); return -1;
     }
 
-    if (listen(listener_fd, 50) == -1) {
-        perror("listen() failed"); close(listener_fd); return 1;
+    if (listen(listener_fd, 512) == -1) {
+        LOG_ERROR("listen() failed: %s", strerror(errno)); close(listener_fd); return -1;
     }
+    set_non_blocking(listener_fd);
+    return listener_fd;
+}
+
+// admin_arm_fn: báo 1 lần khi kết nối quản trị đọc được (chỉ reactor 0 phục vụ cổng quản trị)
+static void admin_arm(int fd) {
+    Reactor* r = &reactors[0];
+    if (r->uring) {
+        struct io_uring_sqe* sqe = uring_get_sqe(r->uring);
+        if (sqe) uring_prep_poll(sqe, fd, ud_make(UD_ADMIN, fd, 0));
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1 && errno == ENOENT) {
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+static int reactor_init(Reactor* r, int id) {
+    memset(r, 0, sizeof(Reactor));
+    r->id = id;
+    r->listener_fd = r->epoll_fd = r->wake_fd = r->timer_fd = r->admin_fd = -1;
+    pthread_mutex_init(&r->mailbox_lock, NULL);
 
-    epoll_fd = epoll_create1(0);
-    if (epoll_fd == -1) { perror("epoll_create1() failed"); close(listener_fd); return 1; }
+    // Mỗi reactor có kết nối SQLite riêng
+    if (db_open(DB_PATH, &r->db) != 0) return -1;
 
+    r->listener_fd = create_listener();
+    if (r->listener_fd == -1) return -1;
+
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->wake_fd == -1) { LOG_ERROR("eventfd() failed: %s", strerror(errno)); return -1; }
+    // Reactor 0 flush hàng đợi presence theo chu kỳ
+    if (id == 0) r->timer_fd = presence_init();
+    if (id == 0 && admin_port > 0) {
+        // Không mở được cổng quản trị thì server vẫn chạy, chỉ không có /metrics
+        r->admin_fd = admin_open(admin_port, admin_arm);
+        if (r->admin_fd == -1) LOG_WARN("Admin port %d unavailable; metrics endpoint disabled", admin_port);
+    }
+
+    if (use_uring) {
+        r->uring = malloc(sizeof(Uring));
+        if (r->uring && uring_init(r->uring) == 0) {
+            // Các SQE này được submit ở lần io_uring_enter đầu tiên của reactor
+            uring_arm_accept(r);
+            uring_arm_poll(r, r->wake_fd, UD_WAKE);
+            if (r->timer_fd != -1) uring_arm_poll(r, r->timer_fd, UD_TIMER);
+            if (r->admin_fd != -1) uring_arm_poll(r, r->admin_fd, UD_ADMIN);
+            return 0;
+        }
+        LOG_WARN("Reactor %d: io_uring unavailable, falling back to epoll", id);
+        free(r->uring);
+        r->uring = NULL;
+    }
+
+    r->epoll_fd = epoll_create1(0);
+    if (r->epoll_fd == -1) { LOG_ERROR("epoll_create1() failed: %s", strerror(errno)); return -1; }
+
+    struct epoll_event event;
     event.events = EPOLLIN; // Sự kiện đọc
-    event.data.fd = listener_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener_fd, &event) == -1) {
-        perror("epoll_ctl ADD listener failed");
-        close(listener_fd); close(epoll_fd); return 1;
+    event.data.fd = r->listener_fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->listener_fd, &event) == -1) {
+        LOG_ERROR("epoll_ctl ADD listener failed: %s", strerror(errno));
+        return -1;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = r->wake_fd;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &event) == -1) {
+        LOG_ERROR("epoll_ctl ADD eventfd failed: %s", strerror(errno));
+        return -1;
+    }
+    if (r->timer_fd != -1) {
+        event.events = EPOLLIN;
+        event.data.fd = r->timer_fd;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->timer_fd, &event) == -1) {
+            LOG_ERROR("epoll_ctl ADD timerfd failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    if (r->admin_fd != -1) {
+        event.events = EPOLLIN;
+        event.data.fd = r->admin_fd;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->admin_fd, &event) == -1) {
+            LOG_ERROR("epoll_ctl ADD admin listener failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Gửi mọi frame đã xếp trong vòng này; đóng session có thể xếp thêm thông báo
+static void finish_iteration(Reactor* r) {
+    while (r->pending_flush_count > 0) {
+        flush_pending_writes(r);
+        reap_closing_sessions(r);
+    }
+}
+
+// Vòng lặp io_uring: 1 lần io_uring_enter vừa submit mọi SQE của vòng trước (SEND, recv
+// mới, accept...) vừa chờ completion
+static void reactor_loop_uring(Reactor* r) {
+    Uring* u = r->uring;
+    if (uring_enable(u) != 0) return;
+    while (1) {
+        // Còn input tồn thì không chờ: chỉ thu completion đã có rồi xử lý tiếp
+        if (uring_submit_and_wait(u, r->pending_input_count ? 0 : 1) < 0) break;
+        r->iteration++;
+        uint64_t start = metrics_now();
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(u)) != NULL) {
+            // Chép ra rồi trả slot ngay: handler có thể submit (khi SQ đầy) và sinh CQE mới
+            struct io_uring_cqe c = *cqe;
+            uring_cqe_seen(u);
+            uring_handle_cqe(r, &c);
+            reap_closing_sessions(r);
+        }
+        process_pending_input(r);
+        reap_closing_sessions(r);
+        finish_iteration(r);
+        metrics_record_loop(start);
     }
+}
 
-    printf("Server is listening on port %d\n", PORT);
+// ----- Vòng lặp của 1 reactor -----
+static void* reactor_loop(void* arg) {
+    Reactor* r = (Reactor*)arg;
+    struct epoll_event events[MAX_EVENTS];
+    current_reactor = r;
+    char name[16];
+    snprintf(name, sizeof(name), "reactor %d", r->id);
+    log_set_thread_name(name);
+
+    if (r->uring) {
+        reactor_loop_uring(r);
+        return NULL;
+    }
 
-    // ----- Vòng lặp Server Chính -----
     while (1) {
-        int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1); // Chờ vô hạn
+        int num_events = epoll_wait(r->epoll_fd, events, MAX_EVENTS, -1); // Chờ vô hạn
         if (num_events == -1) {
-            perror("epoll_wait() failed");
+            if (errno == EINTR) continue;
+            LOG_ERROR("epoll_wait() failed: %s", strerror(errno));
             break;
         }
+        uint64_t start = metrics_now();
 
         // Xử lý từng sự kiện
         for (int i = 0; i < num_events; i++) {
-            if (events[i].data.fd == listener_fd) {
+            int fd = events[i].data.fd;
+            if (fd == r->listener_fd) {
                 // Có kết nối mới
-                handle_new_connection(listener_fd);
+                handle_new_connection(fd);
+            } else if (fd == r->wake_fd) {
+                // Reactor khác gửi packet sang
+                drain_mailbox(r);
+            } else if (fd == r->timer_fd) {
+                presence_on_timer();
+            } else if (r->admin_fd != -1 && (fd == r->admin_fd || !get_session(fd))) {
+                // Listener hoặc kết nối của cổng quản trị (không phải session)
+                admin_on_readable(fd);
             } else {
-                // Có dữ liệu từ client
-                handle_client_data(events[i].data.fd);
+                if (events[i].events & EPOLLOUT) {
+                    handle_client_writable(fd);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    // Có dữ liệu từ client
+                    handle_client_data(fd);
+                }
             }
+            reap_closing_sessions(r);
         }
+
+        finish_iteration(r);
+        metrics_record_loop(start);
     }
+    return NULL;
+}
 
-    close(listener_fd);
-    close(epoll_fd);
-    db_close(db);
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-t reactor_threads] [-c] [-b epoll|uring] [-d db_workers] [-a admin_port]\n"
+                    "          [-l log_file] [-L debug|info|warn|error]\n", prog);
+}
+
+// Hàm main
+int main(int argc, char** argv) {
+    // Ghi vào socket đã bị client đóng không được làm chết server
+    signal(SIGPIPE, SIG_IGN);
+    log_set_thread_name("main");
+    // Trước khi tạo thread nào khác: kill -USR1 in số liệu theo loại packet
+    if (metrics_start() != 0) LOG_ERROR("Failed to start metrics signal thread");
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    num_reactors = ncpu > 0 ? (int)ncpu : 1;
+
+    const char* log_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:cb:d:a:l:L:h")) != -1) {
+        switch (opt) {
+            case 't': num_reactors = atoi(optarg); break;
+            case 'c': cork_mode = 1; break;
+            case 'd': db_workers = atoi(optarg); break;
+            case 'a': admin_port = atoi(optarg); break;
+            case 'l': log_path = optarg; break;
+            case 'L':
+                if (log_level_from_name(optarg) < 0) { usage(argv[0]); return 1; }
+                log_set_level(log_level_from_name(optarg));
+                break;
+            case 'b':
+                if (strcmp(optarg, "uring") == 0) use_uring = 1;
+                else if (strcmp(optarg, "epoll") == 0) use_uring = 0;
+                else { usage(argv[0]); return 1; }
+                break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+#ifndef SO_REUSEPORT
+    num_reactors = 1;
+#endif
+    if (num_reactors < 1) num_reactors = 1;
+    if (num_reactors > MAX_REACTORS) num_reactors = MAX_REACTORS;
+    if (db_workers < 0) db_workers = 0;
+    if (db_workers > DB_POOL_MAX_WORKERS) db_workers = DB_POOL_MAX_WORKERS;
+
+    // Từ đây log đi qua thread nền (trước đó in thẳng ra stdout/stderr);
+    // mọi đường thoát sau đây phải log_stop() để không mất bản ghi còn trong ring
+    if (log_start(log_path, LOG_ROTATE_BYTES, LOG_ROTATE_KEEP) != 0) return 1;
+    if (registry_init() != 0) { log_stop(); return 1; }
+    if (db_pool_start(DB_PATH, db_workers) != 0) {
+        LOG_ERROR("Failed to start database workers");
+        log_stop();
+        return 1;
+    }
+
+    for (int i = 0; i < num_reactors; i++) {
+        if (reactor_init(&reactors[i], i) != 0) {
+            LOG_ERROR("Failed to initialise reactor %d", i);
+            log_stop();
+            return 1;
+        }
+    }
+
+    LOG_INFO("Server is listening on port %d with %d reactor thread(s), %s backend, %d DB worker(s)", PORT,
+             num_reactors, reactors[0].uring ? "io_uring" : "epoll", db_workers);
+    LOG_INFO("Memory per connection: %zu bytes session + %zu bytes registry slot "
+             "(+%zu bytes receive ring only while input is unprocessed), max fds %d",
+             sizeof(ClientSession), sizeof(ClientSession*), sizeof(RecvRing), registry_max_fds());
+    if (reactors[0].admin_fd != -1) LOG_INFO("Metrics: http://127.0.0.1:%d/metrics", admin_port);
+
+    for (int i = 0; i < num_reactors; i++) {
+        if (pthread_create(&reactors[i].thread, NULL, reactor_loop, &reactors[i]) != 0) {
+            LOG_ERROR("pthread_create() failed: %s", strerror(errno));
+            log_stop();
+            return 1;
+        }
+    }
+    for (int i = 0; i < num_reactors; i++) {
+        pthread_join(reactors[i].thread, NULL);
+    }
+    db_pool_stop();
+    admin_close();
+    log_stop();
+
+    for (int i = 0; i < num_reactors; i++) {
+        close(reactors[i].listener_fd);
+        if (reactors[i].uring) {
+            uring_close(reactors[i].uring);
+            free(reactors[i].uring);
+        } else {
+            close(reactors[i].epoll_fd);
+        }
+        close(reactors[i].wake_fd);
+        if (reactors[i].timer_fd != -1) close(reactors[i].timer_fd);
+        db_close(reactors[i].db);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,21 +1,256 @@
 #ifndef SERVER_H
 #define SERVER_H
+#include <pthread.h>
+#include <stdint.h>
+#include <sqlite3.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "friend_manager.h"
 #include "../shared/protocol.h"
+#include "../shared/frame.h"
+#include "outbuf.h"
+#include "uring.h"
+#include "db_pool.h"
+#include "user_ids.h"
 
-#define MAX_CLIENTS 100
+#define MAX_REACTORS 64
+#define SESSION_SLAB_SIZE 1024   // số session cấp phát mỗi lần pool hết chỗ
+
+// Ngưỡng hàng đợi gửi của mỗi session (byte)
+#define OUTBUF_LOW_WATERMARK  (64 * 1024)    // dưới ngưỡng này: đọc input trở lại
+#define OUTBUF_HIGH_WATERMARK (256 * 1024)   // trên ngưỡng này: ngưng đọc input, bỏ packet presence
+#define OUTBUF_MAX            (1024 * 1024)  // vượt quá: client quá chậm -> ngắt kết nối
+
+// Số job DB chưa xong tối đa của 1 session; đạt ngưỡng -> ngưng đọc input như khi throttle
+#define SESSION_DB_INFLIGHT_MAX 32
+
+// Số frame tối đa gom vào 1 lần writev
+#define FLUSH_IOV_MAX 64
+
+// Vòng đệm nhận của 1 session (kích thước lũy thừa của 2, chứa được nhiều frame).
+// head/tail đếm tăng dần, vị trí thật = (x & (RECV_RING_SIZE - 1)).
+#define RECV_RING_SIZE (16 * 1024)
+typedef struct {
+    uint32_t head;      // byte đầu tiên chưa xử lý
+    uint32_t tail;      // vị trí ghi tiếp theo
+    unsigned char data[RECV_RING_SIZE];
+} RecvRing;
+
+// io_uring: mỗi vòng lặp 1 session chỉ được xử lý tối đa RX_BUDGET byte input, phần dư
+// chờ ở rx_spill (recv bị tạm hủy khi rx_spill đầy cỡ RX_BUDGET). Kernel có thể đã nhận
+// sẵn tới cả vùng provided buffer trước khi lệnh hủy có hiệu lực; vượt RX_SPILL_MAX -> ngắt.
+#define RX_BUDGET (64 * 1024)
+#define RX_SPILL_MAX (2 * URING_BUF_COUNT * URING_BUF_SIZE)
+
+// 1 frame đang chờ gửi: tham chiếu tới OutBuf dùng chung, không copy dữ liệu.
+// `sent` > 0 nghĩa là frame đã gửi dở, không được bỏ
+typedef struct OutFrame {
+    struct OutFrame* next;
+    OutBuf* buf;
+    const unsigned char* data;  // trỏ vào buf, theo proto_version của session
+    size_t len;
+    size_t sent;
+} OutFrame;
+
+// io_uring: 1 SENDMSG đang chạy (tương đương 1 writev). Giữ tham chiếu tới các OutBuf mà
+// iov trỏ vào cho tới khi có CQE, nên session có thể đóng trong lúc kernel còn gửi.
+typedef struct UringSend {
+    struct UringSend* next_free;
+    int fd;
+    uint32_t gen;               // CQE về sau khi session đã đóng -> không khớp gen
+    int count;
+    struct msghdr msg;
+    struct iovec iov[FLUSH_IOV_MAX];
+    OutBuf* bufs[FLUSH_IOV_MAX];
+} UringSend;
+
+// Xem server_on_flushed; ok = 0 nếu session đóng trước
+typedef void (*server_wait_fn)(void* arg, int ok);
 
 // Cấu trúc quản lý 1 client
 typedef struct ClientSession {
     int fd;
+    int reactor_id;     // reactor sở hữu session (không đổi)
+    uint32_t gen;       // tăng mỗi lần slot được dùng lại: CQE cũ của fd đã đóng không khớp
     char username[MAX_USERNAME];
-    
-    // Buffer để xử lý stream (khi nhận được nửa gói tin)
-    char read_buffer[sizeof(ChatPacket)];
-    int buffer_len; 
+    UserId user_id;     // users.id sau khi login, 0 = chưa login
+
+    int proto_version;  // định dạng frame gửi cho client (FRAME_PROTO_V1 cho tới khi HELLO)
+
+    // Vòng đệm nhận: chỉ cấp phát khi còn dữ liệu chưa xử lý (nửa frame / bị throttle),
+    // session idle không giữ buffer (NULL)
+    RecvRing* rx;
+    unsigned long rx_reads;     // số lần gọi read/readv
+    unsigned long rx_frames;    // số frame đã nhận
+
+    // Hàng đợi gửi, flush khi socket writable (EPOLLOUT)
+    OutFrame* out_head;
+    OutFrame* out_tail;
+    size_t out_bytes;   // số byte còn chờ gửi
+    unsigned long long out_total;   // tổng số byte đã xếp hàng từ lúc kết nối
+    int offline_ack;    // client xác nhận từng trang tin offline (HELLO có "ack")
+    int want_write;     // đã đăng ký EPOLLOUT
+    int throttled;      // vượt high watermark -> tạm ngưng xử lý input
+    int closing;        // sẽ bị đóng khi reactor xử lý xong sự kiện hiện tại
+    int presence_stale; // đã bỏ packet presence -> gửi lại snapshot khi hết nghẽn
+    int flush_scheduled; // đã nằm trong danh sách flush cuối vòng lặp của reactor
+    int db_inflight;    // số job DB của session chưa chạy xong phần done
+    int db_barrier;     // số job DB_JOB_BARRIER chưa xong: ngưng xử lý input
+    // Việc đang chờ của session, xem server_on_flushed / server_on_offline_ack
+    server_wait_fn wait_cb;
+    void* wait_arg;
+    int wait_ack;                   // 1 = chờ client gửi MSG_TYPE_OFFLINE_ACK
+    unsigned long long wait_mark;   // 0: chờ tới khi đã ghi vào socket wait_mark byte (theo out_total)
+    unsigned long tx_writes;    // số lần gọi writev
+    unsigned long tx_frames;    // số frame đã gửi xong
+
+    // Chỉ dùng với io_uring
+    int rx_armed;               // multishot recv đang chạy
+    int rx_cancel;              // đã gửi yêu cầu hủy recv (tạm ngưng nhận)
+    int tx_inflight;            // số SENDMSG trong chuỗi đang chạy
+    unsigned char* rx_spill;    // dữ liệu đã nhận nhưng chưa xử lý (hết budget / throttle)
+    size_t rx_spill_len;
+    unsigned long rx_iter;      // vòng lặp của reactor mà rx_used thuộc về
+    size_t rx_used;             // số byte input đã xử lý trong vòng lặp rx_iter
+    int input_scheduled;        // đã nằm trong danh sách xử lý input tồn cuối vòng lặp
+
+    struct ClientSession* next_free; // freelist của pool
 } ClientSession;
 
-// Hàm tìm session, sẽ được định nghĩa trong server.c
+// Slab chứa SESSION_SLAB_SIZE session; không bao giờ giải phóng nên con trỏ session luôn hợp lệ
+typedef struct SessionSlab {
+    struct SessionSlab* next;
+    ClientSession sessions[SESSION_SLAB_SIZE];
+} SessionSlab;
+
+// Packet chuyển từ reactor này sang reactor khác (cross-shard delivery)
+typedef struct MailboxItem {
+    struct MailboxItem* next;
+    int fd;                        // fd của session đích trên reactor nhận
+    int store_offline;             // session đã biến mất: MISS_* (bỏ / lưu offline / lưu log group)
+    UserId user_id;                // user đích (để kiểm tra fd chưa bị tái sử dụng)
+    OutBuf* buf;                   // giữ 1 tham chiếu
+} MailboxItem;
+
+// Mỗi reactor = 1 thread, 1 listener (SO_REUSEPORT), 1 epoll hoặc io_uring, 1 shard session,
+// 1 kết nối DB. Chỉ thread của reactor được đọc/ghi socket của các session thuộc shard đó.
+typedef struct Reactor {
+    int id;
+    pthread_t thread;
+    int listener_fd;
+    int epoll_fd;                  // -1 khi dùng io_uring
+    Uring* uring;                  // NULL = backend epoll
+    uint32_t next_gen;
+    int wake_fd;                   // eventfd: báo có packet mới trong mailbox
+    int timer_fd;                  // timerfd flush presence (chỉ reactor 0, -1 nếu không có)
+    int admin_fd;                  // listener cổng quản trị (chỉ reactor 0, -1 nếu tắt)
+    sqlite3* db;
+
+    // Pool session của shard này (tăng dần theo slab, không giới hạn cứng)
+    SessionSlab* slabs;
+    ClientSession* free_sessions;
+    int session_count;               // atomic: cổng quản trị đọc từ thread khác
+    size_t out_queued;               // atomic, tổng out_bytes của các session trong shard
+
+    int* pending_close;              // fd các session đã đánh dấu closing
+    int pending_close_count;
+    int pending_close_cap;
+
+    int* pending_flush;              // fd các session có frame mới trong vòng lặp hiện tại
+    int pending_flush_count;
+    int pending_flush_cap;
+
+    int* pending_input;              // io_uring: fd các session còn input tồn (rx_spill)
+    int pending_input_count;
+    int pending_input_cap;
+    unsigned long iteration;         // số vòng lặp io_uring đã chạy
+    UringSend* free_sends;           // UringSend dùng lại
+    unsigned long tx_writes;         // tổng số lần gọi writev
+    unsigned long tx_frames;         // tổng số frame đã gửi xong
+
+    RecvRing rx_scratch;             // đọc cho session chưa có vòng đệm riêng
+    unsigned char frame_scratch[FRAME_MAX_SIZE]; // ghép frame nằm vắt qua cuối vòng đệm
+    unsigned long rx_reads;          // tổng số lần gọi read/readv
+    unsigned long rx_frames;         // tổng số frame đã nhận
+    unsigned long rx_wrapped;        // số frame phải copy vì vắt qua cuối vòng đệm
+
+    pthread_mutex_t mailbox_lock;
+    MailboxItem* mailbox_head;
+    MailboxItem* mailbox_tail;
+    DbJob* db_done_head;             // job DB đã chạy xong, chờ chạy done (cùng mailbox_lock)
+    DbJob* db_done_tail;
+} Reactor;
+
+// Reactor đang chạy trên thread hiện tại (NULL nếu không phải thread reactor)
+extern __thread Reactor* current_reactor;
+
+// Hàm tìm session trong shard của reactor hiện tại
 ClientSession* get_session(int fd);
 
-#endif
\ No newline at end of file
+// Tham chiếu tới session giữ qua 1 job bất đồng bộ: khi job xong, fd có thể đã đóng
+// và được dùng lại cho kết nối khác (gen khác)
+typedef struct {
+    int fd;
+    uint32_t gen;
+} SessionRef;
+SessionRef server_session_ref(int fd);
+// Session còn đúng là kết nối lúc tạo ref, NULL nếu đã đóng
+ClientSession* server_session_deref(SessionRef ref);
+
+// Worker DB gọi: chuyển job đã xong về reactor gửi nó và đánh thức reactor
+void server_post_db_completion(Reactor* r, DbJob* job);
+// db_pool gọi sau done của job thuộc session: đọc input trở lại nếu đã dưới ngưỡng
+void server_db_job_finished(SessionRef ref, int barrier);
+
+// Gửi packet tới 1 fd thuộc reactor hiện tại. Packet được xếp vào hàng đợi của session;
+// mọi frame xếp trong 1 vòng epoll_wait được gửi bằng 1 writev ở cuối vòng, phần chưa
+// ghi được flush khi có EPOLLOUT.
+// Trả về 0 nếu đã ghi/xếp hàng, -1 nếu packet bị bỏ (session không tồn tại, đang đóng, bị shed).
+int server_send_packet(int fd, const ChatPacket* packet);
+
+// Gửi thông báo tới user đang online (có thể ở reactor khác), tìm theo UserId trong danh bạ.
+// Trả về 1 nếu user online, 0 nếu offline (packet bị bỏ).
+int server_send_to_id(UserId id, const ChatPacket* packet);
+
+// Giống server_send_to_id nhưng lưu offline message nếu user không online.
+// Bản theo username dành cho tên lấy thẳng từ packet của client.
+// Trả về 1 nếu đã chuyển đi trực tiếp, 0 nếu đã lưu offline.
+int server_deliver_to_user(const char* username, const ChatPacket* packet);
+
+// Các bản dùng OutBuf cho fan-out: caller tạo 1 OutBuf, gửi cho từng người nhận rồi
+// release. Mỗi người nhận chỉ giữ thêm 1 tham chiếu, không mã hóa/copy lại.
+int server_send_outbuf(int fd, OutBuf* buf);
+int server_send_outbuf_to_id(UserId id, OutBuf* buf);
+int server_deliver_outbuf_to_id(UserId id, OutBuf* buf);
+
+// Fan-out tin group. Trả về 1 nếu đã chuyển đi, 0 nếu thành viên offline: tin phải nằm trong
+// log group (thành viên đọc theo con trỏ khi login), không lưu thành tin offline riêng.
+// Thành viên ở reactor khác offline trong lúc packet đang chuyển cũng được tính là lỡ tin.
+int server_deliver_group_outbuf_to_id(UserId id, OutBuf* buf);
+// Gọi sau khi đã gửi buf cho mọi thành viên (has_offline: có thành viên lỡ tin).
+// Trả về 1 nếu caller phải lưu tin vào log group; mỗi buf được lưu tối đa 1 lần.
+int server_group_outbuf_sent(OutBuf* buf, int has_offline);
+
+// Gọi cb(arg, 1) trên reactor khi mọi frame đã xếp hàng cho fd tới lúc này đã được ghi
+// vào socket (không gọi lồng trong hàm này), cb(arg, 0) nếu session đóng trước đó.
+// Mỗi session chờ 1 việc 1 lúc. Trả về 0; -1 nếu session không tồn tại / đang chờ.
+int server_on_flushed(int fd, server_wait_fn cb, void* arg);
+// Như trên nhưng chờ client gửi MSG_TYPE_OFFLINE_ACK (chỉ dùng khi session->offline_ack)
+int server_on_offline_ack(int fd, server_wait_fn cb, void* arg);
+
+// Số liệu của 1 reactor cho cổng quản trị (đọc từ thread khác, có thể lệch chút ít).
+// Trả về -1 nếu không có reactor id.
+typedef struct {
+    int sessions;
+    size_t out_queued;
+} ReactorStats;
+int server_reactor_stats(int id, ReactorStats* out);
+
+int server_is_id_online(UserId id);
+int server_is_user_online(const char* username);
+
+// Đăng ký user cho session (fd) của reactor hiện tại.
+// Trả về 0 nếu thành công, -1 nếu user đã đăng nhập ở nơi khác.
+int server_claim_user(UserId id, int fd);
+
+#endif
@@ -0,0 +1,103 @@
+#include "session_registry.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#define REGISTRY_MAX_FDS (1 << 20)
+
+// ----- Bảng fd -> session -----
+// Mỗi ô chỉ được reactor sở hữu fd ghi, nhưng ô của fd đã đóng có thể bị reactor
+// khác ghi lại khi kernel tái sử dụng fd, nên đọc/ghi bằng atomic.
+static ClientSession** fd_table = NULL;
+static int fd_table_size = 0;
+
+// ----- UserId -> vị trí session -----
+// Mỗi ô giữ (reactor_id + 1) << 32 | fd, 0 = offline. claim/release bằng compare-and-swap nên
+// 2 reactor cùng login 1 user chỉ 1 bên thắng, lookup chỉ là 1 atomic load.
+_Static_assert(sizeof(void*) >= sizeof(uint64_t), "registry packs (reactor, fd) into a pointer slot");
+static IdTable user_slots;
+static int user_count = 0;   // số ô đang có user (claim thành công - release thành công)
+
+static void* pack_location(int reactor_id, int fd) {
+    return (void*)(uintptr_t)(((uint64_t)(uint32_t)(reactor_id + 1) << 32) | (uint32_t)fd);
+}
+
+int registry_init(void) {
+    struct rlimit rl;
+    long max_fds = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        // Nâng soft limit lên hard limit để giữ được nhiều kết nối idle
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            if (rl.rlim_cur > REGISTRY_MAX_FDS) rl.rlim_cur = REGISTRY_MAX_FDS;
+            setrlimit(RLIMIT_NOFILE, &rl);
+            getrlimit(RLIMIT_NOFILE, &rl);
+        }
+        max_fds = (rl.rlim_cur == RLIM_INFINITY) ? REGISTRY_MAX_FDS : (long)rl.rlim_cur;
+    }
+    if (max_fds > REGISTRY_MAX_FDS) max_fds = REGISTRY_MAX_FDS;
+
+    fd_table = calloc((size_t)max_fds, sizeof(ClientSession*));
+    if (!fd_table) {
+        LOG_ERROR("Cannot allocate session registry.");
+        return -1;
+    }
+    fd_table_size = (int)max_fds;
+    return 0;
+}
+
+int registry_max_fds(void) {
+    return fd_table_size;
+}
+
+void registry_bind_fd(int fd, ClientSession* session) {
+    if (fd < 0 || fd >= fd_table_size) return;
+    __atomic_store_n(&fd_table[fd], session, __ATOMIC_RELEASE);
+}
+
+void registry_unbind_fd(int fd, ClientSession* session) {
+    if (fd < 0 || fd >= fd_table_size) return;
+    // Chỉ xóa nếu ô vẫn trỏ tới session này (fd có thể đã được reactor khác dùng lại)
+    ClientSession* expected = session;
+    __atomic_compare_exchange_n(&fd_table[fd], &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+ClientSession* registry_get_fd(int fd) {
+    if (fd < 0 || fd >= fd_table_size) return NULL;
+    return __atomic_load_n(&fd_table[fd], __ATOMIC_ACQUIRE);
+}
+
+int registry_claim_user(UserId id, int reactor_id, int fd) {
+    void** slot = id_table_slot(&user_slots, id, 1);
+    void* expected = NULL;
+    if (!slot) return -1;
+    if (!__atomic_compare_exchange_n(slot, &expected, pack_location(reactor_id, fd), 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    __atomic_add_fetch(&user_count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void registry_release_user(UserId id, int reactor_id, int fd) {
+    void** slot = id_table_slot(&user_slots, id, 0);
+    // Chỉ gỡ nếu ô vẫn là của session này
+    void* expected = pack_location(reactor_id, fd);
+    if (slot && __atomic_compare_exchange_n(slot, &expected, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __atomic_sub_fetch(&user_count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int registry_user_count(void) {
+    return __atomic_load_n(&user_count, __ATOMIC_RELAXED);
+}
+
+int registry_lookup_user(UserId id, int* reactor_id, int* fd) {
+    uint64_t v = (uint64_t)(uintptr_t)id_table_get(&user_slots, id);
+    if (v == 0) return -1;
+    if (reactor_id) *reactor_id = (int)(v >> 32) - 1;
+    if (fd) *fd = (int)(uint32_t)v;
+    return 0;
+}
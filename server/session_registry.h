@@ -0,0 +1,28 @@
+#ifndef SESSION_REGISTRY_H
+#define SESSION_REGISTRY_H
+
+#include "../shared/protocol.h"
+#include "user_ids.h"
+
+// Registry dùng chung cho mọi reactor:
+//  - bảng fd -> session (truy cập trực tiếp theo chỉ số fd)
+//  - bảng UserId -> (reactor, fd) cho user đã login (truy cập trực tiếp theo id, không khóa)
+typedef struct ClientSession ClientSession;
+
+// Gọi 1 lần trước khi chạy reactor; kích thước bảng fd lấy theo RLIMIT_NOFILE
+int registry_init(void);
+int registry_max_fds(void);
+
+// Bảng fd. Chỉ reactor sở hữu fd mới bind/unbind nó.
+void registry_bind_fd(int fd, ClientSession* session);
+void registry_unbind_fd(int fd, ClientSession* session);
+ClientSession* registry_get_fd(int fd);
+
+// UserId -> vị trí session. claim trả về 0 nếu thành công, -1 nếu user đã online.
+int registry_claim_user(UserId id, int reactor_id, int fd);
+void registry_release_user(UserId id, int reactor_id, int fd);
+int registry_lookup_user(UserId id, int* reactor_id, int* fd);
+// Số user đang login (đọc không khóa, có thể lệch trong lúc claim/release đang chạy)
+int registry_user_count(void);
+
+#endif
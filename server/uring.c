@@ -0,0 +1,197 @@
+#include "uring.h"
+#include "log.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Provided buffer ring: kernel lấy buffer từ đây cho mỗi lần recv, ta trả lại khi xử lý xong
+static int setup_buffers(Uring* u) {
+    size_t ring_len = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    u->buf_ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->buf_ring == MAP_FAILED) { u->buf_ring = NULL; return -1; }
+    u->buf_base = mmap(NULL, (size_t)URING_BUF_COUNT * URING_BUF_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->buf_base == MAP_FAILED) { u->buf_base = NULL; return -1; }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (sys_io_uring_register(u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        LOG_ERROR("io_uring_register(PBUF_RING) failed: %s", strerror(errno));
+        return -1;
+    }
+    u->buf_tail = 0;
+    for (unsigned bid = 0; bid < URING_BUF_COUNT; bid++) uring_buffer_recycle(u, bid);
+    return 0;
+}
+
+int uring_init(Uring* u) {
+    memset(u, 0, sizeof(Uring));
+    u->ring_fd = -1;
+
+    // Thử từ cấu hình tốt nhất: DEFER_TASKRUN (6.1+) chỉ xử lý completion khi ta gọi
+    // io_uring_enter(GETEVENTS) từ đúng 1 thread; ring được tạo ở trạng thái tắt và bật
+    // bởi thread reactor (uring_enable) để thread đó thành submitter duy nhất.
+    // COOP_TASKRUN (5.19+): không ngắt thread để chạy task work.
+    static const unsigned setup_flags[] = {
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED,
+        IORING_SETUP_COOP_TASKRUN,
+        0,
+    };
+    struct io_uring_params p;
+    for (size_t i = 0; i < sizeof(setup_flags) / sizeof(setup_flags[0]) && u->ring_fd < 0; i++) {
+        memset(&p, 0, sizeof(p));
+        p.flags = setup_flags[i];
+        u->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+        u->disabled = (p.flags & IORING_SETUP_R_DISABLED) != 0;
+    }
+    if (u->ring_fd < 0) {
+        LOG_ERROR("io_uring_setup() failed: %s", strerror(errno));
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        LOG_ERROR("io_uring: kernel too old (features 0x%x)", p.features);
+        uring_close(u);
+        return -1;
+    }
+
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_len > u->sq_map_len) u->sq_map_len = cq_len;
+    u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->ring_fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED) { u->sq_map = NULL; LOG_ERROR("mmap(SQ ring) failed: %s", strerror(errno)); uring_close(u); return -1; }
+    u->cq_map = u->sq_map; // SINGLE_MMAP: SQ và CQ dùng chung 1 vùng
+
+    u->sqe_map_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqe_map = mmap(NULL, u->sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->ring_fd, IORING_OFF_SQES);
+    if (u->sqe_map == MAP_FAILED) { u->sqe_map = NULL; LOG_ERROR("mmap(SQEs) failed: %s", strerror(errno)); uring_close(u); return -1; }
+
+    unsigned char* sq = u->sq_map;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    u->sqes = u->sqe_map;
+    u->sq_local_tail = u->sq_submitted = *u->sq_tail;
+    // SQE thứ i luôn nằm ở slot i: mảng chỉ số cố định
+    for (unsigned i = 0; i < u->sq_entries; i++) u->sq_array[i] = i;
+
+    unsigned char* cq = u->cq_map;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    if (setup_buffers(u) != 0) {
+        uring_close(u);
+        return -1;
+    }
+    return 0;
+}
+
+int uring_enable(Uring* u) {
+    if (!u->disabled) return 0;
+    if (sys_io_uring_register(u->ring_fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) != 0) {
+        LOG_ERROR("io_uring_register(ENABLE_RINGS) failed: %s", strerror(errno));
+        return -1;
+    }
+    u->disabled = 0;
+    return 0;
+}
+
+void uring_close(Uring* u) {
+    if (u->buf_base) munmap(u->buf_base, (size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+    if (u->buf_ring) munmap(u->buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    if (u->sqe_map) munmap(u->sqe_map, u->sqe_map_len);
+    if (u->sq_map) munmap(u->sq_map, u->sq_map_len);
+    if (u->ring_fd >= 0) close(u->ring_fd);
+    memset(u, 0, sizeof(Uring));
+    u->ring_fd = -1;
+}
+
+unsigned uring_sq_space(const Uring* u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    return u->sq_entries - (u->sq_local_tail - head);
+}
+
+struct io_uring_sqe* uring_get_sqe(Uring* u) {
+    if (uring_sq_space(u) == 0) {
+        uring_submit(u);
+        if (uring_sq_space(u) == 0) return NULL;
+    }
+    struct io_uring_sqe* sqe = &u->sqes[u->sq_local_tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_local_tail++;
+    return sqe;
+}
+
+static int enter(Uring* u, unsigned wait_nr, unsigned flags) {
+    unsigned to_submit = u->sq_local_tail - u->sq_submitted;
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+
+    int ret = sys_io_uring_enter(u->ring_fd, to_submit, wait_nr, flags);
+    u->enters++;
+    if (ret < 0) {
+        // EINTR / EBUSY (CQ đầy): caller xử lý CQE rồi gọi lại
+        if (errno == EINTR || errno == EBUSY || errno == EAGAIN) return 0;
+        LOG_ERROR("io_uring_enter() failed: %s", strerror(errno));
+        return -1;
+    }
+    u->sq_submitted += (unsigned)ret;
+    u->sqes_submitted += (unsigned)ret;
+    return ret;
+}
+
+int uring_submit(Uring* u) {
+    if (u->sq_local_tail == u->sq_submitted) return 0;
+    return enter(u, 0, 0);
+}
+
+int uring_submit_and_wait(Uring* u, unsigned wait_nr) {
+    // GETEVENTS cả khi wait_nr = 0: chạy task work để completion sẵn sàng hiện ra trong CQ
+    return enter(u, wait_nr, IORING_ENTER_GETEVENTS);
+}
+
+struct io_uring_cqe* uring_peek_cqe(Uring* u) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &u->cqes[head & u->cq_mask];
+}
+
+void uring_cqe_seen(Uring* u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+    u->cqes_seen++;
+}
+
+unsigned char* uring_buffer(Uring* u, unsigned bid) {
+    return u->buf_base + (size_t)bid * URING_BUF_SIZE;
+}
+
+void uring_buffer_recycle(Uring* u, unsigned bid) {
+    struct io_uring_buf* buf = &u->buf_ring->bufs[u->buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer(u, bid);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = (uint16_t)bid;
+    u->buf_tail++;
+    __atomic_store_n(&u->buf_ring->tail, u->buf_tail, __ATOMIC_RELEASE);
+}
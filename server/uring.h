@@ -0,0 +1,136 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// Lớp mỏng trên io_uring (syscall trực tiếp, không cần liburing): 1 SQ/CQ cho mỗi reactor
+// và 1 ring buffer cung cấp sẵn (provided buffers) cho multishot recv.
+// Chỉ thread của reactor sở hữu được dùng Uring.
+
+#define URING_ENTRIES 1024          // số SQE; CQ gấp đôi
+#define URING_BUF_COUNT 256         // số provided buffer (lũy thừa của 2)
+#define URING_BUF_SIZE 4096         // kích thước mỗi provided buffer
+#define URING_BUF_GROUP 0
+#define URING_SEND_CHAIN_MAX 16     // số SENDMSG tối đa trong 1 chuỗi IOSQE_IO_LINK
+
+typedef struct {
+    int ring_fd;
+    int disabled;               // tạo với IORING_SETUP_R_DISABLED, chờ uring_enable
+
+    // Submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    unsigned sq_local_tail;     // SQE đã điền nhưng chưa công bố cho kernel
+    unsigned sq_submitted;      // tail đã công bố
+
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_map; size_t sq_map_len;
+    void* cq_map; size_t cq_map_len;
+    void* sqe_map; size_t sqe_map_len;
+
+    // Provided buffer ring (IORING_REGISTER_PBUF_RING)
+    struct io_uring_buf_ring* buf_ring;
+    unsigned char* buf_base;
+    uint16_t buf_tail;
+
+    unsigned long enters;       // số lần gọi io_uring_enter
+    unsigned long sqes_submitted;
+    unsigned long cqes_seen;
+} Uring;
+
+// Tạo ring + đăng ký provided buffers. Trả về 0 nếu OK, -1 nếu kernel không hỗ trợ.
+int uring_init(Uring* u);
+void uring_close(Uring* u);
+
+// Bật ring (nếu được tạo ở trạng thái tắt); phải gọi trên thread sẽ submit
+int uring_enable(Uring* u);
+
+// Số SQE còn trống
+unsigned uring_sq_space(const Uring* u);
+
+// Lấy 1 SQE trống (đã xóa về 0); tự submit nếu SQ đầy. NULL nếu lỗi.
+struct io_uring_sqe* uring_get_sqe(Uring* u);
+
+// Submit các SQE đã điền (không gọi syscall nếu không có gì). Trả về số SQE đã submit, -1 nếu lỗi.
+int uring_submit(Uring* u);
+
+// Submit và chờ ít nhất wait_nr CQE (0: chỉ thu completion đã xong, không chờ)
+int uring_submit_and_wait(Uring* u, unsigned wait_nr);
+
+// CQE kế tiếp (NULL nếu CQ rỗng); gọi uring_cqe_seen sau khi xử lý xong
+struct io_uring_cqe* uring_peek_cqe(Uring* u);
+void uring_cqe_seen(Uring* u);
+
+// Dữ liệu của provided buffer bid; trả lại buffer cho kernel bằng uring_buffer_recycle
+unsigned char* uring_buffer(Uring* u, unsigned bid);
+void uring_buffer_recycle(Uring* u, unsigned bid);
+
+// ----- Chuẩn bị SQE -----
+
+static inline void uring_prep_accept_multishot(struct io_uring_sqe* sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = user_data;
+}
+
+static inline void uring_prep_recv_multishot(struct io_uring_sqe* sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = user_data;
+}
+
+static inline void uring_prep_sendmsg(struct io_uring_sqe* sqe, int fd, const struct msghdr* msg,
+                                      int msg_flags, uint64_t user_data) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t)msg_flags;
+    sqe->user_data = user_data;
+}
+
+// Poll nhiều lần (multishot) cho eventfd/timerfd
+static inline void uring_prep_poll_multishot(struct io_uring_sqe* sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+}
+
+// Poll 1 lần (kết nối của cổng quản trị: không còn request nào giữ fd khi đóng)
+static inline void uring_prep_poll(struct io_uring_sqe* sqe, int fd, uint64_t user_data) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = 0;
+    sqe->user_data = user_data;
+}
+
+// Hủy request có user_data = target
+static inline void uring_prep_cancel(struct io_uring_sqe* sqe, uint64_t target, uint64_t user_data) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
+
+#endif
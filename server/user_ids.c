@@ -0,0 +1,127 @@
+#include "user_ids.h"
+#include "name_set.h"
+#include "db_handler.h"
+#include "metrics.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// ----- IdTable -----
+
+void** id_table_slot(IdTable* t, UserId id, int create) {
+    uint32_t page = id >> ID_TABLE_PAGE_BITS;
+    if (id == 0 || page >= ID_TABLE_PAGES) return NULL;
+    void** p = __atomic_load_n(&t->pages[page], __ATOMIC_ACQUIRE);
+    if (!p && create) {
+        void** fresh = calloc(ID_TABLE_PAGE_SIZE, sizeof(void*));
+        if (!fresh) return NULL;
+        // 2 thread cùng cấp trang: bản thua bị bỏ, dùng trang của bản thắng
+        if (__atomic_compare_exchange_n(&t->pages[page], &p, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            p = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return p ? &p[id & (ID_TABLE_PAGE_SIZE - 1)] : NULL;
+}
+
+void* id_table_get(IdTable* t, UserId id) {
+    void** slot = id_table_slot(t, id, 0);
+    return slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+}
+
+// ----- Username <-> UserId -----
+// id -> tên: IdTable (đọc không khóa). Tên -> id: bảng hash open addressing dưới rwlock.
+
+#define NAME_INDEX_INITIAL_CAPACITY 1024  // luôn là lũy thừa của 2
+
+static IdTable names;
+static UserId* name_index = NULL;       // hash(tên) -> id, 0 = trống
+static size_t name_index_cap = 0;
+static size_t name_count = 0;
+static pthread_rwlock_t name_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+const char* user_ids_name(UserId id) {
+    return (const char*)id_table_get(&names, id);
+}
+
+static UserId find_locked(const char* username, uint32_t hash) {
+    if (!name_index) return 0;
+    size_t mask = name_index_cap - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        UserId id = name_index[i];
+        if (id == 0) return 0;
+        if (strncmp(user_ids_name(id), username, MAX_USERNAME) == 0) return id;
+    }
+}
+
+static void place_locked(UserId id, uint32_t hash) {
+    size_t mask = name_index_cap - 1;
+    size_t i = hash & mask;
+    while (name_index[i]) i = (i + 1) & mask;
+    name_index[i] = id;
+}
+
+static int grow_locked(void) {
+    if ((name_count + 1) * 2 <= name_index_cap) return 0;
+    size_t new_cap = name_index_cap ? name_index_cap * 2 : NAME_INDEX_INITIAL_CAPACITY;
+    UserId* fresh = calloc(new_cap, sizeof(UserId));
+    if (!fresh) return -1;
+    UserId* old = name_index;
+    size_t old_cap = name_index_cap;
+    name_index = fresh;
+    name_index_cap = new_cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i]) place_locked(old[i], name_hash(user_ids_name(old[i])));
+    }
+    free(old);
+    return 0;
+}
+
+UserId user_ids_find(const char* username) {
+    if (!username || username[0] == '\0') return 0;
+    uint32_t hash = name_hash(username);
+    pthread_rwlock_rdlock(&name_lock);
+    UserId id = find_locked(username, hash);
+    pthread_rwlock_unlock(&name_lock);
+    return id;
+}
+
+int user_ids_intern(UserId id, const char* username) {
+    if (!username || username[0] == '\0') return -1;
+    if (user_ids_name(id)) return 0;
+
+    int rc = 0;
+    pthread_rwlock_wrlock(&name_lock);
+    void** slot = id_table_slot(&names, id, 1);
+    if (!slot) {
+        rc = -1;
+    } else if (!*slot) {
+        char* copy = calloc(1, MAX_USERNAME);
+        if (!copy || grow_locked() != 0) {
+            free(copy);
+            rc = -1;
+        } else {
+            strncpy(copy, username, MAX_USERNAME - 1);
+            // Ghi tên xong mới công bố ô cho reader không khóa
+            __atomic_store_n(slot, copy, __ATOMIC_RELEASE);
+            place_locked(id, name_hash(copy));
+            name_count++;
+        }
+    }
+    pthread_rwlock_unlock(&name_lock);
+    if (rc != 0) LOG_ERROR("User ids: cannot intern '%s' (id %u).", username, id);
+    return rc;
+}
+
+UserId user_ids_resolve(sqlite3* db, const char* username) {
+    UserId id = user_ids_find(username);
+    if (id || !db || !username) return id;
+    uint64_t start = metrics_now();
+    id = db_get_user_id(db, username);
+    metrics_record_db(metrics_current_type(), start);
+    if (id && user_ids_intern(id, username) != 0) return 0;
+    return id;
+}
@@ -0,0 +1,40 @@
+#ifndef USER_IDS_H
+#define USER_IDS_H
+
+#include <stdint.h>
+#include <sqlite3.h>
+
+// Id số của user = users.id trong DB (dày đặc, tăng dần từ 1; 0 = không có).
+// Bên trong server (session, danh bạ, cache, presence, fan-out) user được nhận diện bằng id;
+// username chỉ dùng ở biên: packet gửi/nhận và câu lệnh SQL nhận tên từ client.
+typedef uint32_t UserId;
+
+// ----- Bảng UserId -> con trỏ, chia trang -----
+// Truy cập O(1) theo id, không hash/so sánh chuỗi. Trang được cấp phát khi cần và không
+// bao giờ giải phóng nên con trỏ tới 1 ô luôn hợp lệ; đọc/ghi ô bằng atomic.
+#define ID_TABLE_PAGE_BITS 10
+#define ID_TABLE_PAGE_SIZE (1u << ID_TABLE_PAGE_BITS)
+#define ID_TABLE_PAGES 16384    // id tối đa = ID_TABLE_PAGES * ID_TABLE_PAGE_SIZE - 1 (~16 triệu user)
+
+typedef struct {
+    void** pages[ID_TABLE_PAGES];
+} IdTable;
+
+// Ô của id. create = 1: cấp trang nếu chưa có. NULL nếu id ngoài phạm vi / chưa có trang / hết bộ nhớ.
+void** id_table_slot(IdTable* t, UserId id, int create);
+void* id_table_get(IdTable* t, UserId id);
+
+// ----- Username <-> UserId -----
+// Bảng dùng chung cho mọi thread, chỉ thêm (user không bị xóa / đổi tên): chuỗi trả về bởi
+// user_ids_name sống tới khi server thoát.
+
+// Ghi nhận cặp (id, username) đọc từ DB. Trả về 0; -1 nếu id không hợp lệ / hết bộ nhớ.
+int user_ids_intern(UserId id, const char* username);
+// Id của username đã intern, 0 nếu chưa biết (user chưa login / chưa được cache nào nạp)
+UserId user_ids_find(const char* username);
+// Username của id đã intern, NULL nếu chưa biết
+const char* user_ids_name(UserId id);
+// Như user_ids_find, chưa biết thì hỏi DB (db_get_user_id) rồi intern. 0 nếu user không tồn tại.
+UserId user_ids_resolve(sqlite3* db, const char* username);
+
+#endif
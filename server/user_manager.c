@@ -1,21 +1,61 @@
 #include "user_manager.h"
 #include "db_handler.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+typedef struct {
+    SessionRef ref;
+    char username[MAX_USERNAME];
+    char password[MAX_BODY];
+    int rc;
+} RegisterJob;
+
+// Chạy trên writer DB (cùng transaction với các thao tác ghi khác trong lô)
+static void register_work(sqlite3* db, void* arg) {
+    RegisterJob* job = (RegisterJob*)arg;
+    job->rc = db_register_user(db, job->username, job->password);
+}
+
+// Chạy lại trên reactor của client
+static void register_done(sqlite3* db, void* arg, int status) {
+    (void)db;
+    RegisterJob* job = (RegisterJob*)arg;
+    if (server_session_deref(job->ref)) {
+        ChatPacket reply;
+        memset(&reply, 0, sizeof(reply));
+        if (status != SQLITE_OK) {
+            // Lô chứa lệnh ghi đã bị ROLLBACK: user chưa được tạo
+            reply.type = MSG_TYPE_REGISTER_FAIL;
+            snprintf(reply.body, MAX_BODY, "Register failed (server error), try again.");
+        } else if (job->rc == 0) {
+            reply.type = MSG_TYPE_REGISTER_SUCCESS;
+            snprintf(reply.body, MAX_BODY, "Register successful. You can now login.");
+        } else {
+            reply.type = MSG_TYPE_REGISTER_FAIL;
+            snprintf(reply.body, MAX_BODY, "Register failed (username may exist).");
+        }
+        server_send_packet(job->ref.fd, &reply);
+    }
+    free(job);
+}
+
 // Handle user registration
 void handle_register(int client_fd, ChatPacket* packet, sqlite3* db) {
-    int rc = db_register_user(db, packet->source_user, packet->body); // Giả sử pass nằm trong body
+    (void)db;
+    RegisterJob* job = calloc(1, sizeof(RegisterJob));
+    if (job) {
+        job->ref = server_session_ref(client_fd);
+        strncpy(job->username, packet->source_user, MAX_USERNAME - 1);
+        strncpy(job->password, packet->body, MAX_BODY - 1); // Giả sử pass nằm trong body
+        if (db_pool_submit_for(client_fd, DB_JOB_WRITE | DB_JOB_BARRIER, NULL, register_work, register_done, job) == 0) return;
+        free(job);
+    }
 
     ChatPacket reply;
     memset(&reply, 0, sizeof(reply));
-    if (rc == 0) {
-        reply.type = MSG_TYPE_REGISTER_SUCCESS;
-        snprintf(reply.body, MAX_BODY, "Register successful. You can now login.");
-    } else {
-        reply.type = MSG_TYPE_REGISTER_FAIL;
-        snprintf(reply.body, MAX_BODY, "Register failed (username may exist).");
-    }
-    write(client_fd, &reply, sizeof(ChatPacket));
-}
\ No newline at end of file
+    reply.type = MSG_TYPE_REGISTER_FAIL;
+    snprintf(reply.body, MAX_BODY, "Register failed (server busy).");
+    server_send_packet(client_fd, &reply);
+}
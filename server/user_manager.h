@@ -11,6 +11,6 @@
 struct ClientSession;
 
 void handle_register(int client_fd, ChatPacket* packet, sqlite3 *db);
-void handle_login(int client_fd, ChatPacket* packet, sqlite3 *db, struct ClientSession* sessions);
+void handle_login(int client_fd, ChatPacket* packet, sqlite3 *db);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "protocol.h"
+
+// Định dạng frame trên dây.
+//
+// v1: nguyên struct ChatPacket (sizeof(ChatPacket) byte, phần lớn là padding 0).
+// v2: header 8 byte + payload độ dài thay đổi:
+//
+//   byte 0     FRAME_V2_MAGIC
+//   byte 1     type
+//   byte 2     flags (chưa dùng, bên nhận phải bỏ qua bit lạ)
+//   byte 3     source_len  (< MAX_USERNAME)
+//   byte 4     target_len  (< MAX_USERNAME)
+//   byte 5     reserved (0)
+//   byte 6-7   body_len    (big endian, < MAX_BODY)
+//   payload    source | target | body (không có '\0')
+//
+// Byte đầu của frame v1 là byte thấp của type (little endian, luôn < FRAME_V2_MAGIC),
+// nên bên nhận phân biệt 2 định dạng theo từng frame. Bên gửi dùng v1 cho tới khi
+// bắt tay xong: client gửi MSG_TYPE_HELLO (v1, body = phiên bản cao nhất nó hiểu),
+// server trả MSG_TYPE_HELLO với phiên bản được chọn rồi chuyển sang v2.
+
+#define FRAME_V2_MAGIC 0xC2
+#define FRAME_V2_HEADER_SIZE 8
+#define FRAME_PROTO_V1 1
+#define FRAME_PROTO_V2 2
+
+// Frame lớn nhất ở cả 2 định dạng (frame v2 đầy đủ nhất vẫn nhỏ hơn ChatPacket)
+#define FRAME_MAX_SIZE sizeof(ChatPacket)
+
+// Độ dài của frame bắt đầu ở buf: > 0 nếu đã biết, 0 nếu cần thêm byte để biết,
+// -1 nếu header không hợp lệ (ngắt kết nối).
+static inline long frame_length(const unsigned char* buf, size_t len) {
+    if (len == 0) return 0;
+    if (buf[0] != FRAME_V2_MAGIC) return (long)sizeof(ChatPacket);
+    if (len < FRAME_V2_HEADER_SIZE) return 0;
+    size_t source_len = buf[3], target_len = buf[4];
+    size_t body_len = ((size_t)buf[6] << 8) | buf[7];
+    if (source_len >= MAX_USERNAME || target_len >= MAX_USERNAME || body_len >= MAX_BODY) return -1;
+    return (long)(FRAME_V2_HEADER_SIZE + source_len + target_len + body_len);
+}
+
+// Giải mã 1 frame đầy đủ (len = frame_length(buf, ...)) vào out
+static inline void frame_decode(const unsigned char* buf, size_t len, ChatPacket* out) {
+    if (buf[0] != FRAME_V2_MAGIC) {
+        memcpy(out, buf, sizeof(ChatPacket));
+        return;
+    }
+    (void)len;
+    size_t source_len = buf[3], target_len = buf[4];
+    size_t body_len = ((size_t)buf[6] << 8) | buf[7];
+    const unsigned char* p = buf + FRAME_V2_HEADER_SIZE;
+
+    memset(out, 0, sizeof(ChatPacket));
+    out->type = (MessageType)buf[1];
+    memcpy(out->source_user, p, source_len);
+    p += source_len;
+    memcpy(out->target_user, p, target_len);
+    p += target_len;
+    memcpy(out->body, p, body_len);
+}
+
+// Mã hóa packet thành frame v2 vào out (ít nhất FRAME_MAX_SIZE byte); trả về số byte
+static inline size_t frame_encode_v2(const ChatPacket* packet, unsigned char* out) {
+    size_t source_len = strnlen(packet->source_user, MAX_USERNAME - 1);
+    size_t target_len = strnlen(packet->target_user, MAX_USERNAME - 1);
+    size_t body_len = strnlen(packet->body, MAX_BODY - 1);
+    unsigned char* p = out + FRAME_V2_HEADER_SIZE;
+
+    out[0] = FRAME_V2_MAGIC;
+    out[1] = (unsigned char)packet->type;
+    out[2] = 0;
+    out[3] = (unsigned char)source_len;
+    out[4] = (unsigned char)target_len;
+    out[5] = 0;
+    out[6] = (unsigned char)(body_len >> 8);
+    out[7] = (unsigned char)body_len;
+    memcpy(p, packet->source_user, source_len);
+    p += source_len;
+    memcpy(p, packet->target_user, target_len);
+    p += target_len;
+    memcpy(p, packet->body, body_len);
+    return FRAME_V2_HEADER_SIZE + source_len + target_len + body_len;
+}
+
+// Mã hóa theo phiên bản đã thỏa thuận; trả về con trỏ tới dữ liệu cần gửi và độ dài qua *len
+static inline const void* frame_encode(const ChatPacket* packet, int proto_version, unsigned char* scratch, size_t* len) {
+    if (proto_version >= FRAME_PROTO_V2) {
+        *len = frame_encode_v2(packet, scratch);
+        return scratch;
+    }
+    *len = sizeof(ChatPacket);
+    return packet;
+}
+
+#endif
@@ -53,7 +53,7 @@ typedef enum {
     MSG_TYPE_RECEIVE_GROUP_MESSAGE_LEGACY, // legacy alias (if needed)
 
     // Presence / offline
-    MSG_TYPE_ONLINE_LIST_UPDATE,      // server updates online list
+    MSG_TYPE_ONLINE_LIST_UPDATE,      // presence snapshot (comma list); target_user "+" = continuation chunk
     MSG_TYPE_SEND_OFFLINE_MSG,        // server sends stored offline message(s)
 
     // Friend-specific server messages
@@ -66,11 +66,20 @@ typedef enum {
     MSG_TYPE_GROUP_RESPONSE,          // generic group operation response
     MSG_TYPE_GROUP_LIST_RESPONSE,     // response carrying group list (joined or all)
 
-    // Expand below as needed...
+    // Presence
+    MSG_TYPE_PRESENCE_DELTA,          // batched presence changes; body = "+user,-user,..." (+ online, - offline)
+
+    // Connection
+    MSG_TYPE_HELLO,                   // wire protocol negotiation; body = version (see frame.h) [+ " ack"]
+    MSG_TYPE_OFFLINE_ACK,             // server: end of an offline message page; client echoes it once the
+                                      // page is processed (only if it sent "ack" in HELLO)
+
+    // Expand below as needed... (types must stay < 256: frame v2 carries the type in 1 byte)
 } MessageType;
 
 // Simple packet shared by client and server.
-// Keep size deterministic and simple for read/write on sockets.
+// In-memory form of every message; on the wire it is either sent as-is (v1)
+// or encoded as a variable-length frame (v2, see frame.h).
 typedef struct {
     MessageType type;
     char source_user[MAX_USERNAME]; // origin username